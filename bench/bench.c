@@ -60,6 +60,16 @@ gettimeofday(struct timeval *tv, void *unused)
 }
 #endif
 
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#define read_cycles() ((uint64_t) __rdtsc())
+#elif defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#define read_cycles() ((uint64_t) __rdtsc())
+#else
+#define read_cycles() ((uint64_t) 0)
+#endif
+
 void
 bench_start(struct bench *bench)
 {
@@ -69,12 +79,14 @@ bench_start(struct bench *bench)
         .seconds = val.tv_sec,
         .microseconds = val.tv_usec,
     };
+    bench->start_cycles = read_cycles();
 }
 
 void
 bench_stop(struct bench *bench)
 {
     struct timeval val;
+    bench->stop_cycles = read_cycles();
     (void) gettimeofday(&val, NULL);
     bench->stop = (struct bench_time) {
         .seconds = val.tv_sec,
@@ -106,3 +118,9 @@ bench_elapsed_str(const struct bench *bench)
 
     return buf;
 }
+
+uint64_t
+bench_elapsed_cycles(const struct bench *bench)
+{
+    return bench->stop_cycles - bench->start_cycles;
+}
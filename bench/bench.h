@@ -25,6 +25,8 @@
 #ifndef LIBXKBCOMMON_BENCH_H
 #define LIBXKBCOMMON_BENCH_H
 
+#include <stdint.h>
+
 struct bench_time {
     long seconds;
     long microseconds;
@@ -33,6 +35,8 @@ struct bench_time {
 struct bench {
     struct bench_time start;
     struct bench_time stop;
+    uint64_t start_cycles;
+    uint64_t stop_cycles;
 };
 
 void
@@ -46,4 +50,11 @@ bench_elapsed(const struct bench *bench, struct bench_time *result);
 char *
 bench_elapsed_str(const struct bench *bench);
 
+/*
+ * CPU cycles (as counted by the time stamp counter) between start and
+ * stop, or 0 if there is no cycle counter on this platform.
+ */
+uint64_t
+bench_elapsed_cycles(const struct bench *bench);
+
 #endif /* LIBXKBCOMMON_BENCH_H */
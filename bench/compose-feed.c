@@ -0,0 +1,208 @@
+/*
+ * Copyright © 2021 libxkbcommon contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+
+#include "xkbcommon/xkbcommon-compose.h"
+
+#include "../test/test.h"
+#include "bench.h"
+
+#define BENCHMARK_ITERATIONS 20
+#define STREAM_LENGTH (1 << 20)
+
+/* Out of 100 words; the rest are plain text. */
+#define COMPOSED_WORD_PERCENT 10
+
+typedef darray(xkb_keysym_t) darray_keysym;
+
+/* The sequences of the table which start with a dead key or Multi_key. */
+static void
+collect_sequences(struct xkb_compose_table *table, darray_keysym *sequences,
+                  darray_uint *offsets)
+{
+    struct xkb_compose_table_iterator *iter;
+    struct xkb_compose_table_entry *entry;
+
+    iter = xkb_compose_table_iterator_new(table);
+    assert(iter);
+    while ((entry = xkb_compose_table_iterator_next(iter))) {
+        size_t sequence_length;
+        const xkb_keysym_t *sequence =
+            xkb_compose_table_entry_sequence(entry, &sequence_length);
+
+        if (sequence[0] != XKB_KEY_Multi_key &&
+            !(sequence[0] >= XKB_KEY_dead_grave &&
+              sequence[0] <= XKB_KEY_dead_greek))
+            continue;
+
+        darray_append(*offsets, darray_size(*sequences));
+        darray_append_items(*sequences, sequence, sequence_length);
+    }
+    darray_append(*offsets, darray_size(*sequences));
+    xkb_compose_table_iterator_free(iter);
+}
+
+/*
+ * A stream of words separated by spaces.  Most words are lowercase
+ * letters, sometimes capitalized with Shift; some contain a compose
+ * sequence.  A fixed seed keeps the stream the same between runs.
+ */
+static void
+generate_stream(struct xkb_compose_table *table, darray_keysym *stream)
+{
+    darray_keysym sequences = darray_new();
+    darray_uint offsets = darray_new();
+    size_t num_sequences;
+
+    collect_sequences(table, &sequences, &offsets);
+    num_sequences = darray_size(offsets) - 1;
+    assert(num_sequences > 0);
+
+    srand(1);
+
+    while (darray_size(*stream) < STREAM_LENGTH) {
+        int word_length = 1 + rand() % 8;
+        int composed = (rand() % 100 < COMPOSED_WORD_PERCENT ?
+                        rand() % word_length : -1);
+
+        if (rand() % 10 == 0) {
+            darray_append(*stream, XKB_KEY_Shift_L);
+            darray_append(*stream, XKB_KEY_A + rand() % 26);
+        }
+
+        for (int i = 0; i < word_length; i++) {
+            if (i == composed) {
+                size_t n = rand() % num_sequences;
+                unsigned start = darray_item(offsets, n);
+                unsigned end = darray_item(offsets, n + 1);
+                darray_append_items(*stream, &darray_item(sequences, start),
+                                    end - start);
+            }
+            else {
+                darray_append(*stream, XKB_KEY_a + rand() % 26);
+            }
+        }
+
+        darray_append(*stream, XKB_KEY_space);
+    }
+
+    darray_free(sequences);
+    darray_free(offsets);
+}
+
+static unsigned
+bench_feed(struct xkb_compose_state *state, const darray_keysym *stream)
+{
+    const xkb_keysym_t *keysym;
+    char buffer[64];
+    unsigned composed = 0;
+
+    darray_foreach(keysym, *stream) {
+        if (xkb_compose_state_feed(state, *keysym) == XKB_COMPOSE_FEED_IGNORED)
+            continue;
+
+        switch (xkb_compose_state_get_status(state)) {
+        case XKB_COMPOSE_COMPOSED:
+            xkb_compose_state_get_utf8(state, buffer, sizeof(buffer));
+            composed++;
+            break;
+        case XKB_COMPOSE_NOTHING:
+        case XKB_COMPOSE_COMPOSING:
+        case XKB_COMPOSE_CANCELLED:
+            break;
+        }
+    }
+
+    return composed;
+}
+
+int
+main(void)
+{
+    struct xkb_context *ctx;
+    char *path;
+    FILE *file;
+    struct xkb_compose_table *table;
+    struct xkb_compose_state *state;
+    darray_keysym stream = darray_new();
+    struct bench bench;
+    struct bench_time elapsed;
+    uint64_t keystrokes, cycles;
+    unsigned composed = 0;
+    double ns;
+
+    ctx = test_get_context(CONTEXT_NO_FLAG);
+    assert(ctx);
+
+    path = test_get_path("compose/en_US.UTF-8/Compose");
+    file = fopen(path, "rb");
+    if (file == NULL) {
+        perror(path);
+        free(path);
+        xkb_context_unref(ctx);
+        return -1;
+    }
+
+    xkb_context_set_log_level(ctx, XKB_LOG_LEVEL_CRITICAL);
+    xkb_context_set_log_verbosity(ctx, 0);
+
+    table = xkb_compose_table_new_from_file(ctx, file, "",
+                                            XKB_COMPOSE_FORMAT_TEXT_V1,
+                                            XKB_COMPOSE_COMPILE_NO_FLAGS);
+    assert(table);
+    fclose(file);
+    free(path);
+
+    state = xkb_compose_state_new(table, XKB_COMPOSE_STATE_NO_FLAGS);
+    assert(state);
+
+    generate_stream(table, &stream);
+
+    bench_start(&bench);
+    for (int i = 0; i < BENCHMARK_ITERATIONS; i++)
+        composed += bench_feed(state, &stream);
+    bench_stop(&bench);
+
+    keystrokes = (uint64_t) BENCHMARK_ITERATIONS * darray_size(stream);
+    bench_elapsed(&bench, &elapsed);
+    ns = (elapsed.seconds * 1e9 + elapsed.microseconds * 1e3) / keystrokes;
+    cycles = bench_elapsed_cycles(&bench);
+
+    fprintf(stderr, "fed %" PRIu64 " keystrokes (%u composed) in %ld.%06lds\n",
+            keystrokes, composed, elapsed.seconds, elapsed.microseconds);
+    if (cycles)
+        fprintf(stderr, "%.2f ns/keystroke, %.2f cycles/keystroke\n",
+                ns, (double) cycles / keystrokes);
+    else
+        fprintf(stderr, "%.2f ns/keystroke\n", ns);
+
+    darray_free(stream);
+    xkb_compose_state_unref(state);
+    xkb_compose_table_unref(table);
+    xkb_context_unref(ctx);
+    return 0;
+}
@@ -0,0 +1,584 @@
+/*
+ * Copyright © 2021 libxkbcommon contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <xcb/xcbext.h>
+
+#include "x11-replay.h"
+
+static const char recording_magic[8] = "XKBREC2\n";
+
+/* X11 error code. */
+#define BAD_IMPLEMENTATION 17
+
+struct record {
+    uint8_t *request;
+    uint32_t request_len;
+    uint8_t *reply;
+    uint32_t reply_len;
+};
+
+struct recording {
+    struct record *records;
+    size_t num_records;
+    size_t alloc;
+};
+
+static bool
+read_full(int fd, void *buf, size_t len)
+{
+    uint8_t *p = buf;
+
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+
+    return true;
+}
+
+static bool
+write_full(int fd, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+
+    return true;
+}
+
+/* The byte order of this machine, as in the X11 connection setup. */
+static char
+native_byte_order(void)
+{
+    const uint16_t one = 1;
+
+    return *(const uint8_t *) &one == 1 ? 'l' : 'B';
+}
+
+/*
+ * Read the header of a recording. Returns false if it is not one; the byte
+ * order it was made in goes in byte_order.
+ */
+static bool
+read_header(FILE *file, char *byte_order)
+{
+    char magic[sizeof(recording_magic)];
+
+    if (fread(magic, sizeof(magic), 1, file) != 1 ||
+        memcmp(magic, recording_magic, sizeof(magic)) != 0 ||
+        fread(byte_order, 1, 1, file) != 1)
+        return false;
+
+    return *byte_order == 'l' || *byte_order == 'B';
+}
+
+static size_t
+pad4(size_t len)
+{
+    return (len + 3) & ~(size_t) 3;
+}
+
+/* Read the connection setup request the client sends first. */
+static uint8_t *
+read_setup_request(int fd, uint32_t *len_out)
+{
+    uint8_t header[12];
+    uint16_t name_len, data_len;
+    uint8_t *buf;
+    size_t len;
+
+    if (!read_full(fd, header, sizeof(header)))
+        return NULL;
+
+    memcpy(&name_len, &header[6], sizeof(name_len));
+    memcpy(&data_len, &header[8], sizeof(data_len));
+    len = sizeof(header) + pad4(name_len) + pad4(data_len);
+
+    buf = malloc(len);
+    if (!buf)
+        return NULL;
+    memcpy(buf, header, sizeof(header));
+    if (!read_full(fd, buf + sizeof(header), len - sizeof(header))) {
+        free(buf);
+        return NULL;
+    }
+
+    *len_out = len;
+    return buf;
+}
+
+/* Read a request. Returns NULL when the client is gone. */
+static uint8_t *
+read_request(int fd, uint32_t *len_out)
+{
+    uint8_t header[4];
+    uint16_t units;
+    uint8_t *buf;
+
+    if (!read_full(fd, header, sizeof(header)))
+        return NULL;
+
+    /* A length of 0 means a BIG-REQUESTS request, which we never see. */
+    memcpy(&units, &header[2], sizeof(units));
+    if (units == 0)
+        return NULL;
+
+    buf = malloc(units * 4);
+    if (!buf)
+        return NULL;
+    memcpy(buf, header, sizeof(header));
+    if (!read_full(fd, buf + sizeof(header), units * 4 - sizeof(header))) {
+        free(buf);
+        return NULL;
+    }
+
+    *len_out = units * 4;
+    return buf;
+}
+
+/* Send a reply or an error, with the sequence number of the request. */
+static bool
+write_reply(int fd, const uint8_t *reply, uint32_t len, uint16_t sequence)
+{
+    uint8_t header[4];
+
+    assert(len >= 32);
+    memcpy(header, reply, 2);
+    memcpy(&header[2], &sequence, sizeof(sequence));
+
+    return write_full(fd, header, sizeof(header)) &&
+           write_full(fd, reply + sizeof(header), len - sizeof(header));
+}
+
+static bool
+recording_add(struct recording *recording,
+              uint8_t *request, uint32_t request_len,
+              const void *reply, uint32_t reply_len)
+{
+    struct record *record;
+
+    if (recording->num_records == recording->alloc) {
+        size_t alloc = recording->alloc ? recording->alloc * 2 : 64;
+        struct record *records =
+            realloc(recording->records, alloc * sizeof(*records));
+        if (!records)
+            return false;
+        recording->records = records;
+        recording->alloc = alloc;
+    }
+
+    record = &recording->records[recording->num_records];
+    record->reply = NULL;
+    if (reply_len > 0 && !(record->reply = malloc(reply_len)))
+        return false;
+    if (reply_len > 0)
+        memcpy(record->reply, reply, reply_len);
+    record->reply_len = reply_len;
+    record->request = request;
+    record->request_len = request_len;
+    recording->num_records++;
+
+    return true;
+}
+
+static void
+recording_free(struct recording *recording)
+{
+    for (size_t i = 0; i < recording->num_records; i++) {
+        free(recording->records[i].request);
+        free(recording->records[i].reply);
+    }
+    free(recording->records);
+}
+
+static bool
+recording_load(struct recording *recording, const char *path)
+{
+    char byte_order;
+    bool ok = false;
+    FILE *file;
+
+    file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Couldn't open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    if (!read_header(file, &byte_order)) {
+        fprintf(stderr, "%s is not an X11 recording\n", path);
+        goto out;
+    }
+    if (byte_order != native_byte_order()) {
+        fprintf(stderr, "%s was recorded in the other byte order\n", path);
+        goto out;
+    }
+
+    for (;;) {
+        uint32_t request_len, reply_len;
+        uint8_t *request, *reply;
+
+        if (fread(&request_len, sizeof(request_len), 1, file) != 1) {
+            ok = feof(file);
+            break;
+        }
+
+        request = malloc(request_len);
+        if (!request)
+            break;
+        /* A request without a reply is recorded with an empty one. */
+        reply = NULL;
+        if (fread(request, request_len, 1, file) != 1 ||
+            fread(&reply_len, sizeof(reply_len), 1, file) != 1 ||
+            (reply_len > 0 && reply_len < 8) ||
+            (reply_len > 0 && !(reply = malloc(reply_len)))) {
+            free(request);
+            break;
+        }
+        if ((reply_len > 0 && fread(reply, reply_len, 1, file) != 1) ||
+            !recording_add(recording, request, request_len,
+                           reply, reply_len)) {
+            free(request);
+            free(reply);
+            break;
+        }
+        free(reply);
+    }
+
+    if (!ok)
+        fprintf(stderr, "Couldn't read the X11 recording %s\n", path);
+out:
+    fclose(file);
+    return ok;
+}
+
+static bool
+recording_save(const struct recording *recording, const char *path)
+{
+    char byte_order;
+    FILE *file;
+    bool ok;
+
+    file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Couldn't create %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    byte_order = native_byte_order();
+    ok = fwrite(recording_magic, sizeof(recording_magic), 1, file) == 1 &&
+         fwrite(&byte_order, 1, 1, file) == 1;
+    for (size_t i = 0; ok && i < recording->num_records; i++) {
+        const struct record *record = &recording->records[i];
+
+        ok = fwrite(&record->request_len, sizeof(record->request_len), 1, file) == 1 &&
+             fwrite(record->request, record->request_len, 1, file) == 1 &&
+             fwrite(&record->reply_len, sizeof(record->reply_len), 1, file) == 1 &&
+             (record->reply_len == 0 ||
+              fwrite(record->reply, record->reply_len, 1, file) == 1);
+    }
+
+    if (fclose(file) != 0)
+        ok = false;
+    if (!ok)
+        fprintf(stderr, "Couldn't write the X11 recording %s\n", path);
+    return ok;
+}
+
+/*
+ * The requests come in the same order every time a keymap is fetched, so
+ * start looking right after the previous match.
+ */
+static const struct record *
+recording_find(const struct recording *recording, size_t *cursor,
+               const uint8_t *request, uint32_t request_len)
+{
+    for (size_t n = 0; n < recording->num_records; n++) {
+        size_t i = (*cursor + n) % recording->num_records;
+        const struct record *record = &recording->records[i];
+
+        if (record->request_len == request_len &&
+            memcmp(record->request, request, request_len) == 0) {
+            *cursor = i + 1;
+            return record;
+        }
+    }
+
+    return NULL;
+}
+
+static bool
+serve_replay(int fd, const char *path)
+{
+    struct recording recording = { 0 };
+    const struct record *record;
+    size_t cursor = 0;
+    uint16_t sequence = 0;
+    uint32_t len;
+    uint8_t *request;
+    bool ok = false;
+
+    if (!recording_load(&recording, path))
+        goto out;
+
+    /* The first record holds the connection setup. */
+    request = read_setup_request(fd, &len);
+    if (!request)
+        goto out;
+    record = recording_find(&recording, &cursor, request, len);
+    free(request);
+    if (!record || record->reply_len < 8) {
+        fprintf(stderr, "The connection setup is not in the recording\n");
+        goto out;
+    }
+    if (!write_full(fd, record->reply, record->reply_len))
+        goto out;
+
+    ok = true;
+    while ((request = read_request(fd, &len))) {
+        sequence++;
+        record = recording_find(&recording, &cursor, request, len);
+        if (record) {
+            if (record->reply_len > 0)
+                write_reply(fd, record->reply, record->reply_len, sequence);
+        }
+        else {
+            uint8_t error[32] = { 0 };
+
+            fprintf(stderr, "Request %u.%u is not in the recording\n",
+                    request[0], request[1]);
+            error[1] = BAD_IMPLEMENTATION;
+            error[8] = request[1];
+            error[10] = request[0];
+            write_reply(fd, error, sizeof(error), sequence);
+            ok = false;
+        }
+        free(request);
+    }
+
+out:
+    recording_free(&recording);
+    return ok;
+}
+
+static bool
+serve_record(int fd, const char *path, int server_fd)
+{
+    struct recording recording = { 0 };
+    xcb_connection_t *real;
+    const xcb_setup_t *setup;
+    uint16_t sequence = 0;
+    uint32_t len;
+    uint8_t *request;
+    bool ok = false;
+
+    if (server_fd >= 0)
+        real = xcb_connect_to_fd(server_fd, NULL);
+    else
+        real = xcb_connect(NULL, NULL);
+    if (!real || xcb_connection_has_error(real)) {
+        fprintf(stderr, "Couldn't connect to X server: error code %d\n",
+                real ? xcb_connection_has_error(real) : -1);
+        goto out;
+    }
+
+    /* Hand out the setup of the real connection. */
+    setup = xcb_get_setup(real);
+    request = read_setup_request(fd, &len);
+    if (!request)
+        goto out;
+    if (!recording_add(&recording, request, len, setup, 8 + setup->length * 4)) {
+        free(request);
+        goto out;
+    }
+    if (!write_full(fd, setup, 8 + setup->length * 4))
+        goto out;
+
+    while ((request = read_request(fd, &len))) {
+        /* xcb_send_request() needs two spare iovecs in front. */
+        struct iovec vector[3] = {
+            [2] = { .iov_base = request, .iov_len = len },
+        };
+        xcb_protocol_request_t protocol_request = {
+            .count = 1,
+            .opcode = request[0],
+            .isvoid = 0,
+        };
+        xcb_generic_error_t *error = NULL;
+        unsigned int real_sequence;
+        xcb_get_input_focus_cookie_t sync;
+        uint8_t *reply;
+        uint32_t reply_len;
+
+        sequence++;
+        real_sequence = xcb_send_request(real,
+                                         XCB_REQUEST_RAW | XCB_REQUEST_CHECKED,
+                                         &vector[2], &protocol_request);
+        /*
+         * We can't tell from the bytes whether the request has a reply.
+         * Follow it with one which does, the way xcb_request_check() does,
+         * so that waiting for a void request ends when the sync's reply
+         * comes in.
+         */
+        sync = xcb_get_input_focus(real);
+        reply = xcb_wait_for_reply(real, real_sequence, &error);
+        xcb_discard_reply(real, sync.sequence);
+        if (reply) {
+            reply_len = 32 + ((xcb_generic_reply_t *) reply)->length * 4;
+        }
+        else if (error) {
+            /* Only the first 32 bytes are on the wire. */
+            reply = (uint8_t *) error;
+            reply_len = 32;
+        }
+        else if (!xcb_connection_has_error(real)) {
+            /* A void request which succeeded; nothing goes back. */
+            reply_len = 0;
+        }
+        else {
+            free(request);
+            fprintf(stderr, "Lost the connection to the X server\n");
+            goto out;
+        }
+
+        if (!recording_add(&recording, request, len, reply, reply_len)) {
+            free(request);
+            free(reply);
+            goto out;
+        }
+        if (reply_len > 0)
+            write_reply(fd, reply, reply_len, sequence);
+        free(reply);
+    }
+
+    ok = recording_save(&recording, path);
+
+out:
+    recording_free(&recording);
+    if (real)
+        xcb_disconnect(real);
+    return ok;
+}
+
+bool
+x11_replay_is_native(const char *path)
+{
+    char byte_order;
+    bool ok;
+    FILE *file;
+
+    file = fopen(path, "rb");
+    if (!file)
+        return true;
+    ok = !read_header(file, &byte_order) || byte_order == native_byte_order();
+    fclose(file);
+    return ok;
+}
+
+bool
+x11_replay_start(struct x11_replay *replay, const char *path,
+                 enum x11_replay_mode mode, int server_fd)
+{
+    int fds[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        fprintf(stderr, "Couldn't create a socket pair: %s\n", strerror(errno));
+        return false;
+    }
+
+    replay->pid = fork();
+    if (replay->pid < 0) {
+        fprintf(stderr, "Couldn't fork: %s\n", strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+
+    if (replay->pid == 0) {
+        bool ok;
+
+        close(fds[0]);
+        if (mode == X11_RECORD)
+            ok = serve_record(fds[1], path, server_fd);
+        else
+            ok = serve_replay(fds[1], path);
+        close(fds[1]);
+        _exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    close(fds[1]);
+    /* Only the child talks to the X server. */
+    if (server_fd >= 0)
+        close(server_fd);
+    replay->conn = xcb_connect_to_fd(fds[0], NULL);
+    if (xcb_connection_has_error(replay->conn)) {
+        fprintf(stderr, "Couldn't set up the X11 %s: error code %d\n",
+                mode == X11_RECORD ? "recording" : "replay",
+                xcb_connection_has_error(replay->conn));
+        x11_replay_stop(replay);
+        return false;
+    }
+
+    return true;
+}
+
+bool
+x11_replay_stop(struct x11_replay *replay)
+{
+    int status;
+
+    xcb_disconnect(replay->conn);
+    replay->conn = NULL;
+
+    while (waitpid(replay->pid, &status, 0) < 0) {
+        if (errno != EINTR)
+            return false;
+    }
+
+    return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright © 2021 libxkbcommon contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef LIBXKBCOMMON_BENCH_X11_REPLAY_H
+#define LIBXKBCOMMON_BENCH_X11_REPLAY_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <xcb/xcb.h>
+
+/*
+ * A stand-in for the X server, so that the X11 code can be benchmarked
+ * without a live server.
+ *
+ * The connection talks to a child process over a socket pair. When
+ * replaying, the child answers each request with the reply recorded for
+ * the same request bytes in a recording file. When recording, the child
+ * forwards each request to the X server at $DISPLAY, passes the reply on,
+ * and writes all the request/reply pairs to the recording file when the
+ * connection is closed.
+ *
+ * Requests without a reply are recorded too: each request is followed by
+ * a sync, so that a void request is known to be done when the sync's reply
+ * comes in. A request which is not in the recording gets an Implementation
+ * error. Recordings use the byte order of the machine they were made on,
+ * which is noted in their header, and can only be replayed on a machine
+ * with the same byte order.
+ */
+
+enum x11_replay_mode {
+    X11_REPLAY,
+    X11_RECORD,
+};
+
+struct x11_replay {
+    xcb_connection_t *conn;
+    pid_t pid;
+};
+
+/*
+ * Returns false if the recording at path was made on a machine with the
+ * other byte order. A file which can't be read or is not a recording
+ * counts as native, and fails when replayed.
+ */
+bool
+x11_replay_is_native(const char *path);
+
+/*
+ * When recording, the child talks to the X server connected to server_fd,
+ * or to the one at $DISPLAY if it is -1. The fd belongs to the child from
+ * then on.
+ */
+bool
+x11_replay_start(struct x11_replay *replay, const char *path,
+                 enum x11_replay_mode mode, int server_fd);
+
+/*
+ * Close the connection and wait for the child. Returns false if the child
+ * failed, e.g. a request was missing from the recording or the recording
+ * could not be written.
+ */
+bool
+x11_replay_stop(struct x11_replay *replay);
+
+#endif /* LIBXKBCOMMON_BENCH_X11_REPLAY_H */
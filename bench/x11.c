@@ -25,18 +25,39 @@
 
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <xcb/xkb.h>
 
 #include "xkbcommon/xkbcommon.h"
 #include "xkbcommon/xkbcommon-x11.h"
 
+#include "../test/test.h"
+#include "../test/x11-server.h"
 #include "bench.h"
+#include "x11-replay.h"
 
 #define BENCHMARK_ITERATIONS 2500
 
+static void
+usage(const char *progname)
+{
+    fprintf(stderr,
+            "Usage: %s [--test-server] [--record FILE | --replay FILE]\n"
+            "\n"
+            "Without options, the keymap is retrieved from the X server at $DISPLAY.\n"
+            "\n"
+            "  --test-server  Use a stand-in X server serving the evdev/pc105/us\n"
+            "                 keymap instead of the X server at $DISPLAY.\n"
+            "  --record FILE  Retrieve the keymap once from the X server\n"
+            "                 and save the replies of the server to FILE.\n"
+            "  --replay FILE  Answer the requests with the replies saved in FILE\n"
+            "                 instead of using an X server.\n",
+            progname);
+}
+
 int
-main(void)
+main(int argc, char *argv[])
 {
     int ret;
     xcb_connection_t *conn;
@@ -44,13 +65,82 @@ main(void)
     struct xkb_context *ctx;
     struct bench bench;
     char *elapsed;
+    const char *path = NULL;
+    enum x11_replay_mode mode = X11_REPLAY;
+    struct x11_replay replay;
+    bool use_test_server = false;
+    struct x11_server server = { .fd = -1 };
+    int iterations = BENCHMARK_ITERATIONS;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--test-server") == 0) {
+            use_test_server = true;
+        }
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc && !path) {
+            mode = X11_RECORD;
+            path = argv[++i];
+            iterations = 1;
+        }
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc && !path) {
+            path = argv[++i];
+        }
+        else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (use_test_server && path && mode == X11_REPLAY) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
 
-    conn = xcb_connect(NULL, NULL);
-    if (!conn || xcb_connection_has_error(conn)) {
-        fprintf(stderr, "Couldn't connect to X server: error code %d\n",
-                conn ? xcb_connection_has_error(conn) : -1);
-        ret = -1;
-        goto err_out;
+    if (path && mode == X11_REPLAY && !x11_replay_is_native(path)) {
+        fprintf(stderr, "%s was recorded in the other byte order, skipping\n",
+                path);
+        return SKIP_TEST;
+    }
+
+    if (use_test_server) {
+        struct xkb_context *server_ctx = test_get_context(0);
+        struct xkb_keymap *server_keymap;
+
+        assert(server_ctx);
+        server_keymap = test_compile_rules(server_ctx, "evdev", "pc105",
+                                           "us", "", "");
+        assert(server_keymap);
+        ret = x11_server_start(&server, server_keymap);
+        xkb_keymap_unref(server_keymap);
+        xkb_context_unref(server_ctx);
+        if (!ret) {
+            ret = -1;
+            goto err_out;
+        }
+    }
+
+    if (path) {
+        if (!x11_replay_start(&replay, path, mode, server.fd)) {
+            ret = -1;
+            goto err_server;
+        }
+        conn = replay.conn;
+    }
+    else if (use_test_server) {
+        conn = xcb_connect_to_fd(server.fd, NULL);
+        if (xcb_connection_has_error(conn)) {
+            fprintf(stderr, "Couldn't connect to the test server: error code %d\n",
+                    xcb_connection_has_error(conn));
+            ret = -1;
+            goto err_conn;
+        }
+    }
+    else {
+        conn = xcb_connect(NULL, NULL);
+        if (!conn || xcb_connection_has_error(conn)) {
+            fprintf(stderr, "Couldn't connect to X server: error code %d\n",
+                    conn ? xcb_connection_has_error(conn) : -1);
+            ret = -1;
+            goto err_conn;
+        }
     }
 
     ret = xkb_x11_setup_xkb_extension(conn,
@@ -59,6 +149,7 @@ main(void)
                                       XKB_X11_SETUP_XKB_EXTENSION_NO_FLAGS,
                                       NULL, NULL, NULL, NULL);
     if (!ret) {
+        ret = -1;
         fprintf(stderr, "Couldn't setup XKB extension\n");
         goto err_conn;
     }
@@ -78,7 +169,7 @@ main(void)
     }
 
     bench_start(&bench);
-    for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+    for (int i = 0; i < iterations; i++) {
         struct xkb_keymap *keymap;
         struct xkb_state *state;
 
@@ -96,13 +187,24 @@ main(void)
     ret = 0;
 
     elapsed = bench_elapsed_str(&bench);
-    fprintf(stderr, "retrieved %d keymaps from X in %ss\n",
-            BENCHMARK_ITERATIONS, elapsed);
+    fprintf(stderr, "retrieved %d keymaps from %s in %ss\n",
+            iterations,
+            path ? path : use_test_server ? "the test server" : "X",
+            elapsed);
     free(elapsed);
 
     xkb_context_unref(ctx);
 err_conn:
-    xcb_disconnect(conn);
+    if (path) {
+        if (!x11_replay_stop(&replay))
+            ret = -1;
+    }
+    else {
+        xcb_disconnect(conn);
+    }
+err_server:
+    if (use_test_server && !x11_server_stop(&server))
+        ret = -1;
 err_out:
     return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
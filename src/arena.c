@@ -0,0 +1,115 @@
+/*
+ * Copyright © 2021 libxkbcommon contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdalign.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_BLOCK_SIZE 16384
+
+struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+    alignas(max_align_t) char data[];
+};
+
+void
+arena_init(struct arena *arena)
+{
+    arena->blocks = NULL;
+}
+
+static void *
+arena_alloc_aligned(struct arena *arena, size_t size, size_t align)
+{
+    struct arena_block *block = arena->blocks;
+    size_t offset = 0;
+
+    if (block)
+        offset = (block->used + align - 1) & ~(align - 1);
+
+    if (!block || offset > block->size || block->size - offset < size) {
+        size_t block_size = ARENA_BLOCK_SIZE;
+
+        if (size > block_size / 4)
+            block_size = size;
+
+        block = malloc(sizeof(*block) + block_size);
+        if (!block)
+            return NULL;
+
+        block->size = block_size;
+        block->used = 0;
+        offset = 0;
+
+        /*
+         * A large allocation gets a block of its own, behind the current
+         * one, so that the rest of the current block is not wasted.
+         */
+        if (arena->blocks && block_size == size) {
+            block->next = arena->blocks->next;
+            arena->blocks->next = block;
+        }
+        else {
+            block->next = arena->blocks;
+            arena->blocks = block;
+        }
+    }
+
+    block->used = offset + size;
+    return memset(block->data + offset, 0, size);
+}
+
+void *
+arena_alloc(struct arena *arena, size_t size)
+{
+    return arena_alloc_aligned(arena, size, alignof(max_align_t));
+}
+
+char *
+arena_strndup(struct arena *arena, const char *s, size_t len)
+{
+    char *copy = arena_alloc_aligned(arena, len + 1, 1);
+
+    if (copy)
+        memcpy(copy, s, len);
+    return copy;
+}
+
+void
+arena_release(struct arena *arena)
+{
+    struct arena_block *block = arena->blocks;
+
+    while (block) {
+        struct arena_block *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->blocks = NULL;
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright © 2021 libxkbcommon contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*
+ * A bump allocator. Allocations are carved out of large blocks and are
+ * only freed all at once, with arena_release().
+ */
+
+struct arena_block;
+
+struct arena {
+    struct arena_block *blocks;
+};
+
+void
+arena_init(struct arena *arena);
+
+/* Returns zeroed memory, suitably aligned for any type, or NULL. */
+void *
+arena_alloc(struct arena *arena, size_t size);
+
+/* Returns a NUL-terminated copy of the first len bytes of s, or NULL. */
+char *
+arena_strndup(struct arena *arena, const char *s, size_t len);
+
+void
+arena_release(struct arena *arena);
+
+#endif /* ARENA_H */
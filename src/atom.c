@@ -72,6 +72,10 @@
 
 #include "config.h"
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 #include "utils.h"
 #include "atom.h"
 
@@ -115,8 +119,31 @@ struct atom_node {
 struct atom_table {
     xkb_atom_t root;
     darray(struct atom_node) table;
+#ifdef HAVE_PTHREAD
+    /* Only taken while threaded, so single-threaded use stays cheap. */
+    bool threaded;
+    pthread_mutex_t mutex;
+#endif
 };
 
+static inline void
+table_lock(struct atom_table *table)
+{
+#ifdef HAVE_PTHREAD
+    if (table->threaded)
+        pthread_mutex_lock(&table->mutex);
+#endif
+}
+
+static inline void
+table_unlock(struct atom_table *table)
+{
+#ifdef HAVE_PTHREAD
+    if (table->threaded)
+        pthread_mutex_unlock(&table->mutex);
+#endif
+}
+
 struct atom_table *
 atom_table_new(void)
 {
@@ -124,6 +151,13 @@ atom_table_new(void)
     if (!table)
         return NULL;
 
+#ifdef HAVE_PTHREAD
+    if (pthread_mutex_init(&table->mutex, NULL) != 0) {
+        free(table);
+        return NULL;
+    }
+#endif
+
     darray_init(table->table);
     /* The original throw-away root is here, at the illegal atom 0. */
     darray_resize0(table->table, 1);
@@ -141,18 +175,39 @@ atom_table_free(struct atom_table *table)
     darray_foreach(node, table->table)
         free(node->string);
     darray_free(table->table);
+#ifdef HAVE_PTHREAD
+    pthread_mutex_destroy(&table->mutex);
+#endif
     free(table);
 }
 
+bool
+atom_table_set_threaded(struct atom_table *table, bool threaded)
+{
+#ifdef HAVE_PTHREAD
+    table->threaded = threaded;
+    return true;
+#else
+    return !threaded;
+#endif
+}
+
 const char *
 atom_text(struct atom_table *table, xkb_atom_t atom)
 {
+    const char *string;
+
+    table_lock(table);
     assert(atom < darray_size(table->table));
-    return darray_item(table->table, atom).string;
+    string = darray_item(table->table, atom).string;
+    table_unlock(table);
+
+    return string;
 }
 
-xkb_atom_t
-atom_intern(struct atom_table *table, const char *string, size_t len, bool add)
+static xkb_atom_t
+intern_locked(struct atom_table *table, const char *string, size_t len,
+              bool add)
 {
     uint32_t fingerprint = hash_buf(string, len);
 
@@ -195,3 +250,15 @@ atom_intern(struct atom_table *table, const char *string, size_t len, bool add)
     darray_append(table->table, node);
     return atom;
 }
+
+xkb_atom_t
+atom_intern(struct atom_table *table, const char *string, size_t len, bool add)
+{
+    xkb_atom_t atom;
+
+    table_lock(table);
+    atom = intern_locked(table, string, len, add);
+    table_unlock(table);
+
+    return atom;
+}
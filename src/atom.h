@@ -42,4 +42,11 @@ atom_intern(struct atom_table *table, const char *string, size_t len, bool add);
 const char *
 atom_text(struct atom_table *table, xkb_atom_t atom);
 
+/*
+ * While set, the table may be used from several threads at once. Returns
+ * false if this is not supported.
+ */
+bool
+atom_table_set_threaded(struct atom_table *table, bool threaded);
+
 #endif /* ATOM_H */
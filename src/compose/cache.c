@@ -0,0 +1,597 @@
+/*
+ * Copyright © 2021 libxkbcommon contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include "utils.h"
+#include "table.h"
+#include "paths.h"
+#include "cache.h"
+
+/*
+ * The binary format of a compose table.
+ *
+ * It is a straight dump of the table arrays, so that a table can be used
+ * directly from a (shared, read-only) mapping of the file, without any
+ * parsing or copying.  Consequently, it is only meant to be read on the
+ * machine which wrote it; the header records enough to reject files
+ * written with a different layout.
+ *
+ * The file consists of, in order:
+ *
+ *   struct compose_table_header
+ *   struct compose_table_dep[num_deps]
+ *   char strings[strings_size], padded to a multiple of 8
+ *   struct compose_node nodes[num_nodes]
+ *   struct compose_leaf leaves[num_leaves]
+ *   char utf8[utf8_size]
+ *
+ * strings holds num_deps + 3 NUL-terminated strings: the locale, the path
+ * of the Compose file the table was compiled from (possibly empty), what
+ * the include paths resolved to (see get_resolution(); empty without a
+ * path), and the path of each dependency.  A dependency which did not
+ * exist has a size of -1.
+ */
+
+#define COMPOSE_TABLE_MAGIC "xkbcmps"
+#define COMPOSE_TABLE_VERSION 2
+#define COMPOSE_TABLE_NUM_STRINGS 3
+#define COMPOSE_TABLE_BYTE_ORDER 0x01020304
+
+struct compose_table_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t node_size;
+    uint32_t leaf_size;
+    uint32_t num_deps;
+    uint32_t strings_size;
+    uint32_t num_nodes;
+    uint32_t num_leaves;
+    uint32_t utf8_size;
+    uint32_t reserved;
+};
+
+struct compose_table_dep {
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t size;
+};
+
+#ifdef HAVE_MMAP
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+static void
+stat_to_dep(const struct stat *st, struct compose_table_dep *dep)
+{
+    dep->mtime_sec = st->st_mtime;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+    dep->mtime_nsec = st->st_mtim.tv_nsec;
+#else
+    dep->mtime_nsec = 0;
+#endif
+    dep->size = st->st_size;
+}
+
+static bool
+append_dep(darray_compose_dep *deps, const char *path,
+           const struct compose_table_dep *dep)
+{
+    char *copy = strdup(path);
+    if (!copy)
+        return false;
+
+    darray_append(*deps, (struct compose_dep) {
+        .path = copy,
+        .mtime_sec = dep->mtime_sec,
+        .mtime_nsec = dep->mtime_nsec,
+        .size = dep->size,
+    });
+    return true;
+}
+
+bool
+compose_dep_add(darray_compose_dep *deps, const char *path, FILE *file)
+{
+    struct stat st;
+    struct compose_table_dep dep;
+
+    if (fstat(fileno(file), &st) != 0)
+        return false;
+
+    stat_to_dep(&st, &dep);
+    return append_dep(deps, path, &dep);
+}
+
+/* Like compose_dep_add(), but the file may not exist. */
+static bool
+compose_dep_add_path(darray_compose_dep *deps, const char *path)
+{
+    struct stat st;
+    struct compose_table_dep dep = { 0, 0, -1 };
+
+    if (stat(path, &st) == 0)
+        stat_to_dep(&st, &dep);
+    return append_dep(deps, path, &dep);
+}
+
+/*
+ * Besides the files which were read, the table depends on how the
+ * Compose file was chosen and how %H and %L expanded in includes.  The
+ * locale and the path are part of the key already; this covers the rest.
+ */
+static char *
+get_resolution(struct xkb_compose_table *table)
+{
+    const char *home = secure_getenv("HOME");
+    const char *xcomposefile = secure_getenv("XCOMPOSEFILE");
+    const char *xdg_config_home = secure_getenv("XDG_CONFIG_HOME");
+    char *locale_path, *resolution;
+
+    locale_path = get_locale_compose_file_path(table->ctx, table->locale);
+    resolution = asprintf_safe("%%H=%s\n%%L=%s\n"
+                               "XCOMPOSEFILE=%s\nXDG_CONFIG_HOME=%s\n",
+                               home ? home : "",
+                               locale_path ? locale_path : "",
+                               xcomposefile ? xcomposefile : "",
+                               xdg_config_home ? xdg_config_home : "");
+    free(locale_path);
+    return resolution;
+}
+
+bool
+compose_table_write(struct xkb_compose_table *table, int fd,
+                    const char *path, const darray_compose_dep *deps)
+{
+    static const char padding[8];
+    struct compose_table_header header;
+    const struct compose_dep *dep;
+    unsigned num_deps = (path && deps ? darray_size(*deps) : 0);
+    size_t strings_size;
+    char *resolution = NULL;
+    bool ok = false;
+
+    if (path) {
+        resolution = get_resolution(table);
+        if (!resolution)
+            return false;
+    }
+
+    strings_size = strlen(table->locale) + 1 + (path ? strlen(path) : 0) + 1 +
+                   (resolution ? strlen(resolution) : 0) + 1;
+    for (unsigned i = 0; i < num_deps; i++)
+        strings_size += strlen(darray_item(*deps, i).path) + 1;
+    if (strings_size > UINT32_MAX)
+        goto out;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, COMPOSE_TABLE_MAGIC, sizeof(header.magic));
+    header.version = COMPOSE_TABLE_VERSION;
+    header.byte_order = COMPOSE_TABLE_BYTE_ORDER;
+    header.node_size = sizeof(struct compose_node);
+    header.leaf_size = sizeof(struct compose_leaf);
+    header.num_deps = num_deps;
+    header.strings_size = strings_size;
+    header.num_nodes = darray_size(table->nodes);
+    header.num_leaves = darray_size(table->leaves);
+    header.utf8_size = darray_size(table->utf8);
+
+    if (!write_all(fd, &header, sizeof(header)))
+        goto out;
+
+    for (unsigned i = 0; i < num_deps; i++) {
+        struct compose_table_dep out;
+        dep = &darray_item(*deps, i);
+        out.mtime_sec = dep->mtime_sec;
+        out.mtime_nsec = dep->mtime_nsec;
+        out.size = dep->size;
+        if (!write_all(fd, &out, sizeof(out)))
+            goto out;
+    }
+
+    if (!write_all(fd, table->locale, strlen(table->locale) + 1) ||
+        !write_all(fd, path ? path : "", (path ? strlen(path) : 0) + 1) ||
+        !write_all(fd, resolution ? resolution : "",
+                   (resolution ? strlen(resolution) : 0) + 1))
+        goto out;
+    for (unsigned i = 0; i < num_deps; i++) {
+        dep = &darray_item(*deps, i);
+        if (!write_all(fd, dep->path, strlen(dep->path) + 1))
+            goto out;
+    }
+    if (!write_all(fd, padding, ROUNDUP(strings_size, 8) - strings_size))
+        goto out;
+
+    ok =
+        write_all(fd, table->nodes.item,
+                  darray_size(table->nodes) * sizeof(struct compose_node)) &&
+        write_all(fd, table->leaves.item,
+                  darray_size(table->leaves) * sizeof(struct compose_leaf)) &&
+        write_all(fd, table->utf8.item, darray_size(table->utf8));
+
+out:
+    free(resolution);
+    return ok;
+}
+
+/*
+ * Check that the arrays are consistent, so that using the table can never
+ * index out of bounds or loop.  Nodes are always laid out after their
+ * parent, which rules out cycles.
+ */
+static bool
+validate_arrays(const struct compose_node *nodes, uint32_t num_nodes,
+                const struct compose_leaf *leaves, uint32_t num_leaves,
+                const char *utf8, uint32_t utf8_size)
+{
+    if (num_nodes < 1 || num_leaves < 1 || utf8_size < 1)
+        return false;
+    if (utf8[0] != '\0' || utf8[utf8_size - 1] != '\0')
+        return false;
+    if (!nodes[0].is_leaf || nodes[0].leaf.data != 0 ||
+        leaves[0].utf8 != 0 || leaves[0].keysym != XKB_KEY_NoSymbol)
+        return false;
+
+    for (uint32_t i = 1; i < num_nodes; i++) {
+        const struct compose_node *node = &nodes[i];
+        if (node->lokid != 0 && (node->lokid <= i || node->lokid >= num_nodes))
+            return false;
+        if (node->hikid != 0 && (node->hikid <= i || node->hikid >= num_nodes))
+            return false;
+        if (node->is_leaf) {
+            if (node->leaf.data >= num_leaves)
+                return false;
+        }
+        else if (node->internal.eqkid != 0 &&
+                 (node->internal.eqkid <= i ||
+                  node->internal.eqkid >= num_nodes)) {
+            return false;
+        }
+    }
+
+    for (uint32_t i = 0; i < num_leaves; i++)
+        if (leaves[i].utf8 >= utf8_size)
+            return false;
+
+    return true;
+}
+
+static bool
+dep_is_current(const char *path, const struct compose_table_dep *dep)
+{
+    struct stat st;
+    struct compose_table_dep current;
+
+    if (stat(path, &st) != 0)
+        return dep->size == -1;
+
+    stat_to_dep(&st, &current);
+    return current.mtime_sec == dep->mtime_sec &&
+           current.mtime_nsec == dep->mtime_nsec &&
+           current.size == dep->size;
+}
+
+bool
+compose_table_load(struct xkb_compose_table *table, char *map, size_t size,
+                   const char *path)
+{
+    struct compose_table_header header;
+    const struct compose_table_dep *deps;
+    const char *strings, *s, *strings_end;
+    const struct compose_node *nodes;
+    const struct compose_leaf *leaves;
+    const char *utf8;
+    uint64_t expected_size, offset;
+    struct xkb_compose_table old;
+    char *resolution = NULL;
+    bool current = true;
+
+    if (size < sizeof(header))
+        return false;
+    memcpy(&header, map, sizeof(header));
+
+    if (memcmp(header.magic, COMPOSE_TABLE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != COMPOSE_TABLE_VERSION ||
+        header.byte_order != COMPOSE_TABLE_BYTE_ORDER ||
+        header.node_size != sizeof(struct compose_node) ||
+        header.leaf_size != sizeof(struct compose_leaf))
+        return false;
+
+    offset = sizeof(header);
+    deps = (const struct compose_table_dep *) (map + offset);
+    offset += (uint64_t) header.num_deps * sizeof(struct compose_table_dep);
+    strings = map + offset;
+    offset += ROUNDUP((uint64_t) header.strings_size, 8);
+    nodes = (const struct compose_node *) (map + offset);
+    offset += (uint64_t) header.num_nodes * sizeof(struct compose_node);
+    leaves = (const struct compose_leaf *) (map + offset);
+    offset += (uint64_t) header.num_leaves * sizeof(struct compose_leaf);
+    utf8 = map + offset;
+    expected_size = offset + header.utf8_size;
+    if (expected_size != size)
+        return false;
+
+    /* The locale, the path, the resolution and the dependency paths. */
+    if (header.strings_size < COMPOSE_TABLE_NUM_STRINGS ||
+        strings[header.strings_size - 1] != '\0')
+        return false;
+    if (path) {
+        resolution = get_resolution(table);
+        if (!resolution)
+            return false;
+    }
+    s = strings;
+    strings_end = strings + header.strings_size;
+    for (uint32_t i = 0; i < header.num_deps + COMPOSE_TABLE_NUM_STRINGS; i++) {
+        if (s >= strings_end) {
+            current = false;
+            break;
+        }
+        if (path) {
+            if (i == 0)
+                current = streq(s, table->locale);
+            else if (i == 1)
+                current = streq(s, path);
+            else if (i == 2)
+                current = streq(s, resolution);
+            else
+                current = dep_is_current(s,
+                                         &deps[i - COMPOSE_TABLE_NUM_STRINGS]);
+            if (!current)
+                break;
+        }
+        s += strlen(s) + 1;
+    }
+    free(resolution);
+    if (!current)
+        return false;
+
+    if (!validate_arrays(nodes, header.num_nodes, leaves, header.num_leaves,
+                         utf8, header.utf8_size))
+        return false;
+
+    if (!path) {
+        /* Take the locale from the serialized table. */
+        char *locale = strdup(strings);
+        if (!locale)
+            return false;
+        free(table->locale);
+        table->locale = locale;
+    }
+
+    /* Keep the current arrays until the table is complete. */
+    old = *table;
+
+    /*
+     * The table is immutable once created, so it is fine for the arrays
+     * to point into read-only memory.  They are never resized or freed
+     * through the darray macros; see xkb_compose_table_unref().
+     */
+    table->nodes.item = (struct compose_node *) nodes;
+    table->nodes.size = table->nodes.alloc = header.num_nodes;
+    table->leaves.item = (struct compose_leaf *) leaves;
+    table->leaves.size = table->leaves.alloc = header.num_leaves;
+    table->utf8.item = (char *) utf8;
+    table->utf8.size = table->utf8.alloc = header.utf8_size;
+
+    if (!compose_table_index_roots(table)) {
+        table->nodes = old.nodes;
+        table->leaves = old.leaves;
+        table->utf8 = old.utf8;
+        return false;
+    }
+
+    darray_free(old.nodes);
+    darray_free(old.leaves);
+    darray_free(old.utf8);
+    table->map = map;
+    table->map_size = size;
+
+    return true;
+}
+
+bool
+compose_table_load_fd(struct xkb_compose_table *table, int fd)
+{
+    struct stat st;
+    char *map;
+
+    if (fstat(fd, &st) != 0 || st.st_size <= 0)
+        return false;
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        return false;
+
+    if (!compose_table_load(table, map, st.st_size, NULL)) {
+        munmap(map, st.st_size);
+        return false;
+    }
+
+    return true;
+}
+
+static char *
+get_cache_file_path(struct xkb_compose_table *table, const char *path)
+{
+    char *dir, *file;
+    uint64_t hash = HASH_STRING_INIT;
+
+    dir = get_cache_dir_path();
+    if (!dir)
+        return NULL;
+
+    hash = hash_string(hash, table->locale);
+    hash = hash_string(hash, path);
+
+    file = asprintf_safe("%s/compose-%016" PRIx64, dir, hash);
+    free(dir);
+    return file;
+}
+
+bool
+compose_cache_load(struct xkb_compose_table *table, const char *path)
+{
+    char *cache_path;
+    FILE *file;
+    char *map;
+    size_t size;
+    bool ok;
+
+    cache_path = get_cache_file_path(table, path);
+    if (!cache_path)
+        return false;
+
+    file = fopen(cache_path, "rb");
+    if (!file) {
+        free(cache_path);
+        return false;
+    }
+
+    ok = map_file(file, &map, &size);
+    fclose(file);
+    if (!ok) {
+        free(cache_path);
+        return false;
+    }
+
+    ok = compose_table_load(table, map, size, path);
+    if (!ok) {
+        log_dbg(table->ctx, "ignoring stale or invalid compose cache %s\n",
+                cache_path);
+        unmap_file(map, size);
+    }
+    else {
+        log_dbg(table->ctx, "loaded compose table for %s from cache %s\n",
+                path, cache_path);
+    }
+
+    free(cache_path);
+    return ok;
+}
+
+struct cache_write_data {
+    struct xkb_compose_table *table;
+    const char *path;
+    const darray_compose_dep *deps;
+};
+
+static bool
+cache_write_fn(int fd, void *data)
+{
+    struct cache_write_data *w = data;
+    return compose_table_write(w->table, fd, w->path, w->deps);
+}
+
+void
+compose_cache_store(struct xkb_compose_table *table, const char *path,
+                    darray_compose_dep *deps)
+{
+    struct cache_write_data data = { table, path, deps };
+    const char *xlocaledir = get_xlocaledir_path();
+    char *cache_path, *locale_file;
+
+    /* These decide what the locale and %L resolve to. */
+    locale_file = asprintf_safe("%s/compose.dir", xlocaledir);
+    if (!locale_file || !compose_dep_add_path(deps, locale_file)) {
+        free(locale_file);
+        return;
+    }
+    free(locale_file);
+    locale_file = asprintf_safe("%s/locale.alias", xlocaledir);
+    if (!locale_file || !compose_dep_add_path(deps, locale_file)) {
+        free(locale_file);
+        return;
+    }
+    free(locale_file);
+
+    cache_path = get_cache_file_path(table, path);
+    if (!cache_path)
+        return;
+
+    if (write_file_atomically(cache_path, cache_write_fn, &data))
+        log_dbg(table->ctx, "stored compose table for %s in cache %s\n",
+                path, cache_path);
+    else
+        log_dbg(table->ctx, "couldn't store compose cache %s: %s\n",
+                cache_path, strerror(errno));
+
+    free(cache_path);
+}
+
+#else
+
+/* Without a cache, there is nothing to collect dependencies for. */
+bool
+compose_dep_add(darray_compose_dep *deps, const char *path, FILE *file)
+{
+    return true;
+}
+
+bool
+compose_table_write(struct xkb_compose_table *table, int fd,
+                    const char *path, const darray_compose_dep *deps)
+{
+    return false;
+}
+
+bool
+compose_table_load(struct xkb_compose_table *table, char *map, size_t size,
+                   const char *path)
+{
+    return false;
+}
+
+bool
+compose_table_load_fd(struct xkb_compose_table *table, int fd)
+{
+    return false;
+}
+
+bool
+compose_cache_load(struct xkb_compose_table *table, const char *path)
+{
+    return false;
+}
+
+void
+compose_cache_store(struct xkb_compose_table *table, const char *path,
+                    darray_compose_dep *deps)
+{
+}
+
+#endif
+
+void
+compose_deps_free(darray_compose_dep *deps)
+{
+    struct compose_dep *dep;
+
+    darray_foreach(dep, *deps)
+        free(dep->path);
+    darray_free(*deps);
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright © 2021 libxkbcommon contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef COMPOSE_CACHE_H
+#define COMPOSE_CACHE_H
+
+#include "table.h"
+
+/*
+ * A file a compose table was compiled from, with the state it had when it
+ * was read.  A cached table is only used if none of its files changed.
+ */
+struct compose_dep {
+    char *path;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t size;
+};
+
+typedef darray(struct compose_dep) darray_compose_dep;
+
+bool
+compose_dep_add(darray_compose_dep *deps, const char *path, FILE *file);
+
+void
+compose_deps_free(darray_compose_dep *deps);
+
+/*
+ * Write @table to @fd in the binary format.  If @path is not NULL, it is
+ * recorded together with @deps, as the key for compose_cache_load().
+ */
+bool
+compose_table_write(struct xkb_compose_table *table, int fd,
+                    const char *path, const darray_compose_dep *deps);
+
+/*
+ * Make @table use the serialized table in @map, as returned by map_file().
+ * The arrays of the table point directly into the mapping.  On success,
+ * the table takes ownership of the mapping.
+ *
+ * If @path is not NULL, the table must have been written for this path
+ * and the locale of @table, and its dependencies must be unchanged.
+ */
+bool
+compose_table_load(struct xkb_compose_table *table, char *map, size_t size,
+                   const char *path);
+
+/* Like compose_table_load(), but maps the whole file @fd. */
+bool
+compose_table_load_fd(struct xkb_compose_table *table, int fd);
+
+/*
+ * Load a cached table for the Compose file @path and the locale of @table,
+ * if there is an up-to-date one.
+ */
+bool
+compose_cache_load(struct xkb_compose_table *table, const char *path);
+
+/*
+ * Store @table, compiled from @path and the files in @deps, in the cache.
+ * The X locale files are added to @deps, since they decide how the locale
+ * resolves.  Failures are not fatal, and are only logged.
+ */
+void
+compose_cache_store(struct xkb_compose_table *table, const char *path,
+                    darray_compose_dep *deps);
+
+#endif
@@ -96,6 +96,9 @@ OR PERFORMANCE OF THIS SOFTWARE.
  *          "/usr/share/X11/locale/<localename>/Compose").
  *     %S - The name of the system directory for Compose files (e.g.,
  *          "/usr/share/X11/locale").
+ *
+ * When parsing an overlay table, an exact `include "%L"` is not read;
+ * the base table stands for it.
  */
 
 enum rules_token {
@@ -103,6 +106,7 @@ enum rules_token {
     TOK_END_OF_LINE,
     TOK_INCLUDE,
     TOK_INCLUDE_STRING,
+    TOK_INCLUDE_BASE,
     TOK_LHS_KEYSYM,
     TOK_COLON,
     TOK_BANG,
@@ -140,8 +144,7 @@ skip_more_whitespace_and_comments:
     if (eof(s)) return TOK_END_OF_FILE;
 
     /* New token. */
-    s->token_line = s->line;
-    s->token_column = s->column;
+    s->token_pos = s->pos;
     s->buf_pos = 0;
 
     /* LHS Keysym. */
@@ -247,8 +250,7 @@ lex_include_string(struct scanner *s, struct xkb_compose_table *table,
         if (next(s) == '\n')
             return TOK_END_OF_LINE;
 
-    s->token_line = s->line;
-    s->token_column = s->column;
+    s->token_pos = s->pos;
     s->buf_pos = 0;
 
     if (!chr(s, '\"')) {
@@ -256,6 +258,10 @@ lex_include_string(struct scanner *s, struct xkb_compose_table *table,
         return TOK_ERROR;
     }
 
+    /* In an overlay table, the locale Compose file is the base table. */
+    if (table->base && lit(s, "%L\""))
+        return TOK_INCLUDE_BASE;
+
     while (!eof(s) && !eol(s) && peek(s) != '\"') {
         if (chr(s, '%')) {
             if (chr(s, '%')) {
@@ -273,7 +279,7 @@ lex_include_string(struct scanner *s, struct xkb_compose_table *table,
                 }
             }
             else if (chr(s, 'L')) {
-                char *path = get_locale_compose_file_path(table->locale);
+                char *path = get_locale_compose_file_path(table->ctx, table->locale);
                 if (!path) {
                     scanner_err(s, "failed to expand %%L to the locale Compose file");
                     return TOK_ERROR;
@@ -327,109 +333,322 @@ struct production {
     xkb_mod_mask_t mods;
 };
 
+/*
+ * Productions are not inserted into the table as they are parsed.  Instead,
+ * they are collected (together with those of any included files), and the
+ * ternary search tree is built in one go once everything has been read; see
+ * build_table().  Knowing all of the sequences up front allows us to resolve
+ * conflicts between them, and to lay out every sibling set (the lokid/hikid
+ * binary tree at each level) as a balanced tree.  Inserting in file order
+ * instead can create long O(n) chains, which results in O(n^2) parsing time
+ * and slow lookups in xkb_compose_state_feed().
+ */
+struct pending_production {
+    xkb_keysym_t lhs[MAX_LHS_LEN];
+    uint8_t len;
+    /* At least one of these is true. */
+    bool has_keysym;
+    bool has_string;
+    xkb_keysym_t keysym;
+    /* Offset into productions::strings. */
+    uint32_t string;
+    /* Order of appearance, later productions take precedence. */
+    uint32_t index;
+    /* Location, for diagnostics. */
+    uint32_t file;
+    size_t line, column;
+};
+
+struct productions {
+    darray(struct pending_production) items;
+    darray_char strings;
+    /* File names referenced by pending_production::file. */
+    darray(char *) files;
+    /* If not NULL, the files read are recorded here. */
+    darray_compose_dep *deps;
+};
+
+static uint32_t
+register_file(struct productions *prods, const char *file_name)
+{
+    darray_append(prods->files, strdup_safe(file_name));
+    return darray_size(prods->files) - 1;
+}
+
 static void
-add_production(struct xkb_compose_table *table, struct scanner *s,
+add_production(struct productions *prods, struct scanner *s, uint32_t file,
                const struct production *production)
 {
-    unsigned lhs_pos = 0;
-    uint16_t curr = darray_size(table->nodes) == 1 ? 0 : 1;
-    uint16_t *pptr = NULL;
-    struct compose_node *node = NULL;
-
-    /* Warn before potentially going over the limit, discard silently after. */
-    if (darray_size(table->nodes) + production->len + MAX_LHS_LEN > MAX_COMPOSE_NODES)
-        scanner_warn(s, "too many sequences for one Compose file; will ignore further lines");
-    if (darray_size(table->nodes) + production->len >= MAX_COMPOSE_NODES)
-        return;
+    struct pending_production pending = {
+        .len = production->len,
+        .has_keysym = production->has_keysym,
+        .has_string = production->has_string,
+        .keysym = production->keysym,
+        .string = 0,
+        .index = darray_size(prods->items),
+        .file = file,
+    };
 
-    /*
-     * Insert the sequence to the ternary search tree, creating new nodes as
-     * needed.
-     *
-     * TODO: We insert in the order given, this means some inputs can create
-     * long O(n) chains, which results in total O(n^2) parsing time. We should
-     * ensure the tree is reasonably balanced somehow.
-     */
-    while (true) {
-        const xkb_keysym_t keysym = production->lhs[lhs_pos];
-        const bool last = lhs_pos + 1 == production->len;
-
-        if (curr == 0) {
-            /*
-             * Create a new node and update the parent pointer to it.
-             * Update the pointer first because the append invalidates it.
-             */
-            struct compose_node new = {
-                .keysym = keysym,
-                .lokid = 0,
-                .hikid = 0,
-                .internal = {
-                    .eqkid = 0,
-                    .is_leaf = false,
-                },
-            };
-            curr = darray_size(table->nodes);
-            if (pptr != NULL) {
-                *pptr = curr;
-                pptr = NULL;
+    scanner_token_location(s, &pending.line, &pending.column);
+
+    memcpy(pending.lhs, production->lhs, production->len * sizeof(xkb_keysym_t));
+
+    if (production->has_string) {
+        pending.string = darray_size(prods->strings);
+        darray_append_items(prods->strings, production->string,
+                            strlen(production->string) + 1);
+    }
+
+    darray_append(prods->items, pending);
+}
+
+static void
+productions_free(struct productions *prods)
+{
+    char **file;
+
+    darray_foreach(file, prods->files)
+        free(*file);
+    darray_free(prods->files);
+    darray_free(prods->strings);
+    darray_free(prods->items);
+}
+
+#define production_warn(table, prods, p, fmt) \
+    log_warn((table)->ctx, "%s:%zu:%zu: " fmt "\n", \
+             darray_item((prods)->files, (p)->file), (p)->line, (p)->column)
+
+static int
+cmp_pending_productions(const void *a, const void *b)
+{
+    const struct pending_production *pa = a;
+    const struct pending_production *pb = b;
+    const unsigned len = MIN(pa->len, pb->len);
+
+    for (unsigned i = 0; i < len; i++)
+        if (pa->lhs[i] != pb->lhs[i])
+            return pa->lhs[i] < pb->lhs[i] ? -1 : 1;
+    if (pa->len != pb->len)
+        return pa->len < pb->len ? -1 : 1;
+    /* Keep the file order for identical sequences. */
+    return pa->index < pb->index ? -1 : pa->index > pb->index;
+}
+
+static bool
+is_proper_prefix(const struct pending_production *a,
+                 const struct pending_production *b)
+{
+    return a->len < b->len &&
+           memcmp(a->lhs, b->lhs, a->len * sizeof(xkb_keysym_t)) == 0;
+}
+
+static bool
+same_lhs(const struct pending_production *a,
+         const struct pending_production *b)
+{
+    return a->len == b->len &&
+           memcmp(a->lhs, b->lhs, a->len * sizeof(xkb_keysym_t)) == 0;
+}
+
+/*
+ * The resolved result of a sequence.  utf8 is an offset into
+ * productions::strings, or 0 if there is no string.
+ */
+struct resolved_production {
+    const xkb_keysym_t *lhs;
+    unsigned len;
+    uint32_t utf8;
+    xkb_keysym_t keysym;
+};
+typedef darray(struct resolved_production) darray_resolved_production;
+
+/*
+ * Reduce the sorted productions to one per distinct sequence, applying the
+ * usual rules: a later definition of the same sequence overrides an earlier
+ * one, and a sequence which is a prefix of another is dropped in favour of
+ * the longer one.
+ */
+static void
+resolve_productions(struct xkb_compose_table *table, struct productions *prods,
+                    darray_resolved_production *resolved)
+{
+    const unsigned num = darray_size(prods->items);
+    unsigned i = 0;
+
+    while (i < num) {
+        const struct pending_production *first = &darray_item(prods->items, i);
+        const struct pending_production *p, *next;
+        struct resolved_production r = {
+            .lhs = first->lhs,
+            .len = first->len,
+            .utf8 = first->has_string ? first->string : 0,
+            .keysym = first->has_keysym ? first->keysym : XKB_KEY_NoSymbol,
+        };
+        unsigned j;
+
+        for (j = i + 1; j < num; j++) {
+            p = &darray_item(prods->items, j);
+            if (!same_lhs(first, p))
+                break;
+
+            if (((r.utf8 == 0 && !p->has_string) ||
+                 (r.utf8 != 0 && p->has_string &&
+                  streq(&darray_item(prods->strings, r.utf8),
+                        &darray_item(prods->strings, p->string)))) &&
+                ((r.keysym == XKB_KEY_NoSymbol && !p->has_keysym) ||
+                 (r.keysym != XKB_KEY_NoSymbol && p->has_keysym &&
+                  r.keysym == p->keysym))) {
+                production_warn(table, prods, p,
+                                "this compose sequence is a duplicate of another; skipping line");
+                continue;
             }
-            darray_append(table->nodes, new);
+
+            production_warn(table, prods, p,
+                            "this compose sequence already exists; overriding");
+            if (p->has_string)
+                r.utf8 = p->string;
+            if (p->has_keysym)
+                r.keysym = p->keysym;
         }
 
-        node = &darray_item(table->nodes, curr);
-
-        if (keysym < node->keysym) {
-            pptr = &node->lokid;
-            curr = node->lokid;
-        } else if (keysym > node->keysym) {
-            pptr = &node->hikid;
-            curr = node->hikid;
-        } else if (!last) {
-            if (node->is_leaf) {
-                scanner_warn(s, "a sequence already exists which is a prefix of this sequence; overriding");
-                node->internal.eqkid = node->lokid = node->hikid = 0;
-                node->internal.is_leaf = false;
-            }
-            lhs_pos++;
-            pptr = &node->internal.eqkid;
-            curr = node->internal.eqkid;
-        } else {
-            if (node->is_leaf) {
-                bool same_string =
-                    (node->leaf.utf8 == 0 && !production->has_string) ||
-                    (
-                        node->leaf.utf8 != 0 && production->has_string &&
-                        streq(&darray_item(table->utf8, node->leaf.utf8),
-                              production->string)
-                    );
-                bool same_keysym =
-                    (node->leaf.keysym == XKB_KEY_NoSymbol && !production->has_keysym) ||
-                    (
-                        node->leaf.keysym != XKB_KEY_NoSymbol && production->has_keysym &&
-                        node->leaf.keysym == production->keysym
-                    );
-                if (same_string && same_keysym) {
-                    scanner_warn(s, "this compose sequence is a duplicate of another; skipping line");
-                    return;
-                } else {
-                    scanner_warn(s, "this compose sequence already exists; overriding");
-                }
-            } else if (node->internal.eqkid != 0) {
-                scanner_warn(s, "this compose sequence is a prefix of another; skipping line");
-                return;
+        /* Sequences extending this one immediately follow it. */
+        next = (j < num ? &darray_item(prods->items, j) : NULL);
+        if (next && is_proper_prefix(first, next)) {
+            for (unsigned k = i; k < j; k++) {
+                p = &darray_item(prods->items, k);
+                if (p->index > next->index)
+                    production_warn(table, prods, p,
+                                    "this compose sequence is a prefix of another; skipping line");
+                else
+                    production_warn(table, prods, next,
+                                    "a sequence already exists which is a prefix of this sequence; overriding");
             }
-            node->is_leaf = true;
-            if (production->has_string) {
-                node->leaf.utf8 = darray_size(table->utf8);
-                darray_append_items(table->utf8, production->string,
-                                    strlen(production->string) + 1);
-            }
-            if (production->has_keysym) {
-                node->leaf.keysym = production->keysym;
-            }
-            return;
         }
+        else {
+            darray_append(*resolved, r);
+        }
+
+        i = j;
+    }
+}
+
+/*
+ * Build the sibling set for the keysyms at position @depth of the sequences
+ * in [@begin, @end), all of which share their first @depth keysyms.  Every
+ * distinct keysym forms a group; the median group becomes the root of the
+ * sibling set, and the groups on each side are built recursively as its
+ * lokid and hikid subtrees.
+ *
+ * Returns the offset of the root node, or 0 if there is nothing to build.
+ */
+static uint32_t
+build_siblings(struct xkb_compose_table *table, struct productions *prods,
+               const struct resolved_production *seqs,
+               unsigned begin, unsigned end, unsigned depth)
+{
+    unsigned mid, group_begin, group_end;
+    xkb_keysym_t keysym;
+    uint32_t curr, kid;
+
+    if (begin >= end)
+        return 0;
+
+    if (darray_size(table->nodes) >= MAX_COMPOSE_NODES)
+        return 0;
+
+    /* Find the group containing the median sequence. */
+    mid = begin + (end - begin) / 2;
+    keysym = seqs[mid].lhs[depth];
+    group_begin = mid;
+    while (group_begin > begin && seqs[group_begin - 1].lhs[depth] == keysym)
+        group_begin--;
+    group_end = mid + 1;
+    while (group_end < end && seqs[group_end].lhs[depth] == keysym)
+        group_end++;
+
+    curr = darray_size(table->nodes);
+    darray_append(table->nodes, (struct compose_node) {
+        .keysym = keysym,
+        .lokid = 0,
+        .hikid = 0,
+        .is_leaf = false,
+        .internal = {
+            .eqkid = 0,
+        },
+    });
+
+    /*
+     * Since prefixes have been dropped, a sequence ending here is the only
+     * one in its group.
+     */
+    if (seqs[group_begin].len == depth + 1) {
+        const struct resolved_production *seq = &seqs[group_begin];
+        struct compose_node *node = &darray_item(table->nodes, curr);
+        struct compose_leaf leaf = {
+            .utf8 = 0,
+            .keysym = seq->keysym,
+        };
+
+        if (seq->utf8 != 0) {
+            const char *string = &darray_item(prods->strings, seq->utf8);
+            leaf.utf8 = darray_size(table->utf8);
+            darray_append_items(table->utf8, string, strlen(string) + 1);
+        }
+
+        node->is_leaf = true;
+        node->leaf.data = darray_size(table->leaves);
+        darray_append(table->leaves, leaf);
+    }
+    else {
+        kid = build_siblings(table, prods, seqs, group_begin, group_end,
+                             depth + 1);
+        darray_item(table->nodes, curr).internal.eqkid = kid;
+    }
+
+    kid = build_siblings(table, prods, seqs, begin, group_begin, depth);
+    darray_item(table->nodes, curr).lokid = kid;
+    kid = build_siblings(table, prods, seqs, group_end, end, depth);
+    darray_item(table->nodes, curr).hikid = kid;
+
+    return curr;
+}
+
+static void
+build_table(struct xkb_compose_table *table, struct productions *prods)
+{
+    darray_resolved_production resolved = darray_new();
+    unsigned num_nodes = 1;
+
+    if (darray_empty(prods->items))
+        return;
+
+    qsort(prods->items.item, darray_size(prods->items),
+          sizeof(struct pending_production), cmp_pending_productions);
+
+    resolve_productions(table, prods, &resolved);
+
+    /*
+     * Warn and ignore the remaining sequences if there are too many to fit.
+     * A sequence needs at most as many nodes as its length.
+     */
+    for (unsigned i = 0; i < darray_size(resolved); i++) {
+        const struct resolved_production *r = &darray_item(resolved, i);
+        if (num_nodes + r->len >= MAX_COMPOSE_NODES) {
+            log_warn(table->ctx,
+                     "too many sequences for one Compose file; ignoring %u sequences\n",
+                     darray_size(resolved) - i);
+            darray_resize(resolved, i);
+            break;
+        }
+        num_nodes += r->len;
     }
+
+    darray_resize(table->nodes, 1);
+    darray_resize(table->leaves, 1);
+    build_siblings(table, prods, resolved.item, 0,
+                   darray_size(resolved), 0);
+
+    darray_free(resolved);
 }
 
 /* Should match resolve_modifier(). */
@@ -470,6 +689,7 @@ do_include(struct xkb_compose_table *table, struct scanner *s,
     char *string;
     size_t size;
     struct scanner new_s;
+    struct productions *prods = s->priv;
 
     if (include_depth >= MAX_INCLUDE_DEPTH) {
         scanner_err(s, "maximum include depth (%d) exceeded; maybe there is an include loop?",
@@ -491,6 +711,12 @@ do_include(struct xkb_compose_table *table, struct scanner *s,
         goto err_file;
     }
 
+    if (prods->deps && !compose_dep_add(prods->deps, path, file)) {
+        scanner_err(s, "failed to stat included Compose file \"%s\"", path);
+        ok = false;
+        goto err_unmap;
+    }
+
     scanner_init(&new_s, table->ctx, string, size, path, s->priv);
 
     ok = parse(table, &new_s, include_depth + 1);
@@ -514,6 +740,7 @@ parse(struct xkb_compose_table *table, struct scanner *s,
     struct production production;
     enum { MAX_ERRORS = 10 };
     int num_errors = 0;
+    const uint32_t file = register_file(s->priv, s->file_name);
 
 initial:
     production.len = 0;
@@ -540,6 +767,8 @@ include:
     switch (tok = lex_include_string(s, table, &val)) {
     case TOK_INCLUDE_STRING:
         goto include_eol;
+    case TOK_INCLUDE_BASE:
+        goto include_base_eol;
     default:
         goto unexpected;
     }
@@ -554,6 +783,15 @@ include_eol:
         goto unexpected;
     }
 
+include_base_eol:
+    switch (tok = lex(s, &val)) {
+    case TOK_END_OF_LINE:
+        /* Nothing to do; the sequences are looked up in the base table. */
+        goto initial;
+    default:
+        goto unexpected;
+    }
+
 lhs:
     tok = lex(s, &val);
 lhs_tok:
@@ -674,7 +912,7 @@ rhs:
             scanner_warn(s, "right-hand side must have at least one of string or keysym; skipping line");
             goto skip;
         }
-        add_production(table, s, &production);
+        add_production(s->priv, s, file, &production);
         goto initial;
     default:
         goto unexpected;
@@ -706,20 +944,38 @@ finished:
 
 bool
 parse_string(struct xkb_compose_table *table, const char *string, size_t len,
-             const char *file_name)
+             const char *file_name, darray_compose_dep *deps)
 {
     struct scanner s;
-    scanner_init(&s, table->ctx, string, len, file_name, NULL);
-    if (!parse(table, &s, 0))
+    struct productions prods = {
+        .items = darray_new(),
+        .strings = darray_new(),
+        .files = darray_new(),
+        .deps = deps,
+    };
+
+    /* Offset 0 is reserved for "no string", like xkb_compose_table::utf8. */
+    darray_append(prods.strings, '\0');
+
+    scanner_init(&s, table->ctx, string, len, file_name, &prods);
+    if (!parse(table, &s, 0)) {
+        productions_free(&prods);
         return false;
+    }
+
+    build_table(table, &prods);
+    productions_free(&prods);
+
     /* Maybe the allocator can use the excess space. */
     darray_shrink(table->nodes);
+    darray_shrink(table->leaves);
     darray_shrink(table->utf8);
-    return true;
+    return compose_table_index_roots(table);
 }
 
 bool
-parse_file(struct xkb_compose_table *table, FILE *file, const char *file_name)
+parse_file(struct xkb_compose_table *table, FILE *file, const char *file_name,
+           darray_compose_dep *deps)
 {
     bool ok;
     char *string;
@@ -732,7 +988,14 @@ parse_file(struct xkb_compose_table *table, FILE *file, const char *file_name)
         return false;
     }
 
-    ok = parse_string(table, string, size, file_name);
+    if (deps && !compose_dep_add(deps, file_name, file)) {
+        log_err(table->ctx, "Couldn't stat Compose file %s: %s\n",
+                file_name, strerror(errno));
+        unmap_file(string, size);
+        return false;
+    }
+
+    ok = parse_string(table, string, size, file_name, deps);
     unmap_file(string, size);
     return ok;
 }
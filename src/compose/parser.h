@@ -24,13 +24,19 @@
 #ifndef COMPOSE_PARSER_H
 #define COMPOSE_PARSER_H
 
+#include "cache.h"
+
+/*
+ * If @deps is not NULL, the files which the table is compiled from are
+ * appended to it.
+ */
 bool
 parse_string(struct xkb_compose_table *table,
              const char *string, size_t len,
-             const char *file_name);
+             const char *file_name, darray_compose_dep *deps);
 
 bool
 parse_file(struct xkb_compose_table *table,
-           FILE *file, const char *file_name);
+           FILE *file, const char *file_name, darray_compose_dep *deps);
 
 #endif
@@ -23,9 +23,13 @@
 
 #include "config.h"
 
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "xkbcommon/xkbcommon.h"
 #include "utils.h"
+#include "context.h"
 #include "paths.h"
-#include "utils.h"
 
 enum resolve_name_direction {
     LEFT_TO_RIGHT,
@@ -42,31 +46,87 @@ get_xlocaledir_path(void)
 }
 
 /*
- * Files like compose.dir have the format LEFT: RIGHT.  Lookup @name in
- * such a file and return its matching value, according to @direction.
- * @filename is relative to the xlocaledir.
+ * Files like compose.dir have the format LEFT: RIGHT, and are looked up
+ * by one side to get the other, according to a direction.  They are
+ * hundreds to thousands of lines long, and several lookups are needed for
+ * every compose table, so each file is parsed once into a hash index,
+ * which is kept in the context.  The index is rebuilt if the file
+ * changes.
  */
-static char *
-resolve_name(const char *filename, enum resolve_name_direction direction,
-             const char *name)
+
+struct locale_file_entry {
+    const char *key;
+    const char *value;
+    size_t key_len;
+    size_t value_len;
+};
+
+struct locale_file_index {
+    /* The path of the indexed file; NULL if there is no index. */
+    char *path;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t size;
+
+    /* A copy of the file, which the entries point into. */
+    char *contents;
+    /* Open addressing, with a power of two size; NULL key is empty. */
+    struct locale_file_entry *entries;
+    size_t num_entries;
+};
+
+struct locale_files {
+    struct locale_file_index alias;
+    struct locale_file_index compose_dir;
+};
+
+static uint32_t
+hash_name(const char *name, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t) name[i];
+        hash *= 0x01000193;
+    }
+    return hash;
+}
+
+static struct locale_file_entry *
+index_find(struct locale_file_index *index, const char *name, size_t len)
+{
+    const size_t mask = index->num_entries - 1;
+    size_t i = hash_name(name, len) & mask;
+
+    while (index->entries[i].key) {
+        struct locale_file_entry *entry = &index->entries[i];
+        if (entry->key_len == len && memcmp(entry->key, name, len) == 0)
+            return entry;
+        i = (i + 1) & mask;
+    }
+
+    return &index->entries[i];
+}
+
+static void
+index_clear(struct locale_file_index *index)
+{
+    free(index->path);
+    free(index->contents);
+    free(index->entries);
+    memset(index, 0, sizeof(*index));
+}
+
+static bool
+index_build(struct locale_file_index *index, const char *path,
+            const struct stat *st, enum resolve_name_direction direction)
 {
-    int ret;
-    bool ok;
-    const char *xlocaledir;
-    char path[512];
     FILE *file;
     char *string;
     size_t string_size;
     const char *end;
     const char *s, *left, *right;
-    char *match;
-    size_t left_len, right_len, name_len;
-
-    xlocaledir = get_xlocaledir_path();
-
-    ret = snprintf(path, sizeof(path), "%s/%s", xlocaledir, filename);
-    if (ret < 0 || (size_t) ret >= sizeof(path))
-        return false;
+    size_t left_len, right_len, num_lines;
+    bool ok;
 
     file = fopen(path, "rb");
     if (!file)
@@ -77,12 +137,34 @@ resolve_name(const char *filename, enum resolve_name_direction direction,
     if (!ok)
         return false;
 
-    s = string;
-    end = string + string_size;
-    name_len = strlen(name);
-    match = NULL;
+    index->contents = malloc(string_size + 1);
+    if (!index->contents) {
+        unmap_file(string, string_size);
+        return false;
+    }
+    memcpy(index->contents, string, string_size);
+    unmap_file(string, string_size);
+
+    /* At most one entry per line; keep the load factor under 1/2. */
+    num_lines = 1;
+    for (size_t i = 0; i < string_size; i++)
+        if (index->contents[i] == '\n')
+            num_lines++;
+    index->num_entries = 1;
+    while (index->num_entries < 2 * num_lines)
+        index->num_entries *= 2;
+    index->entries = calloc(index->num_entries, sizeof(*index->entries));
+    if (!index->entries) {
+        index_clear(index);
+        return false;
+    }
+
+    s = index->contents;
+    end = index->contents + string_size;
 
     while (s < end) {
+        struct locale_file_entry *entry;
+
         /* Skip spaces. */
         while (s < end && is_space(*s))
             s++;
@@ -118,28 +200,119 @@ resolve_name(const char *filename, enum resolve_name_direction direction,
         while (s < end && *s != '\n')
             s++;
 
+        /* The first match wins. */
         if (direction == LEFT_TO_RIGHT) {
-            if (left_len == name_len && memcmp(left, name, left_len) == 0) {
-                match = strndup(right, right_len);
-                break;
-            }
+            entry = index_find(index, left, left_len);
+            if (!entry->key)
+                *entry = (struct locale_file_entry) {
+                    left, right, left_len, right_len
+                };
         }
-        else if (direction == RIGHT_TO_LEFT) {
-            if (right_len == name_len && memcmp(right, name, right_len) == 0) {
-                match = strndup(left, left_len);
-                break;
-            }
+        else {
+            entry = index_find(index, right, right_len);
+            if (!entry->key)
+                *entry = (struct locale_file_entry) {
+                    right, left, right_len, left_len
+                };
         }
     }
 
-    unmap_file(string, string_size);
-    return match;
+    index->path = strdup(path);
+    if (!index->path) {
+        index_clear(index);
+        return false;
+    }
+    index->mtime_sec = st->st_mtime;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+    index->mtime_nsec = st->st_mtim.tv_nsec;
+#else
+    index->mtime_nsec = 0;
+#endif
+    index->size = st->st_size;
+
+    return true;
+}
+
+static bool
+index_is_current(const struct locale_file_index *index, const char *path,
+                 const struct stat *st)
+{
+    if (!index->path || !streq(index->path, path))
+        return false;
+    if (index->mtime_sec != st->st_mtime || index->size != st->st_size)
+        return false;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+    if (index->mtime_nsec != st->st_mtim.tv_nsec)
+        return false;
+#endif
+    return true;
+}
+
+void
+locale_files_free(void *locale_files)
+{
+    struct locale_files *files = locale_files;
+
+    if (!files)
+        return;
+
+    index_clear(&files->alias);
+    index_clear(&files->compose_dir);
+    free(files);
+}
+
+/*
+ * Lookup @name in a file like compose.dir and return its matching value,
+ * according to @direction.  @filename is relative to the xlocaledir.
+ */
+static char *
+resolve_name(struct xkb_context *ctx, const char *filename,
+             enum resolve_name_direction direction, const char *name)
+{
+    int ret;
+    const char *xlocaledir;
+    char path[512];
+    struct stat st;
+    struct locale_files *files;
+    struct locale_file_index *index;
+    struct locale_file_entry *entry;
+
+    xlocaledir = get_xlocaledir_path();
+
+    ret = snprintf(path, sizeof(path), "%s/%s", xlocaledir, filename);
+    if (ret < 0 || (size_t) ret >= sizeof(path))
+        return NULL;
+
+    if (!ctx->compose_locale_files) {
+        ctx->compose_locale_files = calloc(1, sizeof(struct locale_files));
+        if (!ctx->compose_locale_files)
+            return NULL;
+    }
+    files = ctx->compose_locale_files;
+    index = (direction == LEFT_TO_RIGHT ? &files->alias : &files->compose_dir);
+
+    if (stat(path, &st) != 0) {
+        index_clear(index);
+        return NULL;
+    }
+
+    if (!index_is_current(index, path, &st)) {
+        index_clear(index);
+        if (!index_build(index, path, &st, direction))
+            return NULL;
+    }
+
+    entry = index_find(index, name, strlen(name));
+    if (!entry->key)
+        return NULL;
+
+    return strndup(entry->value, entry->value_len);
 }
 
 char *
-resolve_locale(const char *locale)
+resolve_locale(struct xkb_context *ctx, const char *locale)
 {
-    char *alias = resolve_name("locale.alias", LEFT_TO_RIGHT, locale);
+    char *alias = resolve_name(ctx, "locale.alias", LEFT_TO_RIGHT, locale);
     return alias ? alias : strdup(locale);
 }
 
@@ -179,7 +352,7 @@ get_home_xcompose_file_path(void)
 }
 
 char *
-get_locale_compose_file_path(const char *locale)
+get_locale_compose_file_path(struct xkb_context *ctx, const char *locale)
 {
     char *resolved;
     char *path;
@@ -198,7 +371,7 @@ get_locale_compose_file_path(const char *locale)
     if (streq(locale, "C"))
         locale = "en_US.UTF-8";
 
-    resolved = resolve_name("compose.dir", RIGHT_TO_LEFT, locale);
+    resolved = resolve_name(ctx, "compose.dir", RIGHT_TO_LEFT, locale);
     if (!resolved)
         return NULL;
 
@@ -24,8 +24,10 @@
 #ifndef COMPOSE_RESOLVE_H
 #define COMPOSE_RESOLVE_H
 
+struct xkb_context;
+
 char *
-resolve_locale(const char *locale);
+resolve_locale(struct xkb_context *ctx, const char *locale);
 
 const char *
 get_xlocaledir_path(void);
@@ -40,6 +42,10 @@ char *
 get_home_xcompose_file_path(void);
 
 char *
-get_locale_compose_file_path(const char *locale);
+get_locale_compose_file_path(struct xkb_context *ctx, const char *locale);
+
+/* Free the parsed X locale files kept in a context. */
+void
+locale_files_free(void *locale_files);
 
 #endif
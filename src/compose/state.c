@@ -41,8 +41,15 @@ struct xkb_compose_state {
      * This is also sufficient for inferring the current status; see
      * xkb_compose_state_get_status().
      */
-    uint16_t prev_context;
-    uint16_t context;
+    uint32_t prev_context;
+    uint32_t context;
+
+    /*
+     * The same, in the base table, if the table is an overlay; otherwise
+     * they are always 0.
+     */
+    uint32_t prev_base_context;
+    uint32_t base_context;
 };
 
 XKB_EXPORT struct xkb_compose_state *
@@ -61,6 +68,8 @@ xkb_compose_state_new(struct xkb_compose_table *table,
     state->flags = flags;
     state->prev_context = 0;
     state->context = 0;
+    state->prev_base_context = 0;
+    state->base_context = 0;
 
     return state;
 }
@@ -88,11 +97,60 @@ xkb_compose_state_get_compose_table(struct xkb_compose_state *state)
     return state->table;
 }
 
+/* Whether the position is inside a sequence, i.e. at an internal node. */
+static inline bool
+is_composing(const struct xkb_compose_table *table, uint32_t context)
+{
+    return !darray_item(table->nodes, context).is_leaf;
+}
+
+static inline bool
+state_is_composing(const struct xkb_compose_state *state,
+                   uint32_t context, uint32_t base_context)
+{
+    return is_composing(state->table, context) ||
+           (state->table->base && is_composing(state->table->base,
+                                               base_context));
+}
+
+/* Where a sequence which is in progress at @context continues. */
+static inline uint32_t
+next_context(const struct xkb_compose_table *table, uint32_t context)
+{
+    const struct compose_node *node = &darray_item(table->nodes, context);
+    return (node->is_leaf ? 0 : node->internal.eqkid);
+}
+
+/* Find @keysym in the sibling set at @context. */
+static inline uint32_t
+find_keysym(const struct xkb_compose_table *table, uint32_t context,
+            xkb_keysym_t keysym)
+{
+    while (context != 0) {
+        const struct compose_node *node = &darray_item(table->nodes, context);
+        if (keysym < node->keysym)
+            context = node->lokid;
+        else if (keysym > node->keysym)
+            context = node->hikid;
+        else
+            break;
+    }
+
+    return context;
+}
+
+/*
+ * For an overlay table, the state follows the sequence in the overlay
+ * and in the base table side by side, as if they were one table: the
+ * sequence goes on as long as either table has a longer sequence, and if
+ * both tables have the sequence, the overlay's result is used.
+ */
 XKB_EXPORT enum xkb_compose_feed_result
 xkb_compose_state_feed(struct xkb_compose_state *state, xkb_keysym_t keysym)
 {
-    uint16_t context;
-    const struct compose_node *node;
+    const struct xkb_compose_table *table = state->table;
+    uint32_t context, base_context = 0;
+    bool composing;
 
     /*
      * Modifiers do not affect the sequence directly.  In particular,
@@ -107,24 +165,31 @@ xkb_compose_state_feed(struct xkb_compose_state *state, xkb_keysym_t keysym)
     if (xkb_keysym_is_modifier(keysym))
         return XKB_COMPOSE_FEED_IGNORED;
 
-    node = &darray_item(state->table->nodes, state->context);
+    composing = state_is_composing(state, state->context,
+                                   state->base_context);
 
-    context = (node->is_leaf ? 1 : node->internal.eqkid);
-    if (context == 1 && darray_size(state->table->nodes) == 1)
-        context = 0;
+    if (composing) {
+        context = next_context(table, state->context);
+        context = find_keysym(table, context, keysym);
+    }
+    else {
+        context = compose_table_find_root(table, keysym);
+    }
 
-    while (context != 0) {
-        node = &darray_item(state->table->nodes, context);
-        if (keysym < node->keysym)
-            context = node->lokid;
-        else if (keysym > node->keysym)
-            context = node->hikid;
-        else
-            break;
+    if (table->base) {
+        if (composing) {
+            base_context = next_context(table->base, state->base_context);
+            base_context = find_keysym(table->base, base_context, keysym);
+        }
+        else {
+            base_context = compose_table_find_root(table->base, keysym);
+        }
     }
 
     state->prev_context = state->context;
     state->context = context;
+    state->prev_base_context = state->base_context;
+    state->base_context = base_context;
     return XKB_COMPOSE_FEED_ACCEPTED;
 }
 
@@ -133,45 +198,68 @@ xkb_compose_state_reset(struct xkb_compose_state *state)
 {
     state->prev_context = 0;
     state->context = 0;
+    state->prev_base_context = 0;
+    state->base_context = 0;
 }
 
 XKB_EXPORT enum xkb_compose_status
 xkb_compose_state_get_status(struct xkb_compose_state *state)
 {
-    const struct compose_node *prev_node, *node;
-
-    prev_node = &darray_item(state->table->nodes, state->prev_context);
-    node = &darray_item(state->table->nodes, state->context);
-
-    if (state->context == 0 && !prev_node->is_leaf)
-        return XKB_COMPOSE_CANCELLED;
-
-    if (state->context == 0)
+    if (state->context == 0 && state->base_context == 0) {
+        if (state_is_composing(state, state->prev_context,
+                               state->prev_base_context))
+            return XKB_COMPOSE_CANCELLED;
         return XKB_COMPOSE_NOTHING;
+    }
 
-    if (!node->is_leaf)
+    if (state_is_composing(state, state->context, state->base_context))
         return XKB_COMPOSE_COMPOSING;
 
     return XKB_COMPOSE_COMPOSED;
 }
 
+/*
+ * Get the result of the sequence, or NULL if it is not composed.  @table
+ * is set to the table which holds it.
+ */
+static const struct compose_leaf *
+get_result(struct xkb_compose_state *state,
+           const struct xkb_compose_table **table_out)
+{
+    const struct xkb_compose_table *table = state->table;
+    uint32_t context = state->context;
+
+    if (xkb_compose_state_get_status(state) != XKB_COMPOSE_COMPOSED)
+        return NULL;
+
+    /* The overlay wins if the sequence is in both tables. */
+    if (context == 0) {
+        table = table->base;
+        context = state->base_context;
+    }
+
+    *table_out = table;
+    return &darray_item(table->leaves,
+                        darray_item(table->nodes, context).leaf.data);
+}
+
 XKB_EXPORT int
 xkb_compose_state_get_utf8(struct xkb_compose_state *state,
                            char *buffer, size_t size)
 {
-    const struct compose_node *node =
-        &darray_item(state->table->nodes, state->context);
+    const struct xkb_compose_table *table;
+    const struct compose_leaf *leaf = get_result(state, &table);
 
-    if (!node->is_leaf)
+    if (!leaf)
         goto fail;
 
     /* If there's no string specified, but only a keysym, try to do the
      * most helpful thing. */
-    if (node->leaf.utf8 == 0 && node->leaf.keysym != XKB_KEY_NoSymbol) {
+    if (leaf->utf8 == 0 && leaf->keysym != XKB_KEY_NoSymbol) {
         char name[64];
         int ret;
 
-        ret = xkb_keysym_to_utf8(node->leaf.keysym, name, sizeof(name));
+        ret = xkb_keysym_to_utf8(leaf->keysym, name, sizeof(name));
         if (ret < 0 || ret == 0) {
             /* ret < 0 is impossible.
              * ret == 0 means the keysym has no string representation. */
@@ -182,7 +270,7 @@ xkb_compose_state_get_utf8(struct xkb_compose_state *state,
     }
 
     return snprintf(buffer, size, "%s",
-                    &darray_item(state->table->utf8, node->leaf.utf8));
+                    &darray_item(table->utf8, leaf->utf8));
 
 fail:
     if (size > 0)
@@ -193,9 +281,25 @@ fail:
 XKB_EXPORT xkb_keysym_t
 xkb_compose_state_get_one_sym(struct xkb_compose_state *state)
 {
-    const struct compose_node *node =
-        &darray_item(state->table->nodes, state->context);
-    if (!node->is_leaf)
+    const struct xkb_compose_table *table;
+    const struct compose_leaf *leaf = get_result(state, &table);
+    if (!leaf)
         return XKB_KEY_NoSymbol;
-    return node->leaf.keysym;
+    return leaf->keysym;
+}
+
+XKB_EXPORT struct xkb_compose_table_iterator *
+xkb_compose_state_iterator_new(struct xkb_compose_state *state)
+{
+    const struct xkb_compose_table *table = state->table;
+    uint32_t root = 0, base_root = 0;
+
+    /* The dummy node 0 is a leaf, so this is only while composing. */
+    if (state_is_composing(state, state->context, state->base_context)) {
+        root = next_context(table, state->context);
+        if (table->base)
+            base_root = next_context(table->base, state->base_context);
+    }
+
+    return compose_table_iterator_new_at(state->table, root, base_root);
 }
@@ -27,6 +27,7 @@
 #include "table.h"
 #include "parser.h"
 #include "paths.h"
+#include "cache.h"
 
 static struct xkb_compose_table *
 xkb_compose_table_new(struct xkb_context *ctx,
@@ -37,8 +38,10 @@ xkb_compose_table_new(struct xkb_context *ctx,
     char *resolved_locale;
     struct xkb_compose_table *table;
     struct compose_node dummy;
+    struct compose_leaf dummy_leaf;
 
-    resolved_locale = resolve_locale(locale);
+    /* A NULL locale is for tables which get their locale later. */
+    resolved_locale = (locale ? resolve_locale(ctx, locale) : strdup(""));
     if (!resolved_locale)
         return NULL;
 
@@ -56,14 +59,20 @@ xkb_compose_table_new(struct xkb_context *ctx,
     table->flags = flags;
 
     darray_init(table->nodes);
+    darray_init(table->leaves);
     darray_init(table->utf8);
 
     dummy.keysym = XKB_KEY_NoSymbol;
-    dummy.leaf.is_leaf = true;
-    dummy.leaf.utf8 = 0;
-    dummy.leaf.keysym = XKB_KEY_NoSymbol;
+    dummy.lokid = 0;
+    dummy.hikid = 0;
+    dummy.is_leaf = true;
+    dummy.leaf.data = 0;
     darray_append(table->nodes, dummy);
 
+    dummy_leaf.utf8 = 0;
+    dummy_leaf.keysym = XKB_KEY_NoSymbol;
+    darray_append(table->leaves, dummy_leaf);
+
     darray_append(table->utf8, '\0');
 
     return table;
@@ -82,12 +91,346 @@ xkb_compose_table_unref(struct xkb_compose_table *table)
     if (!table || --table->refcnt > 0)
         return;
     free(table->locale);
-    darray_free(table->nodes);
-    darray_free(table->utf8);
+    if (table->map) {
+        unmap_file(table->map, table->map_size);
+    }
+    else {
+        darray_free(table->nodes);
+        darray_free(table->leaves);
+        darray_free(table->utf8);
+    }
+    xkb_compose_table_unref(table->base);
+    free(table->roots);
     xkb_context_unref(table->ctx);
     free(table);
 }
 
+bool
+compose_table_index_roots(struct xkb_compose_table *table)
+{
+    darray(uint32_t) stack = darray_new();
+    uint32_t num_roots = 0, mask;
+    unsigned shift = 32 - 3;
+    struct compose_root_slot *roots;
+
+    if (darray_size(table->nodes) > 1)
+        darray_append(stack, 1);
+
+    /* Count the root sibling set, and size the table to twice that. */
+    while (!darray_empty(stack)) {
+        const struct compose_node *node =
+            &darray_item(table->nodes, darray_item(stack, stack.size - 1));
+        darray_resize(stack, stack.size - 1);
+        num_roots++;
+        if (node->lokid)
+            darray_append(stack, node->lokid);
+        if (node->hikid)
+            darray_append(stack, node->hikid);
+    }
+
+    while ((UINT32_MAX >> shift) + 1 < 2 * num_roots)
+        shift--;
+    mask = UINT32_MAX >> shift;
+
+    roots = calloc(mask + 1, sizeof(*roots));
+    if (!roots) {
+        darray_free(stack);
+        return false;
+    }
+
+    free(table->roots);
+    table->roots = roots;
+    table->roots_shift = shift;
+
+    if (darray_size(table->nodes) > 1)
+        darray_append(stack, 1);
+
+    while (!darray_empty(stack)) {
+        const uint32_t offset = darray_item(stack, stack.size - 1);
+        const struct compose_node *node = &darray_item(table->nodes, offset);
+        uint32_t i = compose_root_hash(table, node->keysym);
+
+        darray_resize(stack, stack.size - 1);
+        while (roots[i].node != 0)
+            i = (i + 1) & mask;
+        roots[i].keysym = node->keysym;
+        roots[i].node = offset;
+
+        if (node->lokid)
+            darray_append(stack, node->lokid);
+        if (node->hikid)
+            darray_append(stack, node->hikid);
+    }
+
+    darray_free(stack);
+    return true;
+}
+
+struct xkb_compose_table_entry {
+    const xkb_keysym_t *sequence;
+    size_t sequence_length;
+    xkb_keysym_t keysym;
+    const char *utf8;
+};
+
+/* What is left to do for a node during iteration, in order. */
+enum iterator_step {
+    ITER_LOKID,
+    ITER_SELF,
+    ITER_HIKID,
+};
+
+struct iterator_frame {
+    uint32_t node;
+    /* Position of the node's keysym in the sequence. */
+    unsigned depth;
+    enum iterator_step step;
+};
+
+/* An in-order walk over a subtree of a single table. */
+struct tree_walk {
+    const struct xkb_compose_table *table;
+    struct xkb_compose_table_entry entry;
+    darray(xkb_keysym_t) sequence;
+    darray(struct iterator_frame) stack;
+};
+
+struct xkb_compose_table_iterator {
+    struct xkb_compose_table *table;
+    /* The walks over the table, and over its base if it is an overlay. */
+    struct tree_walk walks[2];
+    /* The next entry of each walk, or NULL once it is done. */
+    struct xkb_compose_table_entry *heads[2];
+    /* Whether the head was consumed, and the walk must move on. */
+    bool advance[2];
+};
+
+XKB_EXPORT const xkb_keysym_t *
+xkb_compose_table_entry_sequence(struct xkb_compose_table_entry *entry,
+                                 size_t *sequence_length)
+{
+    *sequence_length = entry->sequence_length;
+    return entry->sequence;
+}
+
+XKB_EXPORT xkb_keysym_t
+xkb_compose_table_entry_keysym(struct xkb_compose_table_entry *entry)
+{
+    return entry->keysym;
+}
+
+XKB_EXPORT const char *
+xkb_compose_table_entry_utf8(struct xkb_compose_table_entry *entry)
+{
+    return entry->utf8;
+}
+
+static void
+tree_walk_init(struct tree_walk *walk, const struct xkb_compose_table *table,
+               uint32_t node)
+{
+    walk->table = table;
+    darray_init(walk->sequence);
+    darray_init(walk->stack);
+
+    if (node != 0) {
+        struct iterator_frame frame = {
+            .node = node,
+            .depth = 0,
+            .step = ITER_LOKID,
+        };
+        darray_append(walk->stack, frame);
+    }
+}
+
+static void
+tree_walk_free(struct tree_walk *walk)
+{
+    darray_free(walk->sequence);
+    darray_free(walk->stack);
+}
+
+/*
+ * This is an in-order traversal of the tree, with an explicit stack.  The
+ * sibling sets are binary search trees ordered by keysym, so the sequences
+ * come out sorted.
+ */
+static struct xkb_compose_table_entry *
+tree_walk_next(struct tree_walk *walk)
+{
+    while (!darray_empty(walk->stack)) {
+        struct iterator_frame *frame =
+            &darray_item(walk->stack, darray_size(walk->stack) - 1);
+        const struct compose_node *node =
+            &darray_item(walk->table->nodes, frame->node);
+        const unsigned depth = frame->depth;
+        struct iterator_frame kid = {
+            .node = 0,
+            .depth = depth,
+            .step = ITER_LOKID,
+        };
+
+        /* Note: appending to the stack invalidates frame. */
+        switch (frame->step) {
+        case ITER_LOKID:
+            frame->step = ITER_SELF;
+            if (node->lokid != 0) {
+                kid.node = node->lokid;
+                darray_append(walk->stack, kid);
+            }
+            break;
+
+        case ITER_SELF:
+            frame->step = ITER_HIKID;
+            darray_resize(walk->sequence, depth + 1);
+            darray_item(walk->sequence, depth) = node->keysym;
+            if (node->is_leaf) {
+                const struct compose_leaf *leaf =
+                    &darray_item(walk->table->leaves, node->leaf.data);
+                walk->entry.sequence = walk->sequence.item;
+                walk->entry.sequence_length = depth + 1;
+                walk->entry.keysym = leaf->keysym;
+                walk->entry.utf8 = &darray_item(walk->table->utf8, leaf->utf8);
+                return &walk->entry;
+            }
+            if (node->internal.eqkid != 0) {
+                kid.node = node->internal.eqkid;
+                kid.depth = depth + 1;
+                darray_append(walk->stack, kid);
+            }
+            break;
+
+        case ITER_HIKID:
+            /* The hikid takes the place of its parent. */
+            if (node->hikid != 0) {
+                frame->node = node->hikid;
+                frame->step = ITER_LOKID;
+            }
+            else {
+                darray_resize(walk->stack, darray_size(walk->stack) - 1);
+            }
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+struct xkb_compose_table_iterator *
+compose_table_iterator_new_at(struct xkb_compose_table *table, uint32_t node,
+                              uint32_t base_node)
+{
+    struct xkb_compose_table_iterator *iter;
+
+    iter = calloc(1, sizeof(*iter));
+    if (!iter)
+        return NULL;
+
+    iter->table = xkb_compose_table_ref(table);
+    tree_walk_init(&iter->walks[0], table, node);
+    tree_walk_init(&iter->walks[1], table->base ? table->base : table,
+                   table->base ? base_node : 0);
+    iter->advance[0] = iter->advance[1] = true;
+
+    return iter;
+}
+
+XKB_EXPORT struct xkb_compose_table_iterator *
+xkb_compose_table_iterator_new(struct xkb_compose_table *table)
+{
+    const struct xkb_compose_table *base = table->base;
+    uint32_t root = (darray_size(table->nodes) > 1 ? 1 : 0);
+    uint32_t base_root = (base && darray_size(base->nodes) > 1 ? 1 : 0);
+    return compose_table_iterator_new_at(table, root, base_root);
+}
+
+XKB_EXPORT void
+xkb_compose_table_iterator_free(struct xkb_compose_table_iterator *iter)
+{
+    if (!iter)
+        return;
+    xkb_compose_table_unref(iter->table);
+    tree_walk_free(&iter->walks[0]);
+    tree_walk_free(&iter->walks[1]);
+    free(iter);
+}
+
+/* Compare the sequences of two entries lexicographically. */
+static int
+cmp_entry_sequences(const struct xkb_compose_table_entry *a,
+                    const struct xkb_compose_table_entry *b)
+{
+    size_t len = MIN(a->sequence_length, b->sequence_length);
+
+    for (size_t i = 0; i < len; i++)
+        if (a->sequence[i] != b->sequence[i])
+            return (a->sequence[i] < b->sequence[i] ? -1 : 1);
+
+    if (a->sequence_length == b->sequence_length)
+        return 0;
+    return (a->sequence_length < b->sequence_length ? -1 : 1);
+}
+
+static bool
+is_sequence_prefix(const struct xkb_compose_table_entry *prefix,
+                   const struct xkb_compose_table_entry *entry)
+{
+    return prefix->sequence_length < entry->sequence_length &&
+           memcmp(prefix->sequence, entry->sequence,
+                  prefix->sequence_length * sizeof(*prefix->sequence)) == 0;
+}
+
+/*
+ * For an overlay table, the two sorted walks are merged, with the same
+ * rules as xkb_compose_state_feed(): the overlay wins over an identical
+ * sequence in the base, and a sequence which is a prefix of a sequence in
+ * the other table is dropped.  The extensions of a prefix are sorted right
+ * after it, so it is enough to check the head of the other walk.
+ */
+XKB_EXPORT struct xkb_compose_table_entry *
+xkb_compose_table_iterator_next(struct xkb_compose_table_iterator *iter)
+{
+    for (;;) {
+        struct xkb_compose_table_entry *overlay, *base;
+        int cmp;
+
+        for (int i = 0; i < 2; i++) {
+            if (iter->advance[i]) {
+                iter->heads[i] = tree_walk_next(&iter->walks[i]);
+                iter->advance[i] = false;
+            }
+        }
+
+        overlay = iter->heads[0];
+        base = iter->heads[1];
+
+        if (!base) {
+            iter->advance[0] = true;
+            return overlay;
+        }
+        if (!overlay) {
+            iter->advance[1] = true;
+            return base;
+        }
+
+        cmp = cmp_entry_sequences(overlay, base);
+        if (cmp == 0) {
+            iter->advance[0] = iter->advance[1] = true;
+            return overlay;
+        }
+        else if (cmp < 0) {
+            iter->advance[0] = true;
+            if (!is_sequence_prefix(overlay, base))
+                return overlay;
+        }
+        else {
+            iter->advance[1] = true;
+            if (!is_sequence_prefix(base, overlay))
+                return base;
+        }
+    }
+}
+
 XKB_EXPORT struct xkb_compose_table *
 xkb_compose_table_new_from_file(struct xkb_context *ctx,
                                 FILE *file,
@@ -98,7 +441,7 @@ xkb_compose_table_new_from_file(struct xkb_context *ctx,
     struct xkb_compose_table *table;
     bool ok;
 
-    if (flags & ~(XKB_COMPOSE_COMPILE_NO_FLAGS)) {
+    if (flags & ~(XKB_COMPOSE_COMPILE_USE_CACHE)) {
         log_err_func(ctx, "unrecognized flags: %#x\n", flags);
         return NULL;
     }
@@ -112,7 +455,7 @@ xkb_compose_table_new_from_file(struct xkb_context *ctx,
     if (!table)
         return NULL;
 
-    ok = parse_file(table, file, "(unknown file)");
+    ok = parse_file(table, file, "(unknown file)", NULL);
     if (!ok) {
         xkb_compose_table_unref(table);
         return NULL;
@@ -131,7 +474,7 @@ xkb_compose_table_new_from_buffer(struct xkb_context *ctx,
     struct xkb_compose_table *table;
     bool ok;
 
-    if (flags & ~(XKB_COMPOSE_COMPILE_NO_FLAGS)) {
+    if (flags & ~(XKB_COMPOSE_COMPILE_USE_CACHE)) {
         log_err_func(ctx, "unrecognized flags: %#x\n", flags);
         return NULL;
     }
@@ -145,7 +488,69 @@ xkb_compose_table_new_from_buffer(struct xkb_context *ctx,
     if (!table)
         return NULL;
 
-    ok = parse_string(table, buffer, length, "(input string)");
+    ok = parse_string(table, buffer, length, "(input string)", NULL);
+    if (!ok) {
+        xkb_compose_table_unref(table);
+        return NULL;
+    }
+
+    return table;
+}
+
+static struct xkb_compose_table *
+xkb_compose_table_new_overlay(struct xkb_compose_table *base,
+                              enum xkb_compose_format format,
+                              enum xkb_compose_compile_flags flags)
+{
+    struct xkb_compose_table *table;
+    char *locale;
+
+    if (base->base) {
+        log_err_func1(base->ctx, "the base table must not be an overlay\n");
+        return NULL;
+    }
+
+    locale = strdup(base->locale);
+    if (!locale)
+        return NULL;
+
+    table = xkb_compose_table_new(base->ctx, NULL, format, flags);
+    if (!table) {
+        free(locale);
+        return NULL;
+    }
+
+    free(table->locale);
+    table->locale = locale;
+    table->base = xkb_compose_table_ref(base);
+    return table;
+}
+
+XKB_EXPORT struct xkb_compose_table *
+xkb_compose_table_new_overlay_from_file(struct xkb_compose_table *base,
+                                        FILE *file,
+                                        enum xkb_compose_format format,
+                                        enum xkb_compose_compile_flags flags)
+{
+    struct xkb_context *ctx = base->ctx;
+    struct xkb_compose_table *table;
+    bool ok;
+
+    if (flags & ~(XKB_COMPOSE_COMPILE_USE_CACHE)) {
+        log_err_func(ctx, "unrecognized flags: %#x\n", flags);
+        return NULL;
+    }
+
+    if (format != XKB_COMPOSE_FORMAT_TEXT_V1) {
+        log_err_func(ctx, "unsupported compose format: %d\n", format);
+        return NULL;
+    }
+
+    table = xkb_compose_table_new_overlay(base, format, flags);
+    if (!table)
+        return NULL;
+
+    ok = parse_file(table, file, "(unknown file)", NULL);
     if (!ok) {
         xkb_compose_table_unref(table);
         return NULL;
@@ -154,6 +559,82 @@ xkb_compose_table_new_from_buffer(struct xkb_context *ctx,
     return table;
 }
 
+XKB_EXPORT struct xkb_compose_table *
+xkb_compose_table_new_overlay_from_buffer(struct xkb_compose_table *base,
+                                          const char *buffer, size_t length,
+                                          enum xkb_compose_format format,
+                                          enum xkb_compose_compile_flags flags)
+{
+    struct xkb_context *ctx = base->ctx;
+    struct xkb_compose_table *table;
+    bool ok;
+
+    if (flags & ~(XKB_COMPOSE_COMPILE_USE_CACHE)) {
+        log_err_func(ctx, "unrecognized flags: %#x\n", flags);
+        return NULL;
+    }
+
+    if (format != XKB_COMPOSE_FORMAT_TEXT_V1) {
+        log_err_func(ctx, "unsupported compose format: %d\n", format);
+        return NULL;
+    }
+
+    table = xkb_compose_table_new_overlay(base, format, flags);
+    if (!table)
+        return NULL;
+
+    ok = parse_string(table, buffer, length, "(input string)", NULL);
+    if (!ok) {
+        xkb_compose_table_unref(table);
+        return NULL;
+    }
+
+    return table;
+}
+
+XKB_EXPORT int
+xkb_compose_table_serialize(struct xkb_compose_table *table, int fd)
+{
+    if (table->base) {
+        log_err_func1(table->ctx, "cannot serialize an overlay table\n");
+        return 0;
+    }
+
+    if (!compose_table_write(table, fd, NULL, NULL)) {
+        log_err_func(table->ctx, "failed to write compose table: %s\n",
+                     strerror(errno));
+        return 0;
+    }
+
+    return 1;
+}
+
+XKB_EXPORT struct xkb_compose_table *
+xkb_compose_table_new_from_fd(struct xkb_context *ctx,
+                              int fd,
+                              enum xkb_compose_compile_flags flags)
+{
+    struct xkb_compose_table *table;
+
+    if (flags & ~(XKB_COMPOSE_COMPILE_USE_CACHE)) {
+        log_err_func(ctx, "unrecognized flags: %#x\n", flags);
+        return NULL;
+    }
+
+    table = xkb_compose_table_new(ctx, NULL, XKB_COMPOSE_FORMAT_TEXT_V1,
+                                  flags);
+    if (!table)
+        return NULL;
+
+    if (!compose_table_load_fd(table, fd)) {
+        log_err_func1(ctx, "invalid serialized compose table\n");
+        xkb_compose_table_unref(table);
+        return NULL;
+    }
+
+    return table;
+}
+
 XKB_EXPORT struct xkb_compose_table *
 xkb_compose_table_new_from_locale(struct xkb_context *ctx,
                                   const char *locale,
@@ -164,7 +645,7 @@ xkb_compose_table_new_from_locale(struct xkb_context *ctx,
     FILE *file;
     bool ok;
 
-    if (flags & ~(XKB_COMPOSE_COMPILE_NO_FLAGS)) {
+    if (flags & ~(XKB_COMPOSE_COMPILE_USE_CACHE)) {
         log_err_func(ctx, "unrecognized flags: %#x\n", flags);
         return NULL;
     }
@@ -198,7 +679,7 @@ xkb_compose_table_new_from_locale(struct xkb_context *ctx,
     }
     free(path);
 
-    path = get_locale_compose_file_path(table->locale);
+    path = get_locale_compose_file_path(ctx, table->locale);
     if (path) {
         file = fopen(path, "rb");
         if (file)
@@ -211,7 +692,25 @@ xkb_compose_table_new_from_locale(struct xkb_context *ctx,
     return NULL;
 
 found_path:
-    ok = parse_file(table, file, path);
+    if (flags & XKB_COMPOSE_COMPILE_USE_CACHE) {
+        darray_compose_dep deps = darray_new();
+
+        if (compose_cache_load(table, path)) {
+            fclose(file);
+            log_dbg(ctx, "created compose table from locale %s with path %s (cached)\n",
+                    table->locale, path);
+            free(path);
+            return table;
+        }
+
+        ok = parse_file(table, file, path, &deps);
+        if (ok)
+            compose_cache_store(table, path, &deps);
+        compose_deps_free(&deps);
+    }
+    else {
+        ok = parse_file(table, file, path, NULL);
+    }
     fclose(file);
     if (!ok) {
         free(path);
@@ -69,43 +69,58 @@
  * prefix of another, these are exactly the nodes which terminate the
  * sequences (in a bijective manner).
  *
- * A leaf contains the result data of its sequence.  The result keysym is
- * contained in the node struct itself; the result UTF-8 string is a byte
- * offset into an array of the form "\0first\0second\0third" (the initial
- * \0 is so offset 0 points to an empty string).
+ * A leaf contains the result data of its sequence.  To keep the nodes
+ * small, this is not stored in the node itself; instead, the leaf refers
+ * to an entry in the leaves array, which holds the result keysym and the
+ * result UTF-8 string.  The string is a byte offset into an array of the
+ * form "\0first\0second\0third" (the initial \0 is so offset 0 points to
+ * an empty string).  Entry 0 of the leaves array is the (empty) result of
+ * the dummy node.
  */
 
-/* Fits in uint16_t, also a good idea to have some limit. */
-#define MAX_COMPOSE_NODES 65535
+/* Fits in the 31 bits of compose_node::hikid. */
+#define MAX_COMPOSE_NODES 0x7fffffff
 
 struct compose_node {
     xkb_keysym_t keysym;
 
     /* Offset into xkb_compose_table::nodes or 0. */
-    uint16_t lokid;
+    uint32_t lokid;
     /* Offset into xkb_compose_table::nodes or 0. */
-    uint16_t hikid;
+    uint32_t hikid:31;
+    bool is_leaf:1;
 
     union {
         struct {
-            uint32_t _pad:31;
-            bool is_leaf:1;
-        };
-        struct {
-            uint32_t _pad:31;
-            bool is_leaf:1;
             /* Offset into xkb_compose_table::nodes or 0. */
-            uint16_t eqkid;
+            uint32_t eqkid;
         } internal;
         struct {
-            /* Offset into xkb_compose_table::utf8. */
-            uint32_t utf8:31;
-            bool is_leaf:1;
-            xkb_keysym_t keysym;
+            /* Offset into xkb_compose_table::leaves. */
+            uint32_t data;
         } leaf;
     };
 };
 
+struct compose_leaf {
+    /* Offset into xkb_compose_table::utf8. */
+    uint32_t utf8;
+    xkb_keysym_t keysym;
+};
+
+/*
+ * Most keysyms do not start any sequence, yet every keysym which is fed
+ * outside of a sequence would need a search of the root sibling set.  So
+ * the root keysyms are also kept in an open addressing hash table, which
+ * maps them directly to their nodes.  Empty slots have node 0.  The table
+ * is at most half full, so a keysym which does not start a sequence
+ * usually hits an empty slot right away.
+ */
+struct compose_root_slot {
+    xkb_keysym_t keysym;
+    uint32_t node;
+};
+
 struct xkb_compose_table {
     int refcnt;
     enum xkb_compose_format format;
@@ -116,6 +131,67 @@ struct xkb_compose_table {
 
     darray_char utf8;
     darray(struct compose_node) nodes;
+    darray(struct compose_leaf) leaves;
+
+    /*
+     * If not NULL, the table was loaded from its binary format, and the
+     * arrays above point into this mapping instead of being allocated.
+     */
+    char *map;
+    size_t map_size;
+
+    /*
+     * If not NULL, the table is an overlay over this table.  A sequence
+     * is looked up in both; see xkb_compose_state_feed().  The base is
+     * never itself an overlay.
+     */
+    struct xkb_compose_table *base;
+
+    /* See struct compose_root_slot; has (1 << (32 - roots_shift)) slots. */
+    struct compose_root_slot *roots;
+    unsigned roots_shift;
 };
 
+static inline uint32_t
+compose_root_hash(const struct xkb_compose_table *table, xkb_keysym_t keysym)
+{
+    /* Fibonacci hashing; the top bits are the best mixed. */
+    return (uint32_t) (keysym * UINT32_C(2654435761)) >> table->roots_shift;
+}
+
+/* Find the root node for @keysym, or 0 if no sequence starts with it. */
+static inline uint32_t
+compose_table_find_root(const struct xkb_compose_table *table,
+                        xkb_keysym_t keysym)
+{
+    const uint32_t mask = UINT32_MAX >> table->roots_shift;
+    uint32_t i = compose_root_hash(table, keysym);
+
+    while (table->roots[i].node != 0) {
+        if (table->roots[i].keysym == keysym)
+            return table->roots[i].node;
+        i = (i + 1) & mask;
+    }
+
+    return 0;
+}
+
+/*
+ * Build the root index of a table, once its nodes are complete.
+ * Returns false on allocation failure.
+ */
+bool
+compose_table_index_roots(struct xkb_compose_table *table);
+
+/*
+ * Create an iterator over the sequences of the subtree rooted at @node,
+ * i.e. the sibling set at @node and everything below it.  If @node is 0,
+ * the iterator is empty.  For an overlay table, @base_node is the
+ * corresponding subtree of the base table, and the sequences of both are
+ * merged.
+ */
+struct xkb_compose_table_iterator *
+compose_table_iterator_new_at(struct xkb_compose_table *table, uint32_t node,
+                              uint32_t base_node);
+
 #endif
@@ -42,6 +42,8 @@
 #include "xkbcommon/xkbcommon.h"
 #include "utils.h"
 #include "context.h"
+#include "compose/paths.h"
+#include "xkbcomp/map-index.h"
 
 /**
  * Append one directory to the context's include path.
@@ -211,6 +213,8 @@ xkb_context_unref(struct xkb_context *ctx)
         return;
 
     free(ctx->x11_atom_cache);
+    locale_files_free(ctx->compose_locale_files);
+    map_indexes_free(ctx->xkb_map_indexes);
     xkb_context_include_path_clear(ctx);
     atom_table_free(ctx->atom_table);
     free(ctx);
@@ -325,6 +329,8 @@ xkb_context_new(enum xkb_context_flags flags)
     }
 
     ctx->x11_atom_cache = NULL;
+    ctx->compose_locale_files = NULL;
+    ctx->xkb_map_indexes = NULL;
 
     return ctx;
 }
@@ -48,6 +48,15 @@ struct xkb_context {
     /* Used and allocated by xkbcommon-x11, free()d with the context. */
     void *x11_atom_cache;
 
+    /* Parsed X locale files, used and allocated by the compose code. */
+    void *compose_locale_files;
+
+    /* Indexes of the maps in XKB files, used and allocated by xkbcomp. */
+    void *xkb_map_indexes;
+
+    /* Includes parsed ahead by xkbcomp while it compiles a keymap. */
+    void *xkb_include_prefetch;
+
     /* Buffer for the *Text() functions. */
     char text_buffer[2048];
     size_t text_next;
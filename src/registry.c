@@ -29,11 +29,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
 #include <libxml/parser.h>
+#include <libxml/xmlreader.h>
 
 #include "xkbcommon/xkbregistry.h"
 #include "utils.h"
 #include "util-list.h"
+#include "arena.h"
 
 struct rxkb_object;
 
@@ -49,16 +53,43 @@ struct rxkb_object {
     uint32_t refcount;
     struct list link;
     destroy_func_t destroy;
+    struct rxkb_storage *storage; /* NULL if allocated on its own */
 };
 
 struct rxkb_iso639_code {
     struct rxkb_object base;
-    char *code;
+    const char *code;
 };
 
 struct rxkb_iso3166_code {
     struct rxkb_object base;
-    char *code;
+    const char *code;
+};
+
+/*
+ * An open addressing hash table of items, with linear probing. The table
+ * is at most half full, so a probe always ends at an empty slot.
+ */
+struct index_slot {
+    uint64_t hash;
+    void *item; /* NULL if empty */
+};
+
+struct index {
+    struct index_slot *slots;
+    size_t mask;
+};
+
+/*
+ * The items of a context are allocated from an arena, and all their
+ * strings are interned in it. The arena lives for as long as the context
+ * or any of its items, and is then released at once.
+ */
+struct rxkb_storage {
+    uint32_t refcount;  /* one for the context and each live item */
+    struct arena arena;
+    struct index strings;
+    size_t num_strings;
 };
 
 enum context_state {
@@ -71,7 +102,11 @@ struct rxkb_context {
     struct rxkb_object base;
     enum context_state context_state;
 
+    struct rxkb_storage *storage;
+
     bool load_extra_rules_files;
+    bool use_cache;
+    bool validate;
 
     struct list models;         /* list of struct rxkb_models */
     struct list layouts;        /* list of struct rxkb_layouts */
@@ -79,6 +114,15 @@ struct rxkb_context {
 
     darray(char *) includes;
 
+    /* The lookup indices, built on the first lookup. */
+    bool indexed;
+    struct index layout_index;   /* (name, variant) -> struct rxkb_layout */
+    struct index option_index;   /* name -> struct rxkb_option */
+    struct index iso639_index;   /* code -> struct iso_layouts */
+    struct index iso3166_index;  /* code -> struct iso_layouts */
+
+    /* The full-text search index, built on the first search. */
+    struct search_index *search_index;
 
     ATTR_PRINTF(3, 0) void (*log_fn)(struct rxkb_context *ctx,
                                      enum rxkb_log_level level,
@@ -91,21 +135,24 @@ struct rxkb_context {
 struct rxkb_model {
     struct rxkb_object base;
 
-    char *name;
-    char *vendor;
-    char *description;
+    const char *name;
+    const char *vendor;
+    const char *description;
     enum rxkb_popularity popularity;
 };
 
 struct rxkb_layout {
     struct rxkb_object base;
 
-    char *name;
-    char *brief;
-    char *description;
-    char *variant;
+    const char *name;
+    const char *brief;
+    const char *description;
+    const char *variant;
     enum rxkb_popularity popularity;
 
+    /* The position in the context's layout list, set by the lookup index. */
+    size_t position;
+
     struct list iso639s;  /* list of struct rxkb_iso639_code */
     struct list iso3166s; /* list of struct rxkb_iso3166_code */
 };
@@ -115,17 +162,17 @@ struct rxkb_option_group {
 
     bool allow_multiple;
     struct list options; /* list of struct rxkb_options */
-    char *name;
-    char *description;
+    const char *name;
+    const char *description;
     enum rxkb_popularity popularity;
 };
 
 struct rxkb_option {
     struct rxkb_object base;
 
-    char *name;
-    char *brief;
-    char *description;
+    const char *name;
+    const char *brief;
+    const char *description;
     enum rxkb_popularity popularity;
 };
 
@@ -133,6 +180,199 @@ static bool
 parse(struct rxkb_context *ctx, const char *path,
       enum rxkb_popularity popularity);
 
+static bool
+index_init(struct index *index, size_t count)
+{
+    size_t size = 8;
+
+    while (size < count * 2)
+        size <<= 1;
+
+    index->slots = calloc(size, sizeof(*index->slots));
+    index->mask = size - 1;
+    return index->slots != NULL;
+}
+
+/*
+ * Return the slot of the item with this hash which matches the key, or
+ * the empty slot where such an item goes.
+ */
+static struct index_slot *
+index_find(const struct index *index, uint64_t hash,
+           bool (*match)(const void *item, const void *key), const void *key)
+{
+    size_t i = hash & index->mask;
+
+    while (index->slots[i].item &&
+           (index->slots[i].hash != hash || !match(index->slots[i].item, key)))
+        i = (i + 1) & index->mask;
+
+    return &index->slots[i];
+}
+
+struct string_key {
+    const char *str;
+    size_t len;
+};
+
+/* The same as hash_string(HASH_STRING_INIT, ...) for a string of this length. */
+static uint64_t
+hash_string_key(const struct string_key *key)
+{
+    uint64_t hash = HASH_STRING_INIT;
+
+    for (size_t i = 0; i <= key->len; i++) {
+        hash ^= (i < key->len ? (uint8_t) key->str[i] : 0);
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+static bool
+match_string(const void *item, const void *key)
+{
+    const char *str = item;
+    const struct string_key *k = key;
+
+    return strncmp(str, k->str, k->len) == 0 && str[k->len] == '\0';
+}
+
+static struct rxkb_storage *
+rxkb_storage_new(void)
+{
+    struct rxkb_storage *storage = calloc(1, sizeof(*storage));
+
+    if (!storage)
+        return NULL;
+
+    if (!index_init(&storage->strings, 0)) {
+        free(storage);
+        return NULL;
+    }
+
+    storage->refcount = 1;
+    arena_init(&storage->arena);
+    return storage;
+}
+
+static void
+rxkb_storage_unref(struct rxkb_storage *storage)
+{
+    assert(storage->refcount >= 1);
+    if (--storage->refcount > 0)
+        return;
+
+    free(storage->strings.slots);
+    arena_release(&storage->arena);
+    free(storage);
+}
+
+static bool
+rxkb_storage_grow_strings(struct rxkb_storage *storage)
+{
+    struct index old = storage->strings;
+
+    if (!index_init(&storage->strings, storage->num_strings + 1)) {
+        storage->strings = old;
+        return false;
+    }
+
+    for (size_t i = 0; i <= old.mask; i++) {
+        const char *str = old.slots[i].item;
+
+        if (str) {
+            struct string_key key = { str, strlen(str) };
+            *index_find(&storage->strings, old.slots[i].hash,
+                        match_string, &key) = old.slots[i];
+        }
+    }
+
+    free(old.slots);
+    return true;
+}
+
+/*
+ * Return the copy of the first len bytes of str in the storage, adding it
+ * if needed, so every string is stored only once.
+ */
+static const char *
+rxkb_storage_intern(struct rxkb_storage *storage, const char *str, size_t len)
+{
+    struct string_key key = { str, len };
+    uint64_t hash = hash_string_key(&key);
+    struct index_slot *slot;
+    char *copy;
+
+    assert(storage->strings.slots);
+    slot = index_find(&storage->strings, hash, match_string, &key);
+    if (slot->item)
+        return slot->item;
+
+    if ((storage->num_strings + 1) * 2 > storage->strings.mask + 1) {
+        if (!rxkb_storage_grow_strings(storage))
+            return NULL;
+        slot = index_find(&storage->strings, hash, match_string, &key);
+    }
+
+    copy = arena_strndup(&storage->arena, str, len);
+    if (!copy)
+        return NULL;
+
+    slot->hash = hash;
+    slot->item = copy;
+    storage->num_strings++;
+    return copy;
+}
+
+/*
+ * Drop the table of the interned strings, once all items are added. The
+ * strings themselves stay.
+ */
+static void
+rxkb_storage_seal(struct rxkb_storage *storage)
+{
+    free(storage->strings.slots);
+    storage->strings.slots = NULL;
+}
+
+/* Intern a string which may be NULL. */
+static const char *
+rxkb_context_intern(struct rxkb_context *ctx, const char *str)
+{
+    if (!str)
+        return NULL;
+    return rxkb_storage_intern(ctx->storage, str, strlen(str));
+}
+
+static struct rxkb_storage *
+rxkb_object_get_storage(struct rxkb_object *object)
+{
+    struct rxkb_context *ctx;
+
+    while (object->parent)
+        object = object->parent;
+
+    ctx = container_of(object, struct rxkb_context, base);
+    return ctx->storage;
+}
+
+/* Items go into the storage of their context, the context on its own. */
+static void *
+rxkb_object_alloc(struct rxkb_object *parent, size_t size)
+{
+    struct rxkb_storage *storage;
+    void *object;
+
+    if (!parent)
+        return calloc(1, size);
+
+    storage = rxkb_object_get_storage(parent);
+    object = arena_alloc(&storage->arena, size);
+    if (object)
+        storage->refcount++;
+    return object;
+}
+
 ATTR_PRINTF(3, 4)
 static void
 rxkb_log(struct rxkb_context *ctx, enum rxkb_log_level level,
@@ -176,11 +416,11 @@ XKB_EXPORT struct type_ * type_##_unref(struct type_ *object) { \
     return rxkb_object_unref(&object->base); \
 }
 
-#define DECLARE_CREATE_FOR_TYPE(type_) \
+#define DECLARE_CREATE_FOR_TYPE(type_, destroy_) \
 static inline struct type_ * type_##_create(struct rxkb_object *parent) { \
-    struct type_ *t = calloc(1, sizeof *t); \
+    struct type_ *t = rxkb_object_alloc(parent, sizeof *t); \
     if (t) \
-        rxkb_object_init(&t->base, parent, (destroy_func_t)type_##_destroy); \
+        rxkb_object_init(&t->base, parent, (destroy_func_t)destroy_); \
     return t; \
 }
 
@@ -217,6 +457,7 @@ rxkb_object_init(struct rxkb_object *object, struct rxkb_object *parent, destroy
     object->refcount = 1;
     object->destroy = destroy;
     object->parent = parent;
+    object->storage = (parent ? rxkb_object_get_storage(parent) : NULL);
     list_init(&object->link);
 }
 
@@ -226,7 +467,10 @@ rxkb_object_destroy(struct rxkb_object *object)
     if (object->destroy)
         object->destroy(object);
     list_remove(&object->link);
-    free(object);
+    if (object->storage)
+        rxkb_storage_unref(object->storage);
+    else
+        free(object);
 }
 
 static void *
@@ -246,12 +490,6 @@ rxkb_object_unref(struct rxkb_object *object)
     return NULL;
 }
 
-static void
-rxkb_iso639_code_destroy(struct rxkb_iso639_code *code)
-{
-    free(code->code);
-}
-
 XKB_EXPORT struct rxkb_iso639_code *
 rxkb_layout_get_iso639_first(struct rxkb_layout *layout)
 {
@@ -280,15 +518,9 @@ rxkb_iso639_code_next(struct rxkb_iso639_code *code)
 }
 
 DECLARE_REF_UNREF_FOR_TYPE(rxkb_iso639_code);
-DECLARE_CREATE_FOR_TYPE(rxkb_iso639_code);
+DECLARE_CREATE_FOR_TYPE(rxkb_iso639_code, NULL);
 DECLARE_GETTER_FOR_TYPE(rxkb_iso639_code, code);
 
-static void
-rxkb_iso3166_code_destroy(struct rxkb_iso3166_code *code)
-{
-    free(code->code);
-}
-
 XKB_EXPORT struct rxkb_iso3166_code *
 rxkb_layout_get_iso3166_first(struct rxkb_layout *layout)
 {
@@ -317,19 +549,11 @@ rxkb_iso3166_code_next(struct rxkb_iso3166_code *code)
 }
 
 DECLARE_REF_UNREF_FOR_TYPE(rxkb_iso3166_code);
-DECLARE_CREATE_FOR_TYPE(rxkb_iso3166_code);
+DECLARE_CREATE_FOR_TYPE(rxkb_iso3166_code, NULL);
 DECLARE_GETTER_FOR_TYPE(rxkb_iso3166_code, code);
 
-static void
-rxkb_option_destroy(struct rxkb_option *o)
-{
-    free(o->name);
-    free(o->brief);
-    free(o->description);
-}
-
 DECLARE_REF_UNREF_FOR_TYPE(rxkb_option);
-DECLARE_CREATE_FOR_TYPE(rxkb_option);
+DECLARE_CREATE_FOR_TYPE(rxkb_option, NULL);
 DECLARE_GETTER_FOR_TYPE(rxkb_option, name);
 DECLARE_GETTER_FOR_TYPE(rxkb_option, brief);
 DECLARE_GETTER_FOR_TYPE(rxkb_option, description);
@@ -342,11 +566,6 @@ rxkb_layout_destroy(struct rxkb_layout *l)
     struct rxkb_iso639_code *iso639, *tmp_639;
     struct rxkb_iso3166_code *iso3166, *tmp_3166;
 
-    free(l->name);
-    free(l->brief);
-    free(l->description);
-    free(l->variant);
-
     list_for_each_safe(iso639, tmp_639, &l->iso639s, base.link) {
         rxkb_iso639_code_unref(iso639);
     }
@@ -356,7 +575,7 @@ rxkb_layout_destroy(struct rxkb_layout *l)
 }
 
 DECLARE_REF_UNREF_FOR_TYPE(rxkb_layout);
-DECLARE_CREATE_FOR_TYPE(rxkb_layout);
+DECLARE_CREATE_FOR_TYPE(rxkb_layout, rxkb_layout_destroy);
 DECLARE_GETTER_FOR_TYPE(rxkb_layout, name);
 DECLARE_GETTER_FOR_TYPE(rxkb_layout, brief);
 DECLARE_GETTER_FOR_TYPE(rxkb_layout, description);
@@ -364,16 +583,8 @@ DECLARE_GETTER_FOR_TYPE(rxkb_layout, variant);
 DECLARE_TYPED_GETTER_FOR_TYPE(rxkb_layout, popularity, enum rxkb_popularity);
 DECLARE_FIRST_NEXT_FOR_TYPE(rxkb_layout, rxkb_context, layouts);
 
-static void
-rxkb_model_destroy(struct rxkb_model *m)
-{
-    free(m->name);
-    free(m->vendor);
-    free(m->description);
-}
-
 DECLARE_REF_UNREF_FOR_TYPE(rxkb_model);
-DECLARE_CREATE_FOR_TYPE(rxkb_model);
+DECLARE_CREATE_FOR_TYPE(rxkb_model, NULL);
 DECLARE_GETTER_FOR_TYPE(rxkb_model, name);
 DECLARE_GETTER_FOR_TYPE(rxkb_model, vendor);
 DECLARE_GETTER_FOR_TYPE(rxkb_model, description);
@@ -385,9 +596,6 @@ rxkb_option_group_destroy(struct rxkb_option_group *og)
 {
     struct rxkb_option *o, *otmp;
 
-    free(og->name);
-    free(og->description);
-
     list_for_each_safe(o, otmp, &og->options, base.link) {
         rxkb_option_unref(o);
     }
@@ -400,41 +608,42 @@ rxkb_option_group_allows_multiple(struct rxkb_option_group *g)
 }
 
 DECLARE_REF_UNREF_FOR_TYPE(rxkb_option_group);
-DECLARE_CREATE_FOR_TYPE(rxkb_option_group);
+DECLARE_CREATE_FOR_TYPE(rxkb_option_group, rxkb_option_group_destroy);
 DECLARE_GETTER_FOR_TYPE(rxkb_option_group, name);
 DECLARE_GETTER_FOR_TYPE(rxkb_option_group, description);
 DECLARE_TYPED_GETTER_FOR_TYPE(rxkb_option_group, popularity, enum rxkb_popularity);
 DECLARE_FIRST_NEXT_FOR_TYPE(rxkb_option_group, rxkb_context, option_groups);
 
+static void
+rxkb_context_free_items(struct rxkb_context *ctx);
+
+static void
+rxkb_context_free_index(struct rxkb_context *ctx);
+
+static void
+search_index_free(struct search_index *index);
+
 static void
 rxkb_context_destroy(struct rxkb_context *ctx)
 {
-    struct rxkb_model *m, *mtmp;
-    struct rxkb_layout *l, *ltmp;
-    struct rxkb_option_group *og, *ogtmp;
     char **path;
 
-    list_for_each_safe(m, mtmp, &ctx->models, base.link)
-        rxkb_model_unref(m);
-    assert(list_empty(&ctx->models));
-
-    list_for_each_safe(l, ltmp, &ctx->layouts, base.link)
-        rxkb_layout_unref(l);
-    assert(list_empty(&ctx->layouts));
-
-    list_for_each_safe(og, ogtmp, &ctx->option_groups, base.link)
-        rxkb_option_group_unref(og);
-    assert(list_empty(&ctx->option_groups));
+    rxkb_context_free_index(ctx);
+    search_index_free(ctx->search_index);
+    rxkb_context_free_items(ctx);
 
     darray_foreach(path, ctx->includes)
         free(*path);
     darray_free(ctx->includes);
 
     assert(darray_empty(ctx->includes));
+
+    if (ctx->storage)
+        rxkb_storage_unref(ctx->storage);
 }
 
 DECLARE_REF_UNREF_FOR_TYPE(rxkb_context);
-DECLARE_CREATE_FOR_TYPE(rxkb_context);
+DECLARE_CREATE_FOR_TYPE(rxkb_context, rxkb_context_destroy);
 DECLARE_TYPED_GETTER_FOR_TYPE(rxkb_context, log_level, enum rxkb_log_level);
 
 XKB_EXPORT void
@@ -508,6 +717,8 @@ rxkb_context_new(enum rxkb_context_flags flags)
 
     ctx->context_state = CONTEXT_NEW;
     ctx->load_extra_rules_files = flags & RXKB_CONTEXT_LOAD_EXOTIC_RULES;
+    ctx->use_cache = flags & RXKB_CONTEXT_USE_CACHE;
+    ctx->validate = flags & RXKB_CONTEXT_VALIDATE;
     ctx->log_fn = default_log_fn;
     ctx->log_level = RXKB_LOG_LEVEL_ERROR;
 
@@ -520,6 +731,12 @@ rxkb_context_new(enum rxkb_context_flags flags)
     list_init(&ctx->layouts);
     list_init(&ctx->option_groups);
 
+    ctx->storage = rxkb_storage_new();
+    if (!ctx->storage) {
+        rxkb_context_unref(ctx);
+        return NULL;
+    }
+
     if (!(flags & RXKB_CONTEXT_NO_DEFAULT_INCLUDES) &&
         !rxkb_context_include_path_append_default(ctx)) {
         rxkb_context_unref(ctx);
@@ -640,427 +857,1277 @@ rxkb_context_parse_default_ruleset(struct rxkb_context *ctx)
     return rxkb_context_parse(ctx, DEFAULT_XKB_RULES);
 }
 
-XKB_EXPORT bool
-rxkb_context_parse(struct rxkb_context *ctx, const char *ruleset)
-{
-    char **path;
-    bool success = false;
+/* A rules XML file which rxkb_context_parse() looks at. */
+struct rules_file {
+    char *path;
+    enum rxkb_popularity popularity;
+    /* False for a DTD, which is only looked at by the validation. */
+    bool parse;
 
-    if (ctx->context_state != CONTEXT_NEW) {
-        log_err(ctx, "parse must only be called on a new context\n");
+    /*
+     * The state of the file before it is parsed, which the cache is
+     * checked against.  The size is -1 if the file does not exist.
+     */
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t size;
+};
+
+typedef darray(struct rules_file) darray_rules_file;
+
+static bool
+add_rules_file(darray_rules_file *files, const char *path,
+               enum rxkb_popularity popularity, bool parse)
+{
+    struct rules_file file = {
+        .popularity = popularity,
+        .parse = parse,
+        .size = -1,
+    };
+    struct stat st;
+
+    file.path = strdup(path);
+    if (!file.path)
         return false;
+
+    if (stat(path, &st) == 0) {
+        file.mtime_sec = st.st_mtime;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+        file.mtime_nsec = st.st_mtim.tv_nsec;
+#endif
+        file.size = st.st_size;
     }
 
+    darray_append(*files, file);
+    return true;
+}
+
+/* All the files to parse for @ruleset, lowest priority first. */
+static bool
+get_rules_files(struct rxkb_context *ctx, const char *ruleset,
+                darray_rules_file *files)
+{
+    char **path;
+
     darray_foreach_reverse(path, ctx->includes) {
         char rules[PATH_MAX];
 
         if (snprintf_safe(rules, sizeof(rules), "%s/rules/%s.xml",
-                           *path, ruleset)) {
-            log_dbg(ctx, "Parsing %s\n", rules);
-            if (parse(ctx, rules, RXKB_POPULARITY_STANDARD))
-                success = true;
-        }
+                           *path, ruleset) &&
+            !add_rules_file(files, rules, RXKB_POPULARITY_STANDARD, true))
+            return false;
 
         if (ctx->load_extra_rules_files &&
             snprintf_safe(rules, sizeof(rules), "%s/rules/%s.extras.xml",
-                          *path, ruleset)) {
-            log_dbg(ctx, "Parsing %s\n", rules);
-            if (parse(ctx, rules, RXKB_POPULARITY_EXOTIC))
-                success = true;
-        }
+                          *path, ruleset) &&
+            !add_rules_file(files, rules, RXKB_POPULARITY_EXOTIC, true))
+            return false;
+
+        /* The files reference the DTD next to them, see parse(). */
+        if (ctx->validate &&
+            snprintf_safe(rules, sizeof(rules), "%s/rules/xkb.dtd", *path) &&
+            !add_rules_file(files, rules, RXKB_POPULARITY_STANDARD, false))
+            return false;
     }
 
-    ctx->context_state = success ? CONTEXT_PARSED : CONTEXT_FAILED;
+    return true;
+}
 
-    return success;
+static void
+free_rules_files(darray_rules_file *files)
+{
+    struct rules_file *file;
+
+    darray_foreach(file, *files)
+        free(file->path);
+    darray_free(*files);
 }
 
+/*
+ * The registry cache.
+ *
+ * With RXKB_CONTEXT_USE_CACHE, the result of rxkb_context_parse() is
+ * stored in a cache file, named after a hash of the rules files it may
+ * parse, and of the DTDs they are validated against with
+ * RXKB_CONTEXT_VALIDATE.  The cache file records the state of each of
+ * those files, and is only used while none of them has changed, appeared
+ * or disappeared.
+ *
+ * The format is private to this version of the library, in native byte
+ * order.  Integers are uint32_t unless noted otherwise; a string is a
+ * uint32_t of its length plus one (0 for NULL), followed by its bytes
+ * without the terminating NUL.
+ *
+ *   char magic[8]; uint32_t version; uint32_t num_files;
+ *   num_files times:
+ *     string path; int64_t mtime_sec, mtime_nsec, size;
+ *   uint32_t num_models; num_models times:
+ *     string name, vendor, description; popularity;
+ *   uint32_t num_layouts; num_layouts times:
+ *     string name, variant, brief, description; popularity;
+ *     uint32_t num_iso639; num_iso639 times: string code;
+ *     uint32_t num_iso3166; num_iso3166 times: string code;
+ *   uint32_t num_groups; num_groups times:
+ *     string name, description; popularity; allow_multiple;
+ *     uint32_t num_options; num_options times:
+ *       string name, brief, description; popularity;
+ */
+
+#define CACHE_MAGIC "rxkbreg"
+#define CACHE_VERSION 1
 
-XKB_EXPORT void
-rxkb_context_set_user_data(struct rxkb_context *ctx, void *userdata)
+struct cache_reader {
+    const char *pos;
+    const char *end;
+    bool ok;
+};
+
+static void
+cache_read(struct cache_reader *r, void *out, size_t size)
 {
-    ctx->userdata = userdata;
+    if (!r->ok || (size_t) (r->end - r->pos) < size) {
+        r->ok = false;
+        memset(out, 0, size);
+        return;
+    }
+    memcpy(out, r->pos, size);
+    r->pos += size;
 }
 
-XKB_EXPORT void *
-rxkb_context_get_user_data(struct rxkb_context *ctx)
+static uint32_t
+cache_read_u32(struct cache_reader *r)
 {
-    return ctx->userdata;
+    uint32_t val;
+    cache_read(r, &val, sizeof(val));
+    return val;
 }
 
-static inline bool
-is_node(xmlNode *node, const char *name)
+static int64_t
+cache_read_i64(struct cache_reader *r)
 {
-    return node->type == XML_ELEMENT_NODE &&
-        xmlStrEqual(node->name, (const xmlChar*)name);
+    int64_t val;
+    cache_read(r, &val, sizeof(val));
+    return val;
 }
 
-/* return a copy of the text content from the first text node of this node */
-static char *
-extract_text(xmlNode *node)
+/* Return the bytes of the next string, which are not NUL-terminated. */
+static const char *
+cache_read_string_bytes(struct cache_reader *r, uint32_t *len)
 {
-    xmlNode *n;
+    const char *str;
+
+    *len = cache_read_u32(r);
+    if (!r->ok || *len == 0)
+        return NULL;
 
-    for (n = node->children; n; n = n->next) {
-        if (n->type == XML_TEXT_NODE)
-            return (char *)xmlStrdup(n->content);
+    (*len)--;
+    if ((size_t) (r->end - r->pos) < *len) {
+        r->ok = false;
+        return NULL;
     }
-    return NULL;
-}
 
-static bool
-parse_config_item(struct rxkb_context *ctx,
-                  xmlNode *parent,
-                  char **name,
-                  char **description,
-                  char **brief,
-                  char **vendor)
-{
-    xmlNode *node = NULL;
-    xmlNode *ci = NULL;
-
-    for (ci = parent->children; ci; ci = ci->next) {
-        if (is_node(ci, "configItem")) {
-            *name = NULL;
-            *description = NULL;
-            *brief = NULL;
-            *vendor = NULL;
-
-            for (node = ci->children; node; node = node->next) {
-                if (is_node(node, "name"))
-                    *name = extract_text(node);
-                else if (is_node(node, "description"))
-                    *description = extract_text(node);
-                else if (is_node(node, "shortDescription"))
-                    *brief = extract_text(node);
-                else if (is_node(node, "vendor"))
-                    *vendor = extract_text(node);
-                /* Note: the DTD allows for vendor + brief but models only use
-                 * vendor and everything else only uses shortDescription */
-            }
+    str = r->pos;
+    r->pos += *len;
+    return str;
+}
 
-            if (!*name || !strlen(*name))  {
-                log_err(ctx, "xml:%d: missing required element 'name'\n",
-                        ci->line);
-                free(*name);
-                free(*description);
-                free(*brief);
-                free(*vendor);
-                return false;
-            }
+static const char *
+cache_read_string(struct cache_reader *r, struct rxkb_context *ctx)
+{
+    uint32_t len;
+    const char *bytes = cache_read_string_bytes(r, &len);
+    const char *str;
 
-            return true; /* only one configItem allowed in the dtd */
-        }
-    }
+    if (!bytes)
+        return NULL;
 
-    return false;
+    str = rxkb_storage_intern(ctx->storage, bytes, len);
+    if (!str)
+        r->ok = false;
+    return str;
 }
 
-static void
-parse_model(struct rxkb_context *ctx, xmlNode *model,
-            enum rxkb_popularity popularity)
+static enum rxkb_popularity
+cache_read_popularity(struct cache_reader *r)
 {
-    char *name, *description, *brief, *vendor;
-
-    if (parse_config_item(ctx, model, &name, &description, &brief, &vendor)) {
-        struct rxkb_model *m;
+    uint32_t popularity = cache_read_u32(r);
 
-        list_for_each(m, &ctx->models, base.link) {
-            if (streq(m->name, name)) {
-                free(name);
-                free(description);
-                free(brief);
-                free(vendor);
-                return;
-            }
-        }
+    if (popularity != RXKB_POPULARITY_STANDARD &&
+        popularity != RXKB_POPULARITY_EXOTIC)
+        r->ok = false;
 
-        /* new model */
-        m = rxkb_model_create(&ctx->base);
-        m->name = name;
-        m->description = description;
-        m->vendor = vendor;
-        m->popularity = popularity;
-        list_append(&ctx->models, &m->base.link);
-    }
+    return popularity;
 }
 
 static void
-parse_model_list(struct rxkb_context *ctx, xmlNode *model_list,
-                enum rxkb_popularity popularity)
+cache_write_u32(darray_char *buf, uint32_t val)
 {
-    xmlNode *node = NULL;
+    darray_append_items(*buf, (const char *) &val, sizeof(val));
+}
 
-    for (node = model_list->children; node; node = node->next) {
-        if (is_node(node, "model"))
-            parse_model(ctx, node, popularity);
-    }
+static void
+cache_write_i64(darray_char *buf, int64_t val)
+{
+    darray_append_items(*buf, (const char *) &val, sizeof(val));
 }
 
 static void
-parse_language_list(xmlNode *language_list, struct rxkb_layout *layout)
+cache_write_string(darray_char *buf, const char *str)
 {
-    xmlNode *node = NULL;
-    struct rxkb_iso639_code *code;
+    size_t len = (str ? strlen(str) : 0);
 
-    for (node = language_list->children; node; node = node->next) {
-        if (is_node(node, "iso639Id")) {
-            char *str = extract_text(node);
-            struct rxkb_object *parent;
+    cache_write_u32(buf, str ? len + 1 : 0);
+    if (str)
+        darray_append_items(*buf, str, len);
+}
 
-            parent = &layout->base;
-            code = rxkb_iso639_code_create(parent);
-            code->code = str;
-            list_append(&layout->iso639s, &code->base.link);
-        }
-    }
+static char *
+get_cache_file_path(const char *ruleset, const darray_rules_file *files)
+{
+    const struct rules_file *file;
+    uint64_t hash = HASH_STRING_INIT;
+    char *dir, *path;
+
+    dir = get_cache_dir_path();
+    if (!dir)
+        return NULL;
+
+    hash = hash_string(hash, ruleset);
+    darray_foreach(file, *files)
+        hash = hash_string(hash, file->path);
+
+    path = asprintf_safe("%s/registry-%016" PRIx64, dir, hash);
+    free(dir);
+    return path;
 }
 
+/* Free the models, layouts and option groups of a context. */
 static void
-parse_country_list(xmlNode *country_list, struct rxkb_layout *layout)
+rxkb_context_free_items(struct rxkb_context *ctx)
 {
-    xmlNode *node = NULL;
-    struct rxkb_iso3166_code *code;
+    struct rxkb_model *m, *mtmp;
+    struct rxkb_layout *l, *ltmp;
+    struct rxkb_option_group *og, *ogtmp;
 
-    for (node = country_list->children; node; node = node->next) {
-        if (is_node(node, "iso3166Id")) {
-            char *str = extract_text(node);
-            struct rxkb_object *parent;
+    list_for_each_safe(m, mtmp, &ctx->models, base.link)
+        rxkb_model_unref(m);
+    assert(list_empty(&ctx->models));
 
-            parent = &layout->base;
-            code = rxkb_iso3166_code_create(parent);
-            code->code = str;
-            list_append(&layout->iso3166s, &code->base.link);
-        }
-    }
+    list_for_each_safe(l, ltmp, &ctx->layouts, base.link)
+        rxkb_layout_unref(l);
+    assert(list_empty(&ctx->layouts));
+
+    list_for_each_safe(og, ogtmp, &ctx->option_groups, base.link)
+        rxkb_option_group_unref(og);
+    assert(list_empty(&ctx->option_groups));
 }
 
-static void
-parse_variant(struct rxkb_context *ctx, struct rxkb_layout *l,
-              xmlNode *variant, enum rxkb_popularity popularity)
+static bool
+cache_read_files(struct cache_reader *r, const darray_rules_file *files)
 {
-    xmlNode *ci;
-    char *name, *description, *brief, *vendor;
+    const struct rules_file *file;
+    char magic[8];
 
-    if (parse_config_item(ctx, variant, &name, &description, &brief, &vendor)) {
-        struct rxkb_layout *v;
-        bool exists = false;
+    cache_read(r, magic, sizeof(magic));
+    if (!r->ok || memcmp(magic, CACHE_MAGIC, sizeof(magic)) != 0 ||
+        cache_read_u32(r) != CACHE_VERSION ||
+        cache_read_u32(r) != darray_size(*files))
+        return false;
 
-        list_for_each(v, &ctx->layouts, base.link) {
-            if (streq(v->name, name) && streq(v->name, l->name)) {
-                exists = true;
-                break;
-            }
-        }
+    darray_foreach(file, *files) {
+        uint32_t len;
+        const char *path = cache_read_string_bytes(r, &len);
 
-        if (!exists) {
-            v = rxkb_layout_create(&ctx->base);
-            list_init(&v->iso639s);
-            list_init(&v->iso3166s);
-            v->name = strdup(l->name);
-            v->variant = name;
-            v->description = description;
-            v->brief = brief;
-            v->popularity = popularity;
-            list_append(&ctx->layouts, &v->base.link);
-
-            for (ci = variant->children; ci; ci = ci->next) {
-                xmlNode *node;
-
-                if (!is_node(ci, "configItem"))
-                    continue;
-
-                for (node = ci->children; node; node = node->next) {
-                    if (is_node(node, "languageList"))
-                        parse_language_list(node, v);
-                    if (is_node(node, "countryList"))
-                        parse_country_list(node, v);
-                }
-            }
-        } else {
-            free(name);
-            free(description);
-            free(brief);
-            free(vendor);
-        }
+        if (!path || len != strlen(file->path) ||
+            memcmp(path, file->path, len) != 0 ||
+            cache_read_i64(r) != file->mtime_sec ||
+            cache_read_i64(r) != file->mtime_nsec ||
+            cache_read_i64(r) != file->size)
+            return false;
     }
+
+    return r->ok;
 }
 
 static void
-parse_variant_list(struct rxkb_context *ctx, struct rxkb_layout *l,
-                   xmlNode *variant_list, enum rxkb_popularity popularity)
+cache_read_models(struct cache_reader *r, struct rxkb_context *ctx)
 {
-    xmlNode *node = NULL;
+    uint32_t num_models = cache_read_u32(r);
+
+    for (uint32_t i = 0; i < num_models && r->ok; i++) {
+        struct rxkb_model *m = rxkb_model_create(&ctx->base);
+        if (!m) {
+            r->ok = false;
+            return;
+        }
+        list_append(&ctx->models, &m->base.link);
 
-    for (node = variant_list->children; node; node = node->next) {
-        if (is_node(node, "variant"))
-            parse_variant(ctx, l, node, popularity);
+        m->name = cache_read_string(r, ctx);
+        m->vendor = cache_read_string(r, ctx);
+        m->description = cache_read_string(r, ctx);
+        m->popularity = cache_read_popularity(r);
+        if (!m->name)
+            r->ok = false;
     }
 }
 
 static void
-parse_layout(struct rxkb_context *ctx, xmlNode *layout,
-             enum rxkb_popularity popularity)
+cache_read_layouts(struct cache_reader *r, struct rxkb_context *ctx)
 {
-    char *name, *description, *brief, *vendor;
-    struct rxkb_layout *l;
-    xmlNode *node = NULL;
-    bool exists = false;
+    uint32_t num_layouts = cache_read_u32(r);
 
-    if (!parse_config_item(ctx, layout, &name, &description, &brief, &vendor))
-        return;
+    for (uint32_t i = 0; i < num_layouts && r->ok; i++) {
+        struct rxkb_layout *l = rxkb_layout_create(&ctx->base);
+        uint32_t num_codes;
 
-    list_for_each(l, &ctx->layouts, base.link) {
-        if (streq(l->name, name) && l->variant == NULL) {
-            exists = true;
-            break;
+        if (!l) {
+            r->ok = false;
+            return;
         }
-    }
-
-    if (!exists) {
-        l = rxkb_layout_create(&ctx->base);
         list_init(&l->iso639s);
         list_init(&l->iso3166s);
-        l->name = name;
-        l->variant = NULL;
-        l->description = description;
-        l->brief = brief;
-        l->popularity = popularity;
         list_append(&ctx->layouts, &l->base.link);
-    } else {
-        free(name);
-        free(description);
-        free(brief);
-        free(vendor);
-    }
 
-    for (node = layout->children; node; node = node->next) {
-        if (is_node(node, "variantList")) {
-            parse_variant_list(ctx, l, node, popularity);
+        l->name = cache_read_string(r, ctx);
+        l->variant = cache_read_string(r, ctx);
+        l->brief = cache_read_string(r, ctx);
+        l->description = cache_read_string(r, ctx);
+        l->popularity = cache_read_popularity(r);
+        if (!l->name)
+            r->ok = false;
+
+        num_codes = cache_read_u32(r);
+        for (uint32_t j = 0; j < num_codes && r->ok; j++) {
+            struct rxkb_iso639_code *code =
+                rxkb_iso639_code_create(&l->base);
+            if (!code) {
+                r->ok = false;
+                return;
+            }
+            list_append(&l->iso639s, &code->base.link);
+            code->code = cache_read_string(r, ctx);
         }
-        if (!exists && is_node(node, "configItem")) {
-            xmlNode *ll;
-            for (ll = node->children; ll; ll = ll->next) {
-                if (is_node(ll, "languageList"))
-                    parse_language_list(ll, l);
-                if (is_node(ll, "countryList"))
-                    parse_country_list(ll, l);
+
+        num_codes = cache_read_u32(r);
+        for (uint32_t j = 0; j < num_codes && r->ok; j++) {
+            struct rxkb_iso3166_code *code =
+                rxkb_iso3166_code_create(&l->base);
+            if (!code) {
+                r->ok = false;
+                return;
             }
+            list_append(&l->iso3166s, &code->base.link);
+            code->code = cache_read_string(r, ctx);
         }
     }
 }
 
 static void
-parse_layout_list(struct rxkb_context *ctx, xmlNode *layout_list,
-                  enum rxkb_popularity popularity)
+cache_read_option_groups(struct cache_reader *r, struct rxkb_context *ctx)
+{
+    uint32_t num_groups = cache_read_u32(r);
+
+    for (uint32_t i = 0; i < num_groups && r->ok; i++) {
+        struct rxkb_option_group *g = rxkb_option_group_create(&ctx->base);
+        uint32_t num_options;
+
+        if (!g) {
+            r->ok = false;
+            return;
+        }
+        list_init(&g->options);
+        list_append(&ctx->option_groups, &g->base.link);
+
+        g->name = cache_read_string(r, ctx);
+        g->description = cache_read_string(r, ctx);
+        g->popularity = cache_read_popularity(r);
+        g->allow_multiple = cache_read_u32(r);
+        if (!g->name)
+            r->ok = false;
+
+        num_options = cache_read_u32(r);
+        for (uint32_t j = 0; j < num_options && r->ok; j++) {
+            struct rxkb_option *o = rxkb_option_create(&g->base);
+            if (!o) {
+                r->ok = false;
+                return;
+            }
+            list_append(&g->options, &o->base.link);
+
+            o->name = cache_read_string(r, ctx);
+            o->brief = cache_read_string(r, ctx);
+            o->description = cache_read_string(r, ctx);
+            o->popularity = cache_read_popularity(r);
+            if (!o->name)
+                r->ok = false;
+        }
+    }
+}
+
+static bool
+cache_load(struct rxkb_context *ctx, const char *ruleset,
+           const darray_rules_file *files)
 {
-    xmlNode *node = NULL;
+    struct cache_reader r;
+    char *cache_path;
+    FILE *file;
+    char *map;
+    size_t size;
+    bool ok;
+
+    cache_path = get_cache_file_path(ruleset, files);
+    if (!cache_path)
+        return false;
+
+    file = fopen(cache_path, "rb");
+    if (!file) {
+        free(cache_path);
+        return false;
+    }
+
+    ok = map_file(file, &map, &size);
+    fclose(file);
+    if (!ok) {
+        free(cache_path);
+        return false;
+    }
 
-    for (node = layout_list->children; node; node = node->next) {
-        if (is_node(node, "layout"))
-            parse_layout(ctx, node, popularity);
+    r = (struct cache_reader) {
+        .pos = map,
+        .end = map + size,
+        .ok = true,
+    };
+
+    ok = cache_read_files(&r, files);
+    if (ok) {
+        cache_read_models(&r, ctx);
+        cache_read_layouts(&r, ctx);
+        cache_read_option_groups(&r, ctx);
+        ok = r.ok && r.pos == r.end;
+        if (!ok)
+            rxkb_context_free_items(ctx);
     }
+
+    if (ok)
+        log_dbg(ctx, "Loaded registry from cache %s\n", cache_path);
+    else
+        log_dbg(ctx, "Ignoring stale or invalid registry cache %s\n",
+                cache_path);
+
+    unmap_file(map, size);
+    free(cache_path);
+    return ok;
 }
 
 static void
-parse_option(struct rxkb_context *ctx, struct rxkb_option_group *group,
-             xmlNode *option, enum rxkb_popularity popularity)
+cache_write(struct rxkb_context *ctx, darray_char *buf,
+            const darray_rules_file *files)
 {
-    char *name, *description, *brief, *vendor;
+    const struct rules_file *file;
+    struct rxkb_model *m;
+    struct rxkb_layout *l;
+    struct rxkb_option_group *g;
 
-    if (parse_config_item(ctx, option, &name, &description, &brief, &vendor)) {
+    darray_append_items(*buf, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    cache_write_u32(buf, CACHE_VERSION);
+    cache_write_u32(buf, darray_size(*files));
+    darray_foreach(file, *files) {
+        cache_write_string(buf, file->path);
+        cache_write_i64(buf, file->mtime_sec);
+        cache_write_i64(buf, file->mtime_nsec);
+        cache_write_i64(buf, file->size);
+    }
+
+    cache_write_u32(buf, list_length(&ctx->models));
+    list_for_each(m, &ctx->models, base.link) {
+        cache_write_string(buf, m->name);
+        cache_write_string(buf, m->vendor);
+        cache_write_string(buf, m->description);
+        cache_write_u32(buf, m->popularity);
+    }
+
+    cache_write_u32(buf, list_length(&ctx->layouts));
+    list_for_each(l, &ctx->layouts, base.link) {
+        struct rxkb_iso639_code *iso639;
+        struct rxkb_iso3166_code *iso3166;
+
+        cache_write_string(buf, l->name);
+        cache_write_string(buf, l->variant);
+        cache_write_string(buf, l->brief);
+        cache_write_string(buf, l->description);
+        cache_write_u32(buf, l->popularity);
+
+        cache_write_u32(buf, list_length(&l->iso639s));
+        list_for_each(iso639, &l->iso639s, base.link)
+            cache_write_string(buf, iso639->code);
+
+        cache_write_u32(buf, list_length(&l->iso3166s));
+        list_for_each(iso3166, &l->iso3166s, base.link)
+            cache_write_string(buf, iso3166->code);
+    }
+
+    cache_write_u32(buf, list_length(&ctx->option_groups));
+    list_for_each(g, &ctx->option_groups, base.link) {
         struct rxkb_option *o;
 
-        list_for_each(o, &group->options, base.link) {
-            if (streq(o->name, name)) {
-                free(name);
-                free(description);
-                free(brief);
-                free(vendor);
-                return;
-            }
+        cache_write_string(buf, g->name);
+        cache_write_string(buf, g->description);
+        cache_write_u32(buf, g->popularity);
+        cache_write_u32(buf, g->allow_multiple);
+
+        cache_write_u32(buf, list_length(&g->options));
+        list_for_each(o, &g->options, base.link) {
+            cache_write_string(buf, o->name);
+            cache_write_string(buf, o->brief);
+            cache_write_string(buf, o->description);
+            cache_write_u32(buf, o->popularity);
         }
+    }
+}
+
+static bool
+cache_write_fn(int fd, void *data)
+{
+    darray_char *buf = data;
+    return write_all(fd, buf->item, darray_size(*buf));
+}
+
+static void
+cache_store(struct rxkb_context *ctx, const char *ruleset,
+            const darray_rules_file *files)
+{
+    darray_char buf = darray_new();
+    char *cache_path;
+
+    cache_path = get_cache_file_path(ruleset, files);
+    if (!cache_path)
+        return;
+
+    cache_write(ctx, &buf, files);
+
+    if (write_file_atomically(cache_path, cache_write_fn, &buf))
+        log_dbg(ctx, "Stored registry in cache %s\n", cache_path);
+    else
+        log_dbg(ctx, "Couldn't store registry cache %s: %s\n",
+                cache_path, strerror(errno));
+
+    darray_free(buf);
+    free(cache_path);
+}
+
+XKB_EXPORT bool
+rxkb_context_parse(struct rxkb_context *ctx, const char *ruleset)
+{
+    darray_rules_file files = darray_new();
+    struct rules_file *file;
+    bool success = false;
+
+    if (ctx->context_state != CONTEXT_NEW) {
+        log_err(ctx, "parse must only be called on a new context\n");
+        return false;
+    }
+
+    if (!get_rules_files(ctx, ruleset, &files))
+        goto out;
+
+    if (ctx->use_cache && cache_load(ctx, ruleset, &files)) {
+        success = true;
+        goto out;
+    }
+
+    darray_foreach(file, files) {
+        if (!file->parse)
+            continue;
+
+        log_dbg(ctx, "Parsing %s\n", file->path);
+        if (parse(ctx, file->path, file->popularity))
+            success = true;
+    }
+
+    if (success && ctx->use_cache)
+        cache_store(ctx, ruleset, &files);
+
+out:
+    free_rules_files(&files);
+    rxkb_storage_seal(ctx->storage);
+    ctx->context_state = success ? CONTEXT_PARSED : CONTEXT_FAILED;
+
+    return success;
+}
+
+
+XKB_EXPORT void
+rxkb_context_set_user_data(struct rxkb_context *ctx, void *userdata)
+{
+    ctx->userdata = userdata;
+}
+
+XKB_EXPORT void *
+rxkb_context_get_user_data(struct rxkb_context *ctx)
+{
+    return ctx->userdata;
+}
+
+/* The layouts with a given ISO code, in the order of the layout list. */
+struct iso_layouts {
+    const char *code;
+    darray(struct rxkb_layout *) layouts;
+};
+
+struct layout_key {
+    const char *name;
+    const char *variant;
+};
+
+static uint64_t
+hash_layout(const struct layout_key *key)
+{
+    uint64_t hash = hash_string(HASH_STRING_INIT, key->name);
+
+    /* The terminating NUL keeps a NULL and an empty variant apart. */
+    if (key->variant)
+        hash = hash_string(hash, key->variant);
+    return hash;
+}
+
+static bool
+match_layout(const void *item, const void *key)
+{
+    const struct rxkb_layout *l = item;
+    const struct layout_key *k = key;
+
+    if (!streq(l->name, k->name))
+        return false;
+    if (!l->variant || !k->variant)
+        return l->variant == k->variant;
+    return streq(l->variant, k->variant);
+}
+
+static bool
+match_option(const void *item, const void *key)
+{
+    const struct rxkb_option *o = item;
+
+    return streq(o->name, key);
+}
+
+/* ISO codes are matched case-insensitively. */
+static uint64_t
+hash_code(const char *code)
+{
+    uint64_t hash = HASH_STRING_INIT;
+
+    do {
+        hash ^= (uint8_t) to_lower(*code);
+        hash *= 0x100000001b3;
+    } while (*code++);
+    return hash;
+}
+
+static bool
+match_code(const void *item, const void *key)
+{
+    const struct iso_layouts *iso = item;
+
+    return istreq(iso->code, key);
+}
+
+static bool
+index_add_code(struct index *index, const char *code, struct rxkb_layout *l)
+{
+    uint64_t hash;
+    struct index_slot *slot;
+    struct iso_layouts *iso;
+
+    if (!code)
+        return true;
+
+    hash = hash_code(code);
+    slot = index_find(index, hash, match_code, code);
+    iso = slot->item;
+    if (!iso) {
+        iso = calloc(1, sizeof(*iso));
+        if (!iso)
+            return false;
+        iso->code = code;
+        darray_init(iso->layouts);
+        slot->hash = hash;
+        slot->item = iso;
+    }
+
+    /* A layout may list the same code twice. */
+    if (darray_empty(iso->layouts) ||
+        darray_item(iso->layouts, darray_size(iso->layouts) - 1) != l)
+        darray_append(iso->layouts, l);
+
+    return true;
+}
+
+static void
+index_free_codes(struct index *index)
+{
+    if (!index->slots)
+        return;
+
+    for (size_t i = 0; i <= index->mask; i++) {
+        struct iso_layouts *iso = index->slots[i].item;
 
-        o = rxkb_option_create(&group->base);
-        o->name = name;
-        o->description = description;
-        o->popularity = popularity;
-        list_append(&group->options, &o->base.link);
+        if (iso) {
+            darray_free(iso->layouts);
+            free(iso);
+        }
     }
 }
 
 static void
-parse_group(struct rxkb_context *ctx, xmlNode *group,
-            enum rxkb_popularity popularity)
+rxkb_context_free_index(struct rxkb_context *ctx)
 {
-    char *name, *description, *brief, *vendor;
+    index_free_codes(&ctx->iso639_index);
+    index_free_codes(&ctx->iso3166_index);
+    free(ctx->layout_index.slots);
+    free(ctx->option_index.slots);
+    free(ctx->iso639_index.slots);
+    free(ctx->iso3166_index.slots);
+    memset(&ctx->layout_index, 0, sizeof(ctx->layout_index));
+    memset(&ctx->option_index, 0, sizeof(ctx->option_index));
+    memset(&ctx->iso639_index, 0, sizeof(ctx->iso639_index));
+    memset(&ctx->iso3166_index, 0, sizeof(ctx->iso3166_index));
+    ctx->indexed = false;
+}
+
+/*
+ * Index the layouts, options and ISO codes of a parsed context. Where
+ * several items have the same key, the first one in the list is found,
+ * like a search through the list would.
+ */
+static bool
+rxkb_context_build_index(struct rxkb_context *ctx)
+{
+    struct rxkb_layout *l;
     struct rxkb_option_group *g;
-    xmlNode *node = NULL;
-    xmlChar *multiple;
-    bool exists = false;
+    struct rxkb_option *o;
+    struct rxkb_iso639_code *iso639;
+    struct rxkb_iso3166_code *iso3166;
+    size_t nlayouts = 0, noptions = 0, niso639s = 0, niso3166s = 0;
 
-    if (!parse_config_item(ctx, group, &name, &description, &brief, &vendor))
-        return;
+    if (ctx->indexed)
+        return true;
+
+    if (ctx->context_state != CONTEXT_PARSED)
+        return false;
+
+    list_for_each(l, &ctx->layouts, base.link) {
+        nlayouts++;
+        niso639s += list_length(&l->iso639s);
+        niso3166s += list_length(&l->iso3166s);
+    }
+    list_for_each(g, &ctx->option_groups, base.link)
+        noptions += list_length(&g->options);
+
+    if (!index_init(&ctx->layout_index, nlayouts) ||
+        !index_init(&ctx->option_index, noptions) ||
+        !index_init(&ctx->iso639_index, niso639s) ||
+        !index_init(&ctx->iso3166_index, niso3166s))
+        goto err;
+
+    nlayouts = 0;
+    list_for_each(l, &ctx->layouts, base.link) {
+        struct layout_key key = { l->name, l->variant };
+        uint64_t hash = hash_layout(&key);
+        struct index_slot *slot;
+
+        l->position = nlayouts++;
+
+        slot = index_find(&ctx->layout_index, hash, match_layout, &key);
+        if (!slot->item) {
+            slot->hash = hash;
+            slot->item = l;
+        }
+
+        list_for_each(iso639, &l->iso639s, base.link)
+            if (!index_add_code(&ctx->iso639_index, iso639->code, l))
+                goto err;
+        list_for_each(iso3166, &l->iso3166s, base.link)
+            if (!index_add_code(&ctx->iso3166_index, iso3166->code, l))
+                goto err;
+    }
 
     list_for_each(g, &ctx->option_groups, base.link) {
-        if (streq(g->name, name)) {
-            exists = true;
-            break;
+        list_for_each(o, &g->options, base.link) {
+            uint64_t hash = hash_string(HASH_STRING_INIT, o->name);
+            struct index_slot *slot;
+
+            slot = index_find(&ctx->option_index, hash, match_option, o->name);
+            if (!slot->item) {
+                slot->hash = hash;
+                slot->item = o;
+            }
         }
     }
 
-    if (!exists) {
-        g = rxkb_option_group_create(&ctx->base);
-        g->name = name;
-        g->description = description;
-        g->popularity = popularity;
+    ctx->indexed = true;
+    return true;
 
-        multiple = xmlGetProp(group, (const xmlChar*)"allowMultipleSelection");
-        if (multiple && xmlStrEqual(multiple, (const xmlChar*)"true"))
-            g->allow_multiple = true;
-        xmlFree(multiple);
+err:
+    log_err(ctx, "Failed to allocate the lookup index\n");
+    rxkb_context_free_index(ctx);
+    return false;
+}
 
-        list_init(&g->options);
-        list_append(&ctx->option_groups, &g->base.link);
-    } else {
-        free(name);
-        free(description);
-        free(brief);
-        free(vendor);
+XKB_EXPORT struct rxkb_layout *
+rxkb_layout_find(struct rxkb_context *ctx, const char *name,
+                 const char *variant)
+{
+    struct layout_key key = { name, variant };
+
+    if (!name || !rxkb_context_build_index(ctx))
+        return NULL;
+
+    if (variant && variant[0] == '\0')
+        key.variant = NULL;
+
+    return index_find(&ctx->layout_index, hash_layout(&key),
+                      match_layout, &key)->item;
+}
+
+XKB_EXPORT struct rxkb_option *
+rxkb_option_find(struct rxkb_context *ctx, const char *name)
+{
+    if (!name || !rxkb_context_build_index(ctx))
+        return NULL;
+
+    return index_find(&ctx->option_index, hash_string(HASH_STRING_INIT, name),
+                      match_option, name)->item;
+}
+
+/* Return the first layout with this code after @position. */
+static struct rxkb_layout *
+find_layout_for_code(struct rxkb_context *ctx, struct index *index,
+                     const char *code, size_t position)
+{
+    const struct iso_layouts *iso;
+    size_t lo = 0, hi;
+
+    if (!code || !rxkb_context_build_index(ctx))
+        return NULL;
+
+    iso = index_find(index, hash_code(code), match_code, code)->item;
+    if (!iso)
+        return NULL;
+
+    /* The layouts are sorted by their position. */
+    hi = darray_size(iso->layouts);
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (darray_item(iso->layouts, mid)->position < position)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
 
-    for (node = group->children; node; node = node->next) {
-        if (is_node(node, "option"))
-            parse_option(ctx, g, node, popularity);
+    return lo < darray_size(iso->layouts) ? darray_item(iso->layouts, lo) : NULL;
+}
+
+XKB_EXPORT struct rxkb_layout *
+rxkb_layout_first_for_iso639(struct rxkb_context *ctx, const char *code)
+{
+    return find_layout_for_code(ctx, &ctx->iso639_index, code, 0);
+}
+
+XKB_EXPORT struct rxkb_layout *
+rxkb_layout_next_for_iso639(struct rxkb_layout *l, const char *code)
+{
+    struct rxkb_context *ctx = container_of(l->base.parent,
+                                            struct rxkb_context, base);
+
+    return find_layout_for_code(ctx, &ctx->iso639_index, code,
+                                l->position + 1);
+}
+
+XKB_EXPORT struct rxkb_layout *
+rxkb_layout_first_for_iso3166(struct rxkb_context *ctx, const char *code)
+{
+    return find_layout_for_code(ctx, &ctx->iso3166_index, code, 0);
+}
+
+XKB_EXPORT struct rxkb_layout *
+rxkb_layout_next_for_iso3166(struct rxkb_layout *l, const char *code)
+{
+    struct rxkb_context *ctx = container_of(l->base.parent,
+                                            struct rxkb_context, base);
+
+    return find_layout_for_code(ctx, &ctx->iso3166_index, code,
+                                l->position + 1);
+}
+
+/*
+ * The full-text search index is a sorted array of the lowercase words of
+ * the names, briefs and descriptions of the layouts and options. A query
+ * word matches all the words it is a prefix of, which is a range in the
+ * array.
+ */
+
+enum search_field {
+    SEARCH_FIELD_DESCRIPTION,
+    SEARCH_FIELD_BRIEF,
+    SEARCH_FIELD_NAME,
+};
+
+struct search_item {
+    struct rxkb_object *object;
+    bool is_option;
+    enum rxkb_popularity popularity;
+};
+
+struct search_token {
+    const char *word;
+    uint32_t item;
+    enum search_field field;
+};
+
+struct search_index {
+    darray(struct search_item) items;
+    darray(struct search_token) tokens;
+    char *words;
+};
+
+struct rxkb_search {
+    struct rxkb_object base;
+    struct rxkb_context *ctx;
+    darray(struct rxkb_layout *) layouts;
+    darray(struct rxkb_option *) options;
+};
+
+static inline bool
+is_word_char(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           (c >= '0' && c <= '9') || (unsigned char) c >= 0x80;
+}
+
+/*
+ * Return the next lowercase word of the string, copied into @words, and
+ * advance the string past it. Returns false at the end of the string.
+ */
+static bool
+next_word(const char **str, darray_char *words)
+{
+    const char *s = *str;
+
+    while (*s && !is_word_char(*s))
+        s++;
+    if (!*s)
+        return false;
+
+    while (is_word_char(*s))
+        darray_append(*words, to_lower(*s++));
+    darray_append(*words, '\0');
+
+    *str = s;
+    return true;
+}
+
+static void
+search_index_add(struct search_index *index, darray_char *words,
+                 darray_uint *offsets, const char *str,
+                 enum search_field field)
+{
+    if (!str)
+        return;
+
+    for (;;) {
+        struct search_token token = {
+            .item = darray_size(index->items) - 1,
+            .field = field,
+        };
+        unsigned offset = darray_size(*words);
+
+        if (!next_word(&str, words))
+            break;
+
+        darray_append(index->tokens, token);
+        darray_append(*offsets, offset);
     }
 }
 
+static int
+cmp_search_tokens(const void *a, const void *b)
+{
+    const struct search_token *ta = a, *tb = b;
+    int ret = strcmp(ta->word, tb->word);
+
+    if (ret != 0)
+        return ret;
+    if (ta->item != tb->item)
+        return ta->item < tb->item ? -1 : 1;
+    return (int) ta->field - (int) tb->field;
+}
+
 static void
-parse_option_list(struct rxkb_context *ctx, xmlNode *option_list,
-                  enum rxkb_popularity popularity)
+search_index_free(struct search_index *index)
 {
-    xmlNode *node = NULL;
+    if (!index)
+        return;
+
+    darray_free(index->items);
+    darray_free(index->tokens);
+    free(index->words);
+    free(index);
+}
+
+static struct search_index *
+search_index_new(struct rxkb_context *ctx)
+{
+    struct search_index *index = calloc(1, sizeof(*index));
+    darray_char words = darray_new();
+    darray_uint offsets = darray_new();
+    struct rxkb_layout *l;
+    struct rxkb_option_group *g;
+    struct rxkb_option *o;
+
+    if (!index)
+        return NULL;
+
+    list_for_each(l, &ctx->layouts, base.link) {
+        struct search_item item = { &l->base, false, l->popularity };
+
+        darray_append(index->items, item);
+        search_index_add(index, &words, &offsets, l->name, SEARCH_FIELD_NAME);
+        search_index_add(index, &words, &offsets, l->variant, SEARCH_FIELD_NAME);
+        search_index_add(index, &words, &offsets, l->brief, SEARCH_FIELD_BRIEF);
+        search_index_add(index, &words, &offsets, l->description,
+                         SEARCH_FIELD_DESCRIPTION);
+    }
 
-    for (node = option_list->children; node; node = node->next) {
-        if (is_node(node, "group"))
-            parse_group(ctx, node, popularity);
+    list_for_each(g, &ctx->option_groups, base.link) {
+        list_for_each(o, &g->options, base.link) {
+            struct search_item item = { &o->base, true, o->popularity };
+
+            darray_append(index->items, item);
+            search_index_add(index, &words, &offsets, o->name,
+                             SEARCH_FIELD_NAME);
+            search_index_add(index, &words, &offsets, o->brief,
+                             SEARCH_FIELD_BRIEF);
+            search_index_add(index, &words, &offsets, o->description,
+                             SEARCH_FIELD_DESCRIPTION);
+        }
     }
+
+    /* The words only have a fixed address once they are all added. */
+    darray_steal(words, &index->words, NULL);
+    for (size_t i = 0; i < darray_size(index->tokens); i++)
+        darray_item(index->tokens, i).word =
+            index->words + darray_item(offsets, i);
+    darray_free(offsets);
+
+    if (!darray_empty(index->tokens))
+        qsort(index->tokens.item, darray_size(index->tokens),
+              sizeof(struct search_token), cmp_search_tokens);
+
+    return index;
+}
+
+/*
+ * How well a query word matches a word of an item. A match in the name
+ * counts more than one in the description, a whole word more than a
+ * prefix.
+ */
+static uint32_t
+search_score(const struct search_token *token, bool whole_word)
+{
+    return 2 * ((uint32_t) token->field + 1) + (whole_word ? 1 : 0);
+}
+
+struct search_match {
+    uint32_t item;
+    uint32_t score;
+    enum rxkb_popularity popularity;
+};
+
+/* Best score first, then standard items, then in list order. */
+static int
+cmp_search_matches(const void *a, const void *b)
+{
+    const struct search_match *ma = a, *mb = b;
+
+    if (ma->score != mb->score)
+        return ma->score > mb->score ? -1 : 1;
+    if (ma->popularity != mb->popularity)
+        return ma->popularity == RXKB_POPULARITY_STANDARD ? -1 : 1;
+    return ma->item < mb->item ? -1 : (ma->item > mb->item);
 }
 
+/*
+ * Add the best score of the query word for every item to @scores, and
+ * count the word in @nmatched for the items it matches.
+ */
 static void
-parse_rules_xml(struct rxkb_context *ctx, xmlNode *root,
-                enum rxkb_popularity popularity)
+search_word(const struct search_index *index, const char *word,
+            uint32_t *scores, uint32_t *best, uint16_t *nmatched)
 {
-    xmlNode *node = NULL;
+    size_t len = strlen(word);
+    size_t lo = 0, hi = darray_size(index->tokens);
+    darray_uint touched = darray_new();
+    unsigned *item;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (strcmp(darray_item(index->tokens, mid).word, word) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    for (size_t i = lo; i < darray_size(index->tokens); i++) {
+        const struct search_token *token = &darray_item(index->tokens, i);
+        uint32_t score;
+
+        if (strncmp(token->word, word, len) != 0)
+            break;
+
+        score = search_score(token, token->word[len] == '\0');
+        if (best[token->item] == 0)
+            darray_append(touched, token->item);
+        if (score > best[token->item])
+            best[token->item] = score;
+    }
 
-    for (node = root->children; node; node = node->next) {
-        if (is_node(node, "modelList"))
-            parse_model_list(ctx, node, popularity);
-        else if (is_node(node, "layoutList"))
-            parse_layout_list(ctx, node, popularity);
-        else if (is_node(node, "optionList"))
-            parse_option_list(ctx, node, popularity);
+    darray_foreach(item, touched) {
+        scores[*item] += best[*item];
+        nmatched[*item]++;
+        best[*item] = 0;
     }
+    darray_free(touched);
+}
+
+static void
+rxkb_search_destroy(struct rxkb_search *search)
+{
+    darray_free(search->layouts);
+    darray_free(search->options);
+    rxkb_context_unref(search->ctx);
+}
+
+DECLARE_REF_UNREF_FOR_TYPE(rxkb_search);
+DECLARE_CREATE_FOR_TYPE(rxkb_search, rxkb_search_destroy);
+
+XKB_EXPORT struct rxkb_search *
+rxkb_search_new(struct rxkb_context *ctx, const char *query,
+                enum rxkb_search_flags flags)
+{
+    struct rxkb_search *search;
+    struct search_index *index;
+    darray_char words = darray_new();
+    darray(struct search_match) matches = darray_new();
+    struct search_match *match;
+    uint32_t *scores = NULL, *best = NULL;
+    uint16_t *nmatched = NULL;
+    uint16_t nwords = 0;
+    size_t nitems;
+
+    if (flags & ~(RXKB_SEARCH_SKIP_EXOTIC)) {
+        log_err(ctx, "%s: unrecognized flags: %#x\n", __func__, flags);
+        return NULL;
+    }
+
+    if (ctx->context_state != CONTEXT_PARSED || !query)
+        return NULL;
+
+    if (!ctx->search_index) {
+        ctx->search_index = search_index_new(ctx);
+        if (!ctx->search_index)
+            return NULL;
+    }
+    index = ctx->search_index;
+
+    search = rxkb_search_create(NULL);
+    if (!search)
+        return NULL;
+    search->ctx = rxkb_context_ref(ctx);
+
+    nitems = darray_size(index->items);
+    scores = calloc(nitems + 1, sizeof(*scores));
+    best = calloc(nitems + 1, sizeof(*best));
+    nmatched = calloc(nitems + 1, sizeof(*nmatched));
+    if (!scores || !best || !nmatched) {
+        search = rxkb_search_unref(search);
+        goto out;
+    }
+
+    /* Every word of the query must match. */
+    while (nwords < UINT16_MAX && next_word(&query, &words))
+        nwords++;
+
+    for (size_t offset = 0; offset < darray_size(words);
+         offset += strlen(&darray_item(words, offset)) + 1)
+        search_word(index, &darray_item(words, offset), scores, best,
+                    nmatched);
+
+    for (uint32_t i = 0; i < nitems && nwords > 0; i++) {
+        struct search_match m = {
+            i, scores[i], darray_item(index->items, i).popularity
+        };
+
+        if (nmatched[i] != nwords)
+            continue;
+        if ((flags & RXKB_SEARCH_SKIP_EXOTIC) &&
+            m.popularity == RXKB_POPULARITY_EXOTIC)
+            continue;
+        darray_append(matches, m);
+    }
+
+    if (!darray_empty(matches))
+        qsort(matches.item, darray_size(matches), sizeof(*matches.item),
+              cmp_search_matches);
+
+    darray_foreach(match, matches) {
+        const struct search_item *item = &darray_item(index->items, match->item);
+
+        if (item->is_option)
+            darray_append(search->options,
+                          container_of(item->object, struct rxkb_option, base));
+        else
+            darray_append(search->layouts,
+                          container_of(item->object, struct rxkb_layout, base));
+    }
+
+out:
+    free(scores);
+    free(best);
+    free(nmatched);
+    darray_free(words);
+    darray_free(matches);
+    return search;
+}
+
+XKB_EXPORT size_t
+rxkb_search_get_num_layouts(struct rxkb_search *search)
+{
+    return darray_size(search->layouts);
+}
+
+XKB_EXPORT struct rxkb_layout *
+rxkb_search_get_layout(struct rxkb_search *search, size_t idx)
+{
+    if (idx >= darray_size(search->layouts))
+        return NULL;
+    return darray_item(search->layouts, idx);
+}
+
+XKB_EXPORT size_t
+rxkb_search_get_num_options(struct rxkb_search *search)
+{
+    return darray_size(search->options);
+}
+
+XKB_EXPORT struct rxkb_option *
+rxkb_search_get_option(struct rxkb_search *search, size_t idx)
+{
+    if (idx >= darray_size(search->options))
+        return NULL;
+    return darray_item(search->options, idx);
 }
 
 static void
@@ -1104,76 +2171,484 @@ xml_error_func(void *ctx, const char *msg, ...)
     }
 }
 
+
+/*
+ * The rules files are read with a streaming xmlTextReader, and the items
+ * are added to the context as they are completed, so the document is
+ * never held in memory as a whole.
+ *
+ * With RXKB_CONTEXT_VALIDATE, libxml2 validates the document against the
+ * DTD it references while it is read.  If the document turns out to be
+ * invalid, the items which were already added from it are removed again.
+ * Without it, elements we do not know are skipped along with their
+ * content, and only a document which is not well-formed is rejected.
+ */
+
+enum element {
+    ELEMENT_NONE = 0,
+    ELEMENT_REGISTRY,
+    ELEMENT_MODEL_LIST,
+    ELEMENT_MODEL,
+    ELEMENT_LAYOUT_LIST,
+    ELEMENT_LAYOUT,
+    ELEMENT_VARIANT_LIST,
+    ELEMENT_VARIANT,
+    ELEMENT_OPTION_LIST,
+    ELEMENT_GROUP,
+    ELEMENT_OPTION,
+    ELEMENT_CONFIG_ITEM,
+    ELEMENT_NAME,
+    ELEMENT_SHORT_DESCRIPTION,
+    ELEMENT_DESCRIPTION,
+    ELEMENT_VENDOR,
+    ELEMENT_COUNTRY_LIST,
+    ELEMENT_ISO3166_ID,
+    ELEMENT_LANGUAGE_LIST,
+    ELEMENT_ISO639_ID,
+    ELEMENT_HW_LIST,
+    ELEMENT_HW_ID,
+    _ELEMENT_NUM_ELEMENTS
+};
+
+static const struct element_def {
+    const char *name;
+    /* The element contains text. */
+    bool pcdata;
+} element_defs[_ELEMENT_NUM_ELEMENTS] = {
+    [ELEMENT_REGISTRY] = { "xkbConfigRegistry" },
+    [ELEMENT_MODEL_LIST] = { "modelList" },
+    [ELEMENT_MODEL] = { "model" },
+    [ELEMENT_LAYOUT_LIST] = { "layoutList" },
+    [ELEMENT_LAYOUT] = { "layout" },
+    [ELEMENT_VARIANT_LIST] = { "variantList" },
+    [ELEMENT_VARIANT] = { "variant" },
+    [ELEMENT_OPTION_LIST] = { "optionList" },
+    [ELEMENT_GROUP] = { "group" },
+    [ELEMENT_OPTION] = { "option" },
+    [ELEMENT_CONFIG_ITEM] = { "configItem" },
+    [ELEMENT_NAME] = { "name", true },
+    [ELEMENT_SHORT_DESCRIPTION] = { "shortDescription", true },
+    [ELEMENT_DESCRIPTION] = { "description", true },
+    [ELEMENT_VENDOR] = { "vendor", true },
+    [ELEMENT_COUNTRY_LIST] = { "countryList" },
+    [ELEMENT_ISO3166_ID] = { "iso3166Id", true },
+    [ELEMENT_LANGUAGE_LIST] = { "languageList" },
+    [ELEMENT_ISO639_ID] = { "iso639Id", true },
+    [ELEMENT_HW_LIST] = { "hwList" },
+    [ELEMENT_HW_ID] = { "hwId", true },
+};
+
+/* The fields of a configItem, until the end of the element. */
+struct config_item {
+    const char *name;
+    const char *description;
+    const char *brief;
+    const char *vendor;
+    darray(const char *) iso639s;
+    darray(const char *) iso3166s;
+};
+
+struct xml_parser {
+    struct rxkb_context *ctx;
+    xmlTextReader *reader;
+    enum rxkb_popularity popularity;
+
+    /* The open elements; ELEMENT_NONE for a skipped one. */
+    darray(enum element) stack;
+
+    /* The objects added to the context, in order. */
+    darray(struct rxkb_object *) added;
+
+    struct config_item item;
+    /* The text of the current #PCDATA element, and whether it was seen. */
+    char *text;
+    bool have_text;
+
+    /* The layout or group of the current variants or options, or NULL. */
+    struct rxkb_layout *layout;
+    struct rxkb_option_group *group;
+    bool allow_multiple;
+};
+
+static enum element
+lookup_element(const xmlChar *name)
+{
+    for (enum element e = ELEMENT_NONE + 1; e < _ELEMENT_NUM_ELEMENTS; e++)
+        if (xmlStrEqual(name, (const xmlChar *) element_defs[e].name))
+            return e;
+    return ELEMENT_NONE;
+}
+
+static int
+parser_line(struct xml_parser *p)
+{
+    return xmlTextReaderGetParserLineNumber(p->reader);
+}
+
+static enum element
+parser_top(struct xml_parser *p)
+{
+    if (darray_empty(p->stack))
+        return ELEMENT_NONE;
+    return darray_item(p->stack, darray_size(p->stack) - 1);
+}
+
+static void
+config_item_clear(struct config_item *item)
+{
+    darray_free(item->iso639s);
+    darray_free(item->iso3166s);
+    memset(item, 0, sizeof(*item));
+}
+
+static void
+parser_add_object(struct xml_parser *p, struct list *list,
+                  struct rxkb_object *object)
+{
+    list_append(list, &object->link);
+    darray_append(p->added, object);
+}
+
+/* Add the ISO codes of the config item to the new layout @l. */
+static void
+parser_add_codes(struct xml_parser *p, struct rxkb_layout *l)
+{
+    const char **str;
+
+    darray_foreach(str, p->item.iso639s) {
+        struct rxkb_iso639_code *code = rxkb_iso639_code_create(&l->base);
+        code->code = *str;
+        list_append(&l->iso639s, &code->base.link);
+    }
+
+    darray_foreach(str, p->item.iso3166s) {
+        struct rxkb_iso3166_code *code = rxkb_iso3166_code_create(&l->base);
+        code->code = *str;
+        list_append(&l->iso3166s, &code->base.link);
+    }
+}
+
+static void
+parser_add_model(struct xml_parser *p)
+{
+    struct rxkb_context *ctx = p->ctx;
+    struct rxkb_model *m;
+
+    list_for_each(m, &ctx->models, base.link) {
+        if (streq(m->name, p->item.name))
+            return;
+    }
+
+    /* new model */
+    m = rxkb_model_create(&ctx->base);
+    m->name = p->item.name;
+    m->description = p->item.description;
+    m->vendor = p->item.vendor;
+    m->popularity = p->popularity;
+    parser_add_object(p, &ctx->models, &m->base);
+}
+
+static void
+parser_add_layout(struct xml_parser *p)
+{
+    struct rxkb_context *ctx = p->ctx;
+    struct rxkb_layout *l;
+
+    list_for_each(l, &ctx->layouts, base.link) {
+        if (streq(l->name, p->item.name) && l->variant == NULL) {
+            /* The variants are still added to the existing layout. */
+            p->layout = l;
+            return;
+        }
+    }
+
+    l = rxkb_layout_create(&ctx->base);
+    list_init(&l->iso639s);
+    list_init(&l->iso3166s);
+    l->name = p->item.name;
+    l->variant = NULL;
+    l->description = p->item.description;
+    l->brief = p->item.brief;
+    l->popularity = p->popularity;
+    parser_add_codes(p, l);
+    parser_add_object(p, &ctx->layouts, &l->base);
+    p->layout = l;
+}
+
+static void
+parser_add_variant(struct xml_parser *p)
+{
+    struct rxkb_context *ctx = p->ctx;
+    struct rxkb_layout *l = p->layout, *v;
+
+    if (!l)
+        return;
+
+    list_for_each(v, &ctx->layouts, base.link) {
+        if (streq(v->name, p->item.name) && streq(v->name, l->name))
+            return;
+    }
+
+    v = rxkb_layout_create(&ctx->base);
+    list_init(&v->iso639s);
+    list_init(&v->iso3166s);
+    v->name = l->name;
+    v->variant = p->item.name;
+    v->description = p->item.description;
+    v->brief = p->item.brief;
+    v->popularity = p->popularity;
+    parser_add_codes(p, v);
+    parser_add_object(p, &ctx->layouts, &v->base);
+}
+
+static void
+parser_add_group(struct xml_parser *p)
+{
+    struct rxkb_context *ctx = p->ctx;
+    struct rxkb_option_group *g;
+
+    list_for_each(g, &ctx->option_groups, base.link) {
+        if (streq(g->name, p->item.name)) {
+            /* The options are still added to the existing group. */
+            p->group = g;
+            return;
+        }
+    }
+
+    g = rxkb_option_group_create(&ctx->base);
+    g->name = p->item.name;
+    g->description = p->item.description;
+    g->popularity = p->popularity;
+    g->allow_multiple = p->allow_multiple;
+    list_init(&g->options);
+    parser_add_object(p, &ctx->option_groups, &g->base);
+    p->group = g;
+}
+
+static void
+parser_add_option(struct xml_parser *p)
+{
+    struct rxkb_option_group *g = p->group;
+    struct rxkb_option *o;
+
+    if (!g)
+        return;
+
+    list_for_each(o, &g->options, base.link) {
+        if (streq(o->name, p->item.name))
+            return;
+    }
+
+    o = rxkb_option_create(&g->base);
+    o->name = p->item.name;
+    o->description = p->item.description;
+    o->popularity = p->popularity;
+    parser_add_object(p, &g->options, &o->base);
+}
+
+/* A configItem is complete; add the item it describes to the context. */
+static void
+parser_end_config_item(struct xml_parser *p, enum element owner)
+{
+    if (!p->item.name || !strlen(p->item.name)) {
+        log_err(p->ctx, "xml:%d: missing required element 'name'\n",
+                parser_line(p));
+        config_item_clear(&p->item);
+        return;
+    }
+
+    switch (owner) {
+    case ELEMENT_MODEL:
+        parser_add_model(p);
+        break;
+    case ELEMENT_LAYOUT:
+        parser_add_layout(p);
+        break;
+    case ELEMENT_VARIANT:
+        parser_add_variant(p);
+        break;
+    case ELEMENT_GROUP:
+        parser_add_group(p);
+        break;
+    case ELEMENT_OPTION:
+        parser_add_option(p);
+        break;
+    default:
+        break;
+    }
+
+    config_item_clear(&p->item);
+}
+
 static bool
-validate(struct rxkb_context *ctx, xmlDoc *doc)
+parser_start_element(struct xml_parser *p)
 {
-    bool success = false;
-    xmlValidCtxt *dtdvalid = NULL;
-    xmlDtd *dtd = NULL;
-    xmlParserInputBufferPtr buf = NULL;
-    /* This is a modified version of the xkeyboard-config xkb.dtd. That one
-     * requires modelList, layoutList and optionList, we
-     * allow for any of those to be missing.
-     */
-    const char dtdstr[] =
-        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
-        "<!ELEMENT xkbConfigRegistry (modelList?, layoutList?, optionList?)>\n"
-        "<!ATTLIST xkbConfigRegistry version CDATA \"1.1\">\n"
-        "<!ELEMENT modelList (model*)>\n"
-        "<!ELEMENT model (configItem)>\n"
-        "<!ELEMENT layoutList (layout*)>\n"
-        "<!ELEMENT layout (configItem,  variantList?)>\n"
-        "<!ELEMENT optionList (group*)>\n"
-        "<!ELEMENT variantList (variant*)>\n"
-        "<!ELEMENT variant (configItem)>\n"
-        "<!ELEMENT group (configItem, option*)>\n"
-        "<!ATTLIST group allowMultipleSelection (true|false) \"false\">\n"
-        "<!ELEMENT option (configItem)>\n"
-        "<!ELEMENT configItem (name, shortDescription?, description?, vendor?, countryList?, languageList?, hwList?)>\n"
-        "<!ATTLIST configItem popularity (standard|exotic) \"standard\">\n"
-        "<!ELEMENT name (#PCDATA)>\n"
-        "<!ELEMENT shortDescription (#PCDATA)>\n"
-        "<!ELEMENT description (#PCDATA)>\n"
-        "<!ELEMENT vendor (#PCDATA)>\n"
-        "<!ELEMENT countryList (iso3166Id+)>\n"
-        "<!ELEMENT iso3166Id (#PCDATA)>\n"
-        "<!ELEMENT languageList (iso639Id+)>\n"
-        "<!ELEMENT iso639Id (#PCDATA)>\n"
-        "<!ELEMENT hwList (hwId+)>\n"
-        "<!ELEMENT hwId (#PCDATA)>\n";
-
-    /* Note: do not use xmlParserInputBufferCreateStatic, it generates random
-     * DTD validity errors for unknown reasons */
-    buf = xmlParserInputBufferCreateMem(dtdstr, sizeof(dtdstr),
-                                        XML_CHAR_ENCODING_UTF8);
-    if (!buf)
-        return false;
+    const xmlChar *name = xmlTextReaderConstName(p->reader);
+    enum element element = lookup_element(name);
+
+    if (darray_empty(p->stack)) {
+        if (element != ELEMENT_REGISTRY) {
+            log_err(p->ctx, "xml:%d: unexpected root element '%s'\n",
+                    parser_line(p), (const char *) name);
+            return false;
+        }
+    }
+    else if (parser_top(p) == ELEMENT_NONE) {
+        /* The content of a skipped element is skipped too. */
+        element = ELEMENT_NONE;
+    }
+    else if (element == ELEMENT_NONE) {
+        log_dbg(p->ctx, "xml:%d: skipping unknown element '%s'\n",
+                parser_line(p), (const char *) name);
+    }
+
+    switch (element) {
+    case ELEMENT_LAYOUT:
+        p->layout = NULL;
+        break;
+    case ELEMENT_GROUP: {
+        xmlChar *multiple =
+            xmlTextReaderGetAttribute(p->reader,
+                                      (const xmlChar *) "allowMultipleSelection");
+        p->group = NULL;
+        p->allow_multiple =
+            multiple && xmlStrEqual(multiple, (const xmlChar *) "true");
+        xmlFree(multiple);
+        break;
+    }
+    case ELEMENT_CONFIG_ITEM:
+        config_item_clear(&p->item);
+        break;
+    default:
+        break;
+    }
+
+    free(p->text);
+    p->text = NULL;
+    p->have_text = false;
 
-    dtd = xmlIOParseDTD(NULL, buf, XML_CHAR_ENCODING_UTF8);
-    if (!dtd) {
-        log_err(ctx, "Failed to load DTD\n");
+    darray_append(p->stack, element);
+    return true;
+}
+
+static bool
+parser_text(struct xml_parser *p)
+{
+    const xmlChar *value;
+
+    /* Only the first text of an element counts. */
+    if (p->have_text)
+        return true;
+
+    value = xmlTextReaderConstValue(p->reader);
+    if (value)
+        p->text = strdup((const char *) value);
+    if (!p->text) {
+        log_err(p->ctx, "xml:%d: failed to read text\n", parser_line(p));
         return false;
     }
 
-    dtdvalid = xmlNewValidCtxt();
-    if (xmlValidateDtd(dtdvalid, doc, dtd))
-        success = true;
+    p->have_text = true;
+    return true;
+}
 
-    if (dtd)
-        xmlFreeDtd(dtd);
-    if (dtdvalid)
-        xmlFreeValidCtxt(dtdvalid);
+static void
+parser_end_element(struct xml_parser *p)
+{
+    const enum element element = parser_top(p);
+    enum element owner;
+    const char **field = NULL;
+
+    darray_resize(p->stack, darray_size(p->stack) - 1);
+    owner = parser_top(p);
+
+    switch (element) {
+    case ELEMENT_NAME:
+        field = &p->item.name;
+        break;
+    case ELEMENT_DESCRIPTION:
+        field = &p->item.description;
+        break;
+    case ELEMENT_SHORT_DESCRIPTION:
+        field = &p->item.brief;
+        break;
+    case ELEMENT_VENDOR:
+        field = &p->item.vendor;
+        break;
+    case ELEMENT_ISO639_ID:
+        if (p->text)
+            darray_append(p->item.iso639s,
+                          rxkb_context_intern(p->ctx, p->text));
+        break;
+    case ELEMENT_ISO3166_ID:
+        if (p->text)
+            darray_append(p->item.iso3166s,
+                          rxkb_context_intern(p->ctx, p->text));
+        break;
+    case ELEMENT_CONFIG_ITEM:
+        parser_end_config_item(p, owner);
+        break;
+    case ELEMENT_LAYOUT:
+        p->layout = NULL;
+        break;
+    case ELEMENT_GROUP:
+        p->group = NULL;
+        break;
+    default:
+        break;
+    }
 
-    return success;
+    if (field)
+        *field = rxkb_context_intern(p->ctx, p->text);
+
+    free(p->text);
+    p->text = NULL;
+    p->have_text = false;
+}
+
+static bool
+parser_read(struct xml_parser *p)
+{
+    int ret;
+
+    while ((ret = xmlTextReaderRead(p->reader)) == 1) {
+        switch (xmlTextReaderNodeType(p->reader)) {
+        case XML_READER_TYPE_ELEMENT:
+            if (!parser_start_element(p))
+                return false;
+            /* An empty element has no end element node. */
+            if (xmlTextReaderIsEmptyElement(p->reader))
+                parser_end_element(p);
+            break;
+
+        case XML_READER_TYPE_END_ELEMENT:
+            parser_end_element(p);
+            break;
+
+        case XML_READER_TYPE_TEXT:
+        case XML_READER_TYPE_WHITESPACE:
+        case XML_READER_TYPE_SIGNIFICANT_WHITESPACE:
+            if (element_defs[parser_top(p)].pcdata && !parser_text(p))
+                return false;
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    return ret == 0;
 }
 
 static bool
 parse(struct rxkb_context *ctx, const char *path,
       enum rxkb_popularity popularity)
 {
-    bool success = false;
-    xmlDoc *doc = NULL;
-    xmlNode *root = NULL;
+    struct xml_parser p = {
+        .ctx = ctx,
+        .popularity = popularity,
+    };
+    bool success;
 
     if (!check_eaccess(path, R_OK))
         return false;
@@ -1182,22 +2657,40 @@ parse(struct rxkb_context *ctx, const char *path,
 
     xmlSetGenericErrorFunc(ctx, xml_error_func);
 
-    doc = xmlParseFile(path);
-    if (!doc)
+    p.reader = xmlReaderForFile(path, NULL, 0);
+    if (!p.reader)
+        return false;
+
+    if (ctx->validate &&
+        xmlTextReaderSetParserProp(p.reader, XML_PARSER_VALIDATE, 1) != 0) {
+        log_err(ctx, "Failed to enable validation for %s\n", path);
+        xmlFreeTextReader(p.reader);
         return false;
+    }
 
-    if (!validate(ctx, doc)) {
+    success = parser_read(&p);
+    if (!success)
+        log_err(ctx, "XML error: failed to parse document at %s\n", path);
+    else if (ctx->validate && xmlTextReaderIsValid(p.reader) != 1) {
         log_err(ctx, "XML error: failed to validate document at %s\n", path);
-        goto error;
+        success = false;
     }
 
-    root = xmlDocGetRootElement(doc);
-    parse_rules_xml(ctx, root, popularity);
+    if (!success) {
+        struct rxkb_object **object;
 
-    success = true;
-error:
-    xmlFreeDoc(doc);
+        /* The options of a group go before the group. */
+        darray_foreach_reverse(object, p.added)
+            rxkb_object_unref(*object);
+    }
+
+    xmlFreeTextReader(p.reader);
     xmlCleanupParser();
 
+    config_item_clear(&p.item);
+    free(p.text);
+    darray_free(p.stack);
+    darray_free(p.added);
+
     return success;
 }
@@ -49,19 +49,52 @@ struct scanner {
     size_t len;
     char buf[1024];
     size_t buf_pos;
-    size_t line, column;
-    /* The line/column of the start of the current token. */
-    size_t token_line, token_column;
+    /*
+     * The position of the start of the current token. Line and column are
+     * only computed from it when a diagnostic is emitted, see
+     * scanner_token_location().
+     */
+    size_t token_pos;
+    /* The last position located, to avoid rescanning from the start. */
+    size_t loc_pos, loc_line, loc_line_start;
     const char *file_name;
     struct xkb_context *ctx;
     void *priv;
 };
 
-#define scanner_log(scanner, level, fmt, ...) \
+/*
+ * Get the line and column (both 1-based) of the start of the current token.
+ */
+static inline void
+scanner_token_location(struct scanner *s, size_t *line, size_t *column)
+{
+    const char *p, *nl;
+    const char *end = s->s + s->token_pos;
+
+    if (s->token_pos < s->loc_pos) {
+        s->loc_pos = s->loc_line_start = 0;
+        s->loc_line = 1;
+    }
+
+    p = s->s + s->loc_pos;
+    while (p < end && (nl = memchr(p, '\n', end - p))) {
+        s->loc_line++;
+        p = nl + 1;
+        s->loc_line_start = p - s->s;
+    }
+    s->loc_pos = s->token_pos;
+
+    *line = s->loc_line;
+    *column = s->token_pos - s->loc_line_start + 1;
+}
+
+#define scanner_log(scanner, level, fmt, ...) do { \
+    size_t line_, column_; \
+    scanner_token_location((scanner), &line_, &column_); \
     xkb_log((scanner)->ctx, (level), 0, \
             "%s:%zu:%zu: " fmt "\n", \
-             (scanner)->file_name, \
-             (scanner)->token_line, (scanner)->token_column, ##__VA_ARGS__)
+             (scanner)->file_name, line_, column_, ##__VA_ARGS__); \
+} while (0)
 
 #define scanner_err(scanner, fmt, ...) \
     scanner_log(scanner, XKB_LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
@@ -77,8 +110,9 @@ scanner_init(struct scanner *s, struct xkb_context *ctx,
     s->s = string;
     s->len = len;
     s->pos = 0;
-    s->line = s->column = 1;
-    s->token_line = s->token_column = 1;
+    s->token_pos = 0;
+    s->loc_pos = s->loc_line_start = 0;
+    s->loc_line = 1;
     s->file_name = file_name;
     s->ctx = ctx;
     s->priv = priv;
@@ -108,9 +142,7 @@ static inline void
 skip_to_eol(struct scanner *s)
 {
     const char *nl = memchr(s->s + s->pos, '\n', s->len - s->pos);
-    const size_t new_pos = nl ? (size_t) (nl - s->s) : s->len;
-    s->column += new_pos - s->pos;
-    s->pos = new_pos;
+    s->pos = nl ? (size_t) (nl - s->s) : s->len;
 }
 
 static inline char
@@ -118,13 +150,6 @@ next(struct scanner *s)
 {
     if (unlikely(eof(s)))
         return '\0';
-    if (unlikely(eol(s))) {
-        s->line++;
-        s->column = 1;
-    }
-    else {
-        s->column++;
-    }
     return s->s[s->pos++];
 }
 
@@ -133,7 +158,7 @@ chr(struct scanner *s, char ch)
 {
     if (likely(peek(s) != ch))
         return false;
-    s->pos++; s->column++;
+    s->pos++;
     return true;
 }
 
@@ -144,7 +169,7 @@ str(struct scanner *s, const char *string, size_t len)
         return false;
     if (memcmp(s->s + s->pos, string, len) != 0)
         return false;
-    s->pos += len; s->column += len;
+    s->pos += len;
     return true;
 }
 
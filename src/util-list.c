@@ -78,6 +78,22 @@ list_remove(struct list *elm)
 	elm->prev = NULL;
 }
 
+int
+list_length(const struct list *list)
+{
+	struct list *e;
+	int count;
+
+	count = 0;
+	e = list->next;
+	while (e != list) {
+		e = e->next;
+		count++;
+	}
+
+	return count;
+}
+
 bool
 list_empty(const struct list *list)
 {
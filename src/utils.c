@@ -111,6 +111,149 @@ unmap_file(char *str, size_t size)
 
 #endif
 
+char *
+get_cache_dir_path(void)
+{
+    const char *xdg_cache_home, *home;
+
+    xdg_cache_home = secure_getenv("XDG_CACHE_HOME");
+    if (!xdg_cache_home || xdg_cache_home[0] != '/') {
+        home = secure_getenv("HOME");
+        if (!home)
+            return NULL;
+        return asprintf_safe("%s/.cache/xkbcommon", home);
+    }
+
+    return asprintf_safe("%s/xkbcommon", xdg_cache_home);
+}
+
+#if HAVE_UNISTD_H
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+bool
+write_all(int fd, const void *buf, size_t size)
+{
+    const char *p = buf;
+
+    while (size > 0) {
+        ssize_t ret = write(fd, p, size);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        p += ret;
+        size -= ret;
+    }
+
+    return true;
+}
+
+static bool
+make_dir(const char *path)
+{
+    return mkdir(path, 0700) == 0 || errno == EEXIST;
+}
+
+/* Create the directory of @path, and its parent if needed. */
+static bool
+make_parent_dirs(const char *path)
+{
+    char *dir, *parent;
+    bool ok = false;
+
+    dir = strdup(path);
+    if (!dir)
+        return false;
+
+    parent = strrchr(dir, '/');
+    if (!parent || parent == dir) {
+        free(dir);
+        return true;
+    }
+    *parent = '\0';
+
+    if (make_dir(dir)) {
+        ok = true;
+    }
+    else {
+        parent = strrchr(dir, '/');
+        if (errno == ENOENT && parent && parent != dir) {
+            *parent = '\0';
+            ok = make_dir(dir);
+            *parent = '/';
+            ok = ok && make_dir(dir);
+        }
+    }
+
+    free(dir);
+    return ok;
+}
+
+bool
+write_file_atomically(const char *path,
+                      bool (*write_fn)(int fd, void *data), void *data)
+{
+    char *tmp_path;
+    int fd, err;
+
+    if (!make_parent_dirs(path))
+        return false;
+
+    tmp_path = asprintf_safe("%s.XXXXXX", path);
+    if (!tmp_path)
+        return false;
+
+    fd = mkstemp(tmp_path);
+    if (fd < 0) {
+        err = errno;
+        free(tmp_path);
+        errno = err;
+        return false;
+    }
+
+    if (!write_fn(fd, data)) {
+        err = errno;
+        close(fd);
+        goto err_unlink;
+    }
+
+    if (close(fd) != 0 || rename(tmp_path, path) != 0) {
+        err = errno;
+        goto err_unlink;
+    }
+
+    free(tmp_path);
+    return true;
+
+err_unlink:
+    unlink(tmp_path);
+    free(tmp_path);
+    errno = err;
+    return false;
+}
+
+#else
+
+bool
+write_all(int fd, const void *buf, size_t size)
+{
+    errno = ENOSYS;
+    return false;
+}
+
+bool
+write_file_atomically(const char *path,
+                      bool (*write_fn)(int fd, void *data), void *data)
+{
+    errno = ENOSYS;
+    return false;
+}
+
+#endif
+
 // ASCII lower-case map.
 static const unsigned char lower_map[] = {
     0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20,
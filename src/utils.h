@@ -221,6 +221,47 @@ map_file(FILE *file, char **string_out, size_t *size_out);
 void
 unmap_file(char *string, size_t size);
 
+/* FNV-1a of a string and its terminating NUL, chained from @hash. */
+#define HASH_STRING_INIT 0xcbf29ce484222325
+
+static inline uint64_t
+hash_string(uint64_t hash, const char *s)
+{
+    do {
+        hash ^= (uint8_t) *s;
+        hash *= 0x100000001b3;
+    } while (*s++);
+    return hash;
+}
+
+/* The same, for @len bytes. */
+static inline uint64_t
+hash_bytes(uint64_t hash, const char *s, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t) s[i];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+/* The directory for our cache files, in $XDG_CACHE_HOME or ~/.cache. */
+char *
+get_cache_dir_path(void);
+
+bool
+write_all(int fd, const void *buf, size_t size);
+
+/*
+ * Create the file at @path with the contents written by @write_fn, such
+ * that readers never see a partially-written file.  The directory of the
+ * file, and its parent, are created if needed.  On failure, errno is set
+ * and no file is left behind.
+ */
+bool
+write_file_atomically(const char *path,
+                      bool (*write_fn)(int fd, void *data), void *data);
+
 static inline bool
 check_eaccess(const char *path, int mode)
 {
@@ -88,6 +88,14 @@
     }                                                                   \
 } while (0)
 
+#define DUP_OR_FAIL(arr, src, nmemb) do {                               \
+    if ((nmemb) > 0) {                                                  \
+        (arr) = memdup((src), (nmemb), sizeof(*(arr)));                 \
+        if (!(arr))                                                     \
+            goto fail;                                                  \
+    }                                                                   \
+} while (0)
+
 static const xcb_xkb_map_part_t get_map_required_components =
     (XCB_XKB_MAP_PART_KEY_TYPES |
      XCB_XKB_MAP_PART_KEY_SYMS |
@@ -420,25 +428,20 @@ fail:
     return false;
 }
 
+/*
+ * Fill in the groups of the keys in the reply's KeySyms range. The keys must
+ * not have any groups yet.
+ */
 static bool
-get_sym_maps(struct xkb_keymap *keymap, xcb_connection_t *conn,
-             xcb_xkb_get_map_reply_t *reply, xcb_xkb_get_map_map_t *map)
+get_key_sym_maps(struct xkb_keymap *keymap, xcb_connection_t *conn,
+                 xcb_xkb_get_map_reply_t *reply, xcb_xkb_get_map_map_t *map)
 {
     int sym_maps_length = xcb_xkb_get_map_map_syms_rtrn_length(reply, map);
     xcb_xkb_key_sym_map_iterator_t sym_maps_iter =
         xcb_xkb_get_map_map_syms_rtrn_iterator(reply, map);
 
-    FAIL_UNLESS(reply->minKeyCode <= reply->maxKeyCode);
-    FAIL_UNLESS(reply->firstKeySym >= reply->minKeyCode);
-    FAIL_UNLESS(reply->firstKeySym + reply->nKeySyms <= reply->maxKeyCode + 1);
-
-    keymap->min_key_code = reply->minKeyCode;
-    keymap->max_key_code = reply->maxKeyCode;
-
-    ALLOC_OR_FAIL(keymap->keys, keymap->max_key_code + 1);
-
-    for (xkb_keycode_t kc = keymap->min_key_code; kc <= keymap->max_key_code; kc++)
-        keymap->keys[kc].keycode = kc;
+    FAIL_UNLESS(reply->firstKeySym >= keymap->min_key_code);
+    FAIL_UNLESS(reply->firstKeySym + reply->nKeySyms <= keymap->max_key_code + 1);
 
     for (int i = 0; i < sym_maps_length; i++) {
         xcb_xkb_key_sym_map_t *wire_sym_map = sym_maps_iter.data;
@@ -497,6 +500,26 @@ fail:
     return false;
 }
 
+static bool
+get_sym_maps(struct xkb_keymap *keymap, xcb_connection_t *conn,
+             xcb_xkb_get_map_reply_t *reply, xcb_xkb_get_map_map_t *map)
+{
+    FAIL_UNLESS(reply->minKeyCode <= reply->maxKeyCode);
+
+    keymap->min_key_code = reply->minKeyCode;
+    keymap->max_key_code = reply->maxKeyCode;
+
+    ALLOC_OR_FAIL(keymap->keys, keymap->max_key_code + 1);
+
+    for (xkb_keycode_t kc = keymap->min_key_code; kc <= keymap->max_key_code; kc++)
+        keymap->keys[kc].keycode = kc;
+
+    return get_key_sym_maps(keymap, conn, reply, map);
+
+fail:
+    return false;
+}
+
 static bool
 get_actions(struct xkb_keymap *keymap, xcb_connection_t *conn,
             xcb_xkb_get_map_reply_t *reply, xcb_xkb_get_map_map_t *map)
@@ -509,9 +532,9 @@ get_actions(struct xkb_keymap *keymap, xcb_connection_t *conn,
     xcb_xkb_key_sym_map_iterator_t sym_maps_iter =
         xcb_xkb_get_map_map_syms_rtrn_iterator(reply, map);
 
-    FAIL_UNLESS(reply->firstKeyAction == keymap->min_key_code);
-    FAIL_UNLESS(reply->firstKeyAction + reply->nKeyActions ==
-                keymap->max_key_code + 1);
+    /* The actions are walked together with the key sym maps. */
+    FAIL_UNLESS(reply->firstKeyAction == reply->firstKeySym);
+    FAIL_UNLESS(reply->nKeyActions == reply->nKeySyms);
 
     for (int i = 0; i < acts_count_length; i++) {
         xcb_xkb_key_sym_map_t *wire_sym_map = sym_maps_iter.data;
@@ -673,9 +696,8 @@ fail:
 
 static bool
 get_map(struct xkb_keymap *keymap, xcb_connection_t *conn,
-        xcb_xkb_get_map_cookie_t cookie)
+        xcb_xkb_get_map_reply_t *reply)
 {
-    xcb_xkb_get_map_reply_t *reply = xcb_xkb_get_map_reply(conn, cookie, NULL);
     xcb_xkb_get_map_map_t map;
 
     FAIL_IF_BAD_REPLY(reply, "XkbGetMap");
@@ -765,11 +787,8 @@ get_indicators(struct xkb_keymap *keymap, xcb_connection_t *conn,
 
 static bool
 get_indicator_map(struct xkb_keymap *keymap, xcb_connection_t *conn,
-                  xcb_xkb_get_indicator_map_cookie_t cookie)
+                  xcb_xkb_get_indicator_map_reply_t *reply)
 {
-    xcb_xkb_get_indicator_map_reply_t *reply =
-        xcb_xkb_get_indicator_map_reply(conn, cookie, NULL);
-
     FAIL_IF_BAD_REPLY(reply, "XkbGetIndicatorMap");
 
     if (!get_indicators(keymap, conn, reply))
@@ -845,11 +864,8 @@ fail:
 
 static bool
 get_compat_map(struct xkb_keymap *keymap, xcb_connection_t *conn,
-               xcb_xkb_get_compat_map_cookie_t cookie)
+               xcb_xkb_get_compat_map_reply_t *reply)
 {
-    xcb_xkb_get_compat_map_reply_t *reply =
-        xcb_xkb_get_compat_map_reply(conn, cookie, NULL);
-
     FAIL_IF_BAD_REPLY(reply, "XkbGetCompatMap");
 
     if (!get_sym_interprets(keymap, conn, reply))
@@ -1062,11 +1078,9 @@ fail:
 
 static bool
 get_names(struct xkb_keymap *keymap, struct x11_atom_interner *interner,
-          xcb_xkb_get_names_cookie_t cookie)
+          xcb_xkb_get_names_reply_t *reply)
 {
     xcb_connection_t *conn = interner->conn;
-    xcb_xkb_get_names_reply_t *reply =
-        xcb_xkb_get_names_reply(conn, cookie, NULL);
     xcb_xkb_get_names_value_list_t list;
 
     FAIL_IF_BAD_REPLY(reply, "XkbGetNames");
@@ -1110,11 +1124,8 @@ fail:
 
 static bool
 get_controls(struct xkb_keymap *keymap, xcb_connection_t *conn,
-             xcb_xkb_get_controls_cookie_t cookie)
+             xcb_xkb_get_controls_reply_t *reply)
 {
-    xcb_xkb_get_controls_reply_t *reply =
-        xcb_xkb_get_controls_reply(conn, cookie, NULL);
-
     FAIL_IF_BAD_REPLY(reply, "XkbGetControls");
     FAIL_UNLESS(reply->numGroups > 0 && reply->numGroups <= 4);
 
@@ -1134,13 +1145,31 @@ fail:
     return false;
 }
 
-XKB_EXPORT struct xkb_keymap *
-xkb_x11_keymap_new_from_device(struct xkb_context *ctx,
-                               xcb_connection_t *conn,
-                               int32_t device_id,
-                               enum xkb_keymap_compile_flags flags)
-{
+enum request_step {
+    STEP_MAP,
+    STEP_INDICATOR_MAP,
+    STEP_COMPAT_MAP,
+    STEP_NAMES,
+    STEP_CONTROLS,
+    STEP_ATOMS,
+    STEP_DONE,
+};
+
+struct xkb_x11_keymap_request {
     struct xkb_keymap *keymap;
+    xcb_connection_t *conn;
+    struct x11_atom_interner interner;
+    /* Sequence numbers of the requests, indexed by step. */
+    unsigned int sequences[STEP_ATOMS];
+    enum request_step step;
+    bool had_error;
+};
+
+static struct xkb_x11_keymap_request *
+keymap_request_new(struct xkb_context *ctx, xcb_connection_t *conn,
+                   int32_t device_id, enum xkb_keymap_compile_flags flags)
+{
+    struct xkb_x11_keymap_request *req;
     const enum xkb_keymap_format format = XKB_KEYMAP_FORMAT_TEXT_V1;
 
     if (flags & ~(XKB_KEYMAP_COMPILE_NO_FLAGS)) {
@@ -1153,35 +1182,645 @@ xkb_x11_keymap_new_from_device(struct xkb_context *ctx,
         return NULL;
     }
 
-    keymap = xkb_keymap_new(ctx, format, flags);
+    req = calloc(1, sizeof(*req));
+    if (!req)
+        return NULL;
+
+    req->keymap = xkb_keymap_new(ctx, format, flags);
+    if (!req->keymap) {
+        free(req);
+        return NULL;
+    }
+
+    req->conn = conn;
+    x11_atom_interner_init(&req->interner, ctx, conn);
+
+    req->sequences[STEP_MAP] =
+        xcb_xkb_get_map(conn, device_id, get_map_required_components,
+                        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0).sequence;
+    req->sequences[STEP_INDICATOR_MAP] =
+        xcb_xkb_get_indicator_map(conn, device_id, ALL_INDICATORS_MASK).sequence;
+    req->sequences[STEP_COMPAT_MAP] =
+        xcb_xkb_get_compat_map(conn, device_id, 0, true, 0, 0).sequence;
+    req->sequences[STEP_NAMES] =
+        xcb_xkb_get_names(conn, device_id, get_names_wanted).sequence;
+    req->sequences[STEP_CONTROLS] =
+        xcb_xkb_get_controls(conn, device_id).sequence;
+
+    req->step = STEP_MAP;
+    return req;
+}
+
+/*
+ * Handle the replies in the order the requests were sent, which is also the
+ * order in which they arrive. If @block is false, stop at the first reply
+ * which is not available yet.
+ */
+static void
+keymap_request_advance(struct xkb_x11_keymap_request *req, bool block)
+{
+    struct xkb_keymap *keymap = req->keymap;
+    xcb_connection_t *conn = req->conn;
+
+    while (req->step < STEP_ATOMS) {
+        void *reply = NULL;
+
+        if (block)
+            reply = xcb_wait_for_reply(conn, req->sequences[req->step], NULL);
+        else if (!xcb_poll_for_reply(conn, req->sequences[req->step],
+                                     &reply, NULL))
+            return;
+
+        switch (req->step) {
+        case STEP_MAP:
+            req->had_error |= !get_map(keymap, conn, reply);
+            break;
+        case STEP_INDICATOR_MAP:
+            req->had_error |= !get_indicator_map(keymap, conn, reply);
+            break;
+        case STEP_COMPAT_MAP:
+            req->had_error |= !get_compat_map(keymap, conn, reply);
+            break;
+        case STEP_NAMES:
+            req->had_error |= !get_names(keymap, &req->interner, reply);
+            break;
+        case STEP_CONTROLS:
+            req->had_error |= !get_controls(keymap, conn, reply);
+            break;
+        default:
+            break;
+        }
+        req->step++;
+    }
+
+    if (req->step == STEP_ATOMS) {
+        if (block)
+            x11_atom_interner_round_trip(&req->interner);
+        else if (!x11_atom_interner_poll(&req->interner))
+            return;
+
+        req->had_error |= req->interner.had_error;
+        req->step = STEP_DONE;
+    }
+}
+
+static enum xkb_x11_keymap_request_status
+keymap_request_status(struct xkb_x11_keymap_request *req)
+{
+    if (req->step != STEP_DONE)
+        return XKB_X11_KEYMAP_REQUEST_PENDING;
+    return req->had_error ? XKB_X11_KEYMAP_REQUEST_FAILED
+                          : XKB_X11_KEYMAP_REQUEST_DONE;
+}
+
+XKB_EXPORT struct xkb_x11_keymap_request *
+xkb_x11_keymap_request_new(struct xkb_context *ctx,
+                           xcb_connection_t *conn,
+                           int32_t device_id,
+                           enum xkb_keymap_compile_flags flags)
+{
+    struct xkb_x11_keymap_request *req =
+        keymap_request_new(ctx, conn, device_id, flags);
+
+    if (req)
+        xcb_flush(conn);
+
+    return req;
+}
+
+XKB_EXPORT enum xkb_x11_keymap_request_status
+xkb_x11_keymap_request_poll(struct xkb_x11_keymap_request *req)
+{
+    keymap_request_advance(req, false);
+    return keymap_request_status(req);
+}
+
+XKB_EXPORT struct xkb_keymap *
+xkb_x11_keymap_request_get_keymap(struct xkb_x11_keymap_request *req)
+{
+    if (keymap_request_status(req) != XKB_X11_KEYMAP_REQUEST_DONE)
+        return NULL;
+
+    return xkb_keymap_ref(req->keymap);
+}
+
+XKB_EXPORT void
+xkb_x11_keymap_request_free(struct xkb_x11_keymap_request *req)
+{
+    if (!req)
+        return;
+
+    for (enum request_step step = req->step; step < STEP_ATOMS; step++)
+        xcb_discard_reply(req->conn, req->sequences[step]);
+    x11_atom_interner_finish(&req->interner);
+    xkb_keymap_unref(req->keymap);
+    free(req);
+}
+
+XKB_EXPORT struct xkb_keymap *
+xkb_x11_keymap_new_from_device(struct xkb_context *ctx,
+                               xcb_connection_t *conn,
+                               int32_t device_id,
+                               enum xkb_keymap_compile_flags flags)
+{
+    struct xkb_x11_keymap_request *req;
+    struct xkb_keymap *keymap;
+
+    req = keymap_request_new(ctx, conn, device_id, flags);
+    if (!req)
+        return NULL;
+
+    keymap_request_advance(req, true);
+    keymap = xkb_x11_keymap_request_get_keymap(req);
+    xkb_x11_keymap_request_free(req);
+
+    return keymap;
+}
+
+/*
+ * Incremental updates.
+ *
+ * A MapNotify or NamesNotify event tells which parts of the keymap changed.
+ * Instead of fetching everything again, we copy the old keymap and only
+ * replace the changed parts with what the server sends for them.
+ */
+
+static struct xkb_keymap *
+copy_keymap(const struct xkb_keymap *old)
+{
+    struct xkb_keymap *keymap;
+
+    keymap = xkb_keymap_new(old->ctx, old->format, old->flags);
     if (!keymap)
         return NULL;
 
+    keymap->enabled_ctrls = old->enabled_ctrls;
+    keymap->mods = old->mods;
+    keymap->num_groups = old->num_groups;
+    memcpy(keymap->leds, old->leds, sizeof(old->leds));
+    keymap->num_leds = old->num_leds;
+
+    ALLOC_OR_FAIL(keymap->types, old->num_types);
+    keymap->num_types = old->num_types;
+    for (unsigned i = 0; i < old->num_types; i++) {
+        const struct xkb_key_type *from = &old->types[i];
+        struct xkb_key_type *type = &keymap->types[i];
+
+        type->name = from->name;
+        type->mods = from->mods;
+        type->num_levels = from->num_levels;
+        DUP_OR_FAIL(type->entries, from->entries, from->num_entries);
+        type->num_entries = from->num_entries;
+        DUP_OR_FAIL(type->level_names, from->level_names,
+                    from->num_level_names);
+        type->num_level_names = from->num_level_names;
+    }
+
+    if (old->keys) {
+        keymap->min_key_code = old->min_key_code;
+        keymap->max_key_code = old->max_key_code;
+        ALLOC_OR_FAIL(keymap->keys, keymap->max_key_code + 1);
+    }
+    for (xkb_keycode_t kc = old->min_key_code;
+         old->keys && kc <= old->max_key_code; kc++) {
+        const struct xkb_key *from = &old->keys[kc];
+        struct xkb_key *key = &keymap->keys[kc];
+
+        *key = *from;
+        key->groups = NULL;
+        key->num_groups = 0;
+        ALLOC_OR_FAIL(key->groups, from->num_groups);
+        key->num_groups = from->num_groups;
+
+        for (xkb_layout_index_t i = 0; i < key->num_groups; i++) {
+            const struct xkb_group *from_group = &from->groups[i];
+            struct xkb_group *group = &key->groups[i];
+
+            group->explicit_type = from_group->explicit_type;
+            group->type = &keymap->types[from_group->type - old->types];
+            ALLOC_OR_FAIL(group->levels, group->type->num_levels);
+
+            for (xkb_level_index_t j = 0; j < group->type->num_levels; j++) {
+                const struct xkb_level *from_level = &from_group->levels[j];
+                struct xkb_level *level = &group->levels[j];
+
+                if (from_level->num_syms > 1)
+                    DUP_OR_FAIL(level->u.syms, from_level->u.syms,
+                                from_level->num_syms);
+                else
+                    level->u.sym = from_level->u.sym;
+                level->num_syms = from_level->num_syms;
+                level->action = from_level->action;
+            }
+        }
+    }
+
+    DUP_OR_FAIL(keymap->sym_interprets, old->sym_interprets,
+                old->num_sym_interprets);
+    keymap->num_sym_interprets = old->num_sym_interprets;
+    DUP_OR_FAIL(keymap->key_aliases, old->key_aliases, old->num_key_aliases);
+    keymap->num_key_aliases = old->num_key_aliases;
+    DUP_OR_FAIL(keymap->group_names, old->group_names, old->num_group_names);
+    keymap->num_group_names = old->num_group_names;
+
+    keymap->keycodes_section_name = strdup_safe(old->keycodes_section_name);
+    keymap->symbols_section_name = strdup_safe(old->symbols_section_name);
+    keymap->types_section_name = strdup_safe(old->types_section_name);
+    keymap->compat_section_name = strdup_safe(old->compat_section_name);
+    if ((old->keycodes_section_name && !keymap->keycodes_section_name) ||
+        (old->symbols_section_name && !keymap->symbols_section_name) ||
+        (old->types_section_name && !keymap->types_section_name) ||
+        (old->compat_section_name && !keymap->compat_section_name))
+        goto fail;
+
+    return keymap;
+
+fail:
+    xkb_keymap_unref(keymap);
+    return NULL;
+}
+
+static void
+clear_key_groups(struct xkb_key *key)
+{
+    for (xkb_layout_index_t i = 0; i < key->num_groups; i++) {
+        struct xkb_group *group = &key->groups[i];
+
+        if (!group->levels)
+            continue;
+        for (xkb_level_index_t j = 0; j < group->type->num_levels; j++)
+            if (group->levels[j].num_syms > 1)
+                free(group->levels[j].u.syms);
+        free(group->levels);
+    }
+    free(key->groups);
+    key->groups = NULL;
+    key->num_groups = 0;
+    key->out_of_range_group_action = RANGE_WRAP;
+    key->out_of_range_group_number = 0;
+}
+
+struct key_range {
+    unsigned int first;
+    unsigned int count;
+};
+
+static void
+key_range_add(struct key_range *range, unsigned int first, unsigned int count)
+{
+    unsigned int end;
+
+    if (count == 0)
+        return;
+
+    if (range->count == 0) {
+        range->first = first;
+        range->count = count;
+        return;
+    }
+
+    end = MAX(range->first + range->count, first + count);
+    range->first = MIN(range->first, first);
+    range->count = end - range->first;
+}
+
+static bool
+update_map(struct xkb_keymap *keymap, xcb_connection_t *conn,
+           uint16_t present, xcb_xkb_get_map_reply_t *reply)
+{
+    xcb_xkb_get_map_map_t map;
+
+    FAIL_IF_BAD_REPLY(reply, "XkbGetMap");
+
+    FAIL_UNLESS((reply->present & present) == present);
+    FAIL_UNLESS(reply->minKeyCode == keymap->min_key_code);
+    FAIL_UNLESS(reply->maxKeyCode == keymap->max_key_code);
+
+    xcb_xkb_get_map_map_unpack(xcb_xkb_get_map_map(reply),
+                               reply->nTypes,
+                               reply->nKeySyms,
+                               reply->nKeyActions,
+                               reply->totalActions,
+                               reply->totalKeyBehaviors,
+                               reply->virtualMods,
+                               reply->totalKeyExplicit,
+                               reply->totalModMapKeys,
+                               reply->totalVModMapKeys,
+                               reply->present,
+                               &map);
+
+    if (present & XCB_XKB_MAP_PART_KEY_SYMS) {
+        const struct xkb_key *key;
+
+        FAIL_UNLESS(reply->firstKeySym >= keymap->min_key_code);
+        FAIL_UNLESS(reply->firstKeySym + reply->nKeySyms <=
+                    keymap->max_key_code + 1);
+
+        for (unsigned i = 0; i < reply->nKeySyms; i++)
+            clear_key_groups(&keymap->keys[reply->firstKeySym + i]);
+
+        if (!get_key_sym_maps(keymap, conn, reply, &map) ||
+            !get_actions(keymap, conn, reply, &map))
+            goto fail;
+
+        /* The keys may have gained or lost groups. */
+        keymap->num_groups = 0;
+        xkb_keys_foreach(key, keymap)
+            keymap->num_groups = MAX(keymap->num_groups, key->num_groups);
+    }
+
+    if (present & XCB_XKB_MAP_PART_VIRTUAL_MODS) {
+        /* Which vmods exist is decided by their names, see get_vmod_names(). */
+        xkb_mod_index_t num_mods = keymap->mods.num_mods;
+
+        get_vmods(keymap, conn, reply, &map);
+        keymap->mods.num_mods = num_mods;
+    }
+
+    if (present & XCB_XKB_MAP_PART_EXPLICIT_COMPONENTS) {
+        FAIL_UNLESS(reply->firstKeyExplicit >= keymap->min_key_code);
+        FAIL_UNLESS(reply->firstKeyExplicit + reply->nKeyExplicit <=
+                    keymap->max_key_code + 1);
+
+        for (unsigned i = 0; i < reply->nKeyExplicit; i++) {
+            struct xkb_key *key = &keymap->keys[reply->firstKeyExplicit + i];
+
+            key->explicit = 0;
+            for (xkb_layout_index_t j = 0; j < key->num_groups; j++)
+                key->groups[j].explicit_type = false;
+        }
+
+        if (!get_explicits(keymap, conn, reply, &map))
+            goto fail;
+    }
+
+    if (present & XCB_XKB_MAP_PART_MODIFIER_MAP) {
+        FAIL_UNLESS(reply->firstModMapKey >= keymap->min_key_code);
+        FAIL_UNLESS(reply->firstModMapKey + reply->nModMapKeys <=
+                    keymap->max_key_code + 1);
+
+        for (unsigned i = 0; i < reply->nModMapKeys; i++)
+            keymap->keys[reply->firstModMapKey + i].modmap = 0;
+
+        if (!get_modmaps(keymap, conn, reply, &map))
+            goto fail;
+    }
+
+    if (present & XCB_XKB_MAP_PART_VIRTUAL_MOD_MAP) {
+        FAIL_UNLESS(reply->firstVModMapKey >= keymap->min_key_code);
+        FAIL_UNLESS(reply->firstVModMapKey + reply->nVModMapKeys <=
+                    keymap->max_key_code + 1);
+
+        for (unsigned i = 0; i < reply->nVModMapKeys; i++)
+            keymap->keys[reply->firstVModMapKey + i].vmodmap = 0;
+
+        if (!get_vmodmaps(keymap, conn, reply, &map))
+            goto fail;
+    }
+
+    free(reply);
+    return true;
+
+fail:
+    free(reply);
+    return false;
+}
+
+static bool
+update_from_map_notify(struct xkb_keymap *keymap, xcb_connection_t *conn,
+                       const xcb_xkb_map_notify_event_t *event)
+{
+    struct key_range syms = { 0, 0 }, explicits = { 0, 0 };
+    struct key_range modmaps = { 0, 0 }, vmodmaps = { 0, 0 };
+    uint16_t virtual_mods = 0;
+    uint16_t partial = 0;
+    xcb_xkb_get_map_reply_t *reply;
+
+    /*
+     * The actions are parsed along with the key sym maps, and re-creating
+     * the groups of a key drops their explicit types, so these are always
+     * fetched together.
+     */
+    if (event->changed & XCB_XKB_MAP_PART_KEY_SYMS)
+        key_range_add(&syms, event->firstKeySym, event->nKeySyms);
+    if (event->changed & XCB_XKB_MAP_PART_KEY_ACTIONS)
+        key_range_add(&syms, event->firstKeyAct, event->nKeyActs);
+    key_range_add(&explicits, syms.first, syms.count);
+    if (event->changed & XCB_XKB_MAP_PART_EXPLICIT_COMPONENTS)
+        key_range_add(&explicits, event->firstKeyExplicit, event->nKeyExplicit);
+
+    if (event->changed & XCB_XKB_MAP_PART_MODIFIER_MAP)
+        key_range_add(&modmaps, event->firstModMapKey, event->nModMapKeys);
+    if (event->changed & XCB_XKB_MAP_PART_VIRTUAL_MOD_MAP)
+        key_range_add(&vmodmaps, event->firstVModMapKey, event->nVModMapKeys);
+    if (event->changed & XCB_XKB_MAP_PART_VIRTUAL_MODS)
+        virtual_mods = event->virtualMods;
+
+    if (syms.count > 0)
+        partial |= XCB_XKB_MAP_PART_KEY_SYMS | XCB_XKB_MAP_PART_KEY_ACTIONS;
+    if (explicits.count > 0)
+        partial |= XCB_XKB_MAP_PART_EXPLICIT_COMPONENTS;
+    if (modmaps.count > 0)
+        partial |= XCB_XKB_MAP_PART_MODIFIER_MAP;
+    if (vmodmaps.count > 0)
+        partial |= XCB_XKB_MAP_PART_VIRTUAL_MOD_MAP;
+    if (virtual_mods != 0)
+        partial |= XCB_XKB_MAP_PART_VIRTUAL_MODS;
+
+    if (partial == 0)
+        return true;
+
+    reply = xcb_xkb_get_map_reply(conn,
+        xcb_xkb_get_map(conn, event->deviceID, 0, partial,
+                        0, 0,
+                        syms.first, syms.count,
+                        syms.first, syms.count,
+                        0, 0,
+                        virtual_mods,
+                        explicits.first, explicits.count,
+                        modmaps.first, modmaps.count,
+                        vmodmaps.first, vmodmaps.count),
+        NULL);
+
+    return update_map(keymap, conn, partial, reply);
+}
+
+static bool
+update_names(struct xkb_keymap *keymap, struct x11_atom_interner *interner,
+             uint32_t which, xcb_xkb_get_names_reply_t *reply)
+{
+    xcb_connection_t *conn = interner->conn;
+    xcb_xkb_get_names_value_list_t list;
+
+    FAIL_IF_BAD_REPLY(reply, "XkbGetNames");
+
+    FAIL_UNLESS((reply->which & which) == which);
+
+    xcb_xkb_get_names_value_list_unpack(xcb_xkb_get_names_value_list(reply),
+                                        reply->nTypes,
+                                        reply->indicators,
+                                        reply->virtualMods,
+                                        reply->groupNames,
+                                        reply->nKeys,
+                                        reply->nKeyAliases,
+                                        reply->nRadioGroups,
+                                        reply->which,
+                                        &list);
+
+    if (which & XCB_XKB_NAME_DETAIL_KEYCODES) {
+        free(keymap->keycodes_section_name);
+        x11_atom_interner_get_escaped_atom_name(interner, list.keycodesName,
+                                                &keymap->keycodes_section_name);
+    }
+    if (which & XCB_XKB_NAME_DETAIL_SYMBOLS) {
+        free(keymap->symbols_section_name);
+        x11_atom_interner_get_escaped_atom_name(interner, list.symbolsName,
+                                                &keymap->symbols_section_name);
+    }
+    if (which & XCB_XKB_NAME_DETAIL_TYPES) {
+        free(keymap->types_section_name);
+        x11_atom_interner_get_escaped_atom_name(interner, list.typesName,
+                                                &keymap->types_section_name);
+    }
+    if (which & XCB_XKB_NAME_DETAIL_COMPAT) {
+        free(keymap->compat_section_name);
+        x11_atom_interner_get_escaped_atom_name(interner, list.compatName,
+                                                &keymap->compat_section_name);
+    }
+
+    if (which & XCB_XKB_NAME_DETAIL_KEY_TYPE_NAMES) {
+        for (unsigned i = 0; i < keymap->num_types; i++) {
+            free(keymap->types[i].level_names);
+            keymap->types[i].level_names = NULL;
+            keymap->types[i].num_level_names = 0;
+        }
+
+        if (!get_type_names(keymap, interner, reply, &list))
+            goto fail;
+    }
+
+    if (which & XCB_XKB_NAME_DETAIL_INDICATOR_NAMES) {
+        for (unsigned i = 0; i < NUM_INDICATORS; i++)
+            keymap->leds[i].name = XKB_ATOM_NONE;
+
+        if (!get_indicator_names(keymap, interner, reply, &list))
+            goto fail;
+    }
+
+    if (which & XCB_XKB_NAME_DETAIL_VIRTUAL_MOD_NAMES) {
+        for (unsigned i = 0; i < NUM_VMODS; i++)
+            keymap->mods.mods[NUM_REAL_MODS + i].name = XKB_ATOM_NONE;
+
+        if (!get_vmod_names(keymap, interner, reply, &list))
+            goto fail;
+    }
+
+    if (which & XCB_XKB_NAME_DETAIL_GROUP_NAMES) {
+        free(keymap->group_names);
+        keymap->group_names = NULL;
+        keymap->num_group_names = 0;
+
+        if (!get_group_names(keymap, interner, reply, &list))
+            goto fail;
+    }
+
+    if (which & XCB_XKB_NAME_DETAIL_KEY_NAMES) {
+        if (!get_key_names(keymap, conn, reply, &list))
+            goto fail;
+    }
+
+    if (which & XCB_XKB_NAME_DETAIL_KEY_ALIASES) {
+        free(keymap->key_aliases);
+        keymap->key_aliases = NULL;
+        keymap->num_key_aliases = 0;
+
+        if (!get_aliases(keymap, conn, reply, &list))
+            goto fail;
+    }
+
+    free(reply);
+    return true;
+
+fail:
+    free(reply);
+    return false;
+}
+
+static bool
+update_from_names_notify(struct xkb_keymap *keymap, xcb_connection_t *conn,
+                         const xcb_xkb_names_notify_event_t *event)
+{
+    uint32_t which = event->changed & get_names_wanted;
     struct x11_atom_interner interner;
-    x11_atom_interner_init(&interner, ctx, conn);
+    xcb_xkb_get_names_reply_t *reply;
+    bool ok;
 
-    xcb_xkb_get_map_cookie_t get_map_cookie =
-        xcb_xkb_get_map(conn, device_id, get_map_required_components,
-                        0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
-    xcb_xkb_get_indicator_map_cookie_t indicator_map_cookie =
-        xcb_xkb_get_indicator_map(conn, device_id, ALL_INDICATORS_MASK);
-    xcb_xkb_get_compat_map_cookie_t compat_map_cookie =
-        xcb_xkb_get_compat_map(conn, device_id, 0, true, 0, 0);
-    xcb_xkb_get_names_cookie_t get_names_cookie =
-        xcb_xkb_get_names(conn, device_id, get_names_wanted);
-    xcb_xkb_get_controls_cookie_t get_controls_cookie =
-        xcb_xkb_get_controls(conn, device_id);
-
-    bool had_error = false;
-    had_error |= !get_map(keymap, conn, get_map_cookie);
-    had_error |= !get_indicator_map(keymap, conn, indicator_map_cookie);
-    had_error |= !get_compat_map(keymap, conn, compat_map_cookie);
-    had_error |= !get_names(keymap, &interner, get_names_cookie);
-    had_error |= !get_controls(keymap, conn, get_controls_cookie);
+    /* get_type_names() handles both at once. */
+    if (which & (XCB_XKB_NAME_DETAIL_KEY_TYPE_NAMES |
+                 XCB_XKB_NAME_DETAIL_KT_LEVEL_NAMES))
+        which |= (XCB_XKB_NAME_DETAIL_KEY_TYPE_NAMES |
+                  XCB_XKB_NAME_DETAIL_KT_LEVEL_NAMES);
+
+    if (which == 0)
+        return true;
+
+    reply = xcb_xkb_get_names_reply(conn,
+        xcb_xkb_get_names(conn, event->deviceID, which),
+        NULL);
 
+    x11_atom_interner_init(&interner, keymap->ctx, conn);
+    ok = update_names(keymap, &interner, which, reply);
     x11_atom_interner_round_trip(&interner);
-    had_error |= interner.had_error;
-    if (had_error) {
+    x11_atom_interner_finish(&interner);
+
+    return ok && !interner.had_error;
+}
+
+XKB_EXPORT struct xkb_keymap *
+xkb_x11_keymap_new_from_notify(struct xkb_keymap *old,
+                               xcb_connection_t *conn,
+                               const xcb_generic_event_t *event)
+{
+    struct xkb_context *ctx = old->ctx;
+    const xcb_xkb_map_notify_event_t *map_notify = (const void *) event;
+    const xcb_xkb_names_notify_event_t *names_notify = (const void *) event;
+    struct xkb_keymap *keymap;
+    bool ok;
+
+    switch (map_notify->xkbType) {
+    case XCB_XKB_MAP_NOTIFY:
+        /*
+         * The keys refer to the types by index, and their levels depend on
+         * the types; a different set of keys changes everything. Take the
+         * slow path then.
+         */
+        if ((map_notify->changed & XCB_XKB_MAP_PART_KEY_TYPES) ||
+            map_notify->minKeyCode != old->min_key_code ||
+            map_notify->maxKeyCode != old->max_key_code)
+            return xkb_x11_keymap_new_from_device(ctx, conn,
+                                                  map_notify->deviceID,
+                                                  old->flags);
+
+        keymap = copy_keymap(old);
+        if (!keymap)
+            return NULL;
+        ok = update_from_map_notify(keymap, conn, map_notify);
+        break;
+
+    case XCB_XKB_NAMES_NOTIFY:
+        keymap = copy_keymap(old);
+        if (!keymap)
+            return NULL;
+        ok = update_from_names_notify(keymap, conn, names_notify);
+        break;
+
+    default:
+        log_err_func(ctx, "unsupported XKB event type: %d\n",
+                     map_notify->xkbType);
+        return NULL;
+    }
+
+    if (!ok) {
         xkb_keymap_unref(keymap);
         return NULL;
     }
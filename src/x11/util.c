@@ -23,6 +23,9 @@
 
 #include "config.h"
 
+#include <time.h>
+#include <unistd.h>
+
 #include "x11-priv.h"
 
 XKB_EXPORT int
@@ -124,44 +127,360 @@ xkb_x11_get_core_keyboard_device_id(xcb_connection_t *conn)
     return device_id;
 }
 
+/*
+ * Cache of the names of X atoms, kept in the context across keymap fetches
+ * and connections.
+ *
+ * Atoms belong to an X server rather than to a connection, so the entries
+ * are keyed by a server identity and the X atom. The protocol has no ID
+ * for a server session, and servers started the same way have the same
+ * connection setup and may hand out the same atoms for different names. So
+ * the first client to need one stores a random token in a property of the
+ * first root window; it is gone when the server exits. The cache entries
+ * are keyed by the token, and every interner checks that the server still
+ * has the token it last saw, with a GetProperty sent along with the other
+ * requests. If it does not, the server's entries are dropped and the names
+ * are requested again.
+ */
+struct x11_atom_cache_entry {
+    uint64_t server;
+    /* XCB_ATOM_NONE if the slot is free. */
+    xcb_atom_t from;
+    xkb_atom_t to;
+};
+
+/* The token we last saw on the servers with a given connection setup. */
+struct x11_atom_cache_server {
+    /* 0 if the slot is free. */
+    uint64_t setup;
+    xcb_atom_t property;
+    uint64_t token;
+    /* We wrote the token, and did not see it on the server since. */
+    bool written;
+    /* Writing the token did not work; don't cache the atoms. */
+    bool disabled;
+};
+
+#define ATOM_CACHE_MAX_SERVERS 8
+
 struct x11_atom_cache {
-    /*
-     * Invalidate the cache based on the XCB connection.
-     * X11 atoms are actually not per connection or client, but per X server
-     * session. But better be safe just in case we survive an X server restart.
-     */
-    xcb_connection_t *conn;
-    struct {
-        xcb_atom_t from;
-        xkb_atom_t to;
-    } cache[256];
-    size_t len;
+    struct x11_atom_cache_server servers[ATOM_CACHE_MAX_SERVERS];
+    /* The slot to reuse when all are taken. */
+    size_t next_server;
+    size_t count;
+    /* Number of slots minus one; the table is at most half full. */
+    size_t mask;
+    struct x11_atom_cache_entry entries[];
 };
 
+#define ATOM_CACHE_MIN_SLOTS 256
+#define ATOM_CACHE_MAX_ENTRIES 4096
+
+/* The atoms up to XA_LAST_PREDEFINED have the same names on all servers. */
+#define LAST_PREDEFINED_ATOM XCB_ATOM_WM_TRANSIENT_FOR
+
+/* The property of the root window which holds the token of the server. */
+#define SERVER_TOKEN_PROPERTY "_XKBCOMMON_SERVER_TOKEN"
+
+/*
+ * Hash the parts of the connection setup which are the same for all the
+ * clients of a server.
+ */
+static uint64_t
+get_setup_hash(const xcb_setup_t *setup)
+{
+    uint64_t hash = HASH_STRING_INIT;
+
+    hash = hash_bytes(hash, (const char *) &setup->protocol_major_version,
+                      sizeof(setup->protocol_major_version));
+    hash = hash_bytes(hash, (const char *) &setup->protocol_minor_version,
+                      sizeof(setup->protocol_minor_version));
+    hash = hash_bytes(hash, (const char *) &setup->release_number,
+                      sizeof(setup->release_number));
+    hash = hash_bytes(hash, xcb_setup_vendor(setup),
+                      xcb_setup_vendor_length(setup));
+    for (xcb_screen_iterator_t iter = xcb_setup_roots_iterator(setup);
+         iter.rem; xcb_screen_next(&iter))
+        hash = hash_bytes(hash, (const char *) &iter.data->root,
+                          sizeof(iter.data->root));
+
+    /* 0 marks a free server slot. */
+    return hash ? hash : 1;
+}
+
+/*
+ * Make up a token for a server. It only needs to differ from the tokens
+ * other clients make up, not to be unpredictable.
+ */
+static uint64_t
+new_server_token(uint64_t setup)
+{
+    static unsigned int counter;
+    struct {
+        struct timespec now;
+        pid_t pid;
+        unsigned int counter;
+        uint64_t setup;
+    } seed;
+    uint64_t hash;
+
+    memset(&seed, 0, sizeof(seed));
+    clock_gettime(CLOCK_REALTIME, &seed.now);
+    seed.pid = getpid();
+    seed.counter = counter++;
+    seed.setup = setup;
+
+    hash = hash_bytes(HASH_STRING_INIT, (const char *) &seed, sizeof(seed));
+    /* 0 means the server is not known. */
+    return hash ? hash : 1;
+}
+
+static size_t
+atom_cache_slot(const struct x11_atom_cache *cache,
+                uint64_t server, xcb_atom_t atom)
+{
+    uint64_t hash = (server ^ atom) * UINT64_C(0x9e3779b97f4a7c15);
+    return (hash >> 32) & cache->mask;
+}
+
 static struct x11_atom_cache *
-get_cache(struct xkb_context *ctx, xcb_connection_t *conn)
+atom_cache_new(size_t num_slots)
 {
-    if (!ctx->x11_atom_cache) {
-        ctx->x11_atom_cache = calloc(1, sizeof(struct x11_atom_cache));
-    }
+    struct x11_atom_cache *cache;
+
+    cache = calloc(1, sizeof(*cache) + num_slots * sizeof(cache->entries[0]));
+    if (cache)
+        cache->mask = num_slots - 1;
+    return cache;
+}
+
+static struct x11_atom_cache *
+get_cache(struct xkb_context *ctx)
+{
+    if (!ctx->x11_atom_cache)
+        ctx->x11_atom_cache = atom_cache_new(ATOM_CACHE_MIN_SLOTS);
     /* Can be NULL in case the malloc failed. */
-    struct x11_atom_cache *cache = ctx->x11_atom_cache;
-    if (cache && cache->conn != conn) {
-        cache->conn = conn;
-        cache->len = 0;
+    return ctx->x11_atom_cache;
+}
+
+static xkb_atom_t
+atom_cache_lookup(const struct x11_atom_cache *cache,
+                  uint64_t server, xcb_atom_t atom)
+{
+    for (size_t i = atom_cache_slot(cache, server, atom);;
+         i = (i + 1) & cache->mask) {
+        const struct x11_atom_cache_entry *entry = &cache->entries[i];
+
+        if (entry->from == XCB_ATOM_NONE)
+            return XKB_ATOM_NONE;
+        if (entry->from == atom && entry->server == server)
+            return entry->to;
+    }
+}
+
+static void
+atom_cache_insert(struct x11_atom_cache *cache,
+                  uint64_t server, xcb_atom_t from, xkb_atom_t to)
+{
+    size_t i = atom_cache_slot(cache, server, from);
+
+    while (cache->entries[i].from != XCB_ATOM_NONE) {
+        if (cache->entries[i].from == from &&
+            cache->entries[i].server == server) {
+            cache->entries[i].to = to;
+            return;
+        }
+        i = (i + 1) & cache->mask;
     }
+
+    cache->entries[i].server = server;
+    cache->entries[i].from = from;
+    cache->entries[i].to = to;
+    cache->count++;
+}
+
+/*
+ * Move the entries to a table with @num_slots slots, leaving out those of
+ * @forget_server if it is not NULL.
+ */
+static struct x11_atom_cache *
+atom_cache_rebuild(struct xkb_context *ctx, size_t num_slots,
+                   const uint64_t *forget_server)
+{
+    struct x11_atom_cache *old = ctx->x11_atom_cache;
+    struct x11_atom_cache *cache = atom_cache_new(num_slots);
+
+    if (!cache)
+        return NULL;
+
+    memcpy(cache->servers, old->servers, sizeof(cache->servers));
+    cache->next_server = old->next_server;
+
+    for (size_t i = 0; i <= old->mask; i++) {
+        const struct x11_atom_cache_entry *entry = &old->entries[i];
+
+        if (entry->from == XCB_ATOM_NONE ||
+            (forget_server && entry->server == *forget_server))
+            continue;
+        atom_cache_insert(cache, entry->server, entry->from, entry->to);
+    }
+
+    free(old);
+    ctx->x11_atom_cache = cache;
     return cache;
 }
 
+static void
+atom_cache_add(struct xkb_context *ctx,
+               uint64_t server, xcb_atom_t from, xkb_atom_t to)
+{
+    struct x11_atom_cache *cache = get_cache(ctx);
+
+    if (!cache || server == 0)
+        return;
+
+    if ((cache->count + 1) * 2 > cache->mask + 1) {
+        if (cache->count >= ATOM_CACHE_MAX_ENTRIES)
+            return;
+        cache = atom_cache_rebuild(ctx, (cache->mask + 1) * 2, NULL);
+        if (!cache)
+            return;
+    }
+
+    atom_cache_insert(cache, server, from, to);
+}
+
+static void
+atom_cache_forget(struct xkb_context *ctx, uint64_t server)
+{
+    struct x11_atom_cache *cache = get_cache(ctx);
+
+    if (!cache || server == 0)
+        return;
+
+    if (!atom_cache_rebuild(ctx, cache->mask + 1, &server)) {
+        memset(cache->entries, 0, (cache->mask + 1) * sizeof(cache->entries[0]));
+        cache->count = 0;
+    }
+}
+
+static struct x11_atom_cache_server *
+atom_cache_find_server(struct x11_atom_cache *cache, uint64_t setup)
+{
+    for (size_t i = 0; i < ATOM_CACHE_MAX_SERVERS; i++)
+        if (cache->servers[i].setup == setup)
+            return &cache->servers[i];
+    return NULL;
+}
+
+/* Remember the token of a server, replacing the one we saw before. */
+static void
+atom_cache_set_server(struct xkb_context *ctx, uint64_t setup,
+                      xcb_atom_t property, uint64_t token, bool written)
+{
+    struct x11_atom_cache *cache = get_cache(ctx);
+    struct x11_atom_cache_server *server;
+
+    if (!cache)
+        return;
+
+    server = atom_cache_find_server(cache, setup);
+    if (!server) {
+        server = &cache->servers[cache->next_server];
+        cache->next_server = (cache->next_server + 1) % ATOM_CACHE_MAX_SERVERS;
+    }
+
+    if (server->token != 0 && server->token != token) {
+        uint64_t old_token = server->token;
+        size_t idx = server - cache->servers;
+
+        /* The cache moves. */
+        atom_cache_forget(ctx, old_token);
+        cache = ctx->x11_atom_cache;
+        server = &cache->servers[idx];
+    }
+
+    server->setup = setup;
+    server->property = property;
+    server->token = token;
+    server->written = written;
+    server->disabled = false;
+}
+
 void
 x11_atom_interner_init(struct x11_atom_interner *interner,
                        struct xkb_context *ctx, xcb_connection_t *conn)
 {
+    const xcb_setup_t *setup = xcb_get_setup(conn);
+    struct x11_atom_cache *cache = get_cache(ctx);
+    const struct x11_atom_cache_server *server = NULL;
+
     interner->had_error = false;
     interner->ctx = ctx;
     interner->conn = conn;
-    interner->num_pending = 0;
-    interner->num_copies = 0;
+    interner->server = 0;
+    interner->setup = 0;
+    interner->server_id_state = SERVER_ID_DONE;
+    interner->root = XCB_WINDOW_NONE;
+    interner->server_id_property = XCB_ATOM_NONE;
+    darray_init(interner->pending);
+    interner->num_pending_done = 0;
+    darray_init(interner->copies);
+    darray_init(interner->unverified);
+    interner->num_escaped = 0;
+
+    /* Without a root window for the token, nothing is cached. */
+    if (!cache || !setup || xcb_setup_roots_length(setup) < 1)
+        return;
+
+    interner->setup = get_setup_hash(setup);
+    interner->root = xcb_setup_roots_iterator(setup).data->root;
+
+    server = atom_cache_find_server(cache, interner->setup);
+    if (server && server->disabled)
+        return;
+
+    if (server && server->token != 0) {
+        interner->server = server->token;
+        interner->server_id_property = server->property;
+        interner->property_cookie =
+            xcb_get_property(conn, 0, interner->root, server->property,
+                             XCB_ATOM_INTEGER, 0, 2);
+        interner->server_id_state = SERVER_ID_CHECKING;
+    }
+    else {
+        interner->intern_cookie =
+            xcb_intern_atom(conn, 0, strlen(SERVER_TOKEN_PROPERTY),
+                            SERVER_TOKEN_PROPERTY);
+        interner->server_id_state = SERVER_ID_INTERNING;
+    }
+}
+
+void
+x11_atom_interner_finish(struct x11_atom_interner *interner)
+{
+    for (size_t i = interner->num_pending_done;
+         i < darray_size(interner->pending); i++)
+        xcb_discard_reply(interner->conn,
+                          darray_item(interner->pending, i).cookie.sequence);
+
+    switch (interner->server_id_state) {
+    case SERVER_ID_CHECKING:
+    case SERVER_ID_FETCHING:
+        xcb_discard_reply(interner->conn, interner->property_cookie.sequence);
+        break;
+    case SERVER_ID_INTERNING:
+        xcb_discard_reply(interner->conn, interner->intern_cookie.sequence);
+        break;
+    case SERVER_ID_DONE:
+        break;
+    }
+    interner->server_id_state = SERVER_ID_DONE;
+
+    darray_free(interner->pending);
+    darray_free(interner->copies);
+    darray_free(interner->unverified);
+    interner->num_pending_done = 0;
     interner->num_escaped = 0;
 }
 
@@ -175,123 +494,305 @@ x11_atom_interner_adopt_atom(struct x11_atom_interner *interner,
         return;
 
     /* Can be NULL in case the malloc failed. */
-    struct x11_atom_cache *cache = get_cache(interner->ctx, interner->conn);
-
-retry:
+    struct x11_atom_cache *cache = get_cache(interner->ctx);
 
     /* Already in the cache? */
-    if (cache) {
-        for (size_t c = 0; c < cache->len; c++) {
-            if (cache->cache[c].from == atom) {
-                *out = cache->cache[c].to;
-                return;
+    if (cache && interner->server != 0) {
+        xkb_atom_t cached = atom_cache_lookup(cache, interner->server, atom);
+
+        if (cached != XKB_ATOM_NONE) {
+            *out = cached;
+
+            if (atom > LAST_PREDEFINED_ATOM &&
+                interner->server_id_state == SERVER_ID_CHECKING) {
+                darray_resize(interner->unverified,
+                              darray_size(interner->unverified) + 1);
+                size_t idx = darray_size(interner->unverified) - 1;
+                darray_item(interner->unverified, idx).from = atom;
+                darray_item(interner->unverified, idx).out = out;
             }
+            return;
         }
     }
 
     /* Already pending? */
-    for (size_t i = 0; i < interner->num_pending; i++) {
-        if (interner->pending[i].from == atom) {
-            if (interner->num_copies == ARRAY_SIZE(interner->copies)) {
-                x11_atom_interner_round_trip(interner);
-                goto retry;
-            }
-
-            size_t idx = interner->num_copies++;
-            interner->copies[idx].from = atom;
-            interner->copies[idx].out = out;
+    for (size_t i = interner->num_pending_done;
+         i < darray_size(interner->pending); i++) {
+        if (darray_item(interner->pending, i).from == atom) {
+            darray_resize(interner->copies, darray_size(interner->copies) + 1);
+            size_t idx = darray_size(interner->copies) - 1;
+            darray_item(interner->copies, idx).from = atom;
+            darray_item(interner->copies, idx).out = out;
             return;
         }
     }
 
     /* We have to send a GetAtomName request */
-    if (interner->num_pending == ARRAY_SIZE(interner->pending)) {
-        x11_atom_interner_round_trip(interner);
-        assert(interner->num_pending < ARRAY_SIZE(interner->pending));
+    darray_resize(interner->pending, darray_size(interner->pending) + 1);
+    size_t idx = darray_size(interner->pending) - 1;
+    darray_item(interner->pending, idx).from = atom;
+    darray_item(interner->pending, idx).out = out;
+    darray_item(interner->pending, idx).cookie =
+        xcb_get_atom_name(interner->conn, atom);
+}
+
+/*
+ * Get the reply to a request. If @block is false and the reply has not
+ * arrived yet, returns false. A NULL reply means the request failed.
+ */
+static bool
+get_reply(xcb_connection_t *conn, unsigned int sequence, bool block,
+          void **reply)
+{
+    *reply = NULL;
+
+    if (block) {
+        *reply = xcb_wait_for_reply(conn, sequence, NULL);
+        return true;
+    }
+
+    return xcb_poll_for_reply(conn, sequence, reply, NULL);
+}
+
+static bool
+get_token(const xcb_get_property_reply_t *reply, uint64_t *token)
+{
+    const uint32_t *value;
+
+    if (!reply || reply->type != XCB_ATOM_INTEGER || reply->format != 32 ||
+        reply->value_len != 2 || reply->bytes_after != 0)
+        return false;
+
+    value = xcb_get_property_value(reply);
+    *token = value[0] | ((uint64_t) value[1] << 32);
+    return *token != 0;
+}
+
+/* The server does not have the token we last saw. */
+static void
+server_token_mismatch(struct x11_atom_interner *interner)
+{
+    struct x11_atom_cache *cache = get_cache(interner->ctx);
+    struct x11_atom_cache_server *server = NULL;
+    darray(struct {
+        xcb_atom_t from;
+        xkb_atom_t *out;
+    }) unverified;
+
+    atom_cache_forget(interner->ctx, interner->server);
+    interner->server = 0;
+
+    cache = get_cache(interner->ctx);
+    if (cache)
+        server = atom_cache_find_server(cache, interner->setup);
+    if (server) {
+        /*
+         * If the token we wrote never showed up, we are not allowed to
+         * write it; don't try again on every fetch.
+         */
+        server->disabled = server->written;
+        server->token = 0;
+    }
+
+    /* Ask for all the names again. */
+    memcpy(&unverified, &interner->unverified, sizeof(unverified));
+    darray_init(interner->unverified);
+    for (size_t i = 0; i < darray_size(unverified); i++)
+        x11_atom_interner_adopt_atom(interner,
+                                     darray_item(unverified, i).from,
+                                     darray_item(unverified, i).out);
+    darray_free(unverified);
+
+    if (server && server->disabled) {
+        interner->server_id_state = SERVER_ID_DONE;
+        return;
+    }
+
+    interner->intern_cookie =
+        xcb_intern_atom(interner->conn, 0, strlen(SERVER_TOKEN_PROPERTY),
+                        SERVER_TOKEN_PROPERTY);
+    interner->server_id_state = SERVER_ID_INTERNING;
+}
+
+/* Find out the token of the server, before the atoms are cached. */
+static bool
+collect_server_id(struct x11_atom_interner *interner, bool block)
+{
+    xcb_connection_t *conn = interner->conn;
+
+    for (;;) {
+        xcb_get_property_reply_t *property;
+        xcb_intern_atom_reply_t *intern;
+        uint64_t token = 0;
+        bool written = false;
+
+        switch (interner->server_id_state) {
+        case SERVER_ID_DONE:
+            return true;
+
+        case SERVER_ID_CHECKING:
+            if (!get_reply(conn, interner->property_cookie.sequence, block,
+                           (void **) &property))
+                return false;
+
+            if (get_token(property, &token) && token == interner->server) {
+                struct x11_atom_cache *cache = get_cache(interner->ctx);
+                struct x11_atom_cache_server *server =
+                    cache ? atom_cache_find_server(cache, interner->setup) : NULL;
+
+                if (server)
+                    server->written = false;
+                darray_resize(interner->unverified, 0);
+                interner->server_id_state = SERVER_ID_DONE;
+            }
+            else {
+                /* Probably a restarted server, or another one. */
+                server_token_mismatch(interner);
+                if (!block)
+                    xcb_flush(conn);
+            }
+            free(property);
+            break;
+
+        case SERVER_ID_INTERNING:
+            if (!get_reply(conn, interner->intern_cookie.sequence, block,
+                           (void **) &intern))
+                return false;
+
+            if (!intern || intern->atom == XCB_ATOM_NONE) {
+                interner->server_id_state = SERVER_ID_DONE;
+            }
+            else {
+                interner->server_id_property = intern->atom;
+                interner->property_cookie =
+                    xcb_get_property(conn, 0, interner->root, intern->atom,
+                                     XCB_ATOM_INTEGER, 0, 2);
+                interner->server_id_state = SERVER_ID_FETCHING;
+                if (!block)
+                    xcb_flush(conn);
+            }
+            free(intern);
+            break;
+
+        case SERVER_ID_FETCHING:
+            if (!get_reply(conn, interner->property_cookie.sequence, block,
+                           (void **) &property))
+                return false;
+
+            if (!get_token(property, &token)) {
+                /* The first client to get here stores a token. */
+                uint32_t value[2];
+
+                token = new_server_token(interner->setup);
+                value[0] = token & 0xffffffff;
+                value[1] = token >> 32;
+                xcb_discard_reply(conn, xcb_change_property_checked(
+                    conn, XCB_PROP_MODE_REPLACE, interner->root,
+                    interner->server_id_property, XCB_ATOM_INTEGER, 32,
+                    ARRAY_SIZE(value), value).sequence);
+                written = true;
+            }
+            free(property);
+
+            atom_cache_set_server(interner->ctx, interner->setup,
+                                  interner->server_id_property, token, written);
+            interner->server = token;
+            interner->server_id_state = SERVER_ID_DONE;
+            break;
+        }
     }
-    size_t idx = interner->num_pending++;
-    interner->pending[idx].from = atom;
-    interner->pending[idx].out = out;
-    interner->pending[idx].cookie = xcb_get_atom_name(interner->conn, atom);
 }
 
-void x11_atom_interner_round_trip(struct x11_atom_interner *interner) {
+static bool
+x11_atom_interner_collect(struct x11_atom_interner *interner, bool block)
+{
     struct xkb_context *ctx = interner->ctx;
     xcb_connection_t *conn = interner->conn;
 
-    /* Can be NULL in case the malloc failed. */
-    struct x11_atom_cache *cache = get_cache(ctx, conn);
+    /* The requests may still sit in the output buffer. */
+    if (!block && (interner->server_id_state != SERVER_ID_DONE ||
+                   interner->num_pending_done < darray_size(interner->pending)))
+        xcb_flush(conn);
 
-    for (size_t i = 0; i < interner->num_pending; i++) {
+    /* The names are cached under the token, so get it first. */
+    if (!collect_server_id(interner, block))
+        return false;
+
+    while (interner->num_pending_done < darray_size(interner->pending)) {
+        size_t i = interner->num_pending_done;
         xcb_get_atom_name_reply_t *reply;
 
-        reply = xcb_get_atom_name_reply(conn, interner->pending[i].cookie, NULL);
+        if (!get_reply(conn, darray_item(interner->pending, i).cookie.sequence,
+                       block, (void **) &reply))
+            return false;
+
+        interner->num_pending_done++;
         if (!reply) {
             interner->had_error = true;
             continue;
         }
-        xcb_atom_t x11_atom = interner->pending[i].from;
+        xcb_atom_t x11_atom = darray_item(interner->pending, i).from;
         xkb_atom_t atom = xkb_atom_intern(ctx,
                                           xcb_get_atom_name_name(reply),
                                           xcb_get_atom_name_name_length(reply));
         free(reply);
 
-        if (cache && cache->len < ARRAY_SIZE(cache->cache)) {
-            size_t idx = cache->len++;
-            cache->cache[idx].from = x11_atom;
-            cache->cache[idx].to = atom;
-        }
+        atom_cache_add(ctx, interner->server, x11_atom, atom);
 
-        *interner->pending[i].out = atom;
+        *darray_item(interner->pending, i).out = atom;
 
-        for (size_t j = 0; j < interner->num_copies; j++) {
-            if (interner->copies[j].from == x11_atom)
-                *interner->copies[j].out = atom;
+        for (size_t j = 0; j < darray_size(interner->copies); j++) {
+            if (darray_item(interner->copies, j).from == x11_atom)
+                *darray_item(interner->copies, j).out = atom;
         }
     }
 
     for (size_t i = 0; i < interner->num_escaped; i++) {
-        xcb_get_atom_name_reply_t *reply;
-        int length;
-        char *name;
+        xkb_atom_t atom = interner->escaped[i].atom;
         char **out = interner->escaped[i].out;
 
-        reply = xcb_get_atom_name_reply(conn, interner->escaped[i].cookie, NULL);
-        *interner->escaped[i].out = NULL;
-        if (!reply) {
+        if (atom == XKB_ATOM_NONE)
+            continue;
+
+        *out = strdup(xkb_atom_text(ctx, atom));
+        if (*out == NULL) {
             interner->had_error = true;
         } else {
-            length = xcb_get_atom_name_name_length(reply);
-            name = xcb_get_atom_name_name(reply);
-
-            *out = strndup(name, length);
-            free(reply);
-            if (*out == NULL) {
-                interner->had_error = true;
-            } else {
-                XkbEscapeMapName(*out);
-            }
+            XkbEscapeMapName(*out);
         }
     }
 
-    interner->num_pending = 0;
-    interner->num_copies = 0;
+    darray_resize(interner->pending, 0);
+    darray_resize(interner->copies, 0);
+    interner->num_pending_done = 0;
     interner->num_escaped = 0;
+    return true;
+}
+
+void
+x11_atom_interner_round_trip(struct x11_atom_interner *interner)
+{
+    x11_atom_interner_collect(interner, true);
+}
+
+bool
+x11_atom_interner_poll(struct x11_atom_interner *interner)
+{
+    return x11_atom_interner_collect(interner, false);
 }
 
 void
 x11_atom_interner_get_escaped_atom_name(struct x11_atom_interner *interner,
                                         xcb_atom_t atom, char **out)
 {
-    if (atom == 0) {
-        *out = NULL;
+    *out = NULL;
+    if (atom == 0)
         return;
-    }
     size_t idx = interner->num_escaped++;
     /* There can only be a fixed number of calls to this function "in-flight",
      * thus we assert this number. Increase the array size if this assert fails.
      */
     assert(idx < ARRAY_SIZE(interner->escaped));
     interner->escaped[idx].out = out;
-    interner->escaped[idx].cookie = xcb_get_atom_name(interner->conn, atom);
+    x11_atom_interner_adopt_atom(interner, atom, &interner->escaped[idx].atom);
 }
@@ -25,6 +25,7 @@
 #define _XKBCOMMON_X11_PRIV_H
 
 #include <xcb/xkb.h>
+#include <xcb/xcbext.h>
 
 #include "keymap.h"
 #include "xkbcommon/xkbcommon-x11.h"
@@ -32,23 +33,51 @@
 struct x11_atom_interner {
     struct xkb_context *ctx;
     xcb_connection_t *conn;
+    /*
+     * Identifies the X server the atoms belong to, for the atom cache: the
+     * token in a property of its root window, or 0 while it is not known.
+     */
+    uint64_t server;
+    /* Hash of the connection setup, to find the token we last saw */
+    uint64_t setup;
+    /* The requests to get the token from the server */
+    enum {
+        SERVER_ID_DONE,
+        /* Checking the token we last saw, trusting the cache meanwhile */
+        SERVER_ID_CHECKING,
+        /* Interning the name of the property, then getting it */
+        SERVER_ID_INTERNING,
+        SERVER_ID_FETCHING,
+    } server_id_state;
+    xcb_window_t root;
+    xcb_atom_t server_id_property;
+    xcb_intern_atom_cookie_t intern_cookie;
+    xcb_get_property_cookie_t property_cookie;
     bool had_error;
     /* Atoms for which we send a GetAtomName request */
-    struct {
+    darray(struct {
         xcb_atom_t from;
         xkb_atom_t *out;
         xcb_get_atom_name_cookie_t cookie;
-    } pending[128];
-    size_t num_pending;
+    }) pending;
+    /* Number of leading pending requests whose reply was already handled */
+    size_t num_pending_done;
     /* Atoms which were already pending but queried again */
-    struct {
+    darray(struct {
+        xcb_atom_t from;
+        xkb_atom_t *out;
+    }) copies;
+    /*
+     * Atoms taken from the cache while the token of the server is being
+     * checked; they are requested again if it does not match.
+     */
+    darray(struct {
         xcb_atom_t from;
         xkb_atom_t *out;
-    } copies[128];
-    size_t num_copies;
-    /* These are not interned, but saved directly (after XkbEscapeMapName) */
+    }) unverified;
+    /* These are saved as strings (after XkbEscapeMapName) at the end */
     struct {
-        xcb_get_atom_name_cookie_t cookie;
+        xkb_atom_t atom;
         char **out;
     } escaped[4];
     size_t num_escaped;
@@ -58,12 +87,27 @@ void
 x11_atom_interner_init(struct x11_atom_interner *interner,
                        struct xkb_context *ctx, xcb_connection_t *conn);
 
+/*
+ * Discard the replies which were not handled yet and release the memory held
+ * by the interner.
+ */
+void
+x11_atom_interner_finish(struct x11_atom_interner *interner);
+
 void
 x11_atom_interner_round_trip(struct x11_atom_interner *interner);
 
+/*
+ * Like x11_atom_interner_round_trip(), but only handles the replies which
+ * have already arrived, without blocking. Returns true once all pending
+ * requests are handled.
+ */
+bool
+x11_atom_interner_poll(struct x11_atom_interner *interner);
+
 /*
  * Make a xkb_atom_t's from X atoms. The actual write is delayed until the next
- * call to x11_atom_interner_round_trip() or when too many atoms are pending.
+ * call to x11_atom_interner_round_trip() or x11_atom_interner_poll().
  */
 void
 x11_atom_interner_adopt_atom(struct x11_atom_interner *interner,
@@ -71,7 +115,8 @@ x11_atom_interner_adopt_atom(struct x11_atom_interner *interner,
 
 /*
  * Get a strdup'd and XkbEscapeMapName'd name of an X atom. The actual write is
- * delayed until the next call to x11_atom_interner_round_trip().
+ * delayed until the next call to x11_atom_interner_round_trip() or
+ * x11_atom_interner_poll().
  */
 void
 x11_atom_interner_get_escaped_atom_name(struct x11_atom_interner *interner,
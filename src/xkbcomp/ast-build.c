@@ -56,11 +56,13 @@
 #include "xkbcomp-priv.h"
 #include "ast-build.h"
 #include "include.h"
+#include "arena.h"
 
 static ExprDef *
-ExprCreate(enum expr_op_type op, enum expr_value_type type, size_t size)
+ExprCreate(struct arena *arena, enum expr_op_type op,
+           enum expr_value_type type, size_t size)
 {
-    ExprDef *expr = malloc(size);
+    ExprDef *expr = arena_alloc(arena, size);
     if (!expr)
         return NULL;
 
@@ -73,9 +75,9 @@ ExprCreate(enum expr_op_type op, enum expr_value_type type, size_t size)
 }
 
 ExprDef *
-ExprCreateString(xkb_atom_t str)
+ExprCreateString(struct arena *arena, xkb_atom_t str)
 {
-    ExprDef *expr = ExprCreate(EXPR_VALUE, EXPR_TYPE_STRING, sizeof(ExprString));
+    ExprDef *expr = ExprCreate(arena, EXPR_VALUE, EXPR_TYPE_STRING, sizeof(ExprString));
     if (!expr)
         return NULL;
     expr->string.str = str;
@@ -83,9 +85,9 @@ ExprCreateString(xkb_atom_t str)
 }
 
 ExprDef *
-ExprCreateInteger(int ival)
+ExprCreateInteger(struct arena *arena, int ival)
 {
-    ExprDef *expr = ExprCreate(EXPR_VALUE, EXPR_TYPE_INT, sizeof(ExprInteger));
+    ExprDef *expr = ExprCreate(arena, EXPR_VALUE, EXPR_TYPE_INT, sizeof(ExprInteger));
     if (!expr)
         return NULL;
     expr->integer.ival = ival;
@@ -93,18 +95,18 @@ ExprCreateInteger(int ival)
 }
 
 ExprDef *
-ExprCreateFloat(void)
+ExprCreateFloat(struct arena *arena)
 {
-    ExprDef *expr = ExprCreate(EXPR_VALUE, EXPR_TYPE_FLOAT, sizeof(ExprFloat));
+    ExprDef *expr = ExprCreate(arena, EXPR_VALUE, EXPR_TYPE_FLOAT, sizeof(ExprFloat));
     if (!expr)
         return NULL;
     return expr;
 }
 
 ExprDef *
-ExprCreateBoolean(bool set)
+ExprCreateBoolean(struct arena *arena, bool set)
 {
-    ExprDef *expr = ExprCreate(EXPR_VALUE, EXPR_TYPE_BOOLEAN, sizeof(ExprBoolean));
+    ExprDef *expr = ExprCreate(arena, EXPR_VALUE, EXPR_TYPE_BOOLEAN, sizeof(ExprBoolean));
     if (!expr)
         return NULL;
     expr->boolean.set = set;
@@ -112,9 +114,9 @@ ExprCreateBoolean(bool set)
 }
 
 ExprDef *
-ExprCreateKeyName(xkb_atom_t key_name)
+ExprCreateKeyName(struct arena *arena, xkb_atom_t key_name)
 {
-    ExprDef *expr = ExprCreate(EXPR_VALUE, EXPR_TYPE_KEYNAME, sizeof(ExprKeyName));
+    ExprDef *expr = ExprCreate(arena, EXPR_VALUE, EXPR_TYPE_KEYNAME, sizeof(ExprKeyName));
     if (!expr)
         return NULL;
     expr->key_name.key_name = key_name;
@@ -122,9 +124,9 @@ ExprCreateKeyName(xkb_atom_t key_name)
 }
 
 ExprDef *
-ExprCreateIdent(xkb_atom_t ident)
+ExprCreateIdent(struct arena *arena, xkb_atom_t ident)
 {
-    ExprDef *expr = ExprCreate(EXPR_IDENT, EXPR_TYPE_UNKNOWN, sizeof(ExprIdent));
+    ExprDef *expr = ExprCreate(arena, EXPR_IDENT, EXPR_TYPE_UNKNOWN, sizeof(ExprIdent));
     if (!expr)
         return NULL;
     expr->ident.ident = ident;
@@ -132,10 +134,10 @@ ExprCreateIdent(xkb_atom_t ident)
 }
 
 ExprDef *
-ExprCreateUnary(enum expr_op_type op, enum expr_value_type type,
-                ExprDef *child)
+ExprCreateUnary(struct arena *arena, enum expr_op_type op,
+                enum expr_value_type type, ExprDef *child)
 {
-    ExprDef *expr = ExprCreate(op, type, sizeof(ExprUnary));
+    ExprDef *expr = ExprCreate(arena, op, type, sizeof(ExprUnary));
     if (!expr)
         return NULL;
     expr->unary.child = child;
@@ -143,9 +145,10 @@ ExprCreateUnary(enum expr_op_type op, enum expr_value_type type,
 }
 
 ExprDef *
-ExprCreateBinary(enum expr_op_type op, ExprDef *left, ExprDef *right)
+ExprCreateBinary(struct arena *arena, enum expr_op_type op,
+                 ExprDef *left, ExprDef *right)
 {
-    ExprDef *expr = ExprCreate(op, EXPR_TYPE_UNKNOWN, sizeof(ExprBinary));
+    ExprDef *expr = ExprCreate(arena, op, EXPR_TYPE_UNKNOWN, sizeof(ExprBinary));
     if (!expr)
         return NULL;
 
@@ -161,9 +164,9 @@ ExprCreateBinary(enum expr_op_type op, ExprDef *left, ExprDef *right)
 }
 
 ExprDef *
-ExprCreateFieldRef(xkb_atom_t element, xkb_atom_t field)
+ExprCreateFieldRef(struct arena *arena, xkb_atom_t element, xkb_atom_t field)
 {
-    ExprDef *expr = ExprCreate(EXPR_FIELD_REF, EXPR_TYPE_UNKNOWN, sizeof(ExprFieldRef));
+    ExprDef *expr = ExprCreate(arena, EXPR_FIELD_REF, EXPR_TYPE_UNKNOWN, sizeof(ExprFieldRef));
     if (!expr)
         return NULL;
     expr->field_ref.element = element;
@@ -172,9 +175,10 @@ ExprCreateFieldRef(xkb_atom_t element, xkb_atom_t field)
 }
 
 ExprDef *
-ExprCreateArrayRef(xkb_atom_t element, xkb_atom_t field, ExprDef *entry)
+ExprCreateArrayRef(struct arena *arena, xkb_atom_t element, xkb_atom_t field,
+                   ExprDef *entry)
 {
-    ExprDef *expr = ExprCreate(EXPR_ARRAY_REF, EXPR_TYPE_UNKNOWN, sizeof(ExprArrayRef));
+    ExprDef *expr = ExprCreate(arena, EXPR_ARRAY_REF, EXPR_TYPE_UNKNOWN, sizeof(ExprArrayRef));
     if (!expr)
         return NULL;
     expr->array_ref.element = element;
@@ -184,9 +188,9 @@ ExprCreateArrayRef(xkb_atom_t element, xkb_atom_t field, ExprDef *entry)
 }
 
 ExprDef *
-ExprCreateAction(xkb_atom_t name, ExprDef *args)
+ExprCreateAction(struct arena *arena, xkb_atom_t name, ExprDef *args)
 {
-    ExprDef *expr = ExprCreate(EXPR_ACTION_DECL, EXPR_TYPE_UNKNOWN, sizeof(ExprAction));
+    ExprDef *expr = ExprCreate(arena, EXPR_ACTION_DECL, EXPR_TYPE_UNKNOWN, sizeof(ExprAction));
     if (!expr)
         return NULL;
     expr->action.name = name;
@@ -195,29 +199,72 @@ ExprCreateAction(xkb_atom_t name, ExprDef *args)
 }
 
 ExprDef *
-ExprCreateActionList(ExprDef *actions)
+ExprCreateActionList(struct arena *arena, ExprDef *actions)
 {
-    ExprDef *expr = ExprCreate(EXPR_ACTION_LIST, EXPR_TYPE_ACTIONS, sizeof(ExprActionList));
+    ExprDef *expr = ExprCreate(arena, EXPR_ACTION_LIST, EXPR_TYPE_ACTIONS, sizeof(ExprActionList));
     if (!expr)
         return NULL;
     expr->actions.actions = actions;
     return expr;
 }
 
+/*
+ * Make room for @num_syms more keysyms and @num_levels more levels. The
+ * arrays are moved to bigger ones in the arena when they are full; the old
+ * ones are freed with the arena.
+ */
+static bool
+KeysymListReserve(struct arena *arena, ExprKeysymList *list,
+                  unsigned int num_syms, unsigned int num_levels)
+{
+    if (list->num_syms + num_syms > list->syms_alloc) {
+        unsigned int alloc = MAX(list->syms_alloc * 2, list->num_syms + num_syms);
+        xkb_keysym_t *syms = arena_alloc(arena, alloc * sizeof(*syms));
+        if (!syms)
+            return false;
+        if (list->num_syms > 0)
+            memcpy(syms, list->syms, list->num_syms * sizeof(*syms));
+        list->syms = syms;
+        list->syms_alloc = alloc;
+    }
+
+    if (list->num_levels + num_levels > list->levels_alloc) {
+        unsigned int alloc = MAX(list->levels_alloc * 2,
+                                 list->num_levels + num_levels);
+        unsigned int *index = arena_alloc(arena, alloc * sizeof(*index));
+        unsigned int *entries = arena_alloc(arena, alloc * sizeof(*entries));
+        if (!index || !entries)
+            return false;
+        if (list->num_levels > 0) {
+            memcpy(index, list->symsMapIndex,
+                   list->num_levels * sizeof(*index));
+            memcpy(entries, list->symsNumEntries,
+                   list->num_levels * sizeof(*entries));
+        }
+        list->symsMapIndex = index;
+        list->symsNumEntries = entries;
+        list->levels_alloc = alloc;
+    }
+
+    return true;
+}
+
 ExprDef *
-ExprCreateKeysymList(xkb_keysym_t sym)
+ExprCreateKeysymList(struct arena *arena, xkb_keysym_t sym)
 {
-    ExprDef *expr = ExprCreate(EXPR_KEYSYM_LIST, EXPR_TYPE_SYMBOLS, sizeof(ExprKeysymList));
+    ExprDef *expr = ExprCreate(arena, EXPR_KEYSYM_LIST, EXPR_TYPE_SYMBOLS, sizeof(ExprKeysymList));
     if (!expr)
         return NULL;
 
-    darray_init(expr->keysym_list.syms);
-    darray_init(expr->keysym_list.symsMapIndex);
-    darray_init(expr->keysym_list.symsNumEntries);
+    /* ExprCreate() returns zeroed memory. */
+    if (!KeysymListReserve(arena, &expr->keysym_list, 4, 4))
+        return NULL;
 
-    darray_append(expr->keysym_list.syms, sym);
-    darray_append(expr->keysym_list.symsMapIndex, 0);
-    darray_append(expr->keysym_list.symsNumEntries, 1);
+    expr->keysym_list.syms[0] = sym;
+    expr->keysym_list.symsMapIndex[0] = 0;
+    expr->keysym_list.symsNumEntries[0] = 1;
+    expr->keysym_list.num_syms = 1;
+    expr->keysym_list.num_levels = 1;
 
     return expr;
 }
@@ -225,47 +272,54 @@ ExprCreateKeysymList(xkb_keysym_t sym)
 ExprDef *
 ExprCreateMultiKeysymList(ExprDef *expr)
 {
-    unsigned nLevels = darray_size(expr->keysym_list.symsMapIndex);
+    unsigned nLevels = expr->keysym_list.num_levels;
 
-    darray_resize(expr->keysym_list.symsMapIndex, 1);
-    darray_resize(expr->keysym_list.symsNumEntries, 1);
-    darray_item(expr->keysym_list.symsMapIndex, 0) = 0;
-    darray_item(expr->keysym_list.symsNumEntries, 0) = nLevels;
+    expr->keysym_list.num_levels = 1;
+    expr->keysym_list.symsMapIndex[0] = 0;
+    expr->keysym_list.symsNumEntries[0] = nLevels;
 
     return expr;
 }
 
 ExprDef *
-ExprAppendKeysymList(ExprDef *expr, xkb_keysym_t sym)
+ExprAppendKeysymList(struct arena *arena, ExprDef *expr, xkb_keysym_t sym)
 {
-    unsigned nSyms = darray_size(expr->keysym_list.syms);
+    ExprKeysymList *list = &expr->keysym_list;
 
-    darray_append(expr->keysym_list.symsMapIndex, nSyms);
-    darray_append(expr->keysym_list.symsNumEntries, 1);
-    darray_append(expr->keysym_list.syms, sym);
+    if (!KeysymListReserve(arena, list, 1, 1))
+        return NULL;
+
+    list->symsMapIndex[list->num_levels] = list->num_syms;
+    list->symsNumEntries[list->num_levels] = 1;
+    list->num_levels++;
+    list->syms[list->num_syms++] = sym;
 
     return expr;
 }
 
 ExprDef *
-ExprAppendMultiKeysymList(ExprDef *expr, ExprDef *append)
+ExprAppendMultiKeysymList(struct arena *arena, ExprDef *expr, ExprDef *append)
 {
-    unsigned nSyms = darray_size(expr->keysym_list.syms);
-    unsigned numEntries = darray_size(append->keysym_list.syms);
+    ExprKeysymList *list = &expr->keysym_list;
+    unsigned numEntries = append->keysym_list.num_syms;
 
-    darray_append(expr->keysym_list.symsMapIndex, nSyms);
-    darray_append(expr->keysym_list.symsNumEntries, numEntries);
-    darray_concat(expr->keysym_list.syms, append->keysym_list.syms);
+    if (!KeysymListReserve(arena, list, numEntries, 1))
+        return NULL;
 
-    FreeStmt((ParseCommon *) append);
+    list->symsMapIndex[list->num_levels] = list->num_syms;
+    list->symsNumEntries[list->num_levels] = numEntries;
+    list->num_levels++;
+    memcpy(list->syms + list->num_syms, append->keysym_list.syms,
+           numEntries * sizeof(*list->syms));
+    list->num_syms += numEntries;
 
     return expr;
 }
 
 KeycodeDef *
-KeycodeCreate(xkb_atom_t name, int64_t value)
+KeycodeCreate(struct arena *arena, xkb_atom_t name, int64_t value)
 {
-    KeycodeDef *def = malloc(sizeof(*def));
+    KeycodeDef *def = arena_alloc(arena, sizeof(*def));
     if (!def)
         return NULL;
 
@@ -278,9 +332,9 @@ KeycodeCreate(xkb_atom_t name, int64_t value)
 }
 
 KeyAliasDef *
-KeyAliasCreate(xkb_atom_t alias, xkb_atom_t real)
+KeyAliasCreate(struct arena *arena, xkb_atom_t alias, xkb_atom_t real)
 {
-    KeyAliasDef *def = malloc(sizeof(*def));
+    KeyAliasDef *def = arena_alloc(arena, sizeof(*def));
     if (!def)
         return NULL;
 
@@ -293,9 +347,9 @@ KeyAliasCreate(xkb_atom_t alias, xkb_atom_t real)
 }
 
 VModDef *
-VModCreate(xkb_atom_t name, ExprDef *value)
+VModCreate(struct arena *arena, xkb_atom_t name, ExprDef *value)
 {
-    VModDef *def = malloc(sizeof(*def));
+    VModDef *def = arena_alloc(arena, sizeof(*def));
     if (!def)
         return NULL;
 
@@ -308,9 +362,9 @@ VModCreate(xkb_atom_t name, ExprDef *value)
 }
 
 VarDef *
-VarCreate(ExprDef *name, ExprDef *value)
+VarCreate(struct arena *arena, ExprDef *name, ExprDef *value)
 {
-    VarDef *def = malloc(sizeof(*def));
+    VarDef *def = arena_alloc(arena, sizeof(*def));
     if (!def)
         return NULL;
 
@@ -323,29 +377,19 @@ VarCreate(ExprDef *name, ExprDef *value)
 }
 
 VarDef *
-BoolVarCreate(xkb_atom_t ident, bool set)
+BoolVarCreate(struct arena *arena, xkb_atom_t ident, bool set)
 {
     ExprDef *name, *value;
-    VarDef *def;
-    if (!(name = ExprCreateIdent(ident))) {
-        return NULL;
-    }
-    if (!(value = ExprCreateBoolean(set))) {
-        FreeStmt((ParseCommon *) name);
+    if (!(name = ExprCreateIdent(arena, ident)) ||
+        !(value = ExprCreateBoolean(arena, set)))
         return NULL;
-    }
-    if (!(def = VarCreate(name, value))) {
-        FreeStmt((ParseCommon *) name);
-        FreeStmt((ParseCommon *) value);
-        return NULL;
-    }
-    return def;
+    return VarCreate(arena, name, value);
 }
 
 InterpDef *
-InterpCreate(xkb_keysym_t sym, ExprDef *match)
+InterpCreate(struct arena *arena, xkb_keysym_t sym, ExprDef *match)
 {
-    InterpDef *def = malloc(sizeof(*def));
+    InterpDef *def = arena_alloc(arena, sizeof(*def));
     if (!def)
         return NULL;
 
@@ -359,9 +403,9 @@ InterpCreate(xkb_keysym_t sym, ExprDef *match)
 }
 
 KeyTypeDef *
-KeyTypeCreate(xkb_atom_t name, VarDef *body)
+KeyTypeCreate(struct arena *arena, xkb_atom_t name, VarDef *body)
 {
-    KeyTypeDef *def = malloc(sizeof(*def));
+    KeyTypeDef *def = arena_alloc(arena, sizeof(*def));
     if (!def)
         return NULL;
 
@@ -375,9 +419,9 @@ KeyTypeCreate(xkb_atom_t name, VarDef *body)
 }
 
 SymbolsDef *
-SymbolsCreate(xkb_atom_t keyName, VarDef *symbols)
+SymbolsCreate(struct arena *arena, xkb_atom_t keyName, VarDef *symbols)
 {
-    SymbolsDef *def = malloc(sizeof(*def));
+    SymbolsDef *def = arena_alloc(arena, sizeof(*def));
     if (!def)
         return NULL;
 
@@ -391,9 +435,9 @@ SymbolsCreate(xkb_atom_t keyName, VarDef *symbols)
 }
 
 GroupCompatDef *
-GroupCompatCreate(unsigned group, ExprDef *val)
+GroupCompatCreate(struct arena *arena, unsigned group, ExprDef *val)
 {
-    GroupCompatDef *def = malloc(sizeof(*def));
+    GroupCompatDef *def = arena_alloc(arena, sizeof(*def));
     if (!def)
         return NULL;
 
@@ -407,9 +451,9 @@ GroupCompatCreate(unsigned group, ExprDef *val)
 }
 
 ModMapDef *
-ModMapCreate(xkb_atom_t modifier, ExprDef *keys)
+ModMapCreate(struct arena *arena, xkb_atom_t modifier, ExprDef *keys)
 {
-    ModMapDef *def = malloc(sizeof(*def));
+    ModMapDef *def = arena_alloc(arena, sizeof(*def));
     if (!def)
         return NULL;
 
@@ -423,9 +467,9 @@ ModMapCreate(xkb_atom_t modifier, ExprDef *keys)
 }
 
 LedMapDef *
-LedMapCreate(xkb_atom_t name, VarDef *body)
+LedMapCreate(struct arena *arena, xkb_atom_t name, VarDef *body)
 {
-    LedMapDef *def = malloc(sizeof(*def));
+    LedMapDef *def = arena_alloc(arena, sizeof(*def));
     if (!def)
         return NULL;
 
@@ -439,9 +483,10 @@ LedMapCreate(xkb_atom_t name, VarDef *body)
 }
 
 LedNameDef *
-LedNameCreate(unsigned ndx, ExprDef *name, bool virtual)
+LedNameCreate(struct arena *arena, unsigned ndx, ExprDef *name,
+              bool virtual)
 {
-    LedNameDef *def = malloc(sizeof(*def));
+    LedNameDef *def = arena_alloc(arena, sizeof(*def));
     if (!def)
         return NULL;
 
@@ -455,19 +500,18 @@ LedNameCreate(unsigned ndx, ExprDef *name, bool virtual)
     return def;
 }
 
-static void
-FreeInclude(IncludeStmt *incl);
-
 IncludeStmt *
-IncludeCreate(struct xkb_context *ctx, char *str, enum merge_mode merge)
+IncludeCreate(struct xkb_context *ctx, struct arena *arena, const char *str,
+              enum merge_mode merge)
 {
     IncludeStmt *incl, *first;
     char *stmt, *tmp;
     char nextop;
 
     incl = first = NULL;
-    tmp = str;
-    stmt = strdup_safe(str);
+    stmt = str ? arena_strndup(arena, str, strlen(str)) : NULL;
+    /* ParseIncludeMap() works in place; the arena keeps the copy alive. */
+    tmp = str ? arena_strndup(arena, str, strlen(str)) : NULL;
     while (tmp && *tmp)
     {
         char *file = NULL, *map = NULL, *extra_data = NULL;
@@ -489,9 +533,9 @@ IncludeCreate(struct xkb_context *ctx, char *str, enum merge_mode merge)
         }
 
         if (first == NULL) {
-            first = incl = malloc(sizeof(*first));
+            first = incl = arena_alloc(arena, sizeof(*first));
         } else {
-            incl->next_incl = malloc(sizeof(*first));
+            incl->next_incl = arena_alloc(arena, sizeof(*first));
             incl = incl->next_incl;
         }
 
@@ -506,10 +550,15 @@ IncludeCreate(struct xkb_context *ctx, char *str, enum merge_mode merge)
         incl->common.next = NULL;
         incl->merge = merge;
         incl->stmt = NULL;
-        incl->file = file;
-        incl->map = map;
-        incl->modifier = extra_data;
+        incl->file = arena_strndup(arena, file, strlen(file));
+        incl->map = map ? arena_strndup(arena, map, strlen(map)) : NULL;
+        incl->modifier = (extra_data ?
+                          arena_strndup(arena, extra_data, strlen(extra_data)) :
+                          NULL);
         incl->next_incl = NULL;
+        free(file);
+        free(map);
+        free(extra_data);
 
         if (nextop == '|')
             merge = MERGE_AUGMENT;
@@ -519,31 +568,32 @@ IncludeCreate(struct xkb_context *ctx, char *str, enum merge_mode merge)
 
     if (first)
         first->stmt = stmt;
-    else
-        free(stmt);
 
     return first;
 
 err:
     log_err(ctx, "Illegal include statement \"%s\"; Ignored\n", stmt);
-    FreeInclude(first);
-    free(stmt);
     return NULL;
 }
 
 XkbFile *
-XkbFileCreate(enum xkb_file_type type, char *name, ParseCommon *defs,
-              enum xkb_map_flags flags)
+XkbFileCreate(struct arena *arena, enum xkb_file_type type, const char *name,
+              ParseCommon *defs, enum xkb_map_flags flags)
 {
     XkbFile *file;
 
-    file = calloc(1, sizeof(*file));
+    file = arena_alloc(arena, sizeof(*file));
     if (!file)
         return NULL;
 
-    XkbEscapeMapName(name);
     file->file_type = type;
-    file->name = name ? name : strdup("(unnamed)");
+    if (name) {
+        file->name = arena_strndup(arena, name, strlen(name));
+        XkbEscapeMapName(file->name);
+    }
+    else {
+        file->name = arena_strndup(arena, "(unnamed)", strlen("(unnamed)"));
+    }
     file->defs = defs;
     file->flags = flags;
 
@@ -562,17 +612,21 @@ XkbFileFromComponents(struct xkb_context *ctx,
     IncludeStmt *include = NULL;
     XkbFile *file = NULL;
     ParseCommon *defs = NULL, *defsLast = NULL;
+    struct arena *arena;
+
+    arena = malloc(sizeof(*arena));
+    if (!arena)
+        return NULL;
+    arena_init(arena);
 
     for (type = FIRST_KEYMAP_FILE_TYPE; type <= LAST_KEYMAP_FILE_TYPE; type++) {
-        include = IncludeCreate(ctx, components[type], MERGE_DEFAULT);
+        include = IncludeCreate(ctx, arena, components[type], MERGE_DEFAULT);
         if (!include)
             goto err;
 
-        file = XkbFileCreate(type, NULL, (ParseCommon *) include, 0);
-        if (!file) {
-            FreeInclude(include);
+        file = XkbFileCreate(arena, type, NULL, (ParseCommon *) include, 0);
+        if (!file)
             goto err;
-        }
 
         if (!defs)
             defsLast = defs = &file->common;
@@ -580,168 +634,31 @@ XkbFileFromComponents(struct xkb_context *ctx,
             defsLast = defsLast->next = &file->common;
     }
 
-    file = XkbFileCreate(FILE_TYPE_KEYMAP, NULL, defs, 0);
+    file = XkbFileCreate(arena, FILE_TYPE_KEYMAP, NULL, defs, 0);
     if (!file)
         goto err;
 
+    file->arena = arena;
     return file;
 
 err:
-    FreeXkbFile((XkbFile *) defs);
+    arena_release(arena);
+    free(arena);
     return NULL;
 }
 
-static void
-FreeExpr(ExprDef *expr)
-{
-    if (!expr)
-        return;
-
-    switch (expr->expr.op) {
-    case EXPR_NEGATE:
-    case EXPR_UNARY_PLUS:
-    case EXPR_NOT:
-    case EXPR_INVERT:
-        FreeStmt((ParseCommon *) expr->unary.child);
-        break;
-
-    case EXPR_DIVIDE:
-    case EXPR_ADD:
-    case EXPR_SUBTRACT:
-    case EXPR_MULTIPLY:
-    case EXPR_ASSIGN:
-        FreeStmt((ParseCommon *) expr->binary.left);
-        FreeStmt((ParseCommon *) expr->binary.right);
-        break;
-
-    case EXPR_ACTION_DECL:
-        FreeStmt((ParseCommon *) expr->action.args);
-        break;
-
-    case EXPR_ACTION_LIST:
-        FreeStmt((ParseCommon *) expr->actions.actions);
-        break;
-
-    case EXPR_ARRAY_REF:
-        FreeStmt((ParseCommon *) expr->array_ref.entry);
-        break;
-
-    case EXPR_KEYSYM_LIST:
-        darray_free(expr->keysym_list.syms);
-        darray_free(expr->keysym_list.symsMapIndex);
-        darray_free(expr->keysym_list.symsNumEntries);
-        break;
-
-    default:
-        break;
-    }
-}
-
-static void
-FreeInclude(IncludeStmt *incl)
-{
-    IncludeStmt *next;
-
-    while (incl)
-    {
-        next = incl->next_incl;
-
-        free(incl->file);
-        free(incl->map);
-        free(incl->modifier);
-        free(incl->stmt);
-
-        free(incl);
-        incl = next;
-    }
-}
-
-void
-FreeStmt(ParseCommon *stmt)
-{
-    ParseCommon *next;
-
-    while (stmt)
-    {
-        next = stmt->next;
-
-        switch (stmt->type) {
-        case STMT_INCLUDE:
-            FreeInclude((IncludeStmt *) stmt);
-            /* stmt is already free'd here. */
-            stmt = NULL;
-            break;
-        case STMT_EXPR:
-            FreeExpr((ExprDef *) stmt);
-            break;
-        case STMT_VAR:
-            FreeStmt((ParseCommon *) ((VarDef *) stmt)->name);
-            FreeStmt((ParseCommon *) ((VarDef *) stmt)->value);
-            break;
-        case STMT_TYPE:
-            FreeStmt((ParseCommon *) ((KeyTypeDef *) stmt)->body);
-            break;
-        case STMT_INTERP:
-            FreeStmt((ParseCommon *) ((InterpDef *) stmt)->match);
-            FreeStmt((ParseCommon *) ((InterpDef *) stmt)->def);
-            break;
-        case STMT_VMOD:
-            FreeStmt((ParseCommon *) ((VModDef *) stmt)->value);
-            break;
-        case STMT_SYMBOLS:
-            FreeStmt((ParseCommon *) ((SymbolsDef *) stmt)->symbols);
-            break;
-        case STMT_MODMAP:
-            FreeStmt((ParseCommon *) ((ModMapDef *) stmt)->keys);
-            break;
-        case STMT_GROUP_COMPAT:
-            FreeStmt((ParseCommon *) ((GroupCompatDef *) stmt)->def);
-            break;
-        case STMT_LED_MAP:
-            FreeStmt((ParseCommon *) ((LedMapDef *) stmt)->body);
-            break;
-        case STMT_LED_NAME:
-            FreeStmt((ParseCommon *) ((LedNameDef *) stmt)->name);
-            break;
-        default:
-            break;
-        }
-
-        free(stmt);
-        stmt = next;
-    }
-}
-
 void
 FreeXkbFile(XkbFile *file)
 {
-    XkbFile *next;
-
-    while (file)
-    {
-        next = (XkbFile *) file->common.next;
+    struct arena *arena;
 
-        switch (file->file_type) {
-        case FILE_TYPE_KEYMAP:
-            FreeXkbFile((XkbFile *) file->defs);
-            break;
-
-        case FILE_TYPE_TYPES:
-        case FILE_TYPE_COMPAT:
-        case FILE_TYPE_SYMBOLS:
-        case FILE_TYPE_KEYCODES:
-        case FILE_TYPE_GEOMETRY:
-            FreeStmt(file->defs);
-            break;
-
-        default:
-            break;
-        }
+    /* Nested files have no arena of their own. */
+    if (!file || !file->arena)
+        return;
 
-        free(file->name);
-        free(file);
-        file = next;
-    }
+    arena = file->arena;
+    arena_release(arena);
+    free(arena);
 }
 
 static const char *xkb_file_type_strings[_FILE_TYPE_NUM_ENTRIES] = {
@@ -27,99 +27,107 @@
 #ifndef XKBCOMP_AST_BUILD_H
 #define XKBCOMP_AST_BUILD_H
 
+/*
+ * The nodes are allocated from the arena of the file being parsed, and are
+ * freed all at once with it, see FreeXkbFile().
+ */
+struct arena;
+
 ExprDef *
-ExprCreateString(xkb_atom_t str);
+ExprCreateString(struct arena *arena, xkb_atom_t str);
 
 ExprDef *
-ExprCreateInteger(int ival);
+ExprCreateInteger(struct arena *arena, int ival);
 
 ExprDef *
-ExprCreateFloat(void);
+ExprCreateFloat(struct arena *arena);
 
 ExprDef *
-ExprCreateBoolean(bool set);
+ExprCreateBoolean(struct arena *arena, bool set);
 
 ExprDef *
-ExprCreateKeyName(xkb_atom_t key_name);
+ExprCreateKeyName(struct arena *arena, xkb_atom_t key_name);
 
 ExprDef *
-ExprCreateIdent(xkb_atom_t ident);
+ExprCreateIdent(struct arena *arena, xkb_atom_t ident);
 
 ExprDef *
-ExprCreateUnary(enum expr_op_type op, enum expr_value_type type,
-                ExprDef *child);
+ExprCreateUnary(struct arena *arena, enum expr_op_type op,
+                enum expr_value_type type, ExprDef *child);
 
 ExprDef *
-ExprCreateBinary(enum expr_op_type op, ExprDef *left, ExprDef *right);
+ExprCreateBinary(struct arena *arena, enum expr_op_type op,
+                 ExprDef *left, ExprDef *right);
 
 ExprDef *
-ExprCreateFieldRef(xkb_atom_t element, xkb_atom_t field);
+ExprCreateFieldRef(struct arena *arena, xkb_atom_t element, xkb_atom_t field);
 
 ExprDef *
-ExprCreateArrayRef(xkb_atom_t element, xkb_atom_t field, ExprDef *entry);
+ExprCreateArrayRef(struct arena *arena, xkb_atom_t element, xkb_atom_t field,
+                   ExprDef *entry);
 
 ExprDef *
-ExprCreateAction(xkb_atom_t name, ExprDef *args);
+ExprCreateAction(struct arena *arena, xkb_atom_t name, ExprDef *args);
 
 ExprDef *
-ExprCreateActionList(ExprDef *actions);
+ExprCreateActionList(struct arena *arena, ExprDef *actions);
 
 ExprDef *
 ExprCreateMultiKeysymList(ExprDef *list);
 
 ExprDef *
-ExprCreateKeysymList(xkb_keysym_t sym);
+ExprCreateKeysymList(struct arena *arena, xkb_keysym_t sym);
 
 ExprDef *
-ExprAppendMultiKeysymList(ExprDef *list, ExprDef *append);
+ExprAppendMultiKeysymList(struct arena *arena, ExprDef *list,
+                          ExprDef *append);
 
 ExprDef *
-ExprAppendKeysymList(ExprDef *list, xkb_keysym_t sym);
+ExprAppendKeysymList(struct arena *arena, ExprDef *list, xkb_keysym_t sym);
 
 KeycodeDef *
-KeycodeCreate(xkb_atom_t name, int64_t value);
+KeycodeCreate(struct arena *arena, xkb_atom_t name, int64_t value);
 
 KeyAliasDef *
-KeyAliasCreate(xkb_atom_t alias, xkb_atom_t real);
+KeyAliasCreate(struct arena *arena, xkb_atom_t alias, xkb_atom_t real);
 
 VModDef *
-VModCreate(xkb_atom_t name, ExprDef *value);
+VModCreate(struct arena *arena, xkb_atom_t name, ExprDef *value);
 
 VarDef *
-VarCreate(ExprDef *name, ExprDef *value);
+VarCreate(struct arena *arena, ExprDef *name, ExprDef *value);
 
 VarDef *
-BoolVarCreate(xkb_atom_t ident, bool set);
+BoolVarCreate(struct arena *arena, xkb_atom_t ident, bool set);
 
 InterpDef *
-InterpCreate(xkb_keysym_t sym, ExprDef *match);
+InterpCreate(struct arena *arena, xkb_keysym_t sym, ExprDef *match);
 
 KeyTypeDef *
-KeyTypeCreate(xkb_atom_t name, VarDef *body);
+KeyTypeCreate(struct arena *arena, xkb_atom_t name, VarDef *body);
 
 SymbolsDef *
-SymbolsCreate(xkb_atom_t keyName, VarDef *symbols);
+SymbolsCreate(struct arena *arena, xkb_atom_t keyName, VarDef *symbols);
 
 GroupCompatDef *
-GroupCompatCreate(unsigned group, ExprDef *def);
+GroupCompatCreate(struct arena *arena, unsigned group, ExprDef *def);
 
 ModMapDef *
-ModMapCreate(xkb_atom_t modifier, ExprDef *keys);
+ModMapCreate(struct arena *arena, xkb_atom_t modifier, ExprDef *keys);
 
 LedMapDef *
-LedMapCreate(xkb_atom_t name, VarDef *body);
+LedMapCreate(struct arena *arena, xkb_atom_t name, VarDef *body);
 
 LedNameDef *
-LedNameCreate(unsigned ndx, ExprDef *name, bool virtual);
+LedNameCreate(struct arena *arena, unsigned ndx, ExprDef *name,
+              bool virtual);
 
 IncludeStmt *
-IncludeCreate(struct xkb_context *ctx, char *str, enum merge_mode merge);
+IncludeCreate(struct xkb_context *ctx, struct arena *arena, const char *str,
+              enum merge_mode merge);
 
 XkbFile *
-XkbFileCreate(enum xkb_file_type type, char *name, ParseCommon *defs,
-              enum xkb_map_flags flags);
-
-void
-FreeStmt(ParseCommon *stmt);
+XkbFileCreate(struct arena *arena, enum xkb_file_type type, const char *name,
+              ParseCommon *defs, enum xkb_map_flags flags);
 
 #endif
@@ -236,9 +236,12 @@ typedef struct {
 
 typedef struct {
     ExprCommon expr;
-    darray(xkb_keysym_t) syms;
-    darray(unsigned int) symsMapIndex;
-    darray(unsigned int) symsNumEntries;
+    xkb_keysym_t *syms;
+    unsigned int num_syms, syms_alloc;
+    /* For each level, the index of its first keysym and their number. */
+    unsigned int *symsMapIndex;
+    unsigned int *symsNumEntries;
+    unsigned int num_levels, levels_alloc;
 } ExprKeysymList;
 
 union ExprDef {
@@ -354,6 +357,11 @@ typedef struct {
     char *name;
     ParseCommon *defs;
     enum xkb_map_flags flags;
+    /*
+     * The memory of the file and of all its statements. Only set on the
+     * outermost file, which owns it.
+     */
+    struct arena *arena;
 } XkbFile;
 
 #endif
@@ -55,6 +55,7 @@
 #include "action.h"
 #include "vmod.h"
 #include "include.h"
+#include "hash-index.h"
 
 enum si_field {
     SI_FIELD_VIRTUAL_MOD = (1 << 0),
@@ -88,6 +89,8 @@ typedef struct {
     int errorCount;
     SymInterpInfo default_interp;
     darray(SymInterpInfo) interps;
+    /* Positions in @interps by InterpKey(). */
+    struct hash_index interp_index;
     LedInfo default_led;
     LedInfo leds[XKB_MAX_LEDS];
     unsigned int num_leds;
@@ -162,18 +165,29 @@ ClearCompatInfo(CompatInfo *info)
 {
     free(info->name);
     darray_free(info->interps);
+    hash_index_free(&info->interp_index);
+}
+
+static uint32_t
+InterpKey(const SymInterpInfo *si)
+{
+    return si->interp.sym ^ (si->interp.mods * 0x01000193u) ^
+           ((uint32_t) si->interp.match << 24);
 }
 
 static SymInterpInfo *
 FindMatchingInterp(CompatInfo *info, SymInterpInfo *new)
 {
-    SymInterpInfo *old;
+    uint32_t slot, pos;
+
+    hash_index_foreach(pos, slot, &info->interp_index, InterpKey(new)) {
+        SymInterpInfo *old = &darray_item(info->interps, pos);
 
-    darray_foreach(old, info->interps)
         if (old->interp.sym == new->interp.sym &&
             old->interp.mods == new->interp.mods &&
             old->interp.match == new->interp.match)
             return old;
+    }
 
     return NULL;
 }
@@ -247,6 +261,10 @@ AddInterp(CompatInfo *info, SymInterpInfo *new, bool same_file)
         return true;
     }
 
+    if (!hash_index_add(&info->interp_index, InterpKey(new),
+                        darray_size(info->interps)))
+        return false;
+
     darray_append(info->interps, *new);
     return true;
 }
@@ -395,6 +413,9 @@ MergeIncludedCompatMaps(CompatInfo *into, CompatInfo *from,
     if (darray_empty(into->interps)) {
         into->interps = from->interps;
         darray_init(from->interps);
+        hash_index_free(&into->interp_index);
+        into->interp_index = from->interp_index;
+        hash_index_init(&from->interp_index);
     }
     else {
         SymInterpInfo *si;
@@ -429,8 +450,7 @@ HandleIncludeCompatMap(CompatInfo *info, IncludeStmt *include)
     CompatInfo included;
 
     InitCompatInfo(&included, info->ctx, info->actions, &info->mods);
-    included.name = include->stmt;
-    include->stmt = NULL;
+    included.name = strdup_safe(include->stmt);
 
     for (IncludeStmt *stmt = include; stmt; stmt = stmt->next_incl) {
         CompatInfo next_incl;
@@ -0,0 +1,78 @@
+/*
+ * Copyright © 2021 libxkbcommon contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include "hash-index.h"
+
+#define HASH_INDEX_MIN_SIZE 64
+
+void
+hash_index_free(struct hash_index *index)
+{
+    free(index->entries);
+    hash_index_init(index);
+}
+
+static void
+insert(struct hash_index *index, uint32_t key, uint32_t value)
+{
+    uint32_t slot = hash_index_slot(index, key);
+
+    while (index->entries[slot].value != 0)
+        slot = (slot + 1) & (index->size - 1);
+
+    index->entries[slot].key = key;
+    index->entries[slot].value = value;
+}
+
+bool
+hash_index_add(struct hash_index *index, uint32_t key, uint32_t value)
+{
+    /* Keep the load factor under 1/2, so probe sequences stay short. */
+    if ((index->count + 1) * 2 > index->size) {
+        struct hash_index grown;
+
+        grown.size = index->size ? index->size * 2 : HASH_INDEX_MIN_SIZE;
+        if (grown.size <= index->size)
+            return false;
+        grown.entries = calloc(grown.size, sizeof(*grown.entries));
+        if (!grown.entries)
+            return false;
+        grown.count = index->count;
+
+        for (uint32_t i = 0; i < index->size; i++)
+            if (index->entries[i].value != 0)
+                insert(&grown, index->entries[i].key,
+                       index->entries[i].value);
+
+        free(index->entries);
+        *index = grown;
+    }
+
+    insert(index, key, value + 1);
+    index->count++;
+    return true;
+}
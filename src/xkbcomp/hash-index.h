@@ -0,0 +1,108 @@
+/*
+ * Copyright © 2021 libxkbcommon contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef XKBCOMP_HASH_INDEX_H
+#define XKBCOMP_HASH_INDEX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * A hash index maps 32-bit keys, usually atoms, to positions in an array
+ * kept elsewhere. It never removes anything, and a key may be added more
+ * than once, so a lookup yields candidate positions which the caller must
+ * check against the array itself; stale positions are simply skipped.
+ */
+
+struct hash_index_entry {
+    uint32_t key;
+    /* The position plus one; 0 marks an empty slot. */
+    uint32_t value;
+};
+
+struct hash_index {
+    struct hash_index_entry *entries;
+    /* A power of two, or 0 if nothing was added yet. */
+    uint32_t size;
+    uint32_t count;
+};
+
+static inline void
+hash_index_init(struct hash_index *index)
+{
+    index->entries = NULL;
+    index->size = 0;
+    index->count = 0;
+}
+
+void
+hash_index_free(struct hash_index *index);
+
+/* Returns false if memory could not be allocated. */
+bool
+hash_index_add(struct hash_index *index, uint32_t key, uint32_t value);
+
+static inline uint32_t
+hash_index_slot(const struct hash_index *index, uint32_t key)
+{
+    uint32_t hash = key * 0x9e3779b1u;
+    return (hash ^ (hash >> 16)) & (index->size - 1);
+}
+
+/*
+ * Get the next position added for @key, starting from *@slot, which must be
+ * initialized with hash_index_start(). Returns false when there are no more.
+ */
+static inline bool
+hash_index_next(const struct hash_index *index, uint32_t key,
+                uint32_t *slot, uint32_t *value_out)
+{
+    if (index->size == 0)
+        return false;
+
+    for (;;) {
+        const struct hash_index_entry *entry = &index->entries[*slot];
+
+        if (entry->value == 0)
+            return false;
+
+        *slot = (*slot + 1) & (index->size - 1);
+        if (entry->key == key) {
+            *value_out = entry->value - 1;
+            return true;
+        }
+    }
+}
+
+static inline uint32_t
+hash_index_start(const struct hash_index *index, uint32_t key)
+{
+    return index->size == 0 ? 0 : hash_index_slot(index, key);
+}
+
+/* Iterate over the positions added for @key. */
+#define hash_index_foreach(value, slot, index, key) \
+    for ((slot) = hash_index_start((index), (key)); \
+         hash_index_next((index), (key), &(slot), &(value)); )
+
+#endif
@@ -55,6 +55,7 @@
 
 #include "xkbcomp-priv.h"
 #include "include.h"
+#include "prefetch.h"
 
 /**
  * Parse an include statement. Each call returns a file name, along with
@@ -260,6 +261,8 @@ FindFileInXkbPath(struct xkb_context *ctx, const char *name,
             *offset = i;
             goto out;
         }
+        free(buf);
+        buf = NULL;
     }
 
     /* We only print warnings if we can't find the file on the first lookup */
@@ -282,6 +285,9 @@ ProcessIncludeFile(struct xkb_context *ctx, IncludeStmt *stmt,
     XkbFile *xkb_file = NULL;
     unsigned int offset = 0;
 
+    if (include_prefetch_take(ctx, stmt, file_type, &xkb_file))
+        return xkb_file;
+
     file = FindFileInXkbPath(ctx, stmt->file, file_type, NULL, &offset);
     if (!file)
         return NULL;
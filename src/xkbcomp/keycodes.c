@@ -30,6 +30,7 @@
 #include "text.h"
 #include "expr.h"
 #include "include.h"
+#include "hash-index.h"
 
 typedef struct {
     enum merge_mode merge;
@@ -51,6 +52,11 @@ typedef struct {
     xkb_keycode_t min_key_code;
     xkb_keycode_t max_key_code;
     darray(xkb_atom_t) key_names;
+    /*
+     * Keycodes by key name. A name may have been moved to another keycode
+     * since, so the keycode must be checked against @key_names.
+     */
+    struct hash_index key_index;
     LedNameInfo led_names[XKB_MAX_LEDS];
     unsigned int num_led_names;
     darray(AliasInfo) aliases;
@@ -150,6 +156,7 @@ ClearKeyNamesInfo(KeyNamesInfo *info)
 {
     free(info->name);
     darray_free(info->key_names);
+    hash_index_free(&info->key_index);
     darray_free(info->aliases);
 }
 
@@ -167,11 +174,12 @@ InitKeyNamesInfo(KeyNamesInfo *info, struct xkb_context *ctx)
 static xkb_keycode_t
 FindKeyByName(KeyNamesInfo *info, xkb_atom_t name)
 {
-    xkb_keycode_t i;
+    uint32_t slot, kc;
 
-    for (i = info->min_key_code; i <= info->max_key_code; i++)
-        if (darray_item(info->key_names, i) == name)
-            return i;
+    hash_index_foreach(kc, slot, &info->key_index, name)
+        if (kc < darray_size(info->key_names) &&
+            darray_item(info->key_names, kc) == name)
+            return kc;
 
     return XKB_KEYCODE_INVALID;
 }
@@ -243,6 +251,9 @@ AddKeyName(KeyNamesInfo *info, xkb_keycode_t kc, xkb_atom_t name,
         }
     }
 
+    if (!hash_index_add(&info->key_index, name, kc))
+        return false;
+
     darray_item(info->key_names, kc) = name;
     return true;
 }
@@ -270,6 +281,9 @@ MergeIncludedKeycodes(KeyNamesInfo *into, KeyNamesInfo *from,
     if (darray_empty(into->key_names)) {
         into->key_names = from->key_names;
         darray_init(from->key_names);
+        hash_index_free(&into->key_index);
+        into->key_index = from->key_index;
+        hash_index_init(&from->key_index);
         into->min_key_code = from->min_key_code;
         into->max_key_code = from->max_key_code;
     }
@@ -337,8 +351,7 @@ HandleIncludeKeycodes(KeyNamesInfo *info, IncludeStmt *include)
     KeyNamesInfo included;
 
     InitKeyNamesInfo(&included, info->ctx);
-    included.name = include->stmt;
-    include->stmt = NULL;
+    included.name = strdup_safe(include->stmt);
 
     for (IncludeStmt *stmt = include; stmt; stmt = stmt->next_incl) {
         KeyNamesInfo next_incl;
@@ -30,6 +30,7 @@
 #include "config.h"
 
 #include "xkbcomp-priv.h"
+#include "prefetch.h"
 
 static void
 ComputeEffectiveMask(struct xkb_keymap *keymap, struct xkb_mods *mods)
@@ -237,6 +238,7 @@ CompileKeymap(XkbFile *file, struct xkb_keymap *keymap, enum merge_mode merge)
     XkbFile *files[LAST_KEYMAP_FILE_TYPE + 1] = { NULL };
     enum xkb_file_type type;
     struct xkb_context *ctx = keymap->ctx;
+    struct include_prefetch *prefetch = NULL;
 
     /* Collect section files and check for duplicates. */
     for (file = (XkbFile *) file->defs; file;
@@ -281,6 +283,9 @@ CompileKeymap(XkbFile *file, struct xkb_keymap *keymap, enum merge_mode merge)
     if (!ok)
         return false;
 
+    if (keymap->flags & XKB_KEYMAP_COMPILE_PARALLEL)
+        prefetch = include_prefetch_start(ctx, files);
+
     /* Compile sections. */
     for (type = FIRST_KEYMAP_FILE_TYPE;
          type <= LAST_KEYMAP_FILE_TYPE;
@@ -288,13 +293,19 @@ CompileKeymap(XkbFile *file, struct xkb_keymap *keymap, enum merge_mode merge)
         log_dbg(ctx, "Compiling %s \"%s\"\n",
                 xkb_file_type_to_string(type), files[type]->name);
 
+        if (prefetch)
+            include_prefetch_wait(prefetch, type);
+
         ok = compile_file_fns[type](files[type], keymap, merge);
         if (!ok) {
             log_err(ctx, "Failed to compile %s\n",
                     xkb_file_type_to_string(type));
+            include_prefetch_finish(prefetch);
             return false;
         }
     }
 
+    include_prefetch_finish(prefetch);
+
     return UpdateDerivedKeymapFields(keymap);
 }
@@ -382,7 +382,17 @@ keyword_gperf_lookup (register const char *str, register size_t len)
 int
 keyword_to_token(const char *string, size_t len)
 {
-    const struct keyword_tok *kt = keyword_gperf_lookup(string, len);
+    /* The string need not be terminated, but the lookup compares with
+     * strcmp(); all the keywords are short. */
+    char buf[32];
+    const struct keyword_tok *kt;
+
+    if (len >= sizeof(buf))
+        return -1;
+    memcpy(buf, string, len);
+    buf[len] = '\0';
+
+    kt = keyword_gperf_lookup(buf, len);
     if (!kt)
         return -1;
     return kt->tok;
@@ -0,0 +1,389 @@
+/*
+ * Copyright © 2021 libxkbcommon contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include "xkbcomp-priv.h"
+#include "parser-priv.h"
+#include "map-index.h"
+
+/*
+ * Files like symbols/us hold dozens of maps, and an include statement only
+ * wants one of them. Instead of parsing the whole file to find it, the top
+ * level of the file is scanned by matching braces, recording the flags,
+ * name and byte range of each map; only the range of the wanted map is
+ * then parsed. The indexes are kept in the context, since the same files
+ * are included again and again. They are keyed by the size and a hash of
+ * the contents of the file, since byte offsets are only good for the very
+ * same contents; the file's name, inode or mtime would not tell.
+ */
+
+struct map_index_entry {
+    size_t start, end;
+    enum xkb_map_flags flags;
+    /* NULL if the map has no name. */
+    char *name;
+};
+
+struct map_index {
+    /* Identifies the contents of the file. */
+    bool used;
+    size_t len;
+    uint64_t hash;
+    /* If the file could not be indexed, it is parsed in full. */
+    bool valid;
+    darray(struct map_index_entry) entries;
+};
+
+#define MAP_INDEXES_SIZE 64
+
+struct map_indexes {
+    struct map_index indexes[MAP_INDEXES_SIZE];
+    /* The slot to replace next, round-robin. */
+    unsigned int next;
+};
+
+static void
+index_clear_entries(struct map_index *index)
+{
+    struct map_index_entry *entry;
+
+    darray_foreach(entry, index->entries)
+        free(entry->name);
+    darray_free(index->entries);
+}
+
+static void
+index_clear(struct map_index *index)
+{
+    index_clear_entries(index);
+    index->used = false;
+    index->valid = false;
+}
+
+void
+map_indexes_free(void *map_indexes)
+{
+    struct map_indexes *indexes = map_indexes;
+
+    if (!indexes)
+        return;
+
+    for (unsigned int i = 0; i < MAP_INDEXES_SIZE; i++)
+        index_clear(&indexes->indexes[i]);
+    free(indexes);
+}
+
+static void
+skip_space_and_comments(const char *s, size_t len, size_t *pos)
+{
+    size_t p = *pos;
+
+    while (p < len) {
+        if (is_space(s[p])) {
+            p++;
+        }
+        else if (s[p] == '#' || (s[p] == '/' && p + 1 < len && s[p + 1] == '/')) {
+            const char *nl = memchr(s + p, '\n', len - p);
+            p = nl ? (size_t) (nl - s) : len;
+        }
+        else {
+            break;
+        }
+    }
+
+    *pos = p;
+}
+
+/* Skips a string literal, leaving @pos after the closing quote. */
+static bool
+skip_string(const char *s, size_t len, size_t *pos, bool *has_escape)
+{
+    for (size_t p = *pos + 1; p < len && s[p] != '\n'; p++) {
+        if (s[p] == '\\') {
+            *has_escape = true;
+            p++;
+        }
+        else if (s[p] == '\"') {
+            *pos = p + 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Skips the body of a map, leaving @pos after the closing brace. */
+static bool
+skip_body(const char *s, size_t len, size_t *pos)
+{
+    unsigned int depth = 0;
+    size_t p = *pos;
+    bool has_escape;
+
+    while (p < len) {
+        switch (s[p]) {
+        case '{':
+            depth++;
+            p++;
+            break;
+        case '}':
+            p++;
+            if (--depth == 0) {
+                *pos = p;
+                return true;
+            }
+            break;
+        case '\"':
+            if (!skip_string(s, len, &p, &has_escape))
+                return false;
+            break;
+        case '<':
+            /* Key names may contain braces. */
+            for (p++; p < len && is_graph(s[p]) && s[p] != '>'; p++);
+            if (p >= len || s[p] != '>')
+                return false;
+            p++;
+            break;
+        case '#':
+        case '/':
+            skip_space_and_comments(s, len, &p);
+            if (p < len && s[p] == '/')
+                p++;
+            break;
+        default:
+            p++;
+            break;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Index the maps of a file. Anything the scan does not understand makes it
+ * fail, so that the parser reports it.
+ */
+static bool
+index_build(struct map_index *index, const char *s, size_t len)
+{
+    size_t pos = 0;
+
+    for (;;) {
+        struct map_index_entry entry = { 0 };
+        bool have_type = false;
+
+        skip_space_and_comments(s, len, &pos);
+        if (pos >= len)
+            return true;
+
+        entry.start = pos;
+
+        /* OptFlags FileType OptMapName. */
+        while (pos < len && s[pos] != '{') {
+            if (is_alpha(s[pos]) || s[pos] == '_') {
+                size_t start = pos;
+
+                while (pos < len && (is_alnum(s[pos]) || s[pos] == '_'))
+                    pos++;
+
+                int tok = keyword_to_token(s + start, pos - start);
+                enum xkb_map_flags flag = 0;
+                switch (tok) {
+                case PARTIAL: flag = MAP_IS_PARTIAL; break;
+                case DEFAULT: flag = MAP_IS_DEFAULT; break;
+                case HIDDEN: flag = MAP_IS_HIDDEN; break;
+                case ALPHANUMERIC_KEYS: flag = MAP_HAS_ALPHANUMERIC; break;
+                case MODIFIER_KEYS: flag = MAP_HAS_MODIFIER; break;
+                case KEYPAD_KEYS: flag = MAP_HAS_KEYPAD; break;
+                case FUNCTION_KEYS: flag = MAP_HAS_FN; break;
+                case ALTERNATE_GROUP: flag = MAP_IS_ALTGR; break;
+                case XKB_KEYMAP:
+                case XKB_SEMANTICS:
+                case XKB_LAYOUT:
+                case XKB_KEYCODES:
+                case XKB_TYPES:
+                case XKB_COMPATMAP:
+                case XKB_SYMBOLS:
+                case XKB_GEOMETRY:
+                    if (have_type)
+                        goto err;
+                    have_type = true;
+                    break;
+                default:
+                    goto err;
+                }
+
+                if (flag) {
+                    if (have_type)
+                        goto err;
+                    entry.flags |= flag;
+                }
+            }
+            else if (s[pos] == '\"') {
+                size_t start = pos + 1;
+                bool has_escape = false;
+
+                /* Escaped names would need to be unescaped to compare. */
+                if (!have_type || entry.name ||
+                    !skip_string(s, len, &pos, &has_escape) || has_escape)
+                    goto err;
+                entry.name = strndup(s + start, pos - 1 - start);
+                if (!entry.name)
+                    goto err;
+            }
+            else {
+                goto err;
+            }
+
+            skip_space_and_comments(s, len, &pos);
+        }
+
+        if (!have_type || !skip_body(s, len, &pos))
+            goto err;
+
+        skip_space_and_comments(s, len, &pos);
+        if (pos >= len || s[pos] != ';')
+            goto err;
+        pos++;
+
+        entry.end = pos;
+        darray_append(index->entries, entry);
+        continue;
+
+err:
+        free(entry.name);
+        return false;
+    }
+}
+
+static struct map_index *
+get_index(struct xkb_context *ctx, const char *string, size_t len)
+{
+    struct map_indexes *indexes;
+    struct map_index *index;
+    uint64_t hash = hash_bytes(HASH_STRING_INIT, string, len);
+
+    if (!ctx->xkb_map_indexes) {
+        ctx->xkb_map_indexes = calloc(1, sizeof(struct map_indexes));
+        if (!ctx->xkb_map_indexes)
+            return NULL;
+    }
+    indexes = ctx->xkb_map_indexes;
+
+    for (unsigned int i = 0; i < MAP_INDEXES_SIZE; i++) {
+        index = &indexes->indexes[i];
+        if (index->used && index->len == len && index->hash == hash)
+            return index;
+    }
+
+    index = &indexes->indexes[indexes->next];
+    indexes->next = (indexes->next + 1) % MAP_INDEXES_SIZE;
+
+    index_clear(index);
+    index->valid = index_build(index, string, len);
+    if (!index->valid)
+        index_clear_entries(index);
+
+    index->used = true;
+    index->len = len;
+    index->hash = hash;
+
+    return index;
+}
+
+void
+map_indexes_merge(struct xkb_context *ctx, void *map_indexes)
+{
+    struct map_indexes *from = map_indexes, *into;
+
+    if (!from)
+        return;
+
+    if (!ctx->xkb_map_indexes) {
+        ctx->xkb_map_indexes = from;
+        return;
+    }
+    into = ctx->xkb_map_indexes;
+
+    for (unsigned int i = 0; i < MAP_INDEXES_SIZE; i++) {
+        struct map_index *index = &from->indexes[i];
+        bool known = false;
+
+        if (!index->used)
+            continue;
+
+        for (unsigned int j = 0; j < MAP_INDEXES_SIZE && !known; j++)
+            known = (into->indexes[j].used &&
+                     into->indexes[j].len == index->len &&
+                     into->indexes[j].hash == index->hash);
+        if (known)
+            continue;
+
+        index_clear(&into->indexes[into->next]);
+        into->indexes[into->next] = *index;
+        into->next = (into->next + 1) % MAP_INDEXES_SIZE;
+        darray_init(index->entries);
+        index->used = false;
+    }
+
+    map_indexes_free(from);
+}
+
+int
+map_index_find(struct xkb_context *ctx,
+               const char *string, size_t len, const char *map,
+               size_t *start_out, size_t *end_out)
+{
+    const struct map_index *index;
+    const struct map_index_entry *entry, *found = NULL;
+
+    index = get_index(ctx, string, len);
+    if (!index || !index->valid)
+        return -1;
+
+    /* Same choice as parse(). */
+    darray_foreach(entry, index->entries) {
+        if (map) {
+            if (streq_not_null(map, entry->name)) {
+                found = entry;
+                break;
+            }
+        }
+        else {
+            if (entry->flags & MAP_IS_DEFAULT) {
+                found = entry;
+                break;
+            }
+            else if (!found) {
+                found = entry;
+            }
+        }
+    }
+
+    if (!found)
+        return 0;
+
+    *start_out = found->start;
+    *end_out = found->end;
+    return 1;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright © 2021 libxkbcommon contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef XKBCOMP_MAP_INDEX_H
+#define XKBCOMP_MAP_INDEX_H
+
+#include <stddef.h>
+
+struct xkb_context;
+
+/*
+ * Find the byte range of a map in the contents of an XKB file, without
+ * parsing it. If @map is NULL, finds the default map. Returns 1 if the map
+ * was found, 0 if it was not, and -1 if the file could not be indexed, in
+ * which case it must be parsed in full.
+ */
+int
+map_index_find(struct xkb_context *ctx,
+               const char *string, size_t len, const char *map,
+               size_t *start_out, size_t *end_out);
+
+/* Free the map indexes kept in a context. */
+void
+map_indexes_free(void *map_indexes);
+
+/*
+ * Move the indexes built in another context, e.g. a worker's, into the
+ * indexes of @ctx, and free them.
+ */
+void
+map_indexes_merge(struct xkb_context *ctx, void *map_indexes);
+
+#endif
@@ -36,11 +36,12 @@
 #include "xkbcomp/xkbcomp-priv.h"
 #include "xkbcomp/ast-build.h"
 #include "xkbcomp/parser-priv.h"
-#include "scanner-utils.h"
+#include "arena.h"
 
 struct parser_param {
     struct xkb_context *ctx;
     struct scanner *scanner;
+    struct arena *arena;
     XkbFile *rtrn;
     bool more_maps;
 };
@@ -58,27 +59,41 @@ _xkbcommon_error(struct parser_param *param, const char *msg)
 }
 
 static bool
-resolve_keysym(const char *name, xkb_keysym_t *sym_rtrn)
+resolve_keysym(struct sval name, xkb_keysym_t *sym_rtrn)
 {
+    /* Large enough for all the keysym names; longer ones are copied. */
+    char buf[64];
+    char *str = buf;
     xkb_keysym_t sym;
+    bool ret = true;
 
-    if (!name || istreq(name, "any") || istreq(name, "nosymbol")) {
-        *sym_rtrn = XKB_KEY_NoSymbol;
-        return true;
+    if (name.len < sizeof(buf)) {
+        memcpy(buf, name.start, name.len);
+        buf[name.len] = '\0';
+    }
+    else {
+        str = strndup(name.start, name.len);
+        if (!str)
+            return false;
     }
 
-    if (istreq(name, "none") || istreq(name, "voidsymbol")) {
+    if (istreq(str, "any") || istreq(str, "nosymbol")) {
+        *sym_rtrn = XKB_KEY_NoSymbol;
+    }
+    else if (istreq(str, "none") || istreq(str, "voidsymbol")) {
         *sym_rtrn = XKB_KEY_VoidSymbol;
-        return true;
     }
-
-    sym = xkb_keysym_from_name(name, XKB_KEYSYM_NO_FLAGS);
-    if (sym != XKB_KEY_NoSymbol) {
-        *sym_rtrn = sym;
-        return true;
+    else {
+        sym = xkb_keysym_from_name(str, XKB_KEYSYM_NO_FLAGS);
+        if (sym != XKB_KEY_NoSymbol)
+            *sym_rtrn = sym;
+        else
+            ret = false;
     }
 
-    return false;
+    if (str != buf)
+        free(str);
+    return ret;
 }
 
 #define param_scanner param->scanner
@@ -165,6 +180,7 @@ resolve_keysym(const char *name, xkb_keysym_t *sym_rtrn)
         int64_t          num;
         enum xkb_file_type file_type;
         char            *str;
+        struct sval     sval;
         xkb_atom_t      atom;
         enum merge_mode merge;
         enum xkb_map_flags mapFlags;
@@ -192,7 +208,8 @@ resolve_keysym(const char *name, xkb_keysym_t *sym_rtrn)
 }
 
 %type <num>     INTEGER FLOAT
-%type <str>     IDENT STRING
+%type <sval>    IDENT
+%type <str>     STRING
 %type <atom>    KEYNAME
 %type <num>     KeyCode Number Integer Float SignedNumber DoodadType
 %type <merge>   MergeMode OptMergeMode
@@ -226,15 +243,7 @@ resolve_keysym(const char *name, xkb_keysym_t *sym_rtrn)
 %type <fileList> XkbMapConfigList
 %type <file>    XkbCompositeMap
 
-%destructor { FreeStmt((ParseCommon *) $$); }
-    <any> <expr> <var> <vmod> <interp> <keyType> <syms> <modMask> <groupCompat>
-    <ledMap> <ledName> <keyCode> <keyAlias>
-%destructor { FreeStmt((ParseCommon *) $$.head); }
-    <anyList> <exprList> <varList> <vmodList>
-/* The destructor also runs on the start symbol when the parser *succeeds*.
- * The `if` here catches this case. */
-%destructor { if (!param->rtrn) FreeXkbFile($$); } <file>
-%destructor { FreeXkbFile($$.head); } <fileList>
+/* The statements and files are freed with param->arena. */
 %destructor { free($$); } <str>
 
 %%
@@ -262,7 +271,11 @@ XkbFile         :       XkbCompositeMap
 XkbCompositeMap :       OptFlags XkbCompositeType OptMapName OBRACE
                             XkbMapConfigList
                         CBRACE SEMI
-                        { $$ = XkbFileCreate($2, $3, (ParseCommon *) $5.head, $1); }
+                        {
+                            $$ = XkbFileCreate(param->arena, $2, $3,
+                                               (ParseCommon *) $5.head, $1);
+                            free($3);
+                        }
                 ;
 
 XkbCompositeType:       XKB_KEYMAP      { $$ = FILE_TYPE_KEYMAP; }
@@ -280,7 +293,8 @@ XkbMapConfig    :       OptFlags FileType OptMapName OBRACE
                             DeclList
                         CBRACE SEMI
                         {
-                            $$ = XkbFileCreate($2, $3, $5.head, $1);
+                            $$ = XkbFileCreate(param->arena, $2, $3, $5.head, $1);
+                            free($3);
                         }
                 ;
 
@@ -393,25 +407,25 @@ Decl            :       OptMergeMode VarDecl
                 |       OptMergeMode DoodadDecl         { $$ = NULL; }
                 |       MergeMode STRING
                         {
-                            $$ = (ParseCommon *) IncludeCreate(param->ctx, $2, $1);
+                            $$ = (ParseCommon *) IncludeCreate(param->ctx, param->arena, $2, $1);
                             free($2);
                         }
                 ;
 
 VarDecl         :       Lhs EQUALS Expr SEMI
-                        { $$ = VarCreate($1, $3); }
+                        { $$ = VarCreate(param->arena, $1, $3); }
                 |       Ident SEMI
-                        { $$ = BoolVarCreate($1, true); }
+                        { $$ = BoolVarCreate(param->arena, $1, true); }
                 |       EXCLAM Ident SEMI
-                        { $$ = BoolVarCreate($2, false); }
+                        { $$ = BoolVarCreate(param->arena, $2, false); }
                 ;
 
 KeyNameDecl     :       KEYNAME EQUALS KeyCode SEMI
-                        { $$ = KeycodeCreate($1, $3); }
+                        { $$ = KeycodeCreate(param->arena, $1, $3); }
                 ;
 
 KeyAliasDecl    :       ALIAS KEYNAME EQUALS KEYNAME SEMI
-                        { $$ = KeyAliasCreate($2, $4); }
+                        { $$ = KeyAliasCreate(param->arena, $2, $4); }
                 ;
 
 VModDecl        :       VIRTUAL_MODS VModDefList SEMI
@@ -425,9 +439,9 @@ VModDefList     :       VModDefList COMMA VModDef
                 ;
 
 VModDef         :       Ident
-                        { $$ = VModCreate($1, NULL); }
+                        { $$ = VModCreate(param->arena, $1, NULL); }
                 |       Ident EQUALS Expr
-                        { $$ = VModCreate($1, $3); }
+                        { $$ = VModCreate(param->arena, $1, $3); }
                 ;
 
 InterpretDecl   :       INTERPRET InterpretMatch OBRACE
@@ -437,9 +451,9 @@ InterpretDecl   :       INTERPRET InterpretMatch OBRACE
                 ;
 
 InterpretMatch  :       KeySym PLUS Expr
-                        { $$ = InterpCreate($1, $3); }
+                        { $$ = InterpCreate(param->arena, $1, $3); }
                 |       KeySym
-                        { $$ = InterpCreate($1, NULL); }
+                        { $$ = InterpCreate(param->arena, $1, NULL); }
                 ;
 
 VarDeclList     :       VarDeclList VarDecl
@@ -451,13 +465,13 @@ VarDeclList     :       VarDeclList VarDecl
 KeyTypeDecl     :       TYPE String OBRACE
                             VarDeclList
                         CBRACE SEMI
-                        { $$ = KeyTypeCreate($2, $4.head); }
+                        { $$ = KeyTypeCreate(param->arena, $2, $4.head); }
                 ;
 
 SymbolsDecl     :       KEY KEYNAME OBRACE
                             SymbolsBody
                         CBRACE SEMI
-                        { $$ = SymbolsCreate($2, $4.head); }
+                        { $$ = SymbolsCreate(param->arena, $2, $4.head); }
                 ;
 
 SymbolsBody     :       SymbolsBody COMMA SymbolsVarDecl
@@ -467,35 +481,35 @@ SymbolsBody     :       SymbolsBody COMMA SymbolsVarDecl
                 |       { $$.head = $$.last = NULL; }
                 ;
 
-SymbolsVarDecl  :       Lhs EQUALS Expr         { $$ = VarCreate($1, $3); }
-                |       Lhs EQUALS ArrayInit    { $$ = VarCreate($1, $3); }
-                |       Ident                   { $$ = BoolVarCreate($1, true); }
-                |       EXCLAM Ident            { $$ = BoolVarCreate($2, false); }
-                |       ArrayInit               { $$ = VarCreate(NULL, $1); }
+SymbolsVarDecl  :       Lhs EQUALS Expr         { $$ = VarCreate(param->arena, $1, $3); }
+                |       Lhs EQUALS ArrayInit    { $$ = VarCreate(param->arena, $1, $3); }
+                |       Ident                   { $$ = BoolVarCreate(param->arena, $1, true); }
+                |       EXCLAM Ident            { $$ = BoolVarCreate(param->arena, $2, false); }
+                |       ArrayInit               { $$ = VarCreate(param->arena, NULL, $1); }
                 ;
 
 ArrayInit       :       OBRACKET OptKeySymList CBRACKET
                         { $$ = $2; }
                 |       OBRACKET ActionList CBRACKET
-                        { $$ = ExprCreateActionList($2.head); }
+                        { $$ = ExprCreateActionList(param->arena, $2.head); }
                 ;
 
 GroupCompatDecl :       GROUP Integer EQUALS Expr SEMI
-                        { $$ = GroupCompatCreate($2, $4); }
+                        { $$ = GroupCompatCreate(param->arena, $2, $4); }
                 ;
 
 ModMapDecl      :       MODIFIER_MAP Ident OBRACE ExprList CBRACE SEMI
-                        { $$ = ModMapCreate($2, $4.head); }
+                        { $$ = ModMapCreate(param->arena, $2, $4.head); }
                 ;
 
 LedMapDecl:             INDICATOR String OBRACE VarDeclList CBRACE SEMI
-                        { $$ = LedMapCreate($2, $4.head); }
+                        { $$ = LedMapCreate(param->arena, $2, $4.head); }
                 ;
 
 LedNameDecl:            INDICATOR Integer EQUALS Expr SEMI
-                        { $$ = LedNameCreate($2, $4, false); }
+                        { $$ = LedNameCreate(param->arena, $2, $4, false); }
                 |       VIRTUAL INDICATOR Integer EQUALS Expr SEMI
-                        { $$ = LedNameCreate($3, $5, true); }
+                        { $$ = LedNameCreate(param->arena, $3, $5, true); }
                 ;
 
 ShapeDecl       :       SHAPE String OBRACE OutlineList CBRACE SEMI
@@ -515,11 +529,11 @@ SectionBody     :       SectionBody SectionBodyItem     { $$ = NULL;}
 SectionBodyItem :       ROW OBRACE RowBody CBRACE SEMI
                         { $$ = NULL; }
                 |       VarDecl
-                        { FreeStmt((ParseCommon *) $1); $$ = NULL; }
+                        { $$ = NULL; }
                 |       DoodadDecl
                         { $$ = NULL; }
                 |       LedMapDecl
-                        { FreeStmt((ParseCommon *) $1); $$ = NULL; }
+                        { $$ = NULL; }
                 |       OverlayDecl
                         { $$ = NULL; }
                 ;
@@ -530,7 +544,7 @@ RowBody         :       RowBody RowBodyItem     { $$ = NULL;}
 
 RowBodyItem     :       KEYS OBRACE Keys CBRACE SEMI { $$ = NULL; }
                 |       VarDecl
-                        { FreeStmt((ParseCommon *) $1); $$ = NULL; }
+                        { $$ = NULL; }
                 ;
 
 Keys            :       Keys COMMA Key          { $$ = NULL; }
@@ -540,7 +554,7 @@ Keys            :       Keys COMMA Key          { $$ = NULL; }
 Key             :       KEYNAME
                         { $$ = NULL; }
                 |       OBRACE ExprList CBRACE
-                        { FreeStmt((ParseCommon *) $2.head); $$ = NULL; }
+                        { $$ = NULL; }
                 ;
 
 OverlayDecl     :       OVERLAY String OBRACE OverlayKeyList CBRACE SEMI
@@ -565,7 +579,7 @@ OutlineInList   :       OBRACE CoordList CBRACE
                 |       Ident EQUALS OBRACE CoordList CBRACE
                         { (void) $4; $$ = NULL; }
                 |       Ident EQUALS Expr
-                        { FreeStmt((ParseCommon *) $3); $$ = NULL; }
+                        { $$ = NULL; }
                 ;
 
 CoordList       :       CoordList COMMA Coord
@@ -579,7 +593,7 @@ Coord           :       OBRACKET SignedNumber COMMA SignedNumber CBRACKET
                 ;
 
 DoodadDecl      :       DoodadType String OBRACE VarDeclList CBRACE SEMI
-                        { FreeStmt((ParseCommon *) $4.head); $$ = NULL; }
+                        { $$ = NULL; }
                 ;
 
 DoodadType      :       TEXT    { $$ = 0; }
@@ -645,31 +659,31 @@ ExprList        :       ExprList COMMA Expr
                 ;
 
 Expr            :       Expr DIVIDE Expr
-                        { $$ = ExprCreateBinary(EXPR_DIVIDE, $1, $3); }
+                        { $$ = ExprCreateBinary(param->arena, EXPR_DIVIDE, $1, $3); }
                 |       Expr PLUS Expr
-                        { $$ = ExprCreateBinary(EXPR_ADD, $1, $3); }
+                        { $$ = ExprCreateBinary(param->arena, EXPR_ADD, $1, $3); }
                 |       Expr MINUS Expr
-                        { $$ = ExprCreateBinary(EXPR_SUBTRACT, $1, $3); }
+                        { $$ = ExprCreateBinary(param->arena, EXPR_SUBTRACT, $1, $3); }
                 |       Expr TIMES Expr
-                        { $$ = ExprCreateBinary(EXPR_MULTIPLY, $1, $3); }
+                        { $$ = ExprCreateBinary(param->arena, EXPR_MULTIPLY, $1, $3); }
                 |       Lhs EQUALS Expr
-                        { $$ = ExprCreateBinary(EXPR_ASSIGN, $1, $3); }
+                        { $$ = ExprCreateBinary(param->arena, EXPR_ASSIGN, $1, $3); }
                 |       Term
                         { $$ = $1; }
                 ;
 
 Term            :       MINUS Term
-                        { $$ = ExprCreateUnary(EXPR_NEGATE, $2->expr.value_type, $2); }
+                        { $$ = ExprCreateUnary(param->arena, EXPR_NEGATE, $2->expr.value_type, $2); }
                 |       PLUS Term
-                        { $$ = ExprCreateUnary(EXPR_UNARY_PLUS, $2->expr.value_type, $2); }
+                        { $$ = ExprCreateUnary(param->arena, EXPR_UNARY_PLUS, $2->expr.value_type, $2); }
                 |       EXCLAM Term
-                        { $$ = ExprCreateUnary(EXPR_NOT, EXPR_TYPE_BOOLEAN, $2); }
+                        { $$ = ExprCreateUnary(param->arena, EXPR_NOT, EXPR_TYPE_BOOLEAN, $2); }
                 |       INVERT Term
-                        { $$ = ExprCreateUnary(EXPR_INVERT, $2->expr.value_type, $2); }
+                        { $$ = ExprCreateUnary(param->arena, EXPR_INVERT, $2->expr.value_type, $2); }
                 |       Lhs
                         { $$ = $1;  }
                 |       FieldSpec OPAREN OptExprList CPAREN %prec OPAREN
-                        { $$ = ExprCreateAction($1, $3.head); }
+                        { $$ = ExprCreateAction(param->arena, $1, $3.head); }
                 |       Terminal
                         { $$ = $1;  }
                 |       OPAREN Expr CPAREN
@@ -683,27 +697,27 @@ ActionList      :       ActionList COMMA Action
                 ;
 
 Action          :       FieldSpec OPAREN OptExprList CPAREN
-                        { $$ = ExprCreateAction($1, $3.head); }
+                        { $$ = ExprCreateAction(param->arena, $1, $3.head); }
                 ;
 
 Lhs             :       FieldSpec
-                        { $$ = ExprCreateIdent($1); }
+                        { $$ = ExprCreateIdent(param->arena, $1); }
                 |       FieldSpec DOT FieldSpec
-                        { $$ = ExprCreateFieldRef($1, $3); }
+                        { $$ = ExprCreateFieldRef(param->arena, $1, $3); }
                 |       FieldSpec OBRACKET Expr CBRACKET
-                        { $$ = ExprCreateArrayRef(XKB_ATOM_NONE, $1, $3); }
+                        { $$ = ExprCreateArrayRef(param->arena, XKB_ATOM_NONE, $1, $3); }
                 |       FieldSpec DOT FieldSpec OBRACKET Expr CBRACKET
-                        { $$ = ExprCreateArrayRef($1, $3, $5); }
+                        { $$ = ExprCreateArrayRef(param->arena, $1, $3, $5); }
                 ;
 
 Terminal        :       String
-                        { $$ = ExprCreateString($1); }
+                        { $$ = ExprCreateString(param->arena, $1); }
                 |       Integer
-                        { $$ = ExprCreateInteger($1); }
+                        { $$ = ExprCreateInteger(param->arena, $1); }
                 |       Float
-                        { $$ = ExprCreateFloat(/* Discard $1 */); }
+                        { $$ = ExprCreateFloat(param->arena /* Discard $1 */); }
                 |       KEYNAME
-                        { $$ = ExprCreateKeyName($1); }
+                        { $$ = ExprCreateKeyName(param->arena, $1); }
                 ;
 
 OptKeySymList   :       KeySymList      { $$ = $1; }
@@ -711,11 +725,29 @@ OptKeySymList   :       KeySymList      { $$ = $1; }
                 ;
 
 KeySymList      :       KeySymList COMMA KeySym
-                        { $$ = ExprAppendKeysymList($1, $3); }
+                        {
+                            $$ = ExprAppendKeysymList(param->arena, $1, $3);
+                            if (!$$) {
+                                parser_err(param, "failed to allocate keysyms");
+                                YYABORT;
+                            }
+                        }
                 |       KeySymList COMMA KeySyms
-                        { $$ = ExprAppendMultiKeysymList($1, $3); }
+                        {
+                            $$ = ExprAppendMultiKeysymList(param->arena, $1, $3);
+                            if (!$$) {
+                                parser_err(param, "failed to allocate keysyms");
+                                YYABORT;
+                            }
+                        }
                 |       KeySym
-                        { $$ = ExprCreateKeysymList($1); }
+                        {
+                            $$ = ExprCreateKeysymList(param->arena, $1);
+                            if (!$$) {
+                                parser_err(param, "failed to allocate keysyms");
+                                YYABORT;
+                            }
+                        }
                 |       KeySyms
                         { $$ = ExprCreateMultiKeysymList($1); }
                 ;
@@ -727,10 +759,10 @@ KeySyms         :       OBRACE KeySymList CBRACE
 KeySym          :       IDENT
                         {
                             if (!resolve_keysym($1, &$$)) {
-                                parser_warn(param, "unrecognized keysym \"%s\"", $1);
+                                parser_warn(param, "unrecognized keysym \"%.*s\"",
+                                            $1.len, $1.start);
                                 $$ = XKB_KEY_NoSymbol;
                             }
-                            free($1);
                         }
                 |       SECTION { $$ = XKB_KEY_section; }
                 |       Integer
@@ -744,8 +776,9 @@ KeySym          :       IDENT
                             }
                             else {
                                 char buf[32];
-                                snprintf(buf, sizeof(buf), "0x%"PRIx64, $1);
-                                if (!resolve_keysym(buf, &$$)) {
+                                struct sval name = { buf, 0 };
+                                name.len = snprintf(buf, sizeof(buf), "0x%"PRIx64, $1);
+                                if (!resolve_keysym(name, &$$)) {
                                     parser_warn(param, "unrecognized keysym \"%s\"", buf);
                                     $$ = XKB_KEY_NoSymbol;
                                 }
@@ -770,7 +803,7 @@ Integer         :       INTEGER { $$ = $1; }
 KeyCode         :       INTEGER { $$ = $1; }
                 ;
 
-Ident           :       IDENT   { $$ = xkb_atom_intern(param->ctx, $1, strlen($1)); free($1); }
+Ident           :       IDENT   { $$ = xkb_atom_intern(param->ctx, $1.start, $1.len); }
                 |       DEFAULT { $$ = xkb_atom_intern_literal(param->ctx, "default"); }
                 ;
 
@@ -794,6 +827,7 @@ parse(struct xkb_context *ctx, struct scanner *scanner, const char *map)
     struct parser_param param = {
         .scanner = scanner,
         .ctx = ctx,
+        .arena = NULL,
         .rtrn = NULL,
         .more_maps = false,
     };
@@ -806,7 +840,23 @@ parse(struct xkb_context *ctx, struct scanner *scanner, const char *map)
      * the first map in the file.
      */
 
-    while ((ret = yyparse(&param)) == 0 && param.more_maps) {
+    for (;;) {
+        /* Each map gets an arena of its own, owned by its XkbFile. */
+        param.arena = malloc(sizeof(*param.arena));
+        if (!param.arena) {
+            ret = -1;
+            break;
+        }
+        arena_init(param.arena);
+
+        ret = yyparse(&param);
+        if (ret != 0 || !param.more_maps) {
+            arena_release(param.arena);
+            free(param.arena);
+            break;
+        }
+        param.rtrn->arena = param.arena;
+
         if (map) {
             if (streq_not_null(map, param.rtrn->name))
                 return param.rtrn;
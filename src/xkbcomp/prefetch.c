@@ -0,0 +1,302 @@
+/*
+ * Copyright © 2021 libxkbcommon contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "xkbcomp-priv.h"
+#include "include.h"
+#include "map-index.h"
+#include "prefetch.h"
+
+/*
+ * Most of the time spent compiling a keymap from RMLVO names goes into
+ * finding, reading and parsing the included files, and the include trees
+ * of the sections do not depend on each other. So while a section is
+ * being compiled, workers go through the include statements of the later
+ * sections, in the same order as the compiler, and keep the parsed files.
+ *
+ * A worker runs with a copy of the context which records what is logged
+ * instead of logging it; the messages are logged when the compiler takes
+ * the file, so the log is the same as without workers. The compiler must
+ * ask for the includes in the exact order they were prefetched; as soon
+ * as it does not, e.g. because it abandoned a file, it processes the rest
+ * of the section's includes itself.
+ */
+
+#ifdef HAVE_PTHREAD
+
+/* Files nested deeper than this are left to the compiler. */
+#define PREFETCH_MAX_DEPTH 16
+
+struct logged_message {
+    enum xkb_log_level level;
+    char *message;
+};
+
+typedef darray(struct logged_message) darray_logged_message;
+
+struct prefetched_include {
+    IncludeStmt *stmt;
+    XkbFile *file;
+    darray_logged_message messages;
+};
+
+struct prefetch_worker {
+    XkbFile *section;
+    enum xkb_file_type type;
+    struct xkb_context ctx;
+    /* Logged while processing the current include statement. */
+    darray_logged_message messages;
+    darray(struct prefetched_include) includes;
+    /* The next include the compiler should ask for. */
+    unsigned int next;
+    bool diverged;
+    bool running;
+    pthread_t thread;
+};
+
+struct include_prefetch {
+    struct xkb_context *ctx;
+    struct prefetch_worker workers[LAST_KEYMAP_FILE_TYPE + 1];
+    unsigned int num_running;
+};
+
+ATTR_PRINTF(3, 0) static void
+record_log(struct xkb_context *ctx, enum xkb_log_level level,
+           const char *fmt, va_list args)
+{
+    struct prefetch_worker *worker = ctx->user_data;
+    struct logged_message logged;
+
+    logged.level = level;
+    logged.message = vasprintf_safe(fmt, args);
+    if (logged.message)
+        darray_append(worker->messages, logged);
+}
+
+static void
+clear_messages(darray_logged_message *messages)
+{
+    struct logged_message *logged;
+
+    darray_foreach(logged, *messages)
+        free(logged->message);
+    darray_free(*messages);
+}
+
+/* Mirrors HandleInclude*() and Handle*File(). */
+static void
+prefetch_file(struct prefetch_worker *worker, XkbFile *file,
+              unsigned int depth)
+{
+    if (depth >= PREFETCH_MAX_DEPTH)
+        return;
+
+    for (ParseCommon *def = file->defs; def; def = def->next) {
+        if (def->type != STMT_INCLUDE)
+            continue;
+
+        for (IncludeStmt *stmt = (IncludeStmt *) def; stmt;
+             stmt = stmt->next_incl) {
+            struct prefetched_include prefetched;
+
+            prefetched.stmt = stmt;
+            prefetched.file = ProcessIncludeFile(&worker->ctx, stmt,
+                                                 worker->type);
+            prefetched.messages = worker->messages;
+            darray_init(worker->messages);
+            darray_append(worker->includes, prefetched);
+
+            if (!prefetched.file)
+                break;
+
+            prefetch_file(worker, prefetched.file, depth + 1);
+        }
+    }
+}
+
+static void *
+run_worker(void *data)
+{
+    struct prefetch_worker *worker = data;
+
+    prefetch_file(worker, worker->section, 0);
+    return NULL;
+}
+
+struct include_prefetch *
+include_prefetch_start(struct xkb_context *ctx, XkbFile **files)
+{
+    struct include_prefetch *prefetch;
+
+    prefetch = calloc(1, sizeof(*prefetch));
+    if (!prefetch)
+        return NULL;
+
+    prefetch->ctx = ctx;
+    atom_table_set_threaded(ctx->atom_table, true);
+
+    for (enum xkb_file_type type = FIRST_KEYMAP_FILE_TYPE + 1;
+         type <= LAST_KEYMAP_FILE_TYPE;
+         type++) {
+        struct prefetch_worker *worker = &prefetch->workers[type];
+
+        worker->section = files[type];
+        worker->type = type;
+
+        /* Share the include paths and atoms, but nothing else mutable. */
+        worker->ctx = *ctx;
+        worker->ctx.log_fn = record_log;
+        worker->ctx.user_data = worker;
+        worker->ctx.x11_atom_cache = NULL;
+        worker->ctx.compose_locale_files = NULL;
+        worker->ctx.xkb_map_indexes = NULL;
+        worker->ctx.xkb_include_prefetch = NULL;
+        worker->ctx.text_next = 0;
+
+        if (pthread_create(&worker->thread, NULL, run_worker, worker) != 0)
+            continue;
+
+        worker->running = true;
+        prefetch->num_running++;
+    }
+
+    if (prefetch->num_running == 0) {
+        atom_table_set_threaded(ctx->atom_table, false);
+        free(prefetch);
+        return NULL;
+    }
+
+    ctx->xkb_include_prefetch = prefetch;
+    return prefetch;
+}
+
+void
+include_prefetch_wait(struct include_prefetch *prefetch,
+                      enum xkb_file_type type)
+{
+    struct prefetch_worker *worker = &prefetch->workers[type];
+
+    if (!worker->running)
+        return;
+
+    pthread_join(worker->thread, NULL);
+    worker->running = false;
+    if (--prefetch->num_running == 0)
+        atom_table_set_threaded(prefetch->ctx->atom_table, false);
+
+    /* Keep the indexes of the files the worker read for later keymaps. */
+    map_indexes_merge(prefetch->ctx, worker->ctx.xkb_map_indexes);
+    worker->ctx.xkb_map_indexes = NULL;
+}
+
+bool
+include_prefetch_take(struct xkb_context *ctx, IncludeStmt *stmt,
+                      enum xkb_file_type type, XkbFile **file_out)
+{
+    struct include_prefetch *prefetch = ctx->xkb_include_prefetch;
+    struct prefetch_worker *worker;
+    struct prefetched_include *prefetched;
+    struct logged_message *logged;
+
+    if (!prefetch || type > LAST_KEYMAP_FILE_TYPE)
+        return false;
+
+    worker = &prefetch->workers[type];
+    if (worker->running || worker->diverged)
+        return false;
+
+    if (worker->next >= darray_size(worker->includes) ||
+        darray_item(worker->includes, worker->next).stmt != stmt) {
+        worker->diverged = true;
+        return false;
+    }
+
+    prefetched = &darray_item(worker->includes, worker->next++);
+
+    darray_foreach(logged, prefetched->messages)
+        xkb_log(ctx, logged->level, 0, "%s", logged->message);
+    clear_messages(&prefetched->messages);
+
+    *file_out = prefetched->file;
+    prefetched->file = NULL;
+    return true;
+}
+
+void
+include_prefetch_finish(struct include_prefetch *prefetch)
+{
+    if (!prefetch)
+        return;
+
+    for (enum xkb_file_type type = FIRST_KEYMAP_FILE_TYPE + 1;
+         type <= LAST_KEYMAP_FILE_TYPE;
+         type++) {
+        struct prefetch_worker *worker = &prefetch->workers[type];
+        struct prefetched_include *prefetched;
+
+        include_prefetch_wait(prefetch, type);
+
+        darray_foreach(prefetched, worker->includes) {
+            FreeXkbFile(prefetched->file);
+            clear_messages(&prefetched->messages);
+        }
+        darray_free(worker->includes);
+        clear_messages(&worker->messages);
+    }
+
+    prefetch->ctx->xkb_include_prefetch = NULL;
+    free(prefetch);
+}
+
+#else /* HAVE_PTHREAD */
+
+struct include_prefetch *
+include_prefetch_start(struct xkb_context *ctx, XkbFile **files)
+{
+    return NULL;
+}
+
+void
+include_prefetch_wait(struct include_prefetch *prefetch,
+                      enum xkb_file_type type)
+{
+}
+
+bool
+include_prefetch_take(struct xkb_context *ctx, IncludeStmt *stmt,
+                      enum xkb_file_type type, XkbFile **file_out)
+{
+    return false;
+}
+
+void
+include_prefetch_finish(struct include_prefetch *prefetch)
+{
+}
+
+#endif /* HAVE_PTHREAD */
@@ -0,0 +1,54 @@
+/*
+ * Copyright © 2021 libxkbcommon contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef XKBCOMP_PREFETCH_H
+#define XKBCOMP_PREFETCH_H
+
+struct include_prefetch;
+
+/*
+ * Start resolving and parsing the includes of the keymap sections in
+ * @files in worker threads, except for the first section, which is
+ * compiled right away. Returns NULL if no thread could be started.
+ */
+struct include_prefetch *
+include_prefetch_start(struct xkb_context *ctx, XkbFile **files);
+
+/* Wait for the includes of a section. Call before compiling it. */
+void
+include_prefetch_wait(struct include_prefetch *prefetch,
+                      enum xkb_file_type type);
+
+/*
+ * If the include statement was prefetched, log what processing it logged,
+ * set @file_out to the result, which may be NULL, and return true.
+ */
+bool
+include_prefetch_take(struct xkb_context *ctx, IncludeStmt *stmt,
+                      enum xkb_file_type type, XkbFile **file_out);
+
+/* Wait for all workers and free what was not taken. */
+void
+include_prefetch_finish(struct include_prefetch *prefetch);
+
+#endif
@@ -115,8 +115,7 @@ skip_more_whitespace_and_comments:
     if (eof(s)) return TOK_END_OF_FILE;
 
     /* New token. */
-    s->token_line = s->line;
-    s->token_column = s->column;
+    s->token_pos = s->pos;
 
     /* Operators and punctuation. */
     if (chr(s, '!')) return TOK_BANG;
@@ -364,10 +363,15 @@ matcher_include(struct matcher *m, struct scanner *parent_scanner,
     struct scanner s; /* parses the !include value */
     FILE *file;
 
-    scanner_init(&s, m->ctx, inc.start, inc.len,
+    /*
+     * Scan the value in place in the parent's buffer, so that diagnostics
+     * point at the include statement.
+     */
+    scanner_init(&s, m->ctx, parent_scanner->s,
+                 (size_t) (inc.start - parent_scanner->s) + inc.len,
                  parent_scanner->file_name, NULL);
-    s.token_line = parent_scanner->token_line;
-    s.token_column = parent_scanner->token_column;
+    s.pos = (size_t) (inc.start - parent_scanner->s);
+    s.token_pos = parent_scanner->token_pos;
     s.buf_pos = 0;
 
     if (include_depth >= MAX_INCLUDE_DEPTH) {
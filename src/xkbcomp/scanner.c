@@ -25,7 +25,7 @@
 
 #include "xkbcomp-priv.h"
 #include "parser-priv.h"
-#include "scanner-utils.h"
+#include "map-index.h"
 
 static bool
 number(struct scanner *s, int64_t *out, int *out_tok)
@@ -62,6 +62,59 @@ number(struct scanner *s, int64_t *out, int *out_tok)
     return true;
 }
 
+/*
+ * Fast paths for the common tokens. These work on the buffer directly, and
+ * find the end of the token before copying anything; line and column are
+ * not tracked, see scanner_token_location().
+ */
+
+static inline void
+skip_spaces(struct scanner *s)
+{
+    const char *p = s->s + s->pos;
+    const char *end = s->s + s->len;
+
+    while (p < end && is_space(*p))
+        p++;
+    s->pos = p - s->s;
+}
+
+/* Returns the length of the identifier at the current position. */
+static inline size_t
+scan_ident(struct scanner *s)
+{
+    const char *start = s->s + s->pos;
+    const char *p = start;
+    const char *end = s->s + s->len;
+
+    while (p < end && (is_alnum(*p) || *p == '_'))
+        p++;
+    return p - start;
+}
+
+/*
+ * If the string literal starting at the current position (after the quote)
+ * is terminated and has no escape sequences, gets its length.
+ */
+static inline bool
+scan_plain_string(struct scanner *s, size_t *len)
+{
+    const char *start = s->s + s->pos;
+    const char *end = s->s + s->len;
+    const char *quote, *p;
+
+    /* Strings do not span lines, so stop looking at the end of the line. */
+    p = memchr(start, '\n', end - start);
+    if (p)
+        end = p;
+
+    quote = memchr(start, '\"', end - start);
+    if (!quote || memchr(start, '\\', quote - start))
+        return false;
+    *len = quote - start;
+    return true;
+}
+
 int
 _xkbcommon_lex(YYSTYPE *yylval, struct scanner *s)
 {
@@ -69,7 +122,7 @@ _xkbcommon_lex(YYSTYPE *yylval, struct scanner *s)
 
 skip_more_whitespace_and_comments:
     /* Skip spaces. */
-    while (is_space(peek(s))) next(s);
+    skip_spaces(s);
 
     /* Skip comments. */
     if (lit(s, "//") || chr(s, '#')) {
@@ -81,12 +134,25 @@ skip_more_whitespace_and_comments:
     if (eof(s)) return END_OF_FILE;
 
     /* New token. */
-    s->token_line = s->line;
-    s->token_column = s->column;
+    s->token_pos = s->pos;
     s->buf_pos = 0;
 
     /* String literal. */
     if (chr(s, '\"')) {
+        size_t len;
+
+        if (scan_plain_string(s, &len)) {
+            if (len + 1 >= sizeof(s->buf)) {
+                scanner_err(s, "unterminated string literal");
+                return ERROR_TOK;
+            }
+            yylval->str = strndup(s->s + s->pos, len);
+            if (!yylval->str)
+                return ERROR_TOK;
+            s->pos += len + 1;
+            return STRING;
+        }
+
         while (!eof(s) && !eol(s) && peek(s) != '\"') {
             if (chr(s, '\\')) {
                 uint8_t o;
@@ -119,52 +185,58 @@ skip_more_whitespace_and_comments:
 
     /* Key name literal. */
     if (chr(s, '<')) {
+        const char *start = s->s + s->pos;
+
         while (is_graph(peek(s)) && peek(s) != '>')
-            buf_append(s, next(s));
-        if (!buf_append(s, '\0') || !chr(s, '>')) {
+            s->pos++;
+        size_t len = s->s + s->pos - start;
+        if (len + 1 >= sizeof(s->buf) || !chr(s, '>')) {
             scanner_err(s, "unterminated key name literal");
             return ERROR_TOK;
         }
         /* Empty key name literals are allowed. */
-        yylval->atom = xkb_atom_intern(s->ctx, s->buf, s->buf_pos - 1);
+        yylval->atom = xkb_atom_intern(s->ctx, start, len);
         return KEYNAME;
     }
 
     /* Operators and punctuation. */
-    if (chr(s, ';')) return SEMI;
-    if (chr(s, '{')) return OBRACE;
-    if (chr(s, '}')) return CBRACE;
-    if (chr(s, '=')) return EQUALS;
-    if (chr(s, '[')) return OBRACKET;
-    if (chr(s, ']')) return CBRACKET;
-    if (chr(s, '(')) return OPAREN;
-    if (chr(s, ')')) return CPAREN;
-    if (chr(s, '.')) return DOT;
-    if (chr(s, ',')) return COMMA;
-    if (chr(s, '+')) return PLUS;
-    if (chr(s, '-')) return MINUS;
-    if (chr(s, '*')) return TIMES;
-    if (chr(s, '/')) return DIVIDE;
-    if (chr(s, '!')) return EXCLAM;
-    if (chr(s, '~')) return INVERT;
+    switch (peek(s)) {
+    case ';': s->pos++; return SEMI;
+    case '{': s->pos++; return OBRACE;
+    case '}': s->pos++; return CBRACE;
+    case '=': s->pos++; return EQUALS;
+    case '[': s->pos++; return OBRACKET;
+    case ']': s->pos++; return CBRACKET;
+    case '(': s->pos++; return OPAREN;
+    case ')': s->pos++; return CPAREN;
+    case '.': s->pos++; return DOT;
+    case ',': s->pos++; return COMMA;
+    case '+': s->pos++; return PLUS;
+    case '-': s->pos++; return MINUS;
+    case '*': s->pos++; return TIMES;
+    case '/': s->pos++; return DIVIDE;
+    case '!': s->pos++; return EXCLAM;
+    case '~': s->pos++; return INVERT;
+    }
 
     /* Identifier. */
     if (is_alpha(peek(s)) || peek(s) == '_') {
-        s->buf_pos = 0;
-        while (is_alnum(peek(s)) || peek(s) == '_')
-            buf_append(s, next(s));
-        if (!buf_append(s, '\0')) {
+        const char *start = s->s + s->pos;
+        size_t len = scan_ident(s);
+
+        s->pos += len;
+        if (len + 1 >= sizeof(s->buf)) {
             scanner_err(s, "identifier too long");
             return ERROR_TOK;
         }
 
         /* Keyword. */
-        tok = keyword_to_token(s->buf, s->buf_pos - 1);
+        tok = keyword_to_token(start, len);
         if (tok != -1) return tok;
 
-        yylval->str = strdup(s->buf);
-        if (!yylval->str)
-            return ERROR_TOK;
+        /* The parser uses it before the input goes away. */
+        yylval->sval.start = start;
+        yylval->sval.len = len;
         return IDENT;
     }
 
@@ -195,9 +267,11 @@ XkbParseFile(struct xkb_context *ctx, FILE *file,
              const char *file_name, const char *map)
 {
     bool ok;
+    int ret;
     XkbFile *xkb_file;
+    struct scanner scanner;
     char *string;
-    size_t size;
+    size_t size, start, end;
 
     ok = map_file(file, &string, &size);
     if (!ok) {
@@ -206,7 +280,19 @@ XkbParseFile(struct xkb_context *ctx, FILE *file,
         return NULL;
     }
 
-    xkb_file = XkbParseString(ctx, string, size, file_name, map);
+    ret = map_index_find(ctx, string, size, map, &start, &end);
+    if (ret < 0) {
+        xkb_file = XkbParseString(ctx, string, size, file_name, map);
+    }
+    else if (ret > 0) {
+        /* Parse just the map, in place so that locations stay right. */
+        scanner_init(&scanner, ctx, string, end, file_name, NULL);
+        scanner.pos = start;
+        xkb_file = parse(ctx, &scanner, map);
+    }
+    else {
+        xkb_file = NULL;
+    }
     unmap_file(string, size);
     return xkb_file;
 }
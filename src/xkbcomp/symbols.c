@@ -60,6 +60,7 @@
 #include "vmod.h"
 #include "include.h"
 #include "keysym.h"
+#include "hash-index.h"
 
 enum key_repeat {
     KEY_REPEAT_UNDEFINED = 0,
@@ -175,6 +176,8 @@ typedef struct {
     enum merge_mode merge;
     xkb_layout_index_t explicit_group;
     darray(KeyInfo) keys;
+    /* Positions in @keys by key name. */
+    struct hash_index key_index;
     KeyInfo default_key;
     ActionsInfo *actions;
     darray(xkb_atom_t) group_names;
@@ -208,6 +211,7 @@ ClearSymbolsInfo(SymbolsInfo *info)
     darray_foreach(keyi, info->keys)
         ClearKeyInfo(keyi);
     darray_free(info->keys);
+    hash_index_free(&info->key_index);
     darray_free(info->group_names);
     darray_free(info->modmaps);
     ClearKeyInfo(&info->default_key);
@@ -421,7 +425,7 @@ static bool
 AddKeySymbols(SymbolsInfo *info, KeyInfo *keyi, bool same_file)
 {
     xkb_atom_t real_name;
-    KeyInfo *iter;
+    uint32_t slot, pos;
 
     /*
      * Don't keep aliases in the keys array; this guarantees that
@@ -433,9 +437,18 @@ AddKeySymbols(SymbolsInfo *info, KeyInfo *keyi, bool same_file)
     if (real_name != XKB_ATOM_NONE)
         keyi->name = real_name;
 
-    darray_foreach(iter, info->keys)
+    hash_index_foreach(pos, slot, &info->key_index, keyi->name) {
+        KeyInfo *iter = &darray_item(info->keys, pos);
         if (iter->name == keyi->name)
             return MergeKeys(info, iter, keyi, same_file);
+    }
+
+    if (!hash_index_add(&info->key_index, keyi->name,
+                        darray_size(info->keys))) {
+        ClearKeyInfo(keyi);
+        InitKeyInfo(info->ctx, keyi);
+        return false;
+    }
 
     darray_append(info->keys, *keyi);
     InitKeyInfo(info->ctx, keyi);
@@ -506,24 +519,35 @@ MergeIncludedSymbols(SymbolsInfo *into, SymbolsInfo *from,
         from->name = NULL;
     }
 
-    group_names_in_both = MIN(darray_size(into->group_names),
-                              darray_size(from->group_names));
-    for (xkb_layout_index_t i = 0; i < group_names_in_both; i++) {
-        if (!darray_item(from->group_names, i))
-            continue;
+    if (darray_empty(into->group_names)) {
+        into->group_names = from->group_names;
+        darray_init(from->group_names);
+    }
+    else {
+        group_names_in_both = MIN(darray_size(into->group_names),
+                                  darray_size(from->group_names));
+        for (xkb_layout_index_t i = 0; i < group_names_in_both; i++) {
+            if (!darray_item(from->group_names, i))
+                continue;
 
-        if (merge == MERGE_AUGMENT && darray_item(into->group_names, i))
-            continue;
+            if (merge == MERGE_AUGMENT && darray_item(into->group_names, i))
+                continue;
 
-        darray_item(into->group_names, i) = darray_item(from->group_names, i);
+            darray_item(into->group_names, i) =
+                darray_item(from->group_names, i);
+        }
+        /* If @from has more, get them as well. */
+        darray_foreach_from(group_name, from->group_names,
+                            group_names_in_both)
+            darray_append(into->group_names, *group_name);
     }
-    /* If @from has more, get them as well. */
-    darray_foreach_from(group_name, from->group_names, group_names_in_both)
-        darray_append(into->group_names, *group_name);
 
     if (darray_empty(into->keys)) {
         into->keys = from->keys;
         darray_init(from->keys);
+        hash_index_free(&into->key_index);
+        into->key_index = from->key_index;
+        hash_index_init(&from->key_index);
     }
     else {
         KeyInfo *keyi;
@@ -557,8 +581,7 @@ HandleIncludeSymbols(SymbolsInfo *info, IncludeStmt *include)
     SymbolsInfo included;
 
     InitSymbolsInfo(&included, info->keymap, info->actions, &info->mods);
-    included.name = include->stmt;
-    include->stmt = NULL;
+    included.name = strdup_safe(include->stmt);
 
     for (IncludeStmt *stmt = include; stmt; stmt = stmt->next_incl) {
         SymbolsInfo next_incl;
@@ -686,7 +709,7 @@ AddSymbolsToKey(SymbolsInfo *info, KeyInfo *keyi, ExprDef *arrayNdx,
         return false;
     }
 
-    nLevels = darray_size(value->keysym_list.symsMapIndex);
+    nLevels = value->keysym_list.num_levels;
     if (darray_size(groupi->levels) < nLevels)
         darray_resize0(groupi->levels, nLevels);
 
@@ -696,14 +719,13 @@ AddSymbolsToKey(SymbolsInfo *info, KeyInfo *keyi, ExprDef *arrayNdx,
         unsigned int sym_index;
         struct xkb_level *leveli = &darray_item(groupi->levels, i);
 
-        sym_index = darray_item(value->keysym_list.symsMapIndex, i);
-        leveli->num_syms = darray_item(value->keysym_list.symsNumEntries, i);
+        sym_index = value->keysym_list.symsMapIndex[i];
+        leveli->num_syms = value->keysym_list.symsNumEntries[i];
         if (leveli->num_syms > 1)
             leveli->u.syms = calloc(leveli->num_syms, sizeof(*leveli->u.syms));
 
         for (unsigned j = 0; j < leveli->num_syms; j++) {
-            xkb_keysym_t keysym = darray_item(value->keysym_list.syms,
-                                              sym_index + j);
+            xkb_keysym_t keysym = value->keysym_list.syms[sym_index + j];
 
             if (leveli->num_syms == 1) {
                 if (keysym == XKB_KEY_NoSymbol)
@@ -1120,19 +1142,23 @@ HandleSymbolsDef(SymbolsInfo *info, SymbolsDef *stmt)
 
     keyi = info->default_key;
     darray_init(keyi.groups);
-    darray_copy(keyi.groups, info->default_key.groups);
-    for (xkb_layout_index_t i = 0; i < darray_size(keyi.groups); i++)
-        CopyGroupInfo(&darray_item(keyi.groups, i),
-                      &darray_item(info->default_key.groups, i));
+    if (!darray_empty(info->default_key.groups)) {
+        darray_copy(keyi.groups, info->default_key.groups);
+        for (xkb_layout_index_t i = 0; i < darray_size(keyi.groups); i++)
+            CopyGroupInfo(&darray_item(keyi.groups, i),
+                          &darray_item(info->default_key.groups, i));
+    }
     keyi.merge = stmt->merge;
     keyi.name = stmt->keyName;
 
     if (!HandleSymbolsBody(info, stmt->symbols, &keyi)) {
+        ClearKeyInfo(&keyi);
         info->errorCount++;
         return false;
     }
 
     if (!SetExplicitGroup(info, &keyi)) {
+        ClearKeyInfo(&keyi);
         info->errorCount++;
         return false;
     }
@@ -1393,9 +1419,22 @@ use_default:
     return &keymap->types[0];
 }
 
+static struct xkb_key *
+FindKeyInKeymap(struct xkb_keymap *keymap, const struct hash_index *keys,
+                xkb_atom_t name)
+{
+    uint32_t slot, kc;
+
+    hash_index_foreach(kc, slot, keys, name)
+        if (keymap->keys[kc].name == name)
+            return &keymap->keys[kc];
+
+    return NULL;
+}
+
 static bool
 CopySymbolsDefToKeymap(struct xkb_keymap *keymap, SymbolsInfo *info,
-                       KeyInfo *keyi)
+                       const struct hash_index *keys, KeyInfo *keyi)
 {
     struct xkb_key *key;
     GroupInfo *groupi;
@@ -1404,9 +1443,9 @@ CopySymbolsDefToKeymap(struct xkb_keymap *keymap, SymbolsInfo *info,
 
     /*
      * The name is guaranteed to be real and not an alias (see
-     * AddKeySymbols), so 'false' is safe here.
+     * AddKeySymbols), so aliases need not be resolved here.
      */
-    key = XkbKeyByName(keymap, keyi->name, false);
+    key = FindKeyInKeymap(keymap, keys, keyi->name);
     if (!key) {
         log_vrb(info->ctx, 5,
                 "Key %s not found in keycodes; Symbols ignored\n",
@@ -1532,6 +1571,8 @@ CopySymbolsToKeymap(struct xkb_keymap *keymap, SymbolsInfo *info)
 {
     KeyInfo *keyi;
     ModMapEntry *mm;
+    struct xkb_key *key;
+    struct hash_index keys;
 
     keymap->symbols_section_name = strdup_safe(info->name);
     XkbEscapeMapName(keymap->symbols_section_name);
@@ -1541,13 +1582,24 @@ CopySymbolsToKeymap(struct xkb_keymap *keymap, SymbolsInfo *info)
     darray_steal(info->group_names,
                  &keymap->group_names, &keymap->num_group_names);
 
+    hash_index_init(&keys);
+    xkb_keys_foreach(key, keymap) {
+        if (key->name == XKB_ATOM_NONE)
+            continue;
+
+        if (!hash_index_add(&keys, key->name, key->keycode)) {
+            hash_index_free(&keys);
+            return false;
+        }
+    }
+
     darray_foreach(keyi, info->keys)
-        if (!CopySymbolsDefToKeymap(keymap, info, keyi))
+        if (!CopySymbolsDefToKeymap(keymap, info, &keys, keyi))
             info->errorCount++;
 
-    if (xkb_context_get_log_verbosity(keymap->ctx) > 3) {
-        struct xkb_key *key;
+    hash_index_free(&keys);
 
+    if (xkb_context_get_log_verbosity(keymap->ctx) > 3) {
         xkb_keys_foreach(key, keymap) {
             if (key->name == XKB_ATOM_NONE)
                 continue;
@@ -31,6 +31,7 @@
 #include "vmod.h"
 #include "expr.h"
 #include "include.h"
+#include "hash-index.h"
 
 enum type_field {
     TYPE_FIELD_MASK = (1 << 0),
@@ -55,6 +56,8 @@ typedef struct {
     int errorCount;
 
     darray(KeyTypeInfo) types;
+    /* Positions in @types by type name. */
+    struct hash_index type_index;
     struct xkb_mod_set mods;
 
     struct xkb_context *ctx;
@@ -117,18 +120,23 @@ ClearKeyTypeInfo(KeyTypeInfo *type)
 static void
 ClearKeyTypesInfo(KeyTypesInfo *info)
 {
+    KeyTypeInfo *type;
+
     free(info->name);
+    darray_foreach(type, info->types)
+        ClearKeyTypeInfo(type);
     darray_free(info->types);
+    hash_index_free(&info->type_index);
 }
 
 static KeyTypeInfo *
 FindMatchingKeyType(KeyTypesInfo *info, xkb_atom_t name)
 {
-    KeyTypeInfo *old;
+    uint32_t slot, pos;
 
-    darray_foreach(old, info->types)
-        if (old->name == name)
-            return old;
+    hash_index_foreach(pos, slot, &info->type_index, name)
+        if (darray_item(info->types, pos).name == name)
+            return &darray_item(info->types, pos);
 
     return NULL;
 }
@@ -166,7 +174,16 @@ AddKeyType(KeyTypesInfo *info, KeyTypeInfo *new, bool same_file)
         return true;
     }
 
+    if (!hash_index_add(&info->type_index, new->name,
+                        darray_size(info->types))) {
+        ClearKeyTypeInfo(new);
+        return false;
+    }
+
+    /* The new type takes over the entries and level names. */
     darray_append(info->types, *new);
+    darray_init(new->entries);
+    darray_init(new->level_names);
     return true;
 }
 
@@ -191,6 +208,9 @@ MergeIncludedKeyTypes(KeyTypesInfo *into, KeyTypesInfo *from,
     if (darray_empty(into->types)) {
         into->types = from->types;
         darray_init(from->types);
+        hash_index_free(&into->type_index);
+        into->type_index = from->type_index;
+        hash_index_init(&from->type_index);
     }
     else {
         KeyTypeInfo *type;
@@ -211,8 +231,7 @@ HandleIncludeKeyTypes(KeyTypesInfo *info, IncludeStmt *include)
     KeyTypesInfo included;
 
     InitKeyTypesInfo(&included, info->ctx, &info->mods);
-    included.name = include->stmt;
-    include->stmt = NULL;
+    included.name = strdup_safe(include->stmt);
 
     for (IncludeStmt *stmt = include; stmt; stmt = stmt->next_incl) {
         KeyTypesInfo next_incl;
@@ -613,6 +632,7 @@ HandleKeyTypeDef(KeyTypesInfo *info, KeyTypeDef *def, enum merge_mode merge)
     };
 
     if (!HandleKeyTypeBody(info, def->body, &type)) {
+        ClearKeyTypeInfo(&type);
         info->errorCount++;
         return false;
     }
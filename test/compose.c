@@ -23,6 +23,9 @@
 
 #include "config.h"
 
+#include <dirent.h>
+#include <sys/stat.h>
+
 #include "xkbcommon/xkbcommon-compose.h"
 
 #include "test.h"
@@ -311,6 +314,18 @@ test_conflicting(struct xkb_context *ctx)
         XKB_KEY_C,              XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSED,   "foo",  XKB_KEY_A,
         XKB_KEY_NoSymbol));
 
+    // old is a prefix of new, siblings of old are kept
+    assert(test_compose_seq_buffer(ctx,
+        "<A> <B>      :  \"bar\"  B \n"
+        "<A> <C>      :  \"baz\"  C \n"
+        "<A> <B> <D>  :  \"foo\"  A \n",
+        XKB_KEY_A,              XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSING,  "",     XKB_KEY_NoSymbol,
+        XKB_KEY_C,              XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSED,   "baz",  XKB_KEY_C,
+        XKB_KEY_A,              XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSING,  "",     XKB_KEY_NoSymbol,
+        XKB_KEY_B,              XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSING,  "",     XKB_KEY_NoSymbol,
+        XKB_KEY_D,              XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSED,   "foo",  XKB_KEY_A,
+        XKB_KEY_NoSymbol));
+
     // new duplicate of old
     assert(test_compose_seq_buffer(ctx,
         "<A> <B>      :  \"bar\"  B \n"
@@ -515,6 +530,620 @@ test_include(struct xkb_context *ctx)
     free(table_string);
 }
 
+static void
+test_many_sequences(struct xkb_context *ctx)
+{
+    struct xkb_compose_table *table;
+    darray_char buffer = darray_new();
+    char line[64];
+    const unsigned num_sequences = 40000;
+
+    /* Needs more than 65535 nodes. */
+    for (unsigned i = 0; i < num_sequences; i++) {
+        int len = snprintf(line, sizeof(line), "<U%X> <U%X> : \"%u\"\n",
+                           0x10000 + i, 0x4e00 + i % 64, i);
+        darray_append_items(buffer, line, len);
+    }
+
+    table = xkb_compose_table_new_from_buffer(ctx, buffer.item, buffer.size,
+                                              "", XKB_COMPOSE_FORMAT_TEXT_V1,
+                                              XKB_COMPOSE_COMPILE_NO_FLAGS);
+    assert(table);
+
+    assert(test_compose_seq(table,
+        0x1010000,              XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSING,  "",     XKB_KEY_NoSymbol,
+        0x1004e00,              XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSED,   "0",    XKB_KEY_NoSymbol,
+        0x1010000 + num_sequences - 1,
+                                XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSING,  "",     XKB_KEY_NoSymbol,
+        0x1004e00 + (num_sequences - 1) % 64,
+                                XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSED,   "39999", XKB_KEY_NoSymbol,
+        XKB_KEY_NoSymbol));
+
+    xkb_compose_table_unref(table);
+    darray_free(buffer);
+}
+
+static void
+write_file(const char *path, const char *contents)
+{
+    FILE *file = fopen(path, "wb");
+    assert(file);
+    assert(fputs(contents, file) >= 0);
+    assert(fclose(file) == 0);
+}
+
+#ifdef HAVE_MMAP
+static unsigned
+count_cache_files(const char *dir)
+{
+    DIR *d;
+    struct dirent *ent;
+    unsigned count = 0;
+
+    d = opendir(dir);
+    if (!d)
+        return 0;
+    while ((ent = readdir(d)))
+        if (strncmp(ent->d_name, "compose-", strlen("compose-")) == 0)
+            count++;
+    closedir(d);
+    return count;
+}
+#endif
+
+static void
+test_cache(struct xkb_context *ctx)
+{
+    struct xkb_compose_table *table;
+    char tmpdir[] = "/tmp/xkbcommon-test-compose.XXXXXX";
+    char *main_path, *included_path, *cache_dir, *contents;
+    char *home1, *home2, *home1_path, *home2_path, *old_home;
+
+    assert(mkdtemp(tmpdir));
+    main_path = asprintf_safe("%s/XCompose", tmpdir);
+    included_path = asprintf_safe("%s/included", tmpdir);
+    cache_dir = asprintf_safe("%s/cache/xkbcommon", tmpdir);
+    home1 = asprintf_safe("%s/home1", tmpdir);
+    home2 = asprintf_safe("%s/home2", tmpdir);
+    home1_path = asprintf_safe("%s/home.compose", home1);
+    home2_path = asprintf_safe("%s/home.compose", home2);
+    contents = asprintf_safe("<A> <B> : \"ab\"\n"
+                             "include \"%s\"\n"
+                             "include \"%%H/home.compose\"\n",
+                             included_path);
+    assert(main_path && included_path && cache_dir && contents);
+    assert(home1 && home2 && home1_path && home2_path);
+    old_home = strdup_safe(getenv("HOME"));
+
+    assert(mkdir(home1, 0700) == 0);
+    assert(mkdir(home2, 0700) == 0);
+    write_file(main_path, contents);
+    write_file(included_path, "<C> <D> : \"cd\"\n");
+    write_file(home1_path, "<E> <F> : \"h1\"\n");
+    write_file(home2_path, "<E> <F> : \"h2\"\n");
+    setenv("HOME", home1, 1);
+    setenv("XCOMPOSEFILE", main_path, 1);
+    /* The parent of the cache directory doesn't exist yet either. */
+    *strrchr(cache_dir, '/') = '\0';
+    setenv("XDG_CACHE_HOME", cache_dir, 1);
+    cache_dir[strlen(cache_dir)] = '/';
+
+    /* Compiled, then stored. */
+    table = xkb_compose_table_new_from_locale(ctx, "C",
+                                              XKB_COMPOSE_COMPILE_USE_CACHE);
+    assert(table);
+#ifdef HAVE_MMAP
+    assert(count_cache_files(cache_dir) == 1);
+#endif
+    assert(test_compose_seq(table,
+        XKB_KEY_A,              XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSING,  "",     XKB_KEY_NoSymbol,
+        XKB_KEY_B,              XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSED,   "ab",   XKB_KEY_NoSymbol,
+        XKB_KEY_NoSymbol));
+    xkb_compose_table_unref(table);
+
+    /* Loaded from the cache. */
+    table = xkb_compose_table_new_from_locale(ctx, "C",
+                                              XKB_COMPOSE_COMPILE_USE_CACHE);
+    assert(table);
+#ifdef HAVE_MMAP
+    assert(count_cache_files(cache_dir) == 1);
+#endif
+    assert(test_compose_seq(table,
+        XKB_KEY_A,              XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSING,  "",     XKB_KEY_NoSymbol,
+        XKB_KEY_B,              XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSED,   "ab",   XKB_KEY_NoSymbol,
+        XKB_KEY_C,              XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSING,  "",     XKB_KEY_NoSymbol,
+        XKB_KEY_D,              XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSED,   "cd",   XKB_KEY_NoSymbol,
+        XKB_KEY_NoSymbol));
+    xkb_compose_table_unref(table);
+
+    /* A change in an included file invalidates the cached table. */
+    write_file(included_path, "<C> <D> : \"changed\"\n");
+    table = xkb_compose_table_new_from_locale(ctx, "C",
+                                              XKB_COMPOSE_COMPILE_USE_CACHE);
+    assert(table);
+#ifdef HAVE_MMAP
+    assert(count_cache_files(cache_dir) == 1);
+#endif
+    assert(test_compose_seq(table,
+        XKB_KEY_C,              XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSING,  "",     XKB_KEY_NoSymbol,
+        XKB_KEY_D,              XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSED,   "changed", XKB_KEY_NoSymbol,
+        XKB_KEY_NoSymbol));
+    xkb_compose_table_unref(table);
+
+    /* So does a change of what %H expands to. */
+    setenv("HOME", home2, 1);
+    table = xkb_compose_table_new_from_locale(ctx, "C",
+                                              XKB_COMPOSE_COMPILE_USE_CACHE);
+    assert(table);
+    assert(test_compose_seq(table,
+        XKB_KEY_E,              XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSING,  "",     XKB_KEY_NoSymbol,
+        XKB_KEY_F,              XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSED,   "h2",   XKB_KEY_NoSymbol,
+        XKB_KEY_NoSymbol));
+    xkb_compose_table_unref(table);
+
+    /* Without the flag, the cache is neither used nor written. */
+    write_file(included_path, "<C> <D> : \"uncached\"\n");
+    table = xkb_compose_table_new_from_locale(ctx, "C",
+                                              XKB_COMPOSE_COMPILE_NO_FLAGS);
+    assert(table);
+    assert(test_compose_seq(table,
+        XKB_KEY_C,              XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSING,  "",     XKB_KEY_NoSymbol,
+        XKB_KEY_D,              XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSED,   "uncached", XKB_KEY_NoSymbol,
+        XKB_KEY_NoSymbol));
+    xkb_compose_table_unref(table);
+
+    unsetenv("XCOMPOSEFILE");
+    unsetenv("XDG_CACHE_HOME");
+    if (old_home)
+        setenv("HOME", old_home, 1);
+    else
+        unsetenv("HOME");
+
+    /* Without mmap support, the flag is accepted but nothing is cached. */
+    {
+        DIR *d = opendir(cache_dir);
+        struct dirent *ent;
+#ifdef HAVE_MMAP
+        assert(d);
+#else
+        assert(!d);
+#endif
+        while (d && (ent = readdir(d))) {
+            if (ent->d_name[0] != '.') {
+                char *path = asprintf_safe("%s/%s", cache_dir, ent->d_name);
+                unlink(path);
+                free(path);
+            }
+        }
+        if (d)
+            closedir(d);
+    }
+    rmdir(cache_dir);
+    *strrchr(cache_dir, '/') = '\0';
+    rmdir(cache_dir);
+    unlink(included_path);
+    unlink(main_path);
+    unlink(home1_path);
+    unlink(home2_path);
+    rmdir(home1);
+    rmdir(home2);
+    rmdir(tmpdir);
+
+    free(old_home);
+    free(home1_path);
+    free(home2_path);
+    free(home1);
+    free(home2);
+    free(contents);
+    free(cache_dir);
+    free(included_path);
+    free(main_path);
+}
+
+#ifdef HAVE_MMAP
+/* Serialized tables can only be loaded by mapping them. */
+static void
+test_serialize(struct xkb_context *ctx)
+{
+    struct xkb_compose_table *table, *loaded;
+    char path[] = "/tmp/xkbcommon-test-compose.XXXXXX";
+    char *file_path;
+    FILE *file;
+    struct stat st, st2;
+    int fd, fd2;
+
+    file_path = test_get_path("compose/en_US.UTF-8/Compose");
+    file = fopen(file_path, "rb");
+    assert(file);
+    free(file_path);
+    table = xkb_compose_table_new_from_file(ctx, file, "en_US.UTF-8",
+                                            XKB_COMPOSE_FORMAT_TEXT_V1,
+                                            XKB_COMPOSE_COMPILE_NO_FLAGS);
+    assert(table);
+    fclose(file);
+
+    fd = mkstemp(path);
+    assert(fd >= 0);
+    unlink(path);
+
+    assert(xkb_compose_table_serialize(table, fd));
+    xkb_compose_table_unref(table);
+
+    loaded = xkb_compose_table_new_from_fd(ctx, fd,
+                                           XKB_COMPOSE_COMPILE_NO_FLAGS);
+    assert(loaded);
+    assert(test_compose_seq(loaded,
+        XKB_KEY_dead_tilde,     XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSING,  "",     XKB_KEY_NoSymbol,
+        XKB_KEY_space,          XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSED,   "~",    XKB_KEY_asciitilde,
+        XKB_KEY_Multi_key,      XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSING,  "",     XKB_KEY_NoSymbol,
+        XKB_KEY_A,              XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSING,  "",     XKB_KEY_NoSymbol,
+        XKB_KEY_T,              XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSED,   "@",    XKB_KEY_at,
+        XKB_KEY_7,              XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_NOTHING,    "",     XKB_KEY_NoSymbol,
+        XKB_KEY_NoSymbol));
+
+    /* A table can be serialized again after loading. */
+    strcpy(path, "/tmp/xkbcommon-test-compose.XXXXXX");
+    fd2 = mkstemp(path);
+    assert(fd2 >= 0);
+    unlink(path);
+    assert(xkb_compose_table_serialize(loaded, fd2));
+    assert(fstat(fd, &st) == 0);
+    assert(fstat(fd2, &st2) == 0);
+    assert(st.st_size == st2.st_size);
+    close(fd2);
+    xkb_compose_table_unref(loaded);
+
+    /* Truncated. */
+    assert(ftruncate(fd, st.st_size - 1) == 0);
+    assert(!xkb_compose_table_new_from_fd(ctx, fd,
+                                          XKB_COMPOSE_COMPILE_NO_FLAGS));
+
+    /* Empty. */
+    assert(ftruncate(fd, 0) == 0);
+    assert(!xkb_compose_table_new_from_fd(ctx, fd,
+                                          XKB_COMPOSE_COMPILE_NO_FLAGS));
+
+    /* Not a serialized table. */
+    assert(lseek(fd, 0, SEEK_SET) == 0);
+    assert(write(fd, "<A> <B> : \"ab\"\n", 16) == 16);
+    assert(!xkb_compose_table_new_from_fd(ctx, fd,
+                                          XKB_COMPOSE_COMPILE_NO_FLAGS));
+
+    close(fd);
+}
+#endif
+
+struct expected_entry {
+    xkb_keysym_t sequence[4];
+    size_t sequence_length;
+    xkb_keysym_t keysym;
+    const char *utf8;
+};
+
+static void
+check_entries(struct xkb_compose_table_iterator *iter,
+              const struct expected_entry *expected, size_t num_expected)
+{
+    struct xkb_compose_table_entry *entry;
+    const xkb_keysym_t *sequence;
+    size_t sequence_length;
+
+    for (size_t i = 0; i < num_expected; i++) {
+        entry = xkb_compose_table_iterator_next(iter);
+        assert(entry);
+        sequence = xkb_compose_table_entry_sequence(entry, &sequence_length);
+        assert(sequence_length == expected[i].sequence_length);
+        for (size_t j = 0; j < sequence_length; j++)
+            assert(sequence[j] == expected[i].sequence[j]);
+        assert(xkb_compose_table_entry_keysym(entry) == expected[i].keysym);
+        assert(streq(xkb_compose_table_entry_utf8(entry), expected[i].utf8));
+    }
+    assert(!xkb_compose_table_iterator_next(iter));
+    assert(!xkb_compose_table_iterator_next(iter));
+}
+
+static void
+test_traverse(struct xkb_context *ctx)
+{
+    struct xkb_compose_table *table;
+    struct xkb_compose_table_iterator *iter;
+    struct xkb_compose_table_entry *entry;
+    struct xkb_compose_state *state;
+    const char *table_string;
+    char *path;
+    FILE *file;
+    unsigned count;
+
+    table_string =
+        "<dead_tilde> <space>          : \"~\"  asciitilde\n"
+        "<Multi_key> <A> <T>           : \"@\"  at\n"
+        "<dead_tilde> <dead_tilde>     : \"~\"\n"
+        "<Multi_key> <A> <E>           : AE\n"
+        "<Multi_key> <minus> <period>  : \"·\"\n"
+        "<a>                           : \"b\"\n";
+    table = xkb_compose_table_new_from_buffer(ctx, table_string,
+                                              strlen(table_string), "",
+                                              XKB_COMPOSE_FORMAT_TEXT_V1,
+                                              XKB_COMPOSE_COMPILE_NO_FLAGS);
+    assert(table);
+
+    /* All entries, in keysym order. */
+    iter = xkb_compose_table_iterator_new(table);
+    assert(iter);
+    check_entries(iter, (const struct expected_entry []) {
+        { { XKB_KEY_a }, 1, XKB_KEY_NoSymbol, "b" },
+        { { XKB_KEY_dead_tilde, XKB_KEY_space }, 2, XKB_KEY_asciitilde, "~" },
+        { { XKB_KEY_dead_tilde, XKB_KEY_dead_tilde }, 2, XKB_KEY_NoSymbol, "~" },
+        { { XKB_KEY_Multi_key, XKB_KEY_minus, XKB_KEY_period }, 3, XKB_KEY_NoSymbol, "·" },
+        { { XKB_KEY_Multi_key, XKB_KEY_A, XKB_KEY_E }, 3, XKB_KEY_AE, "" },
+        { { XKB_KEY_Multi_key, XKB_KEY_A, XKB_KEY_T }, 3, XKB_KEY_at, "@" },
+    }, 6);
+    xkb_compose_table_iterator_free(iter);
+
+    /* Candidates for the current sequence. */
+    state = xkb_compose_state_new(table, XKB_COMPOSE_STATE_NO_FLAGS);
+    assert(state);
+
+    iter = xkb_compose_state_iterator_new(state);
+    assert(iter);
+    check_entries(iter, NULL, 0);
+    xkb_compose_table_iterator_free(iter);
+
+    xkb_compose_state_feed(state, XKB_KEY_Multi_key);
+    iter = xkb_compose_state_iterator_new(state);
+    assert(iter);
+    check_entries(iter, (const struct expected_entry []) {
+        { { XKB_KEY_minus, XKB_KEY_period }, 2, XKB_KEY_NoSymbol, "·" },
+        { { XKB_KEY_A, XKB_KEY_E }, 2, XKB_KEY_AE, "" },
+        { { XKB_KEY_A, XKB_KEY_T }, 2, XKB_KEY_at, "@" },
+    }, 3);
+    xkb_compose_table_iterator_free(iter);
+
+    xkb_compose_state_feed(state, XKB_KEY_A);
+    iter = xkb_compose_state_iterator_new(state);
+    assert(iter);
+    /* The iterator does not depend on the state afterwards. */
+    xkb_compose_state_reset(state);
+    check_entries(iter, (const struct expected_entry []) {
+        { { XKB_KEY_E }, 1, XKB_KEY_AE, "" },
+        { { XKB_KEY_T }, 1, XKB_KEY_at, "@" },
+    }, 2);
+    xkb_compose_table_iterator_free(iter);
+
+    xkb_compose_state_feed(state, XKB_KEY_a);
+    assert(xkb_compose_state_get_status(state) == XKB_COMPOSE_COMPOSED);
+    iter = xkb_compose_state_iterator_new(state);
+    assert(iter);
+    check_entries(iter, NULL, 0);
+    xkb_compose_table_iterator_free(iter);
+
+    xkb_compose_state_unref(state);
+    xkb_compose_table_unref(table);
+
+    /* Every entry of a real table leads to its result. */
+    path = test_get_path("compose/en_US.UTF-8/Compose");
+    file = fopen(path, "rb");
+    assert(file);
+    free(path);
+    table = xkb_compose_table_new_from_file(ctx, file, "",
+                                            XKB_COMPOSE_FORMAT_TEXT_V1,
+                                            XKB_COMPOSE_COMPILE_NO_FLAGS);
+    assert(table);
+    fclose(file);
+
+    state = xkb_compose_state_new(table, XKB_COMPOSE_STATE_NO_FLAGS);
+    assert(state);
+    iter = xkb_compose_table_iterator_new(table);
+    assert(iter);
+    count = 0;
+    while ((entry = xkb_compose_table_iterator_next(iter))) {
+        const xkb_keysym_t *sequence;
+        size_t sequence_length;
+        char buffer[64];
+
+        sequence = xkb_compose_table_entry_sequence(entry, &sequence_length);
+        xkb_compose_state_reset(state);
+        for (size_t i = 0; i < sequence_length; i++)
+            xkb_compose_state_feed(state, sequence[i]);
+        assert(xkb_compose_state_get_status(state) == XKB_COMPOSE_COMPOSED);
+        assert(xkb_compose_state_get_one_sym(state) ==
+               xkb_compose_table_entry_keysym(entry));
+        if (*xkb_compose_table_entry_utf8(entry)) {
+            xkb_compose_state_get_utf8(state, buffer, sizeof(buffer));
+            assert(streq(buffer, xkb_compose_table_entry_utf8(entry)));
+        }
+        count++;
+    }
+    assert(count > 4000);
+    xkb_compose_table_iterator_free(iter);
+    xkb_compose_state_unref(state);
+    xkb_compose_table_unref(table);
+}
+
+static void
+test_overlay(struct xkb_context *ctx)
+{
+    struct xkb_compose_table *base, *table;
+    struct xkb_compose_table_iterator *iter;
+    struct xkb_compose_state *state;
+    const char *base_string, *overlay_string;
+    char path[] = "/tmp/xkbcommon-test-compose.XXXXXX";
+    int fd;
+
+    base_string =
+        "<dead_tilde> <space>          : \"~\"  asciitilde\n"
+        "<Multi_key> <A> <T>           : \"@\"  at\n"
+        "<Multi_key> <o>               : \"x\"\n"
+        "<Multi_key> <c> <c>           : \"C\"\n"
+        "<a>                           : \"b\"\n";
+    base = xkb_compose_table_new_from_buffer(ctx, base_string,
+                                             strlen(base_string), "",
+                                             XKB_COMPOSE_FORMAT_TEXT_V1,
+                                             XKB_COMPOSE_COMPILE_NO_FLAGS);
+    assert(base);
+
+    /* The include of the locale file stands for the base table. */
+    overlay_string =
+        "include \"%L\"\n"
+        "<Multi_key> <A> <T>           : \"A\"\n"
+        "<Multi_key> <o> <o>           : \"°\"  degree\n"
+        "<Multi_key> <c>               : \"c\"\n"
+        "<dead_acute> <e>              : \"é\"  eacute\n";
+    table = xkb_compose_table_new_overlay_from_buffer(base, overlay_string,
+                                                      strlen(overlay_string),
+                                                      XKB_COMPOSE_FORMAT_TEXT_V1,
+                                                      XKB_COMPOSE_COMPILE_NO_FLAGS);
+    assert(table);
+
+    /* The overlay holds its own reference. */
+    xkb_compose_table_unref(base);
+
+    assert(test_compose_seq(table,
+        XKB_KEY_dead_tilde,     XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSING,  "",     XKB_KEY_NoSymbol,
+        XKB_KEY_space,          XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSED,   "~",    XKB_KEY_asciitilde,
+        XKB_KEY_Multi_key,      XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSING,  "",     XKB_KEY_NoSymbol,
+        XKB_KEY_A,              XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSING,  "",     XKB_KEY_NoSymbol,
+        XKB_KEY_T,              XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSED,   "A",    XKB_KEY_NoSymbol,
+        XKB_KEY_Multi_key,      XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSING,  "",     XKB_KEY_NoSymbol,
+        XKB_KEY_o,              XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSING,  "",     XKB_KEY_NoSymbol,
+        XKB_KEY_o,              XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSED,   "°",    XKB_KEY_degree,
+        XKB_KEY_Multi_key,      XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSING,  "",     XKB_KEY_NoSymbol,
+        XKB_KEY_c,              XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSING,  "",     XKB_KEY_NoSymbol,
+        XKB_KEY_c,              XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSED,   "C",    XKB_KEY_NoSymbol,
+        XKB_KEY_dead_acute,     XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSING,  "",     XKB_KEY_NoSymbol,
+        XKB_KEY_e,              XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSED,   "é",    XKB_KEY_eacute,
+        XKB_KEY_Multi_key,      XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSING,  "",     XKB_KEY_NoSymbol,
+        XKB_KEY_x,              XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_CANCELLED,  "",     XKB_KEY_NoSymbol,
+        XKB_KEY_a,              XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSED,   "b",    XKB_KEY_NoSymbol,
+        XKB_KEY_dead_acute,     XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSING,  "",     XKB_KEY_NoSymbol,
+        XKB_KEY_e,              XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSED,   "é",    XKB_KEY_eacute,
+        XKB_KEY_b,              XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_NOTHING,    "",     XKB_KEY_NoSymbol,
+        XKB_KEY_NoSymbol));
+
+    /* The base table itself is unchanged. */
+    assert(test_compose_seq(base,
+        XKB_KEY_Multi_key,      XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSING,  "",     XKB_KEY_NoSymbol,
+        XKB_KEY_o,              XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSED,   "x",    XKB_KEY_NoSymbol,
+        XKB_KEY_NoSymbol));
+
+    iter = xkb_compose_table_iterator_new(table);
+    assert(iter);
+    check_entries(iter, (const struct expected_entry []) {
+        { { XKB_KEY_a }, 1, XKB_KEY_NoSymbol, "b" },
+        { { XKB_KEY_dead_acute, XKB_KEY_e }, 2, XKB_KEY_eacute, "é" },
+        { { XKB_KEY_dead_tilde, XKB_KEY_space }, 2, XKB_KEY_asciitilde, "~" },
+        { { XKB_KEY_Multi_key, XKB_KEY_A, XKB_KEY_T }, 3, XKB_KEY_NoSymbol, "A" },
+        { { XKB_KEY_Multi_key, XKB_KEY_c, XKB_KEY_c }, 3, XKB_KEY_NoSymbol, "C" },
+        { { XKB_KEY_Multi_key, XKB_KEY_o, XKB_KEY_o }, 3, XKB_KEY_degree, "°" },
+    }, 6);
+    xkb_compose_table_iterator_free(iter);
+
+    state = xkb_compose_state_new(table, XKB_COMPOSE_STATE_NO_FLAGS);
+    assert(state);
+    xkb_compose_state_feed(state, XKB_KEY_Multi_key);
+    iter = xkb_compose_state_iterator_new(state);
+    assert(iter);
+    check_entries(iter, (const struct expected_entry []) {
+        { { XKB_KEY_A, XKB_KEY_T }, 2, XKB_KEY_NoSymbol, "A" },
+        { { XKB_KEY_c, XKB_KEY_c }, 2, XKB_KEY_NoSymbol, "C" },
+        { { XKB_KEY_o, XKB_KEY_o }, 2, XKB_KEY_degree, "°" },
+    }, 3);
+    xkb_compose_table_iterator_free(iter);
+    xkb_compose_state_unref(state);
+
+    /* Overlays do not nest, and are not serialized. */
+    assert(!xkb_compose_table_new_overlay_from_buffer(table, "", 0,
+                                                      XKB_COMPOSE_FORMAT_TEXT_V1,
+                                                      XKB_COMPOSE_COMPILE_NO_FLAGS));
+    fd = mkstemp(path);
+    assert(fd >= 0);
+    unlink(path);
+    assert(!xkb_compose_table_serialize(table, fd));
+    close(fd);
+
+    xkb_compose_table_unref(table);
+}
+
+static void
+test_locale_files(struct xkb_context *ctx)
+{
+    struct xkb_compose_table *table;
+    char tmpdir[] = "/tmp/xkbcommon-test-compose.XXXXXX";
+    char *alias_path, *dir_path, *first_path, *second_path;
+
+    assert(mkdtemp(tmpdir));
+    alias_path = asprintf_safe("%s/locale.alias", tmpdir);
+    dir_path = asprintf_safe("%s/compose.dir", tmpdir);
+    first_path = asprintf_safe("%s/first", tmpdir);
+    second_path = asprintf_safe("%s/second", tmpdir);
+    assert(alias_path && dir_path && first_path && second_path);
+
+    write_file(alias_path,
+               "# comment\n"
+               "foo:        xx_XX.UTF-8\n"
+               "foo:        yy_YY.UTF-8\n"
+               "bar         yy_YY.UTF-8\n");
+    write_file(dir_path,
+               "first:      xx_XX.UTF-8\n"
+               "second:     yy_YY.UTF-8\n"
+               "second:     xx_XX.UTF-8\n");
+    write_file(first_path, "<A> : \"first\"\n");
+    write_file(second_path, "<A> : \"second\"\n");
+    setenv("XLOCALEDIR", tmpdir, 1);
+    /* Make sure no user Compose file is found instead. */
+    unsetenv("XCOMPOSEFILE");
+    setenv("XDG_CONFIG_HOME", tmpdir, 1);
+    setenv("HOME", tmpdir, 1);
+
+    /* The first match wins, for both files and in both directions. */
+    for (int i = 0; i < 2; i++) {
+        table = xkb_compose_table_new_from_locale(ctx, "foo",
+                                                  XKB_COMPOSE_COMPILE_NO_FLAGS);
+        assert(table);
+        assert(test_compose_seq(table,
+            XKB_KEY_A,  XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSED,   "first",    XKB_KEY_NoSymbol,
+            XKB_KEY_NoSymbol));
+        xkb_compose_table_unref(table);
+
+        table = xkb_compose_table_new_from_locale(ctx, "bar",
+                                                  XKB_COMPOSE_COMPILE_NO_FLAGS);
+        assert(table);
+        assert(test_compose_seq(table,
+            XKB_KEY_A,  XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSED,   "second",   XKB_KEY_NoSymbol,
+            XKB_KEY_NoSymbol));
+        xkb_compose_table_unref(table);
+    }
+
+    /* Changes to the files are picked up. */
+    write_file(dir_path,
+               "second:     xx_XX.UTF-8\n"
+               "first:      yy_YY.UTF-8\n"
+               "# The file is now longer.\n");
+    table = xkb_compose_table_new_from_locale(ctx, "foo",
+                                              XKB_COMPOSE_COMPILE_NO_FLAGS);
+    assert(table);
+    assert(test_compose_seq(table,
+        XKB_KEY_A,  XKB_COMPOSE_FEED_ACCEPTED,  XKB_COMPOSE_COMPOSED,   "second",   XKB_KEY_NoSymbol,
+        XKB_KEY_NoSymbol));
+    xkb_compose_table_unref(table);
+
+    unlink(dir_path);
+    assert(!xkb_compose_table_new_from_locale(ctx, "foo",
+                                              XKB_COMPOSE_COMPILE_NO_FLAGS));
+
+    unsetenv("XLOCALEDIR");
+    unsetenv("XDG_CONFIG_HOME");
+    unsetenv("HOME");
+    unlink(alias_path);
+    unlink(first_path);
+    unlink(second_path);
+    rmdir(tmpdir);
+    free(alias_path);
+    free(dir_path);
+    free(first_path);
+    free(second_path);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -529,6 +1158,14 @@ main(int argc, char *argv[])
     test_state(ctx);
     test_modifier_syntax(ctx);
     test_include(ctx);
+    test_many_sequences(ctx);
+    test_cache(ctx);
+#ifdef HAVE_MMAP
+    test_serialize(ctx);
+#endif
+    test_traverse(ctx);
+    test_overlay(ctx);
+    test_locale_files(ctx);
 
     xkb_context_unref(ctx);
     return 0;
@@ -26,8 +26,11 @@
 #include "config.h"
 
 #include <assert.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "test.h"
 
@@ -149,11 +152,112 @@ test_keymap(void)
     xkb_context_unref(context);
 }
 
+/* The keysym on the first level of AE01 for an RMLVO layout, or NoSymbol. */
+static xkb_keysym_t
+get_ae01(struct xkb_context *context, const char *layout, const char *variant)
+{
+    struct xkb_keymap *keymap;
+    const xkb_keysym_t *syms;
+    xkb_keysym_t sym = XKB_KEY_NoSymbol;
+
+    keymap = test_compile_rules(context, "evdev", NULL, layout, variant, NULL);
+    if (!keymap)
+        return XKB_KEY_NoSymbol;
+
+    if (xkb_keymap_key_get_syms_by_level(keymap,
+                                         xkb_keymap_key_by_name(keymap, "AE01"),
+                                         0, 0, &syms) == 1)
+        sym = syms[0];
+
+    xkb_keymap_unref(keymap);
+    return sym;
+}
+
+static void
+write_symbols(const char *path, const char *first, const char *second)
+{
+    FILE *file = fopen(path, "w");
+
+    assert(file);
+    fprintf(file,
+            "xkb_symbols \"first\" { key <AE01> { [ %s ] }; };\n"
+            "xkb_symbols \"second\" { key <AE01> { [ %s ] }; };\n",
+            first, second);
+    fclose(file);
+}
+
+static void
+test_map_index(void)
+{
+    struct xkb_context *context = test_get_context(0);
+    struct xkb_keymap *keymap;
+    char dir[] = "/tmp/xkb-map-index.XXXXXX";
+    char *symbols_dir, *path;
+    struct stat st;
+
+    assert(context);
+
+    /* Braces in strings, comments and key names are not counted. */
+    assert(get_ae01(context, "mapindex", "strings") == XKB_KEY_1);
+    assert(get_ae01(context, "mapindex", "comments") == XKB_KEY_3);
+    assert(get_ae01(context, "mapindex", "keynames") == XKB_KEY_4);
+
+    keymap = test_compile_rules(context, "evdev", NULL, "mapindex", "strings",
+                                NULL);
+    assert(keymap);
+    assert(streq(xkb_keymap_layout_get_name(keymap, 0),
+                 "Braces } in { a string"));
+    xkb_keymap_unref(keymap);
+
+    /* The first default map, or else the first map. */
+    assert(get_ae01(context, "mapindex", NULL) == XKB_KEY_6);
+    assert(get_ae01(context, "mapindex_first", NULL) == XKB_KEY_a);
+    assert(get_ae01(context, "mapindex_first", "second") == XKB_KEY_b);
+
+    /* The broken map only fails when it is requested. */
+    assert(!test_compile_rules(context, "evdev", NULL, "mapindex", "broken",
+                               NULL));
+
+    /*
+     * A file which changes keeps its index only if its contents are the
+     * same, even with the same inode, size and mtime.
+     */
+    assert(mkdtemp(dir));
+    symbols_dir = asprintf_safe("%s/symbols", dir);
+    path = asprintf_safe("%s/symbols/mapindex_tmp", dir);
+    assert(symbols_dir && path);
+    assert(mkdir(symbols_dir, 0700) == 0);
+    assert(xkb_context_include_path_append(context, dir));
+
+    write_symbols(path, "a", "at");
+    assert(get_ae01(context, "mapindex_tmp", "second") == XKB_KEY_at);
+    assert(stat(path, &st) == 0);
+
+    /* Moves the second map by one byte. */
+    write_symbols(path, "at", "a");
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+    {
+        struct timespec times[2] = { st.st_atim, st.st_mtim };
+        assert(utimensat(AT_FDCWD, path, times, 0) == 0);
+    }
+#endif
+    assert(get_ae01(context, "mapindex_tmp", "second") == XKB_KEY_a);
+    assert(get_ae01(context, "mapindex_tmp", "first") == XKB_KEY_at);
+
+    unlink(path);
+    rmdir(symbols_dir);
+    rmdir(dir);
+    free(path);
+    free(symbols_dir);
+    xkb_context_unref(context);
+}
+
 int
 main(void)
 {
     test_garbage_key();
     test_keymap();
+    test_map_index();
 
     return 0;
 }
@@ -24,6 +24,9 @@
 #include "config.h"
 
 #include <assert.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
 #if HAVE_UNISTD_H
 #include <unistd.h>
 #endif
@@ -815,6 +818,571 @@ test_load_merge_no_overwrite(void)
     rxkb_context_unref(ctx);
 }
 
+/* Whether two contexts have exactly the same items, in the same order. */
+static bool
+cmp_contexts(struct rxkb_context *a, struct rxkb_context *b)
+{
+    struct rxkb_model *ma = rxkb_model_first(a), *mb = rxkb_model_first(b);
+    struct rxkb_layout *la = rxkb_layout_first(a), *lb = rxkb_layout_first(b);
+    struct rxkb_option_group *ga = rxkb_option_group_first(a),
+                             *gb = rxkb_option_group_first(b);
+
+    for (; ma && mb; ma = rxkb_model_next(ma), mb = rxkb_model_next(mb)) {
+        if (!streq(rxkb_model_get_name(ma), rxkb_model_get_name(mb)) ||
+            !streq_null(rxkb_model_get_vendor(ma), rxkb_model_get_vendor(mb)) ||
+            !streq_null(rxkb_model_get_description(ma),
+                        rxkb_model_get_description(mb)) ||
+            rxkb_model_get_popularity(ma) != rxkb_model_get_popularity(mb))
+            return false;
+    }
+    if (ma || mb)
+        return false;
+
+    for (; la && lb; la = rxkb_layout_next(la), lb = rxkb_layout_next(lb)) {
+        struct rxkb_iso639_code *ia = rxkb_layout_get_iso639_first(la),
+                                *ib = rxkb_layout_get_iso639_first(lb);
+        struct rxkb_iso3166_code *ca = rxkb_layout_get_iso3166_first(la),
+                                 *cb = rxkb_layout_get_iso3166_first(lb);
+
+        if (!streq(rxkb_layout_get_name(la), rxkb_layout_get_name(lb)) ||
+            !streq_null(rxkb_layout_get_variant(la),
+                        rxkb_layout_get_variant(lb)) ||
+            !streq_null(rxkb_layout_get_brief(la), rxkb_layout_get_brief(lb)) ||
+            !streq_null(rxkb_layout_get_description(la),
+                        rxkb_layout_get_description(lb)) ||
+            rxkb_layout_get_popularity(la) != rxkb_layout_get_popularity(lb))
+            return false;
+
+        for (; ia && ib; ia = rxkb_iso639_code_next(ia),
+                         ib = rxkb_iso639_code_next(ib))
+            if (!streq(rxkb_iso639_code_get_code(ia),
+                       rxkb_iso639_code_get_code(ib)))
+                return false;
+        if (ia || ib)
+            return false;
+
+        for (; ca && cb; ca = rxkb_iso3166_code_next(ca),
+                         cb = rxkb_iso3166_code_next(cb))
+            if (!streq(rxkb_iso3166_code_get_code(ca),
+                       rxkb_iso3166_code_get_code(cb)))
+                return false;
+        if (ca || cb)
+            return false;
+    }
+    if (la || lb)
+        return false;
+
+    for (; ga && gb; ga = rxkb_option_group_next(ga),
+                     gb = rxkb_option_group_next(gb)) {
+        struct rxkb_option *oa = rxkb_option_first(ga),
+                           *ob = rxkb_option_first(gb);
+
+        if (!streq(rxkb_option_group_get_name(ga),
+                   rxkb_option_group_get_name(gb)) ||
+            !streq_null(rxkb_option_group_get_description(ga),
+                        rxkb_option_group_get_description(gb)) ||
+            rxkb_option_group_allows_multiple(ga) !=
+                rxkb_option_group_allows_multiple(gb) ||
+            rxkb_option_group_get_popularity(ga) !=
+                rxkb_option_group_get_popularity(gb))
+            return false;
+
+        for (; oa && ob; oa = rxkb_option_next(oa), ob = rxkb_option_next(ob)) {
+            if (!streq(rxkb_option_get_name(oa), rxkb_option_get_name(ob)) ||
+                !streq_null(rxkb_option_get_brief(oa),
+                            rxkb_option_get_brief(ob)) ||
+                !streq_null(rxkb_option_get_description(oa),
+                            rxkb_option_get_description(ob)) ||
+                rxkb_option_get_popularity(oa) != rxkb_option_get_popularity(ob))
+                return false;
+        }
+        if (oa || ob)
+            return false;
+    }
+    if (ga || gb)
+        return false;
+
+    return true;
+}
+
+static bool loaded_from_cache;
+
+static void
+cache_log_fn(struct rxkb_context *ctx, enum rxkb_log_level level,
+             const char *fmt, va_list args)
+{
+    if (strstr(fmt, "from cache"))
+        loaded_from_cache = true;
+}
+
+static struct rxkb_context *
+test_parse_cached(const char *dir, const char *ruleset,
+                  enum rxkb_context_flags flags, bool expect_cached)
+{
+    struct rxkb_context *ctx;
+
+    ctx = rxkb_context_new(RXKB_CONTEXT_NO_DEFAULT_INCLUDES | flags);
+    assert(ctx);
+    rxkb_context_set_log_level(ctx, RXKB_LOG_LEVEL_DEBUG);
+    rxkb_context_set_log_fn(ctx, cache_log_fn);
+    assert(rxkb_context_include_path_append(ctx, dir));
+
+    loaded_from_cache = false;
+    assert(rxkb_context_parse(ctx, ruleset));
+    assert(loaded_from_cache == expect_cached);
+
+    return ctx;
+}
+
+static void
+test_cache(void)
+{
+    struct test_model models[] =  {
+        {"m1", "vendor1", "desc1"},
+        {NULL},
+    };
+    struct test_model changed_models[] =  {
+        {"m9", "vendor9", "desc9"},
+        {NULL},
+    };
+    struct test_layout layouts[] =  {
+        {"l1", NO_VARIANT, "lbrief1", "ldesc1"},
+        {"l1", "v1", "vbrief1", "vdesc1"},
+        {NULL},
+    };
+    struct test_option_group groups[] = {
+        {"grp1", "gdesc1", true,
+          { {"grp1:1", "odesc11"}, {"grp1:2", "odesc12"} } },
+        { NULL },
+    };
+    const enum rxkb_context_flags flags =
+        RXKB_CONTEXT_USE_CACHE | RXKB_CONTEXT_LOAD_EXOTIC_RULES;
+    char cache_home[] = "/tmp/xkbregistry-test-cache.XXXXXX";
+    char path[PATH_MAX], changed_path[PATH_MAX];
+    struct rxkb_context *ctx, *cached_ctx;
+    char *dir, *changed_dir, *datadir;
+    struct timespec times[2];
+    struct stat st;
+    DIR *cache_dir;
+    struct dirent *ent;
+
+    assert(mkdtemp(cache_home));
+    setenv("XDG_CACHE_HOME", cache_home, 1);
+
+    /* The real rules files, with extras: the cache holds the same items. */
+    datadir = asprintf_safe("%s/test/data", getenv("top_srcdir"));
+    assert(datadir);
+    ctx = test_parse_cached(datadir, "evdev", flags, false);
+    cached_ctx = test_parse_cached(datadir, "evdev", flags, true);
+    assert(cmp_contexts(ctx, cached_ctx));
+    assert(rxkb_model_first(cached_ctx) && rxkb_layout_first(cached_ctx) &&
+           rxkb_option_group_first(cached_ctx));
+    rxkb_context_unref(ctx);
+    rxkb_context_unref(cached_ctx);
+    free(datadir);
+
+    /* The second parse loads the cache. */
+    dir = test_create_rules("xkbtests", models, layouts, groups);
+    ctx = test_parse_cached(dir, "xkbtests", RXKB_CONTEXT_USE_CACHE, false);
+    rxkb_context_unref(ctx);
+    ctx = test_parse_cached(dir, "xkbtests", RXKB_CONTEXT_USE_CACHE, true);
+    assert(find_models(ctx, "m1", NULL));
+    assert(find_layouts(ctx, "l1", NO_VARIANT, "l1", "v1", NULL));
+    assert(find_options(ctx, "grp1", "grp1:1", "grp1", "grp1:2", NULL));
+    rxkb_context_unref(ctx);
+
+    /* Same size and mtime: the cache cannot tell, which shows it is used. */
+    assert(snprintf_safe(path, sizeof(path), "%s/rules/xkbtests.xml", dir));
+    assert(stat(path, &st) == 0);
+    changed_dir = test_create_rules("xkbtests", changed_models, layouts,
+                                    groups);
+    assert(snprintf_safe(changed_path, sizeof(changed_path),
+                         "%s/rules/xkbtests.xml", changed_dir));
+    assert(rename(changed_path, path) == 0);
+    test_remove_rules(changed_dir, "xkbtests");
+    times[0] = st.st_atim;
+    times[1] = st.st_mtim;
+    assert(utimensat(AT_FDCWD, path, times, 0) == 0);
+
+    ctx = test_parse_cached(dir, "xkbtests", RXKB_CONTEXT_USE_CACHE, true);
+    assert(find_models(ctx, "m1", NULL));
+    rxkb_context_unref(ctx);
+
+    /* A modified file invalidates the cache. */
+    times[1].tv_sec -= 10;
+    assert(utimensat(AT_FDCWD, path, times, 0) == 0);
+    ctx = test_parse_cached(dir, "xkbtests", RXKB_CONTEXT_USE_CACHE, false);
+    assert(find_models(ctx, "m9", NULL));
+    assert(!find_model(ctx, "m1"));
+    rxkb_context_unref(ctx);
+
+    /* So does an added file. */
+    ctx = test_parse_cached(dir, "xkbtests", RXKB_CONTEXT_USE_CACHE |
+                            RXKB_CONTEXT_LOAD_EXOTIC_RULES, false);
+    rxkb_context_unref(ctx);
+    assert(snprintf_safe(changed_path, sizeof(changed_path),
+                         "%s/rules/xkbtests.extras.xml", dir));
+    changed_dir = test_create_rules("xkbtests", models, NULL, NULL);
+    assert(snprintf_safe(path, sizeof(path), "%s/rules/xkbtests.xml",
+                         changed_dir));
+    assert(rename(path, changed_path) == 0);
+    test_remove_rules(changed_dir, "xkbtests");
+    ctx = test_parse_cached(dir, "xkbtests", RXKB_CONTEXT_USE_CACHE |
+                            RXKB_CONTEXT_LOAD_EXOTIC_RULES, false);
+    assert(find_models(ctx, "m1", "m9", NULL));
+    rxkb_context_unref(ctx);
+    unlink(changed_path);
+    test_remove_rules(dir, "xkbtests");
+
+    assert(snprintf_safe(path, sizeof(path), "%s/xkbcommon", cache_home));
+    cache_dir = opendir(path);
+    assert(cache_dir);
+    while ((ent = readdir(cache_dir))) {
+        if (ent->d_name[0] == '.')
+            continue;
+        assert(strncmp(ent->d_name, "registry-", 9) == 0);
+        assert(snprintf_safe(changed_path, sizeof(changed_path), "%s/%s",
+                             path, ent->d_name));
+        assert(unlink(changed_path) == 0);
+    }
+    closedir(cache_dir);
+    assert(rmdir(path) == 0);
+    assert(rmdir(cache_home) == 0);
+    unsetenv("XDG_CACHE_HOME");
+}
+
+static void
+write_file(const char *dir, const char *name, const char *contents)
+{
+    char path[PATH_MAX];
+    FILE *fp;
+
+    assert(snprintf_safe(path, sizeof(path), "%s/rules/%s", dir, name));
+    fp = fopen(path, "w");
+    assert(fp);
+    fputs(contents, fp);
+    fclose(fp);
+}
+
+static void
+test_invalid_document(void)
+{
+    struct test_model system_models[] =  {
+        {"m1"},
+        {NULL},
+    };
+    struct test_model user_models[] =  {
+        {"m2"},
+        {NULL},
+    };
+    const char dtd[] =
+        "<!ELEMENT xkbConfigRegistry (modelList?,layoutList?)>\n"
+        "<!ATTLIST xkbConfigRegistry version CDATA \"1.1\">\n"
+        "<!ELEMENT modelList (model*)>\n"
+        "<!ELEMENT model (configItem)>\n"
+        "<!ELEMENT layoutList (layout*)>\n"
+        "<!ELEMENT layout (configItem,variantList?)>\n"
+        "<!ELEMENT variantList (variant*)>\n"
+        "<!ELEMENT variant (configItem)>\n"
+        "<!ELEMENT configItem (name)>\n"
+        "<!ELEMENT name (#PCDATA)>\n";
+    struct rxkb_context *ctx;
+    char *sysdir, *userdir;
+    char path[PATH_MAX];
+
+    sysdir = test_create_rules("xkbtests", system_models, NULL, NULL);
+    userdir = test_create_rules("xkbtests", user_models, NULL, NULL);
+
+    /* The document only turns out invalid after model m2 and layout l9. */
+    write_file(userdir, "xkbtests.xml",
+               "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+               "<!DOCTYPE xkbConfigRegistry SYSTEM \"xkb.dtd\">\n"
+               "<xkbConfigRegistry version=\"1.1\">\n"
+               "<modelList>\n"
+               "  <model><configItem><name>m2</name></configItem></model>\n"
+               "</modelList>\n"
+               "<layoutList>\n"
+               "  <layout>\n"
+               "    <configItem><name>l9</name></configItem>\n"
+               "    <variantList><bogus><variant/></bogus></variantList>\n"
+               "  </layout>\n"
+               "</layoutList>\n"
+               "</xkbConfigRegistry>\n");
+    write_file(sysdir, "xkb.dtd", dtd);
+    write_file(userdir, "xkb.dtd", dtd);
+
+    /* Without validation, the unknown element is skipped. */
+    ctx = rxkb_context_new(RXKB_CONTEXT_NO_DEFAULT_INCLUDES);
+    assert(ctx);
+    assert(rxkb_context_include_path_append(ctx, userdir));
+    assert(rxkb_context_include_path_append(ctx, sysdir));
+    assert(rxkb_context_parse(ctx, "xkbtests"));
+    assert(find_models(ctx, "m1", "m2", NULL));
+    assert(find_layout(ctx, "l9", NO_VARIANT));
+    rxkb_context_unref(ctx);
+
+    /* With validation, nothing of the invalid document is left behind. */
+    ctx = rxkb_context_new(RXKB_CONTEXT_NO_DEFAULT_INCLUDES |
+                           RXKB_CONTEXT_VALIDATE);
+    assert(ctx);
+    assert(rxkb_context_include_path_append(ctx, userdir));
+    assert(rxkb_context_include_path_append(ctx, sysdir));
+    assert(rxkb_context_parse(ctx, "xkbtests"));
+    assert(find_models(ctx, "m1", NULL));
+    assert(!find_model(ctx, "m2"));
+    assert(!find_layout(ctx, "l9", NO_VARIANT));
+    rxkb_context_unref(ctx);
+
+    /* A document which is not well-formed is always left out. */
+    write_file(userdir, "xkbtests.xml",
+               "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+               "<xkbConfigRegistry version=\"1.1\">\n"
+               "<modelList>\n"
+               "  <model><configItem><name>m2</name></configItem></model>\n"
+               "</modelList>\n"
+               "<layoutList>\n"
+               "</xkbConfigRegistry>\n");
+
+    ctx = rxkb_context_new(RXKB_CONTEXT_NO_DEFAULT_INCLUDES);
+    assert(ctx);
+    assert(rxkb_context_include_path_append(ctx, userdir));
+    assert(rxkb_context_include_path_append(ctx, sysdir));
+    assert(rxkb_context_parse(ctx, "xkbtests"));
+    assert(find_models(ctx, "m1", NULL));
+    assert(!find_model(ctx, "m2"));
+    rxkb_context_unref(ctx);
+
+    assert(snprintf_safe(path, sizeof(path), "%s/rules/xkb.dtd", sysdir));
+    unlink(path);
+    assert(snprintf_safe(path, sizeof(path), "%s/rules/xkb.dtd", userdir));
+    unlink(path);
+    test_remove_rules(sysdir, "xkbtests");
+    test_remove_rules(userdir, "xkbtests");
+}
+
+static void
+test_lookup(void)
+{
+    struct rxkb_context *ctx;
+    struct rxkb_layout *l, *found;
+    struct rxkb_option_group *g;
+    struct rxkb_option *o;
+    char *datadir;
+
+    datadir = asprintf_safe("%s/test/data", getenv("top_srcdir"));
+    assert(datadir);
+    ctx = rxkb_context_new(RXKB_CONTEXT_NO_DEFAULT_INCLUDES |
+                           RXKB_CONTEXT_LOAD_EXOTIC_RULES);
+    assert(ctx);
+    assert(!rxkb_layout_find(ctx, "us", NULL));
+    assert(rxkb_context_include_path_append(ctx, datadir));
+    assert(rxkb_context_parse(ctx, "evdev"));
+    free(datadir);
+
+    /* Every layout is found, and so are all layouts with its codes. */
+    for (l = rxkb_layout_first(ctx); l; l = rxkb_layout_next(l)) {
+        struct rxkb_iso639_code *iso639;
+        struct rxkb_iso3166_code *iso3166;
+
+        found = rxkb_layout_find(ctx, rxkb_layout_get_name(l),
+                                 rxkb_layout_get_variant(l));
+        assert(streq(rxkb_layout_get_name(found), rxkb_layout_get_name(l)));
+        assert(streq_null(rxkb_layout_get_variant(found),
+                          rxkb_layout_get_variant(l)));
+
+        for (iso639 = rxkb_layout_get_iso639_first(l);
+             iso639;
+             iso639 = rxkb_iso639_code_next(iso639)) {
+            const char *code = rxkb_iso639_code_get_code(iso639);
+            struct rxkb_layout *scan = rxkb_layout_first(ctx);
+
+            /* The layouts come in list order. */
+            for (found = rxkb_layout_first_for_iso639(ctx, code);
+                 found;
+                 found = rxkb_layout_next_for_iso639(found, code)) {
+                while (scan != found) {
+                    assert(scan);
+                    scan = rxkb_layout_next(scan);
+                }
+                scan = rxkb_layout_next(scan);
+                if (found == l)
+                    break;
+            }
+            assert(found == l);
+        }
+
+        for (iso3166 = rxkb_layout_get_iso3166_first(l);
+             iso3166;
+             iso3166 = rxkb_iso3166_code_next(iso3166)) {
+            const char *code = rxkb_iso3166_code_get_code(iso3166);
+
+            for (found = rxkb_layout_first_for_iso3166(ctx, code);
+                 found && found != l;
+                 found = rxkb_layout_next_for_iso3166(found, code))
+                ;
+            assert(found == l);
+        }
+    }
+
+    for (g = rxkb_option_group_first(ctx); g; g = rxkb_option_group_next(g)) {
+        for (o = rxkb_option_first(g); o; o = rxkb_option_next(o)) {
+            assert(streq(rxkb_option_get_name(
+                             rxkb_option_find(ctx, rxkb_option_get_name(o))),
+                         rxkb_option_get_name(o)));
+        }
+    }
+
+    l = rxkb_layout_find(ctx, "us", "");
+    assert(l && rxkb_layout_get_variant(l) == NULL);
+    assert(rxkb_layout_find(ctx, "us", "intl"));
+    assert(!rxkb_layout_find(ctx, "us", "nonexistent"));
+    assert(!rxkb_layout_find(ctx, "intl", NULL));
+    assert(rxkb_option_find(ctx, "grp:alt_shift_toggle"));
+    assert(!rxkb_option_find(ctx, "grp"));
+
+    l = rxkb_layout_first_for_iso3166(ctx, "us");
+    assert(l && l == rxkb_layout_first_for_iso3166(ctx, "US"));
+    assert(rxkb_layout_first_for_iso639(ctx, "eng"));
+    assert(!rxkb_layout_first_for_iso639(ctx, "xyz"));
+
+    rxkb_context_unref(ctx);
+}
+
+/* Whether a word of the text starts with the prefix, ignoring case. */
+static bool
+has_word_prefix(const char *text, const char *prefix)
+{
+    size_t len = strlen(prefix);
+
+    if (!text)
+        return false;
+
+    for (const char *s = text; *s; s++) {
+        size_t i = 0;
+
+        if (s != text && isalnum((unsigned char) s[-1]))
+            continue;
+
+        while (i < len && s[i] &&
+               tolower((unsigned char) s[i]) == tolower((unsigned char) prefix[i]))
+            i++;
+        if (i == len)
+            return true;
+    }
+    return false;
+}
+
+static bool
+layout_has_word_prefix(struct rxkb_layout *l, const char *prefix)
+{
+    return has_word_prefix(rxkb_layout_get_name(l), prefix) ||
+           has_word_prefix(rxkb_layout_get_variant(l), prefix) ||
+           has_word_prefix(rxkb_layout_get_brief(l), prefix) ||
+           has_word_prefix(rxkb_layout_get_description(l), prefix);
+}
+
+static bool
+option_has_word_prefix(struct rxkb_option *o, const char *prefix)
+{
+    return has_word_prefix(rxkb_option_get_name(o), prefix) ||
+           has_word_prefix(rxkb_option_get_brief(o), prefix) ||
+           has_word_prefix(rxkb_option_get_description(o), prefix);
+}
+
+static void
+test_search(void)
+{
+    struct rxkb_context *ctx;
+    struct rxkb_search *search;
+    struct rxkb_layout *l;
+    struct rxkb_option_group *g;
+    struct rxkb_option *o;
+    size_t count;
+    char *datadir;
+
+    datadir = asprintf_safe("%s/test/data", getenv("top_srcdir"));
+    assert(datadir);
+    ctx = rxkb_context_new(RXKB_CONTEXT_NO_DEFAULT_INCLUDES |
+                           RXKB_CONTEXT_LOAD_EXOTIC_RULES);
+    assert(ctx);
+    assert(!rxkb_search_new(ctx, "us", RXKB_SEARCH_NO_FLAGS));
+    assert(rxkb_context_include_path_append(ctx, datadir));
+    assert(rxkb_context_parse(ctx, "evdev"));
+    free(datadir);
+
+    /* The search finds the same layouts and options as a scan. */
+    search = rxkb_search_new(ctx, "GERM", RXKB_SEARCH_NO_FLAGS);
+    assert(search);
+    count = 0;
+    for (l = rxkb_layout_first(ctx); l; l = rxkb_layout_next(l))
+        count += layout_has_word_prefix(l, "germ");
+    assert(count > 0);
+    assert(rxkb_search_get_num_layouts(search) == count);
+    for (size_t i = 0; i < count; i++)
+        assert(layout_has_word_prefix(rxkb_search_get_layout(search, i),
+                                      "germ"));
+    assert(!rxkb_search_get_layout(search, count));
+    rxkb_search_unref(search);
+
+    search = rxkb_search_new(ctx, "caps", RXKB_SEARCH_NO_FLAGS);
+    assert(search);
+    count = 0;
+    for (g = rxkb_option_group_first(ctx); g; g = rxkb_option_group_next(g))
+        for (o = rxkb_option_first(g); o; o = rxkb_option_next(o))
+            count += option_has_word_prefix(o, "caps");
+    assert(count > 0);
+    assert(rxkb_search_get_num_options(search) == count);
+    for (size_t i = 0; i < count; i++)
+        assert(option_has_word_prefix(rxkb_search_get_option(search, i),
+                                      "caps"));
+    rxkb_search_unref(search);
+
+    /* All words must match. */
+    search = rxkb_search_new(ctx, "germ swi", RXKB_SEARCH_NO_FLAGS);
+    assert(search);
+    count = rxkb_search_get_num_layouts(search);
+    assert(count > 0);
+    for (size_t i = 0; i < count; i++) {
+        l = rxkb_search_get_layout(search, i);
+        assert(layout_has_word_prefix(l, "germ") &&
+               layout_has_word_prefix(l, "swi"));
+    }
+    rxkb_search_unref(search);
+
+    /* A whole name ranks first, the base layout before its variants. */
+    search = rxkb_search_new(ctx, "us", RXKB_SEARCH_NO_FLAGS);
+    assert(search);
+    l = rxkb_search_get_layout(search, 0);
+    assert(streq(rxkb_layout_get_name(l), "us"));
+    assert(rxkb_layout_get_variant(l) == NULL);
+    rxkb_search_unref(search);
+
+    search = rxkb_search_new(ctx, "a", RXKB_SEARCH_SKIP_EXOTIC);
+    assert(search);
+    assert(rxkb_search_get_num_layouts(search) > 0);
+    for (size_t i = 0; i < rxkb_search_get_num_layouts(search); i++)
+        assert(rxkb_layout_get_popularity(rxkb_search_get_layout(search, i)) ==
+               RXKB_POPULARITY_STANDARD);
+    for (size_t i = 0; i < rxkb_search_get_num_options(search); i++)
+        assert(rxkb_option_get_popularity(rxkb_search_get_option(search, i)) ==
+               RXKB_POPULARITY_STANDARD);
+    rxkb_search_unref(search);
+
+    search = rxkb_search_new(ctx, " ,; ", RXKB_SEARCH_NO_FLAGS);
+    assert(search);
+    assert(rxkb_search_get_num_layouts(search) == 0);
+    assert(rxkb_search_get_num_options(search) == 0);
+    rxkb_search_unref(search);
+
+    search = rxkb_search_new(ctx, "xyzzy", RXKB_SEARCH_NO_FLAGS);
+    assert(search);
+    assert(rxkb_search_get_num_layouts(search) == 0);
+
+    /* The results keep the context alive. */
+    rxkb_context_unref(ctx);
+    rxkb_search_unref(search);
+}
+
 static void
 test_no_include_paths(void)
 {
@@ -850,6 +1418,10 @@ main(void)
     test_load_merge();
     test_load_merge_no_overwrite();
     test_popularity();
+    test_invalid_document();
+    test_lookup();
+    test_search();
+    test_cache();
 
     return 0;
 }
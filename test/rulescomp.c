@@ -107,6 +107,63 @@ test_rmlvo_env(struct xkb_context *ctx, const char *rules, const char *model,
     return ret;
 }
 
+ATTR_PRINTF(3, 0) static void
+append_log(struct xkb_context *ctx, enum xkb_log_level level,
+           const char *fmt, va_list args)
+{
+    darray_char *log = xkb_context_get_user_data(ctx);
+    char *s = vasprintf_safe(fmt, args);
+    assert(s);
+
+    darray_append_string(*log, s);
+    free(s);
+}
+
+/*
+ * Compile with and without XKB_KEYMAP_COMPILE_PARALLEL, and check that the
+ * keymaps and the log messages are the same.
+ */
+static void
+test_parallel(const char *layout, const char *variant, const char *options)
+{
+    struct xkb_context *ctx = test_get_context(0);
+    const struct xkb_rule_names rmlvo = {
+        "evdev", "pc105", layout, variant, options
+    };
+    enum xkb_keymap_compile_flags flags[] = {
+        XKB_KEYMAP_COMPILE_NO_FLAGS, XKB_KEYMAP_COMPILE_PARALLEL
+    };
+    darray_char logs[2] = { darray_new(), darray_new() };
+    char *strings[2];
+
+    assert(ctx);
+    xkb_context_set_log_level(ctx, XKB_LOG_LEVEL_DEBUG);
+    xkb_context_set_log_verbosity(ctx, 10);
+    xkb_context_set_log_fn(ctx, append_log);
+
+    for (int i = 0; i < 2; i++) {
+        struct xkb_keymap *keymap;
+
+        xkb_context_set_user_data(ctx, &logs[i]);
+        keymap = xkb_keymap_new_from_names(ctx, &rmlvo, flags[i]);
+        strings[i] = (keymap ? xkb_keymap_get_as_string(keymap,
+                                                        XKB_KEYMAP_FORMAT_TEXT_V1)
+                             : NULL);
+        xkb_keymap_unref(keymap);
+        darray_append(logs[i], '\0');
+    }
+
+    xkb_context_unref(ctx);
+
+    assert(streq_null(strings[0], strings[1]));
+    assert(streq(logs[0].item, logs[1].item));
+
+    for (int i = 0; i < 2; i++) {
+        free(strings[i]);
+        darray_free(logs[i]);
+    }
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -193,6 +250,12 @@ main(int argc, char *argv[])
     assert(test_rmlvo_env(ctx, "broken", "but", "ignored", "per", "ctx flags",
                           KEY_A,          BOTH, XKB_KEY_a,                FINISH));
 
+    test_parallel("us,il,ru,ca", ",,,multix",
+                  "grp:alts_toggle,ctrl:nocaps,compose:rwin");
+    test_parallel("cz", "bksl", "");
+    test_parallel("us", "no-such-variant", "");
+    test_parallel("us,de", "", "no-such-option");
+
     /* Test response to invalid flags. */
     {
         struct xkb_rule_names rmlvo = { NULL };
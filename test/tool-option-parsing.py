@@ -236,6 +236,7 @@ class TestXkbcli(unittest.TestCase):
             ['-v'],
             ['--verbose', '--load-exotic'],
             ['--load-exotic'],
+            ['--validate'],
             ['--ruleset=evdev'],
             ['--ruleset=base'],
         ):
@@ -0,0 +1,293 @@
+/*
+ * Copyright © 2021 libxkbcommon contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "test.h"
+#include "x11-server.h"
+#include "x11/x11-priv.h"
+
+/*
+ * Check that the atom name cache in the context is not trusted blindly.
+ *
+ * Two servers started the same way have the same connection setup, so
+ * nothing in it tells their atoms apart. The same names are interned on
+ * both, but two of them in the opposite order, so those X atoms have each
+ * other's name on the other server. Looking up the names on one server
+ * after the other must notice the stale entries and ask the server again.
+ *
+ * This runs on two stand-in servers, and on two Xvfb if there are.
+ */
+
+static const char *names[] = {
+    "XKBCOMMON_TEST_ATOM_0", "XKBCOMMON_TEST_ATOM_1",
+    "XKBCOMMON_TEST_ATOM_2", "XKBCOMMON_TEST_ATOM_3",
+    "XKBCOMMON_TEST_ATOM_4", "XKBCOMMON_TEST_ATOM_5",
+    "XKBCOMMON_TEST_ATOM_6", "XKBCOMMON_TEST_ATOM_7",
+};
+
+#define NUM_NAMES ARRAY_SIZE(names)
+
+/* The order in which the names are interned on each server. */
+static const size_t order1[NUM_NAMES] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+static const size_t order2[NUM_NAMES] = { 0, 1, 3, 2, 4, 5, 6, 7 };
+
+/* Start an Xvfb on a free display, and connect to it. */
+static xcb_connection_t *
+start_xvfb(pid_t *pid)
+{
+    char fd_arg[16], display[32];
+    char *argv[] = {
+        (char *) "Xvfb", (char *) "-displayfd", fd_arg, NULL
+    };
+    char *envp[] = { NULL };
+    xcb_connection_t *conn;
+    int fds[2];
+    ssize_t len;
+
+    *pid = 0;
+    if (pipe(fds) != 0)
+        return NULL;
+
+    snprintf(fd_arg, sizeof(fd_arg), "%d", fds[1]);
+    if (posix_spawnp(pid, "Xvfb", NULL, NULL, argv, envp) != 0) {
+        *pid = 0;
+        close(fds[0]);
+        close(fds[1]);
+        return NULL;
+    }
+    close(fds[1]);
+
+    /* Xvfb writes the display number once it accepts connections. */
+    display[0] = ':';
+    len = read(fds[0], &display[1], sizeof(display) - 2);
+    close(fds[0]);
+    if (len <= 0)
+        return NULL;
+    display[len + 1] = '\0';
+
+    conn = xcb_connect(display, NULL);
+    if (xcb_connection_has_error(conn)) {
+        xcb_disconnect(conn);
+        return NULL;
+    }
+
+    return conn;
+}
+
+static void
+stop_xvfb(pid_t pid)
+{
+    if (pid > 0) {
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+    }
+}
+
+
+static void
+intern_names(xcb_connection_t *conn, const size_t order[],
+             xcb_atom_t atoms[])
+{
+    xcb_intern_atom_cookie_t cookies[NUM_NAMES];
+
+    for (size_t i = 0; i < NUM_NAMES; i++)
+        cookies[order[i]] = xcb_intern_atom(conn, 0, strlen(names[order[i]]),
+                                            names[order[i]]);
+
+    for (size_t i = 0; i < NUM_NAMES; i++) {
+        xcb_intern_atom_reply_t *reply =
+            xcb_intern_atom_reply(conn, cookies[order[i]], NULL);
+        assert(reply);
+        atoms[order[i]] = reply->atom;
+        free(reply);
+    }
+}
+
+/*
+ * Look up the names of the atoms, and check them. Returns the token of the
+ * server; @cached tells whether the names came from the cache, without
+ * asking the server for them.
+ */
+static uint64_t
+check_names(struct xkb_context *ctx, xcb_connection_t *conn,
+            const xcb_atom_t atoms[], bool *cached)
+{
+    struct x11_atom_interner interner;
+    xkb_atom_t out[NUM_NAMES];
+    uint64_t server;
+
+    x11_atom_interner_init(&interner, ctx, conn);
+    for (size_t i = 0; i < NUM_NAMES; i++)
+        x11_atom_interner_adopt_atom(&interner, atoms[i], &out[i]);
+    *cached = darray_empty(interner.pending);
+    server = interner.server;
+    x11_atom_interner_round_trip(&interner);
+    assert(!interner.had_error);
+    assert(interner.server != 0);
+    /* A token which does not match has the names requested again. */
+    if (interner.server != server)
+        *cached = false;
+    server = interner.server;
+    x11_atom_interner_finish(&interner);
+
+    for (size_t i = 0; i < NUM_NAMES; i++)
+        assert(streq(xkb_atom_text(ctx, out[i]), names[i]));
+
+    return server;
+}
+
+/* Returns false if the servers don't give the same atoms. */
+static bool
+test_servers(xcb_connection_t *conn1, xcb_connection_t *conn2)
+{
+    struct xkb_context *ctx = test_get_context(0);
+    xcb_atom_t atoms1[NUM_NAMES], atoms2[NUM_NAMES];
+    uint64_t server1, server2;
+    bool cached;
+
+    assert(ctx);
+
+    intern_names(conn1, order1, atoms1);
+    intern_names(conn2, order2, atoms2);
+
+    /* Otherwise the cache entries are not stale. */
+    if (atoms1[2] != atoms2[3] || atoms1[3] != atoms2[2] ||
+        memcmp(xcb_get_setup(conn1), xcb_get_setup(conn2),
+               sizeof(xcb_setup_t)) != 0) {
+        xkb_context_unref(ctx);
+        return false;
+    }
+
+    /* Fill the cache, then use it on the same server. */
+    server1 = check_names(ctx, conn1, atoms1, &cached);
+    assert(!cached);
+    assert(check_names(ctx, conn1, atoms1, &cached) == server1);
+    assert(cached);
+
+    /* Two of the entries are stale on the other server, and back. */
+    server2 = check_names(ctx, conn2, atoms2, &cached);
+    assert(server2 != server1);
+    assert(!cached);
+    assert(check_names(ctx, conn2, atoms2, &cached) == server2);
+    assert(cached);
+    assert(check_names(ctx, conn1, atoms1, &cached) == server1);
+    assert(!cached);
+
+    xkb_context_unref(ctx);
+    return true;
+}
+
+/* Remove the token of the server, as if no client had stored one yet. */
+static void
+delete_server_token(xcb_connection_t *conn)
+{
+    static const char name[] = "_XKBCOMMON_SERVER_TOKEN";
+    xcb_window_t root = xcb_setup_roots_iterator(xcb_get_setup(conn)).data->root;
+    xcb_intern_atom_reply_t *reply =
+        xcb_intern_atom_reply(conn,
+                              xcb_intern_atom(conn, 0, strlen(name), name),
+                              NULL);
+
+    assert(reply);
+    assert(!xcb_request_check(conn,
+                              xcb_delete_property_checked(conn, root,
+                                                          reply->atom)));
+    free(reply);
+}
+
+static void
+test_stand_in_servers(void)
+{
+    struct xkb_context *ctx = test_get_context(0);
+    struct xkb_keymap *keymap;
+    struct x11_server server1, server2;
+    xcb_connection_t *conn1, *conn2;
+    bool ok;
+
+    assert(ctx);
+    keymap = test_compile_rules(ctx, "evdev", "pc105", "us", "", "");
+    assert(keymap);
+
+    ok = x11_server_start(&server1, keymap);
+    assert(ok);
+    conn1 = xcb_connect_to_fd(server1.fd, NULL);
+    assert(!xcb_connection_has_error(conn1));
+    ok = x11_server_start(&server2, keymap);
+    assert(ok);
+    conn2 = xcb_connect_to_fd(server2.fd, NULL);
+    assert(!xcb_connection_has_error(conn2));
+
+    /* The first client of a server stores the token. */
+    delete_server_token(conn2);
+
+    ok = test_servers(conn1, conn2);
+    assert(ok);
+
+    xcb_disconnect(conn2);
+    xcb_disconnect(conn1);
+    /* The second server keeps the first one's connection open. */
+    ok = x11_server_stop(&server2);
+    assert(ok);
+    ok = x11_server_stop(&server1);
+    assert(ok);
+
+    xkb_keymap_unref(keymap);
+    xkb_context_unref(ctx);
+}
+
+int
+main(void)
+{
+    xcb_connection_t *conn1, *conn2 = NULL;
+    pid_t pid1, pid2 = 0;
+
+    test_stand_in_servers();
+
+    conn1 = start_xvfb(&pid1);
+    if (conn1)
+        conn2 = start_xvfb(&pid2);
+
+    if (!conn2)
+        fprintf(stderr, "Couldn't start Xvfb, skipping it\n");
+    else if (!test_servers(conn1, conn2))
+        fprintf(stderr, "The Xvfb servers do not give the same atoms, skipping them\n");
+
+    if (conn2)
+        xcb_disconnect(conn2);
+    if (conn1)
+        xcb_disconnect(conn1);
+    stop_xvfb(pid2);
+    stop_xvfb(pid1);
+    return 0;
+}
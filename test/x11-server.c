@@ -0,0 +1,1525 @@
+/*
+ * Copyright © 2021 libxkbcommon contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <xcb/xkb.h>
+
+#include "darray.h"
+#include "keymap.h"
+#include "x11-server.h"
+
+/*
+ * This is the reverse of src/x11/keymap.c; see there for references on
+ * the protocol. Requests and replies use the native byte order.
+ */
+
+/* Constants from /usr/include/X11/X.h. */
+#define X_REPLY 1
+#define BAD_VALUE 2
+#define BAD_WINDOW 3
+#define BAD_ATOM 5
+#define BAD_ALLOC 11
+#define BAD_LENGTH 16
+#define BAD_IMPLEMENTATION 17
+
+/* Constants from /usr/include/X11/extensions/XKB.h. */
+#define NUM_REAL_MODS 8u
+#define NUM_INDICATORS 32u
+#define NO_MODIFIER 0xff
+#define MIN_KEYCODE 8
+#define MAX_KEYCODE 255
+
+/* What the server hands out for XKB; the values of a usual Xorg server. */
+#define XKB_MAJOR_OPCODE 135
+#define XKB_FIRST_EVENT 85
+#define XKB_FIRST_ERROR 137
+#define XKB_BAD_KEYBOARD XKB_FIRST_ERROR
+#define KEYBOARD_DEVICE_ID 3
+
+/*
+ * The atoms up to XA_LAST_PREDEFINED have fixed names. The other atoms of
+ * the server are the atoms of the keymap's context, moved past those.
+ */
+#define LAST_PREDEFINED_ATOM XCB_ATOM_WM_TRANSIENT_FOR
+
+/*
+ * The only window is the root window, and its properties are small: enough
+ * for the token xkbcommon-x11 keeps there.
+ */
+#define ROOT_WINDOW 0x100
+#define MAX_PROPERTIES 8
+#define MAX_PROPERTY_SIZE 32
+
+/* The property in which xkbcommon-x11 keeps the token of the server. */
+#define SERVER_TOKEN_PROPERTY "_XKBCOMMON_SERVER_TOKEN"
+
+struct property {
+    /* XCB_ATOM_NONE if the slot is free. */
+    xcb_atom_t name;
+    xcb_atom_t type;
+    uint8_t format;
+    uint32_t size;
+    uint8_t data[MAX_PROPERTY_SIZE];
+};
+
+struct server {
+    struct xkb_keymap *keymap;
+    int fd;
+    /* The keys which fit in the protocol. */
+    xkb_keycode_t min_key_code;
+    xkb_keycode_t max_key_code;
+    uint16_t sequence;
+    /* The reply or error to the current request. */
+    darray(uint8_t) out;
+    bool ok;
+    struct property properties[MAX_PROPERTIES];
+};
+
+struct key_range {
+    xkb_keycode_t first;
+    unsigned int count;
+};
+
+static bool
+read_full(int fd, void *buf, size_t len)
+{
+    uint8_t *p = buf;
+
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+
+    return true;
+}
+
+static bool
+write_full(int fd, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+
+    return true;
+}
+
+static size_t
+pad4(size_t len)
+{
+    return (len + 3) & ~(size_t) 3;
+}
+
+static void
+put(struct server *server, const void *data, size_t len)
+{
+    darray_append_items(server->out, (const uint8_t *) data, len);
+}
+
+static void
+put_pad(struct server *server)
+{
+    static const uint8_t zeros[3];
+
+    put(server, zeros, pad4(darray_size(server->out)) - darray_size(server->out));
+}
+
+/* The reply header is put first and filled in once the rest is known. */
+static void
+set_header(struct server *server, const void *header, size_t len)
+{
+    memcpy(&darray_item(server->out, 0), header, len);
+}
+
+static void
+put_error(struct server *server, const uint8_t *request, uint8_t code,
+          uint32_t resource)
+{
+    xcb_generic_error_t error = {
+        .response_type = 0,
+        .error_code = code,
+        .resource_id = resource,
+        /* Core requests have no minor opcode. */
+        .minor_code = request[0] < 128 ? 0 : request[1],
+        .major_code = request[0],
+    };
+
+    /* The full_sequence field is not on the wire. */
+    darray_resize(server->out, 0);
+    put(server, &error, 32);
+}
+
+static void
+put_unsupported(struct server *server, const uint8_t *request)
+{
+    fprintf(stderr, "x11-server: request %u.%u is not supported\n",
+            request[0], request[1]);
+    put_error(server, request, BAD_IMPLEMENTATION, 0);
+    server->ok = false;
+}
+
+/* Send the reply or error to the current request, if any. */
+static bool
+send_out(struct server *server)
+{
+    uint8_t *data;
+    uint32_t length;
+    bool ok;
+
+    if (darray_empty(server->out))
+        return true;
+
+    put_pad(server);
+    if (darray_size(server->out) < 32)
+        darray_resize0(server->out, 32);
+
+    data = &darray_item(server->out, 0);
+    memcpy(&data[2], &server->sequence, sizeof(server->sequence));
+    if (data[0] == X_REPLY) {
+        length = (darray_size(server->out) - 32) / 4;
+        memcpy(&data[4], &length, sizeof(length));
+    }
+
+    ok = write_full(server->fd, data, darray_size(server->out));
+    darray_resize(server->out, 0);
+    return ok;
+}
+
+static xcb_atom_t
+wire_atom(xkb_atom_t atom)
+{
+    if (atom == XKB_ATOM_NONE)
+        return XCB_ATOM_NONE;
+    return LAST_PREDEFINED_ATOM + atom;
+}
+
+static xcb_atom_t
+wire_string_atom(struct server *server, const char *string)
+{
+    if (!string)
+        return XCB_ATOM_NONE;
+    return wire_atom(xkb_atom_intern(server->keymap->ctx,
+                                     string, strlen(string)));
+}
+
+static uint32_t
+wire_controls_mask(enum xkb_action_controls ctrls)
+{
+    uint32_t ret = 0;
+    if (ctrls & CONTROL_REPEAT)
+        ret |= XCB_XKB_BOOL_CTRL_REPEAT_KEYS;
+    if (ctrls & CONTROL_SLOW)
+        ret |= XCB_XKB_BOOL_CTRL_SLOW_KEYS;
+    if (ctrls & CONTROL_DEBOUNCE)
+        ret |= XCB_XKB_BOOL_CTRL_BOUNCE_KEYS;
+    if (ctrls & CONTROL_STICKY)
+        ret |= XCB_XKB_BOOL_CTRL_STICKY_KEYS;
+    if (ctrls & CONTROL_MOUSEKEYS)
+        ret |= XCB_XKB_BOOL_CTRL_MOUSE_KEYS;
+    if (ctrls & CONTROL_MOUSEKEYS_ACCEL)
+        ret |= XCB_XKB_BOOL_CTRL_MOUSE_KEYS_ACCEL;
+    if (ctrls & CONTROL_AX)
+        ret |= XCB_XKB_BOOL_CTRL_ACCESS_X_KEYS;
+    if (ctrls & CONTROL_AX_TIMEOUT)
+        ret |= XCB_XKB_BOOL_CTRL_ACCESS_X_TIMEOUT_MASK;
+    if (ctrls & CONTROL_AX_FEEDBACK)
+        ret |= XCB_XKB_BOOL_CTRL_ACCESS_X_FEEDBACK_MASK;
+    if (ctrls & CONTROL_BELL)
+        ret |= XCB_XKB_BOOL_CTRL_AUDIBLE_BELL_MASK;
+    if (ctrls & CONTROL_IGNORE_GROUP_LOCK)
+        ret |= XCB_XKB_BOOL_CTRL_IGNORE_GROUP_LOCK_MASK;
+    return ret;
+}
+
+static void
+wire_mods_action(xcb_xkb_sa_set_mods_t *wire, const struct xkb_mod_action *action)
+{
+    wire->mask = action->mods.mask & MOD_REAL_MASK_ALL;
+    wire->realMods = action->mods.mods & MOD_REAL_MASK_ALL;
+    wire->vmodsLow = (action->mods.mods >> 8) & 0xff;
+    wire->vmodsHigh = (action->mods.mods >> 16) & 0xff;
+    if (action->flags & ACTION_MODS_LOOKUP_MODMAP)
+        wire->flags |= XCB_XKB_SA_USE_MOD_MAP_MODS;
+}
+
+static xcb_xkb_action_t
+wire_action(const union xkb_action *action)
+{
+    xcb_xkb_action_t wire;
+
+    memset(&wire, 0, sizeof(wire));
+
+    switch (action->type) {
+    case ACTION_TYPE_NONE:
+        wire.type = XCB_XKB_SA_TYPE_NO_ACTION;
+        break;
+    case ACTION_TYPE_MOD_SET:
+    case ACTION_TYPE_MOD_LATCH:
+        wire.type = (action->type == ACTION_TYPE_MOD_SET ?
+                     XCB_XKB_SA_TYPE_SET_MODS : XCB_XKB_SA_TYPE_LATCH_MODS);
+        wire_mods_action(&wire.setmods, &action->mods);
+        if (action->mods.flags & ACTION_LOCK_CLEAR)
+            wire.setmods.flags |= XCB_XKB_SA_CLEAR_LOCKS;
+        if (action->mods.flags & ACTION_LATCH_TO_LOCK)
+            wire.setmods.flags |= XCB_XKB_SA_LATCH_TO_LOCK;
+        break;
+    case ACTION_TYPE_MOD_LOCK:
+        wire.type = XCB_XKB_SA_TYPE_LOCK_MODS;
+        wire_mods_action(&wire.setmods, &action->mods);
+        if (action->mods.flags & ACTION_LOCK_NO_LOCK)
+            wire.setmods.flags |= XCB_XKB_SA_ISO_LOCK_FLAG_NO_LOCK;
+        if (action->mods.flags & ACTION_LOCK_NO_UNLOCK)
+            wire.setmods.flags |= XCB_XKB_SA_ISO_LOCK_FLAG_NO_UNLOCK;
+        break;
+    case ACTION_TYPE_GROUP_SET:
+    case ACTION_TYPE_GROUP_LATCH:
+    case ACTION_TYPE_GROUP_LOCK:
+        wire.type = (action->type == ACTION_TYPE_GROUP_SET ?
+                     XCB_XKB_SA_TYPE_SET_GROUP :
+                     action->type == ACTION_TYPE_GROUP_LATCH ?
+                     XCB_XKB_SA_TYPE_LATCH_GROUP : XCB_XKB_SA_TYPE_LOCK_GROUP);
+        wire.setgroup.group = action->group.group;
+        if (action->type != ACTION_TYPE_GROUP_LOCK &&
+            (action->group.flags & ACTION_LOCK_CLEAR))
+            wire.setgroup.flags |= XCB_XKB_SA_CLEAR_LOCKS;
+        if (action->type != ACTION_TYPE_GROUP_LOCK &&
+            (action->group.flags & ACTION_LATCH_TO_LOCK))
+            wire.setgroup.flags |= XCB_XKB_SA_LATCH_TO_LOCK;
+        if (action->group.flags & ACTION_ABSOLUTE_SWITCH)
+            wire.setgroup.flags |= XCB_XKB_SA_ISO_LOCK_FLAG_GROUP_ABSOLUTE;
+        break;
+    case ACTION_TYPE_PTR_MOVE:
+        wire.type = XCB_XKB_SA_TYPE_MOVE_PTR;
+        wire.moveptr.xLow = (uint16_t) action->ptr.x & 0xff;
+        wire.moveptr.xHigh = (int8_t) ((uint16_t) action->ptr.x >> 8);
+        wire.moveptr.yLow = (uint16_t) action->ptr.y & 0xff;
+        wire.moveptr.yHigh = (int8_t) ((uint16_t) action->ptr.y >> 8);
+        if (!(action->ptr.flags & ACTION_ACCEL))
+            wire.moveptr.flags |= XCB_XKB_SA_MOVE_PTR_FLAG_NO_ACCELERATION;
+        if (action->ptr.flags & ACTION_ABSOLUTE_X)
+            wire.moveptr.flags |= XCB_XKB_SA_MOVE_PTR_FLAG_MOVE_ABSOLUTE_X;
+        if (action->ptr.flags & ACTION_ABSOLUTE_Y)
+            wire.moveptr.flags |= XCB_XKB_SA_MOVE_PTR_FLAG_MOVE_ABSOLUTE_Y;
+        break;
+    case ACTION_TYPE_PTR_BUTTON:
+        wire.type = XCB_XKB_SA_TYPE_PTR_BTN;
+        wire.ptrbtn.count = action->btn.count;
+        wire.ptrbtn.button = action->btn.button;
+        break;
+    case ACTION_TYPE_PTR_LOCK:
+        wire.type = XCB_XKB_SA_TYPE_LOCK_PTR_BTN;
+        wire.lockptrbtn.button = action->btn.button;
+        if (action->btn.flags & ACTION_LOCK_NO_LOCK)
+            wire.lockptrbtn.flags |= XCB_XKB_SA_ISO_LOCK_FLAG_NO_LOCK;
+        if (action->btn.flags & ACTION_LOCK_NO_UNLOCK)
+            wire.lockptrbtn.flags |= XCB_XKB_SA_ISO_LOCK_FLAG_NO_UNLOCK;
+        break;
+    case ACTION_TYPE_PTR_DEFAULT:
+        wire.type = XCB_XKB_SA_TYPE_SET_PTR_DFLT;
+        wire.setptrdflt.affect = XCB_XKB_SA_SET_PTR_DFLT_FLAG_AFFECT_DFLT_BUTTON;
+        wire.setptrdflt.value = action->dflt.value;
+        if (action->dflt.flags & ACTION_ABSOLUTE_SWITCH)
+            wire.setptrdflt.flags |= XCB_XKB_SA_SET_PTR_DFLT_FLAG_DFLT_BTN_ABSOLUTE;
+        break;
+    case ACTION_TYPE_TERMINATE:
+        wire.type = XCB_XKB_SA_TYPE_TERMINATE;
+        break;
+    case ACTION_TYPE_SWITCH_VT:
+        wire.type = XCB_XKB_SA_TYPE_SWITCH_SCREEN;
+        wire.switchscreen.newScreen = action->screen.screen;
+        if (!(action->screen.flags & ACTION_SAME_SCREEN))
+            wire.switchscreen.flags |= XCB_XKB_SWITCH_SCREEN_FLAG_APPLICATION;
+        if (action->screen.flags & ACTION_ABSOLUTE_SWITCH)
+            wire.switchscreen.flags |= XCB_XKB_SWITCH_SCREEN_FLAG_ABSOLUTE;
+        break;
+    case ACTION_TYPE_CTRL_SET:
+    case ACTION_TYPE_CTRL_LOCK: {
+        uint32_t mask = wire_controls_mask(action->ctrls.ctrls);
+
+        wire.type = (action->type == ACTION_TYPE_CTRL_SET ?
+                     XCB_XKB_SA_TYPE_SET_CONTROLS :
+                     XCB_XKB_SA_TYPE_LOCK_CONTROLS);
+        wire.setcontrols.boolCtrlsLow = mask & 0xff;
+        wire.setcontrols.boolCtrlsHigh = (mask >> 8) & 0xff;
+        break;
+    }
+    default:
+        /* Private actions keep their type and data. */
+        wire.type = action->priv.type;
+        memcpy(wire.noaction.pad0, action->priv.data,
+               sizeof(wire.noaction.pad0));
+        break;
+    }
+
+    return wire;
+}
+
+static void
+put_key_type(struct server *server, const struct xkb_key_type *type)
+{
+    xcb_xkb_key_type_t wire = {
+        .mods_mask = type->mods.mask & MOD_REAL_MASK_ALL,
+        .mods_mods = type->mods.mods & MOD_REAL_MASK_ALL,
+        .mods_vmods = type->mods.mods >> NUM_REAL_MODS,
+        .numLevels = type->num_levels,
+        .nMapEntries = type->num_entries,
+    };
+
+    for (unsigned i = 0; i < type->num_entries; i++)
+        if (type->entries[i].preserve.mods != 0)
+            wire.hasPreserve = 1;
+
+    put(server, &wire, sizeof(wire));
+
+    for (unsigned i = 0; i < type->num_entries; i++) {
+        const struct xkb_key_type_entry *entry = &type->entries[i];
+        xcb_xkb_kt_map_entry_t wire_entry = {
+            .active = entry_is_active(entry),
+            .mods_mask = entry->mods.mask & MOD_REAL_MASK_ALL,
+            .level = entry->level,
+            .mods_mods = entry->mods.mods & MOD_REAL_MASK_ALL,
+            .mods_vmods = entry->mods.mods >> NUM_REAL_MODS,
+        };
+
+        put(server, &wire_entry, sizeof(wire_entry));
+    }
+
+    if (!wire.hasPreserve)
+        return;
+
+    for (unsigned i = 0; i < type->num_entries; i++) {
+        const struct xkb_key_type_entry *entry = &type->entries[i];
+        xcb_xkb_mod_def_t wire_preserve = {
+            .mask = entry->preserve.mask & MOD_REAL_MASK_ALL,
+            .realMods = entry->preserve.mods & MOD_REAL_MASK_ALL,
+            .vmods = entry->preserve.mods >> NUM_REAL_MODS,
+        };
+
+        put(server, &wire_preserve, sizeof(wire_preserve));
+    }
+}
+
+/* The number of keysyms per group on the wire. */
+static xkb_level_index_t
+key_width(const struct xkb_key *key)
+{
+    xkb_level_index_t width = 0;
+
+    for (xkb_layout_index_t i = 0; i < key->num_groups; i++)
+        width = MAX(width, XkbKeyNumLevels(key, i));
+
+    return width;
+}
+
+static bool
+key_has_actions(const struct xkb_key *key)
+{
+    for (xkb_layout_index_t i = 0; i < key->num_groups; i++)
+        for (xkb_level_index_t j = 0; j < XkbKeyNumLevels(key, i); j++)
+            if (key->groups[i].levels[j].action.type != ACTION_TYPE_NONE)
+                return true;
+
+    return false;
+}
+
+static unsigned int
+put_key_sym_map(struct server *server, const struct xkb_key *key)
+{
+    xkb_level_index_t width = key_width(key);
+    xcb_xkb_key_sym_map_t wire = {
+        .groupInfo = key->num_groups | (key->out_of_range_group_number << 4),
+        .width = width,
+        .nSyms = width * key->num_groups,
+    };
+
+    if (key->out_of_range_group_action == RANGE_SATURATE)
+        wire.groupInfo |= XCB_XKB_GROUPS_WRAP_CLAMP_INTO_RANGE;
+    else if (key->out_of_range_group_action == RANGE_REDIRECT)
+        wire.groupInfo |= XCB_XKB_GROUPS_WRAP_REDIRECT_INTO_RANGE;
+
+    for (xkb_layout_index_t i = 0; i < key->num_groups; i++)
+        wire.kt_index[i] = key->groups[i].type - server->keymap->types;
+
+    put(server, &wire, sizeof(wire));
+
+    for (xkb_layout_index_t i = 0; i < key->num_groups; i++) {
+        for (xkb_level_index_t j = 0; j < width; j++) {
+            xcb_keysym_t sym = XKB_KEY_NoSymbol;
+
+            if (j < XkbKeyNumLevels(key, i)) {
+                const struct xkb_level *level = &key->groups[i].levels[j];
+
+                if (level->num_syms == 1)
+                    sym = level->u.sym;
+                else if (level->num_syms > 1)
+                    sym = level->u.syms[0];
+            }
+
+            put(server, &sym, sizeof(sym));
+        }
+    }
+
+    return wire.nSyms;
+}
+
+static unsigned int
+put_key_actions(struct server *server, const struct xkb_key *key)
+{
+    xkb_level_index_t width = key_width(key);
+
+    if (!key_has_actions(key))
+        return 0;
+
+    for (xkb_layout_index_t i = 0; i < key->num_groups; i++) {
+        for (xkb_level_index_t j = 0; j < width; j++) {
+            static const union xkb_action none = { .type = ACTION_TYPE_NONE };
+            xcb_xkb_action_t wire;
+
+            if (j < XkbKeyNumLevels(key, i))
+                wire = wire_action(&key->groups[i].levels[j].action);
+            else
+                wire = wire_action(&none);
+
+            put(server, &wire, sizeof(wire));
+        }
+    }
+
+    return width * key->num_groups;
+}
+
+static uint8_t
+wire_explicit(const struct xkb_key *key)
+{
+    uint8_t ret = 0;
+
+    for (xkb_layout_index_t i = 0; i < key->num_groups && i < 4; i++)
+        if (key->groups[i].explicit_type)
+            ret |= XCB_XKB_EXPLICIT_KEY_TYPE_1 << i;
+    if (key->explicit & EXPLICIT_INTERP)
+        ret |= XCB_XKB_EXPLICIT_INTERPRET;
+    if (key->explicit & EXPLICIT_REPEAT)
+        ret |= XCB_XKB_EXPLICIT_AUTO_REPEAT;
+    if (key->explicit & EXPLICIT_VMODMAP)
+        ret |= XCB_XKB_EXPLICIT_V_MOD_MAP;
+    return ret;
+}
+
+/*
+ * The keys of a map part: all of them if the part is requested in full,
+ * the given ones if it is requested partially, none otherwise.
+ */
+static bool
+get_key_range(struct server *server, const xcb_xkb_get_map_request_t *req,
+              uint16_t part, uint8_t first, uint8_t count,
+              struct key_range *range)
+{
+    range->first = 0;
+    range->count = 0;
+
+    if (req->full & part) {
+        range->first = server->min_key_code;
+        range->count = server->max_key_code - server->min_key_code + 1;
+    }
+    else if ((req->partial & part) && count > 0) {
+        if (first < server->min_key_code ||
+            first + count > server->max_key_code + 1)
+            return false;
+        range->first = first;
+        range->count = count;
+    }
+
+    return true;
+}
+
+static void
+handle_get_map(struct server *server, const uint8_t *request)
+{
+    const xcb_xkb_get_map_request_t *req = (const void *) request;
+    const struct xkb_keymap *keymap = server->keymap;
+    const uint16_t present = (req->full | req->partial) &
+                             ~XCB_XKB_MAP_PART_KEY_BEHAVIORS;
+    struct key_range syms, acts, explicits, modmaps, vmodmaps;
+    unsigned int first_type = 0, num_types = 0;
+    xcb_xkb_get_map_reply_t reply = {
+        .response_type = X_REPLY,
+        .deviceID = KEYBOARD_DEVICE_ID,
+        .minKeyCode = server->min_key_code,
+        .maxKeyCode = server->max_key_code,
+        .present = present,
+        .totalTypes = keymap->num_types,
+    };
+
+    if (req->full & XCB_XKB_MAP_PART_KEY_TYPES) {
+        num_types = keymap->num_types;
+    }
+    else if (req->partial & XCB_XKB_MAP_PART_KEY_TYPES) {
+        first_type = req->firstType;
+        num_types = req->nTypes;
+    }
+
+    if (first_type + num_types > keymap->num_types ||
+        !get_key_range(server, req, XCB_XKB_MAP_PART_KEY_SYMS,
+                       req->firstKeySym, req->nKeySyms, &syms) ||
+        !get_key_range(server, req, XCB_XKB_MAP_PART_KEY_ACTIONS,
+                       req->firstKeyAction, req->nKeyActions, &acts) ||
+        !get_key_range(server, req, XCB_XKB_MAP_PART_EXPLICIT_COMPONENTS,
+                       req->firstKeyExplicit, req->nKeyExplicit, &explicits) ||
+        !get_key_range(server, req, XCB_XKB_MAP_PART_MODIFIER_MAP,
+                       req->firstModMapKey, req->nModMapKeys, &modmaps) ||
+        !get_key_range(server, req, XCB_XKB_MAP_PART_VIRTUAL_MOD_MAP,
+                       req->firstVModMapKey, req->nVModMapKeys, &vmodmaps)) {
+        put_error(server, request, BAD_VALUE, 0);
+        return;
+    }
+
+    put(server, &reply, sizeof(reply));
+
+    reply.firstType = first_type;
+    reply.nTypes = num_types;
+    for (unsigned i = first_type; i < first_type + num_types; i++)
+        put_key_type(server, &keymap->types[i]);
+
+    reply.firstKeySym = syms.first;
+    reply.nKeySyms = syms.count;
+    for (unsigned i = 0; i < syms.count; i++)
+        reply.totalSyms += put_key_sym_map(server,
+                                           &keymap->keys[syms.first + i]);
+
+    reply.firstKeyAction = acts.first;
+    reply.nKeyActions = acts.count;
+    for (unsigned i = 0; i < acts.count; i++) {
+        const struct xkb_key *key = &keymap->keys[acts.first + i];
+        uint8_t count = key_has_actions(key) ?
+                        key_width(key) * key->num_groups : 0;
+
+        put(server, &count, sizeof(count));
+    }
+    put_pad(server);
+    for (unsigned i = 0; i < acts.count; i++)
+        reply.totalActions += put_key_actions(server,
+                                              &keymap->keys[acts.first + i]);
+
+    if (req->full & XCB_XKB_MAP_PART_VIRTUAL_MODS)
+        reply.virtualMods = 0xffff;
+    else if (req->partial & XCB_XKB_MAP_PART_VIRTUAL_MODS)
+        reply.virtualMods = req->virtualMods;
+    for (unsigned i = 0; i < 16; i++) {
+        if (reply.virtualMods & (1u << i)) {
+            uint8_t mapping = 0;
+
+            if (NUM_REAL_MODS + i < keymap->mods.num_mods)
+                mapping = keymap->mods.mods[NUM_REAL_MODS + i].mapping &
+                          MOD_REAL_MASK_ALL;
+            put(server, &mapping, sizeof(mapping));
+        }
+    }
+    put_pad(server);
+
+    reply.firstKeyExplicit = explicits.first;
+    reply.nKeyExplicit = explicits.count;
+    for (unsigned i = 0; i < explicits.count; i++) {
+        const struct xkb_key *key = &keymap->keys[explicits.first + i];
+        xcb_xkb_set_explicit_t wire = {
+            .keycode = key->keycode,
+            .explicit = wire_explicit(key),
+        };
+
+        if (wire.explicit != 0) {
+            put(server, &wire, sizeof(wire));
+            reply.totalKeyExplicit++;
+        }
+    }
+    put_pad(server);
+
+    reply.firstModMapKey = modmaps.first;
+    reply.nModMapKeys = modmaps.count;
+    for (unsigned i = 0; i < modmaps.count; i++) {
+        const struct xkb_key *key = &keymap->keys[modmaps.first + i];
+        xcb_xkb_key_mod_map_t wire = {
+            .keycode = key->keycode,
+            .mods = key->modmap & MOD_REAL_MASK_ALL,
+        };
+
+        if (wire.mods != 0) {
+            put(server, &wire, sizeof(wire));
+            reply.totalModMapKeys++;
+        }
+    }
+    put_pad(server);
+
+    reply.firstVModMapKey = vmodmaps.first;
+    reply.nVModMapKeys = vmodmaps.count;
+    for (unsigned i = 0; i < vmodmaps.count; i++) {
+        const struct xkb_key *key = &keymap->keys[vmodmaps.first + i];
+        xcb_xkb_key_v_mod_map_t wire = {
+            .keycode = key->keycode,
+            .vmods = key->vmodmap >> NUM_REAL_MODS,
+        };
+
+        if (wire.vmods != 0) {
+            put(server, &wire, sizeof(wire));
+            reply.totalVModMapKeys++;
+        }
+    }
+
+    set_header(server, &reply, sizeof(reply));
+}
+
+static void
+handle_get_indicator_map(struct server *server, const uint8_t *request)
+{
+    const xcb_xkb_get_indicator_map_request_t *req = (const void *) request;
+    const struct xkb_keymap *keymap = server->keymap;
+    const uint32_t leds = (keymap->num_leds >= NUM_INDICATORS ? 0xffffffff :
+                           (1u << keymap->num_leds) - 1);
+    xcb_xkb_get_indicator_map_reply_t reply = {
+        .response_type = X_REPLY,
+        .deviceID = KEYBOARD_DEVICE_ID,
+        .which = req->which & leds,
+        .nIndicators = keymap->num_leds,
+    };
+
+    put(server, &reply, sizeof(reply));
+
+    for (unsigned i = 0; i < NUM_INDICATORS; i++) {
+        const struct xkb_led *led = &keymap->leds[i];
+        xcb_xkb_indicator_map_t wire = {
+            .groups = led->groups,
+            .mods = led->mods.mask & MOD_REAL_MASK_ALL,
+            .realMods = led->mods.mods & MOD_REAL_MASK_ALL,
+            .vmods = led->mods.mods >> NUM_REAL_MODS,
+            .ctrls = wire_controls_mask(led->ctrls),
+        };
+
+        if (!(reply.which & (1u << i)))
+            continue;
+
+        if (led->which_groups & XKB_STATE_LAYOUT_DEPRESSED)
+            wire.whichGroups |= XCB_XKB_IM_GROUPS_WHICH_USE_BASE;
+        if (led->which_groups & XKB_STATE_LAYOUT_LATCHED)
+            wire.whichGroups |= XCB_XKB_IM_GROUPS_WHICH_USE_LATCHED;
+        if (led->which_groups & XKB_STATE_LAYOUT_LOCKED)
+            wire.whichGroups |= XCB_XKB_IM_GROUPS_WHICH_USE_LOCKED;
+        if (led->which_groups & XKB_STATE_LAYOUT_EFFECTIVE)
+            wire.whichGroups |= XCB_XKB_IM_GROUPS_WHICH_USE_EFFECTIVE;
+
+        if (led->which_mods & XKB_STATE_MODS_DEPRESSED)
+            wire.whichMods |= XCB_XKB_IM_MODS_WHICH_USE_BASE;
+        if (led->which_mods & XKB_STATE_MODS_LATCHED)
+            wire.whichMods |= XCB_XKB_IM_MODS_WHICH_USE_LATCHED;
+        if (led->which_mods & XKB_STATE_MODS_LOCKED)
+            wire.whichMods |= XCB_XKB_IM_MODS_WHICH_USE_LOCKED;
+        if (led->which_mods & XKB_STATE_MODS_EFFECTIVE)
+            wire.whichMods |= XCB_XKB_IM_MODS_WHICH_USE_EFFECTIVE;
+
+        put(server, &wire, sizeof(wire));
+    }
+}
+
+static void
+handle_get_compat_map(struct server *server, const uint8_t *request)
+{
+    const xcb_xkb_get_compat_map_request_t *req = (const void *) request;
+    const struct xkb_keymap *keymap = server->keymap;
+    xcb_xkb_get_compat_map_reply_t reply = {
+        .response_type = X_REPLY,
+        .deviceID = KEYBOARD_DEVICE_ID,
+        .groupsRtrn = req->groups & 0x0f,
+        .nTotalSI = keymap->num_sym_interprets,
+    };
+
+    if (req->getAllSI) {
+        reply.nSIRtrn = keymap->num_sym_interprets;
+    }
+    else {
+        if (req->firstSI + req->nSI > keymap->num_sym_interprets) {
+            put_error(server, request, BAD_VALUE, 0);
+            return;
+        }
+        reply.firstSIRtrn = req->firstSI;
+        reply.nSIRtrn = req->nSI;
+    }
+
+    put(server, &reply, sizeof(reply));
+
+    for (unsigned i = reply.firstSIRtrn;
+         i < reply.firstSIRtrn + reply.nSIRtrn; i++) {
+        const struct xkb_sym_interpret *si = &keymap->sym_interprets[i];
+        xcb_xkb_action_t action = wire_action(&si->action);
+        xcb_xkb_sym_interpret_t wire = {
+            .sym = si->sym,
+            .mods = si->mods & MOD_REAL_MASK_ALL,
+            .virtualMod = (si->virtual_mod == XKB_MOD_INVALID ? NO_MODIFIER :
+                           si->virtual_mod - NUM_REAL_MODS),
+            .flags = si->repeat ? 0x01 : 0,
+        };
+
+        switch (si->match) {
+        case MATCH_NONE:
+            wire.match = XCB_XKB_SYM_INTERPRET_MATCH_NONE_OF;
+            break;
+        case MATCH_ANY_OR_NONE:
+            wire.match = XCB_XKB_SYM_INTERPRET_MATCH_ANY_OF_OR_NONE;
+            break;
+        case MATCH_ANY:
+            wire.match = XCB_XKB_SYM_INTERPRET_MATCH_ANY_OF;
+            break;
+        case MATCH_ALL:
+            wire.match = XCB_XKB_SYM_INTERPRET_MATCH_ALL_OF;
+            break;
+        case MATCH_EXACTLY:
+            wire.match = XCB_XKB_SYM_INTERPRET_MATCH_EXACTLY;
+            break;
+        }
+        if (si->level_one_only)
+            wire.match |= XCB_XKB_SYM_INTERP_MATCH_LEVEL_ONE_ONLY;
+
+        STATIC_ASSERT(sizeof(wire.action) == sizeof(action),
+                      "An interpret's action must be an action");
+        memcpy(&wire.action, &action, sizeof(wire.action));
+
+        put(server, &wire, sizeof(wire));
+    }
+
+    /* xkbcommon keeps no group compat maps; they are all empty. */
+    for (unsigned i = 0; i < 4; i++) {
+        if (reply.groupsRtrn & (1u << i)) {
+            xcb_xkb_mod_def_t wire = { 0 };
+
+            put(server, &wire, sizeof(wire));
+        }
+    }
+}
+
+static void
+handle_get_names(struct server *server, const uint8_t *request)
+{
+    const xcb_xkb_get_names_request_t *req = (const void *) request;
+    const struct xkb_keymap *keymap = server->keymap;
+    xcb_xkb_get_names_reply_t reply = {
+        .response_type = X_REPLY,
+        .deviceID = KEYBOARD_DEVICE_ID,
+        .which = req->which,
+        .minKeyCode = server->min_key_code,
+        .maxKeyCode = server->max_key_code,
+        .nTypes = keymap->num_types,
+        .firstKey = server->min_key_code,
+        .nKeys = server->max_key_code - server->min_key_code + 1,
+        .nKeyAliases = keymap->num_key_aliases,
+    };
+    const uint32_t which = req->which;
+    xcb_atom_t atom;
+
+    for (unsigned i = 0; i < keymap->num_types; i++)
+        reply.nKTLevels += keymap->types[i].num_levels;
+    for (unsigned i = 0; i < keymap->num_leds && i < NUM_INDICATORS; i++)
+        if (keymap->leds[i].name != XKB_ATOM_NONE)
+            reply.indicators |= 1u << i;
+    for (unsigned i = NUM_REAL_MODS; i < keymap->mods.num_mods; i++)
+        if (keymap->mods.mods[i].name != XKB_ATOM_NONE)
+            reply.virtualMods |= 1u << (i - NUM_REAL_MODS);
+    for (unsigned i = 0; i < keymap->num_group_names && i < 4; i++)
+        reply.groupNames |= 1u << i;
+
+    put(server, &reply, sizeof(reply));
+
+    if (which & XCB_XKB_NAME_DETAIL_KEYCODES) {
+        atom = wire_string_atom(server, keymap->keycodes_section_name);
+        put(server, &atom, sizeof(atom));
+    }
+    if (which & XCB_XKB_NAME_DETAIL_GEOMETRY) {
+        atom = XCB_ATOM_NONE;
+        put(server, &atom, sizeof(atom));
+    }
+    if (which & XCB_XKB_NAME_DETAIL_SYMBOLS) {
+        atom = wire_string_atom(server, keymap->symbols_section_name);
+        put(server, &atom, sizeof(atom));
+    }
+    if (which & XCB_XKB_NAME_DETAIL_PHYS_SYMBOLS) {
+        atom = wire_string_atom(server, keymap->symbols_section_name);
+        put(server, &atom, sizeof(atom));
+    }
+    if (which & XCB_XKB_NAME_DETAIL_TYPES) {
+        atom = wire_string_atom(server, keymap->types_section_name);
+        put(server, &atom, sizeof(atom));
+    }
+    if (which & XCB_XKB_NAME_DETAIL_COMPAT) {
+        atom = wire_string_atom(server, keymap->compat_section_name);
+        put(server, &atom, sizeof(atom));
+    }
+
+    if (which & XCB_XKB_NAME_DETAIL_KEY_TYPE_NAMES) {
+        for (unsigned i = 0; i < keymap->num_types; i++) {
+            atom = wire_atom(keymap->types[i].name);
+            put(server, &atom, sizeof(atom));
+        }
+    }
+
+    if (which & XCB_XKB_NAME_DETAIL_KT_LEVEL_NAMES) {
+        for (unsigned i = 0; i < keymap->num_types; i++) {
+            uint8_t num_levels = keymap->types[i].num_levels;
+
+            put(server, &num_levels, sizeof(num_levels));
+        }
+        put_pad(server);
+
+        for (unsigned i = 0; i < keymap->num_types; i++) {
+            const struct xkb_key_type *type = &keymap->types[i];
+
+            for (unsigned j = 0; j < type->num_levels; j++) {
+                atom = (j < type->num_level_names ?
+                        wire_atom(type->level_names[j]) : XCB_ATOM_NONE);
+                put(server, &atom, sizeof(atom));
+            }
+        }
+    }
+
+    if (which & XCB_XKB_NAME_DETAIL_INDICATOR_NAMES) {
+        for (unsigned i = 0; i < NUM_INDICATORS; i++) {
+            if (reply.indicators & (1u << i)) {
+                atom = wire_atom(keymap->leds[i].name);
+                put(server, &atom, sizeof(atom));
+            }
+        }
+    }
+
+    if (which & XCB_XKB_NAME_DETAIL_VIRTUAL_MOD_NAMES) {
+        for (unsigned i = 0; i < 16; i++) {
+            if (reply.virtualMods & (1u << i)) {
+                atom = wire_atom(keymap->mods.mods[NUM_REAL_MODS + i].name);
+                put(server, &atom, sizeof(atom));
+            }
+        }
+    }
+
+    if (which & XCB_XKB_NAME_DETAIL_GROUP_NAMES) {
+        for (unsigned i = 0; i < 4; i++) {
+            if (reply.groupNames & (1u << i)) {
+                atom = wire_atom(keymap->group_names[i]);
+                put(server, &atom, sizeof(atom));
+            }
+        }
+    }
+
+    if (which & XCB_XKB_NAME_DETAIL_KEY_NAMES) {
+        for (xkb_keycode_t kc = server->min_key_code;
+             kc <= server->max_key_code; kc++) {
+            const char *name = xkb_atom_text(keymap->ctx, keymap->keys[kc].name);
+            xcb_xkb_key_name_t wire;
+
+            memset(&wire, 0, sizeof(wire));
+            if (name)
+                strncpy(wire.name, name, sizeof(wire.name));
+            put(server, &wire, sizeof(wire));
+        }
+    }
+
+    if (which & XCB_XKB_NAME_DETAIL_KEY_ALIASES) {
+        for (unsigned i = 0; i < keymap->num_key_aliases; i++) {
+            const struct xkb_key_alias *alias = &keymap->key_aliases[i];
+            xcb_xkb_key_alias_t wire;
+
+            memset(&wire, 0, sizeof(wire));
+            strncpy(wire.real, xkb_atom_text(keymap->ctx, alias->real),
+                    sizeof(wire.real));
+            strncpy(wire.alias, xkb_atom_text(keymap->ctx, alias->alias),
+                    sizeof(wire.alias));
+            put(server, &wire, sizeof(wire));
+        }
+    }
+
+    /* No radio groups. */
+}
+
+static void
+handle_get_controls(struct server *server, const uint8_t *request)
+{
+    const struct xkb_keymap *keymap = server->keymap;
+    xcb_xkb_get_controls_reply_t reply = {
+        .response_type = X_REPLY,
+        .deviceID = KEYBOARD_DEVICE_ID,
+        .numGroups = MAX(keymap->num_groups, 1),
+        .repeatDelay = 660,
+        .repeatInterval = 40,
+        .enabledControls = wire_controls_mask(keymap->enabled_ctrls),
+    };
+
+    for (xkb_keycode_t kc = server->min_key_code;
+         kc <= server->max_key_code; kc++)
+        if (keymap->keys[kc].repeats)
+            reply.perKeyRepeat[kc / 8] |= 1 << (kc % 8);
+
+    put(server, &reply, sizeof(reply));
+}
+
+static void
+handle_get_state(struct server *server, const uint8_t *request)
+{
+    xcb_xkb_get_state_reply_t reply = {
+        .response_type = X_REPLY,
+        .deviceID = KEYBOARD_DEVICE_ID,
+    };
+
+    put(server, &reply, sizeof(reply));
+}
+
+static void
+handle_get_device_info(struct server *server, const uint8_t *request)
+{
+    xcb_xkb_get_device_info_reply_t reply = {
+        .response_type = X_REPLY,
+        .deviceID = KEYBOARD_DEVICE_ID,
+    };
+
+    put(server, &reply, sizeof(reply));
+}
+
+static void
+handle_use_extension(struct server *server, const uint8_t *request)
+{
+    xcb_xkb_use_extension_reply_t reply = {
+        .response_type = X_REPLY,
+        .supported = 1,
+        .serverMajor = 1,
+        .serverMinor = 0,
+    };
+
+    put(server, &reply, sizeof(reply));
+}
+
+static void
+handle_xkb_request(struct server *server, const uint8_t *request, uint32_t len)
+{
+    static const struct {
+        uint8_t minor;
+        size_t len;
+        void (*handle)(struct server *server, const uint8_t *request);
+    } handlers[] = {
+        { XCB_XKB_USE_EXTENSION, sizeof(xcb_xkb_use_extension_request_t),
+          handle_use_extension },
+        /* Events are never sent, so there is nothing to do. */
+        { XCB_XKB_SELECT_EVENTS, sizeof(xcb_xkb_select_events_request_t),
+          NULL },
+        { XCB_XKB_GET_STATE, sizeof(xcb_xkb_get_state_request_t),
+          handle_get_state },
+        { XCB_XKB_GET_CONTROLS, sizeof(xcb_xkb_get_controls_request_t),
+          handle_get_controls },
+        { XCB_XKB_GET_MAP, sizeof(xcb_xkb_get_map_request_t),
+          handle_get_map },
+        { XCB_XKB_GET_COMPAT_MAP, sizeof(xcb_xkb_get_compat_map_request_t),
+          handle_get_compat_map },
+        { XCB_XKB_GET_INDICATOR_MAP,
+          sizeof(xcb_xkb_get_indicator_map_request_t),
+          handle_get_indicator_map },
+        { XCB_XKB_GET_NAMES, sizeof(xcb_xkb_get_names_request_t),
+          handle_get_names },
+        { XCB_XKB_GET_DEVICE_INFO, sizeof(xcb_xkb_get_device_info_request_t),
+          handle_get_device_info },
+    };
+
+    for (size_t i = 0; i < ARRAY_SIZE(handlers); i++) {
+        uint16_t device_spec;
+
+        if (handlers[i].minor != request[1])
+            continue;
+
+        if (len < handlers[i].len) {
+            put_error(server, request, BAD_LENGTH, 0);
+            return;
+        }
+
+        /* All but UseExtension start with the device. */
+        memcpy(&device_spec, &request[4], sizeof(device_spec));
+        if (request[1] != XCB_XKB_USE_EXTENSION &&
+            device_spec != XCB_XKB_ID_USE_CORE_KBD &&
+            device_spec != KEYBOARD_DEVICE_ID) {
+            put_error(server, request, XKB_BAD_KEYBOARD, device_spec);
+            return;
+        }
+
+        if (handlers[i].handle)
+            handlers[i].handle(server, request);
+        return;
+    }
+
+    put_unsupported(server, request);
+}
+
+static struct property *
+find_property(struct server *server, xcb_atom_t name)
+{
+    for (size_t i = 0; i < MAX_PROPERTIES; i++)
+        if (server->properties[i].name == name)
+            return &server->properties[i];
+    return NULL;
+}
+
+static void
+handle_get_property(struct server *server, const uint8_t *request)
+{
+    const xcb_get_property_request_t *req = (const void *) request;
+    struct property *property = find_property(server, req->property);
+    xcb_get_property_reply_t reply = {
+        .response_type = X_REPLY,
+    };
+    uint32_t offset, len;
+
+    if (req->window != ROOT_WINDOW) {
+        put_error(server, request, BAD_WINDOW, req->window);
+        return;
+    }
+
+    if (req->property == XCB_ATOM_NONE || !property) {
+        put(server, &reply, sizeof(reply));
+        return;
+    }
+
+    reply.type = property->type;
+    reply.format = property->format;
+
+    if (req->type != XCB_GET_PROPERTY_TYPE_ANY && req->type != property->type) {
+        reply.bytes_after = property->size;
+        put(server, &reply, sizeof(reply));
+        return;
+    }
+
+    if ((uint64_t) req->long_offset * 4 > property->size) {
+        put_error(server, request, BAD_VALUE, req->long_offset);
+        return;
+    }
+    offset = req->long_offset * 4;
+    len = MIN(property->size - offset, (uint64_t) req->long_length * 4);
+    reply.bytes_after = property->size - offset - len;
+    reply.value_len = len / (property->format / 8);
+
+    put(server, &reply, sizeof(reply));
+    put(server, property->data + offset, len);
+
+    if (req->_delete && reply.bytes_after == 0)
+        property->name = XCB_ATOM_NONE;
+}
+
+static void
+handle_change_property(struct server *server, const uint8_t *request,
+                       uint32_t len)
+{
+    const xcb_change_property_request_t *req = (const void *) request;
+    struct property *property;
+    uint64_t size;
+
+    if (req->window != ROOT_WINDOW) {
+        put_error(server, request, BAD_WINDOW, req->window);
+        return;
+    }
+    if (req->mode != XCB_PROP_MODE_REPLACE) {
+        put_unsupported(server, request);
+        return;
+    }
+    if (req->format != 8 && req->format != 16 && req->format != 32) {
+        put_error(server, request, BAD_VALUE, req->format);
+        return;
+    }
+
+    size = (uint64_t) req->data_len * (req->format / 8);
+    if (len < sizeof(*req) + size) {
+        put_error(server, request, BAD_LENGTH, 0);
+        return;
+    }
+
+    property = find_property(server, req->property);
+    if (!property)
+        property = find_property(server, XCB_ATOM_NONE);
+    if (!property || size > MAX_PROPERTY_SIZE) {
+        put_error(server, request, BAD_ALLOC, 0);
+        return;
+    }
+
+    property->name = req->property;
+    property->type = req->type;
+    property->format = req->format;
+    property->size = size;
+    memcpy(property->data, &request[sizeof(*req)], size);
+}
+
+/*
+ * Store a token for the server, as xkbcommon-x11 does when it finds none.
+ * It is there from the start, so that the requests of a client are the
+ * same every time and can be recorded.
+ */
+static void
+set_server_token(struct server *server)
+{
+    struct property *property = &server->properties[0];
+    struct timespec now;
+    uint32_t token[2];
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    token[0] = (uint32_t) now.tv_nsec ^ (uint32_t) now.tv_sec;
+    token[1] = (uint32_t) getpid();
+
+    property->name = wire_string_atom(server, SERVER_TOKEN_PROPERTY);
+    property->type = XCB_ATOM_INTEGER;
+    property->format = 32;
+    property->size = sizeof(token);
+    memcpy(property->data, token, sizeof(token));
+}
+
+static void
+handle_request(struct server *server, const uint8_t *request, uint32_t len)
+{
+    switch (request[0]) {
+    case XCB_QUERY_EXTENSION: {
+        static const char xkb_name[] = "XKEYBOARD";
+        const xcb_query_extension_request_t *req = (const void *) request;
+        xcb_query_extension_reply_t reply = {
+            .response_type = X_REPLY,
+        };
+
+        if (len < sizeof(*req) || len < sizeof(*req) + req->name_len) {
+            put_error(server, request, BAD_LENGTH, 0);
+            break;
+        }
+
+        if (req->name_len == sizeof(xkb_name) - 1 &&
+            memcmp(&request[sizeof(*req)], xkb_name, req->name_len) == 0) {
+            reply.present = 1;
+            reply.major_opcode = XKB_MAJOR_OPCODE;
+            reply.first_event = XKB_FIRST_EVENT;
+            reply.first_error = XKB_FIRST_ERROR;
+        }
+
+        put(server, &reply, sizeof(reply));
+        break;
+    }
+
+    case XCB_GET_ATOM_NAME: {
+        const xcb_get_atom_name_request_t *req = (const void *) request;
+        xcb_get_atom_name_reply_t reply = {
+            .response_type = X_REPLY,
+        };
+        const char *name = NULL;
+
+        if (len < sizeof(*req)) {
+            put_error(server, request, BAD_LENGTH, 0);
+            break;
+        }
+
+        if (req->atom > LAST_PREDEFINED_ATOM)
+            name = xkb_atom_text(server->keymap->ctx,
+                                 req->atom - LAST_PREDEFINED_ATOM);
+        if (!name) {
+            put_error(server, request, BAD_ATOM, req->atom);
+            break;
+        }
+
+        reply.name_len = strlen(name);
+        put(server, &reply, sizeof(reply));
+        put(server, name, reply.name_len);
+        break;
+    }
+
+    case XCB_INTERN_ATOM: {
+        const xcb_intern_atom_request_t *req = (const void *) request;
+        xcb_intern_atom_reply_t reply = {
+            .response_type = X_REPLY,
+        };
+        struct xkb_context *ctx = server->keymap->ctx;
+        const char *name = (const char *) &request[sizeof(*req)];
+
+        if (len < sizeof(*req) || len < sizeof(*req) + req->name_len) {
+            put_error(server, request, BAD_LENGTH, 0);
+            break;
+        }
+
+        /* Names of the predefined atoms are not recognized. */
+        if (req->only_if_exists) {
+            char *copy = strndup(name, req->name_len);
+
+            if (!copy) {
+                put_error(server, request, BAD_ALLOC, 0);
+                break;
+            }
+            reply.atom = wire_atom(xkb_atom_lookup(ctx, copy));
+            free(copy);
+        }
+        else {
+            reply.atom = wire_atom(xkb_atom_intern(ctx, name, req->name_len));
+        }
+
+        put(server, &reply, sizeof(reply));
+        break;
+    }
+
+    case XCB_CHANGE_PROPERTY:
+        if (len < sizeof(xcb_change_property_request_t)) {
+            put_error(server, request, BAD_LENGTH, 0);
+            break;
+        }
+        handle_change_property(server, request, len);
+        break;
+
+    case XCB_DELETE_PROPERTY: {
+        const xcb_delete_property_request_t *req = (const void *) request;
+        struct property *property;
+
+        if (len < sizeof(*req)) {
+            put_error(server, request, BAD_LENGTH, 0);
+            break;
+        }
+        if (req->window != ROOT_WINDOW) {
+            put_error(server, request, BAD_WINDOW, req->window);
+            break;
+        }
+
+        property = find_property(server, req->property);
+        if (req->property != XCB_ATOM_NONE && property)
+            property->name = XCB_ATOM_NONE;
+        break;
+    }
+
+    case XCB_GET_PROPERTY:
+        if (len < sizeof(xcb_get_property_request_t)) {
+            put_error(server, request, BAD_LENGTH, 0);
+            break;
+        }
+        handle_get_property(server, request);
+        break;
+
+    case XCB_GET_INPUT_FOCUS: {
+        xcb_get_input_focus_reply_t reply = {
+            .response_type = X_REPLY,
+            .revert_to = XCB_INPUT_FOCUS_NONE,
+            .focus = XCB_WINDOW_NONE,
+        };
+
+        put(server, &reply, sizeof(reply));
+        break;
+    }
+
+    case XKB_MAJOR_OPCODE:
+        handle_xkb_request(server, request, len);
+        break;
+
+    default:
+        put_unsupported(server, request);
+        break;
+    }
+}
+
+/* Read the connection setup request, which says nothing we care about. */
+static bool
+read_setup_request(int fd)
+{
+    uint8_t header[12];
+    uint16_t name_len, data_len;
+    uint8_t buf[4];
+
+    if (!read_full(fd, header, sizeof(header)))
+        return false;
+
+    memcpy(&name_len, &header[6], sizeof(name_len));
+    memcpy(&data_len, &header[8], sizeof(data_len));
+    for (size_t n = pad4(name_len) + pad4(data_len); n > 0; n -= sizeof(buf))
+        if (!read_full(fd, buf, sizeof(buf)))
+            return false;
+
+    return true;
+}
+
+static bool
+send_setup(struct server *server)
+{
+    static const char vendor[] = "libxkbcommon test server";
+    /* A screen without depths; nothing is drawn. */
+    const xcb_screen_t screen = {
+        .root = ROOT_WINDOW,
+        .width_in_pixels = 1024,
+        .height_in_pixels = 768,
+        .width_in_millimeters = 270,
+        .height_in_millimeters = 203,
+        .min_installed_maps = 1,
+        .max_installed_maps = 1,
+        .root_depth = 24,
+    };
+    xcb_setup_t setup = {
+        .status = 1,
+        .protocol_major_version = X_PROTOCOL,
+        .protocol_minor_version = X_PROTOCOL_REVISION,
+        .length = (sizeof(setup) - 8 + pad4(sizeof(vendor) - 1) +
+                   sizeof(screen)) / 4,
+        .release_number = 1,
+        .resource_id_base = 0x00200000,
+        .resource_id_mask = 0x001fffff,
+        .vendor_len = sizeof(vendor) - 1,
+        .maximum_request_length = UINT16_MAX,
+        .bitmap_format_scanline_unit = 32,
+        .bitmap_format_scanline_pad = 32,
+        .min_keycode = server->min_key_code,
+        .max_keycode = server->max_key_code,
+        .roots_len = 1,
+    };
+    bool ok;
+
+    put(server, &setup, sizeof(setup));
+    put(server, vendor, sizeof(vendor) - 1);
+    put_pad(server);
+    put(server, &screen, sizeof(screen));
+
+    ok = write_full(server->fd, &darray_item(server->out, 0),
+                    darray_size(server->out));
+    darray_resize(server->out, 0);
+    return ok;
+}
+
+/* Read a request. Returns NULL when the client is gone. */
+static uint8_t *
+read_request(int fd, uint32_t *len_out)
+{
+    uint8_t header[4];
+    uint16_t units;
+    uint8_t *buf;
+
+    if (!read_full(fd, header, sizeof(header)))
+        return NULL;
+
+    /* A length of 0 means a BIG-REQUESTS request, which we don't offer. */
+    memcpy(&units, &header[2], sizeof(units));
+    if (units == 0)
+        return NULL;
+
+    buf = malloc(units * 4);
+    if (!buf)
+        return NULL;
+    memcpy(buf, header, sizeof(header));
+    if (!read_full(fd, buf + sizeof(header), units * 4 - sizeof(header))) {
+        free(buf);
+        return NULL;
+    }
+
+    *len_out = units * 4;
+    return buf;
+}
+
+static bool
+serve(int fd, struct xkb_keymap *keymap)
+{
+    struct server server = {
+        .keymap = keymap,
+        .fd = fd,
+        .min_key_code = MAX(keymap->min_key_code, MIN_KEYCODE),
+        .max_key_code = MIN(keymap->max_key_code, MAX_KEYCODE),
+        .ok = true,
+    };
+    uint8_t *request;
+    uint32_t len;
+
+    darray_init(server.out);
+    set_server_token(&server);
+
+    if (!read_setup_request(fd) || !send_setup(&server)) {
+        server.ok = false;
+        goto out;
+    }
+
+    while ((request = read_request(fd, &len))) {
+        server.sequence++;
+        handle_request(&server, request, len);
+        free(request);
+        if (!send_out(&server)) {
+            server.ok = false;
+            break;
+        }
+    }
+
+out:
+    darray_free(server.out);
+    return server.ok;
+}
+
+bool
+x11_server_start(struct x11_server *server, struct xkb_keymap *keymap)
+{
+    int fds[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        fprintf(stderr, "Couldn't create a socket pair: %s\n", strerror(errno));
+        return false;
+    }
+
+    server->pid = fork();
+    if (server->pid < 0) {
+        fprintf(stderr, "Couldn't fork: %s\n", strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+
+    if (server->pid == 0) {
+        bool ok;
+
+        close(fds[0]);
+        ok = serve(fds[1], keymap);
+        close(fds[1]);
+        _exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    close(fds[1]);
+    server->fd = fds[0];
+    return true;
+}
+
+bool
+x11_server_stop(struct x11_server *server)
+{
+    int status;
+
+    while (waitpid(server->pid, &status, 0) < 0) {
+        if (errno != EINTR)
+            return false;
+    }
+
+    return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright © 2021 libxkbcommon contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef LIBXKBCOMMON_TEST_X11_SERVER_H
+#define LIBXKBCOMMON_TEST_X11_SERVER_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "xkbcommon/xkbcommon.h"
+
+/*
+ * A stand-in for an X server with the XKB extension, which serves a keymap
+ * compiled by xkbcommon to a single client, so that xkbcommon-x11 can be
+ * exercised without a live server.
+ *
+ * The server runs in a child process and talks to the client over a socket
+ * pair. It answers the requests which xkbcommon-x11 sends, with the keymap
+ * translated the way an X server would present it; other requests get an
+ * Implementation error. Keysyms past the first of a level are dropped, as
+ * the protocol has room for one keysym per level only. There is one screen,
+ * whose root window holds a few properties; it starts out with a server
+ * token for the atom cache, as if another client had stored one.
+ *
+ * A server keeps the client end of the connections of servers started
+ * before it open, so stop servers in the reverse order of starting them,
+ * after all the clients disconnected; otherwise an earlier server would
+ * never see its client go away.
+ */
+
+struct x11_server {
+    /* The client end of the connection, for xcb_connect_to_fd(). */
+    int fd;
+    pid_t pid;
+};
+
+bool
+x11_server_start(struct x11_server *server, struct xkb_keymap *keymap);
+
+/*
+ * Wait for the server to finish, once the client closed its end of the
+ * connection. Returns false if the server failed, e.g. it got a request it
+ * does not support.
+ */
+bool
+x11_server_stop(struct x11_server *server);
+
+#endif /* LIBXKBCOMMON_TEST_X11_SERVER_H */
@@ -0,0 +1,181 @@
+/*
+ * Copyright © 2021 libxkbcommon contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include <xcb/xkb.h>
+
+#include "test.h"
+#include "x11-server.h"
+#include "xkbcommon/xkbcommon-x11.h"
+
+/*
+ * Check that updating a keymap from the notifications for a layout change
+ * gives the same keymap as fetching it anew, when the keys gain or lose
+ * groups. The stand-in server serves one keymap for the first fetch, and
+ * another one for the update.
+ */
+
+/*
+ * Fetch the keymap served for ctx, or update old from it if it is not NULL.
+ * A server sends a MapNotify for the key syms of all keys and a NamesNotify
+ * for the group names when the layouts change; both are applied in turn.
+ */
+static struct xkb_keymap *
+fetch_keymap(struct xkb_context *ctx, struct xkb_keymap *served,
+             struct xkb_keymap *old)
+{
+    struct x11_server server;
+    xcb_connection_t *conn;
+    int32_t device_id;
+    struct xkb_keymap *keymap;
+    int ret;
+
+    ret = x11_server_start(&server, served);
+    assert(ret);
+    conn = xcb_connect_to_fd(server.fd, NULL);
+    assert(!xcb_connection_has_error(conn));
+
+    ret = xkb_x11_setup_xkb_extension(conn,
+                                      XKB_X11_MIN_MAJOR_XKB_VERSION,
+                                      XKB_X11_MIN_MINOR_XKB_VERSION,
+                                      XKB_X11_SETUP_XKB_EXTENSION_NO_FLAGS,
+                                      NULL, NULL, NULL, NULL);
+    assert(ret);
+    device_id = xkb_x11_get_core_keyboard_device_id(conn);
+    assert(device_id != -1);
+
+    if (!old) {
+        keymap = xkb_x11_keymap_new_from_device(ctx, conn, device_id,
+                                                XKB_KEYMAP_COMPILE_NO_FLAGS);
+    }
+    else {
+        struct xkb_keymap *mapped;
+        xcb_xkb_map_notify_event_t map_notify = {
+            .xkbType = XCB_XKB_MAP_NOTIFY,
+            .deviceID = device_id,
+            .changed = XCB_XKB_MAP_PART_KEY_SYMS,
+            .minKeyCode = xkb_keymap_min_keycode(old),
+            .maxKeyCode = xkb_keymap_max_keycode(old),
+            .firstKeySym = xkb_keymap_min_keycode(old),
+            .nKeySyms = xkb_keymap_max_keycode(old) -
+                        xkb_keymap_min_keycode(old) + 1,
+        };
+
+        xcb_xkb_names_notify_event_t names_notify = {
+            .xkbType = XCB_XKB_NAMES_NOTIFY,
+            .deviceID = device_id,
+            .changed = XCB_XKB_NAME_DETAIL_GROUP_NAMES,
+        };
+
+        mapped = xkb_x11_keymap_new_from_notify(old, conn,
+            (const xcb_generic_event_t *) &map_notify);
+        assert(mapped);
+        keymap = xkb_x11_keymap_new_from_notify(mapped, conn,
+            (const xcb_generic_event_t *) &names_notify);
+        xkb_keymap_unref(mapped);
+    }
+    assert(keymap);
+
+    xcb_disconnect(conn);
+    ret = x11_server_stop(&server);
+    assert(ret);
+
+    return keymap;
+}
+
+static void
+test_update(struct xkb_keymap *from, struct xkb_keymap *to)
+{
+    struct xkb_context *ctx;
+    struct xkb_keymap *old, *updated, *fetched;
+    struct xkb_state *state;
+    char *updated_dump, *fetched_dump;
+
+    ctx = test_get_context(0);
+    assert(ctx);
+    old = fetch_keymap(ctx, from, NULL);
+    assert(xkb_keymap_num_layouts(old) == xkb_keymap_num_layouts(from));
+
+    updated = fetch_keymap(ctx, to, old);
+    fetched = fetch_keymap(ctx, to, NULL);
+
+    assert(xkb_keymap_num_layouts(updated) == xkb_keymap_num_layouts(to));
+    assert(xkb_keymap_num_layouts(updated) == xkb_keymap_num_layouts(fetched));
+    for (xkb_keycode_t kc = xkb_keymap_min_keycode(updated);
+         kc <= xkb_keymap_max_keycode(updated); kc++)
+        assert(xkb_keymap_num_layouts_for_key(updated, kc) ==
+               xkb_keymap_num_layouts_for_key(fetched, kc));
+
+    updated_dump = xkb_keymap_get_as_string(updated,
+                                            XKB_KEYMAP_USE_ORIGINAL_FORMAT);
+    assert(updated_dump);
+    fetched_dump = xkb_keymap_get_as_string(fetched,
+                                            XKB_KEYMAP_USE_ORIGINAL_FORMAT);
+    assert(fetched_dump);
+    assert(streq(updated_dump, fetched_dump));
+    free(fetched_dump);
+    free(updated_dump);
+
+    /* Layouts past the end wrap around to the first one. */
+    state = xkb_state_new(updated);
+    assert(state);
+    xkb_state_update_mask(state, 0, 0, 0, 0, 0, 1);
+    assert(xkb_state_serialize_layout(state, XKB_STATE_LAYOUT_EFFECTIVE) ==
+           1 % xkb_keymap_num_layouts(to));
+    xkb_state_unref(state);
+
+    xkb_keymap_unref(fetched);
+    xkb_keymap_unref(updated);
+    xkb_keymap_unref(old);
+    xkb_context_unref(ctx);
+}
+
+int
+main(void)
+{
+    struct xkb_context *ctx = test_get_context(0);
+    struct xkb_keymap *us, *us_de;
+
+    assert(ctx);
+    us = test_compile_rules(ctx, "evdev", "pc105", "us", "", "");
+    assert(us);
+    us_de = test_compile_rules(ctx, "evdev", "pc105", "us,de", "", "");
+    assert(us_de);
+    assert(xkb_keymap_num_layouts(us) == 1);
+    assert(xkb_keymap_num_layouts(us_de) == 2);
+
+    /* The keys gain a group. */
+    test_update(us, us_de);
+    /* The keys lose a group. */
+    test_update(us_de, us);
+
+    xkb_keymap_unref(us_de);
+    xkb_keymap_unref(us);
+    xkb_context_unref(ctx);
+
+    return EXIT_SUCCESS;
+}
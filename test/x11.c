@@ -23,6 +23,10 @@
 
 #include "config.h"
 
+#include <poll.h>
+
+#include <xcb/xkb.h>
+
 #include "test.h"
 #include "xkbcommon/xkbcommon-x11.h"
 
@@ -33,9 +37,11 @@ main(void)
     xcb_connection_t *conn;
     int ret;
     int32_t device_id;
-    struct xkb_keymap *keymap;
+    struct xkb_keymap *keymap, *async_keymap;
+    struct xkb_x11_keymap_request *request;
+    enum xkb_x11_keymap_request_status status;
     struct xkb_state *state;
-    char *dump;
+    char *dump, *async_dump;
     int exit_code = 0;
 
     /*
@@ -73,8 +79,86 @@ main(void)
     assert(dump);
     fputs(dump, stdout);
 
+    /* The non-blocking fetch gives the same keymap. */
+    request = xkb_x11_keymap_request_new(ctx, conn, device_id,
+                                         XKB_KEYMAP_COMPILE_NO_FLAGS);
+    assert(request);
+    assert(!xkb_x11_keymap_request_get_keymap(request));
+    while ((status = xkb_x11_keymap_request_poll(request)) ==
+           XKB_X11_KEYMAP_REQUEST_PENDING) {
+        struct pollfd pfd = {
+            .fd = xcb_get_file_descriptor(conn),
+            .events = POLLIN,
+        };
+        assert(poll(&pfd, 1, -1) == 1);
+    }
+    assert(status == XKB_X11_KEYMAP_REQUEST_DONE);
+    async_keymap = xkb_x11_keymap_request_get_keymap(request);
+    assert(async_keymap);
+    xkb_x11_keymap_request_free(request);
+
+    async_dump = xkb_keymap_get_as_string(async_keymap,
+                                          XKB_KEYMAP_USE_ORIGINAL_FORMAT);
+    assert(async_dump);
+    assert(streq(dump, async_dump));
+
+    /* A request may be dropped before it completes. */
+    request = xkb_x11_keymap_request_new(ctx, conn, device_id,
+                                         XKB_KEYMAP_COMPILE_NO_FLAGS);
+    assert(request);
+    xkb_x11_keymap_request_free(request);
+
+    /* Refreshing parts of the keymap which did not change is a no-op. */
+    {
+        xcb_xkb_map_notify_event_t map_notify = {
+            .xkbType = XCB_XKB_MAP_NOTIFY,
+            .deviceID = device_id,
+            .changed = XCB_XKB_MAP_PART_KEY_SYMS |
+                       XCB_XKB_MAP_PART_MODIFIER_MAP |
+                       XCB_XKB_MAP_PART_VIRTUAL_MODS,
+            .minKeyCode = xkb_keymap_min_keycode(keymap),
+            .maxKeyCode = xkb_keymap_max_keycode(keymap),
+            .firstKeySym = xkb_keymap_min_keycode(keymap),
+            .nKeySyms = xkb_keymap_max_keycode(keymap) -
+                        xkb_keymap_min_keycode(keymap) + 1,
+            .firstModMapKey = xkb_keymap_min_keycode(keymap),
+            .nModMapKeys = 16,
+            .virtualMods = 0xffff,
+        };
+        xcb_xkb_names_notify_event_t names_notify = {
+            .xkbType = XCB_XKB_NAMES_NOTIFY,
+            .deviceID = device_id,
+            .changed = XCB_XKB_NAME_DETAIL_SYMBOLS |
+                       XCB_XKB_NAME_DETAIL_KEY_TYPE_NAMES |
+                       XCB_XKB_NAME_DETAIL_GROUP_NAMES |
+                       XCB_XKB_NAME_DETAIL_KEY_ALIASES,
+        };
+        struct xkb_keymap *updated;
+        char *updated_dump;
+
+        updated = xkb_x11_keymap_new_from_notify(keymap, conn,
+            (const xcb_generic_event_t *) &map_notify);
+        assert(updated);
+        updated_dump = xkb_keymap_get_as_string(updated,
+                                                XKB_KEYMAP_USE_ORIGINAL_FORMAT);
+        assert(streq(dump, updated_dump));
+        free(updated_dump);
+
+        xkb_keymap_unref(keymap);
+        keymap = xkb_x11_keymap_new_from_notify(updated, conn,
+            (const xcb_generic_event_t *) &names_notify);
+        assert(keymap);
+        updated_dump = xkb_keymap_get_as_string(keymap,
+                                                XKB_KEYMAP_USE_ORIGINAL_FORMAT);
+        assert(streq(dump, updated_dump));
+        free(updated_dump);
+        xkb_keymap_unref(updated);
+    }
+
     /* TODO: Write some X11-specific tests. */
 
+    free(async_dump);
+    xkb_keymap_unref(async_keymap);
     free(dump);
     xkb_state_unref(state);
     xkb_keymap_unref(keymap);
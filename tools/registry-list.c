@@ -40,6 +40,7 @@ usage(const char *progname, FILE *fp)
             "  --ruleset=foo .......... Load the 'foo' ruleset\n"
             "  --skip-default-paths ... Do not load the default XKB paths\n"
             "  --load-exotic .......... Load the exotic (extra) rulesets\n"
+            "  --validate ............. Validate the rules files against their DTD\n"
             "\n"
             "Trailing arguments are treated as XKB base directory installations.\n",
             progname);
@@ -64,6 +65,7 @@ main(int argc, char **argv)
         {"load-exotic",         no_argument,        0, 'e'},
         {"skip-default-paths",  no_argument,        0, 'd'},
         {"ruleset",             required_argument,  0, 'r'},
+        {"validate",            no_argument,        0, 'V'},
         {0, 0, 0, 0},
     };
 
@@ -91,6 +93,9 @@ main(int argc, char **argv)
             case 'r':
                 ruleset = optarg;
                 break;
+            case 'V':
+                flags |= RXKB_CONTEXT_VALIDATE;
+                break;
             case 'v':
                 verbosity++;
                 break;
@@ -141,7 +141,22 @@ struct xkb_compose_state;
 /** Flags affecting Compose file compilation. */
 enum xkb_compose_compile_flags {
     /** Do not apply any flags. */
-    XKB_COMPOSE_COMPILE_NO_FLAGS = 0
+    XKB_COMPOSE_COMPILE_NO_FLAGS = 0,
+    /**
+     * Use an on-disk cache of compiled compose tables.
+     *
+     * A table created with xkb_compose_table_new_from_locale() is then
+     * stored in `$XDG_CACHE_HOME/xkbcommon` (or `$HOME/.cache/xkbcommon`),
+     * and later calls which would compile the same Compose file use the
+     * stored table instead, as long as neither the file nor any file it
+     * includes has changed.  Stored tables are mapped directly, so they
+     * are shared between processes.
+     *
+     * This flag has no effect on the other constructors.
+     *
+     * @since 1.3.0
+     */
+    XKB_COMPOSE_COMPILE_USE_CACHE = (1 << 0)
 };
 
 /** The recognized Compose file formats. */
@@ -279,6 +294,130 @@ xkb_compose_table_new_from_buffer(struct xkb_context *context,
                                   enum xkb_compose_format format,
                                   enum xkb_compose_compile_flags flags);
 
+/**
+ * Create a new compose table which overlays a Compose file on a base table.
+ *
+ * Only the sequences of the Compose file are compiled into the new table;
+ * the sequences of @p base are looked up in @p base itself, which is
+ * shared and not copied.  This is useful for the common case of a user
+ * Compose file which starts with `include "%L"` and adds a few sequences
+ * of its own: the large locale table can be compiled (or loaded with
+ * xkb_compose_table_new_from_fd()) once, and shared by the tables of all
+ * users.
+ *
+ * The tables behave as a single table:
+ * - If both tables have the same sequence, the result of the overlay is
+ *   used.
+ * - If a sequence of one table is a prefix of a sequence of the other,
+ *   the shorter sequence is dropped, like for a single Compose file.
+ *
+ * An `include "%L"` statement in the Compose file is taken to refer to
+ * @p base, and is not read again.  Other include statements are read as
+ * usual.
+ *
+ * The new table takes a reference on @p base, and has the same context
+ * and locale.  @p base must not itself be an overlay table.  An overlay
+ * table cannot be serialized.
+ *
+ * @param base
+ *     The base compose table.
+ * @param file
+ *     The Compose file to compile.
+ * @param format
+ *     The text format of the Compose file to compile.
+ * @param flags
+ *     Optional flags for the compose table, or 0.
+ *
+ * @returns A compose table compiled from the given file, or NULL if
+ * the compilation failed.
+ *
+ * @memberof xkb_compose_table
+ * @since 1.3.0
+ */
+struct xkb_compose_table *
+xkb_compose_table_new_overlay_from_file(struct xkb_compose_table *base,
+                                        FILE *file,
+                                        enum xkb_compose_format format,
+                                        enum xkb_compose_compile_flags flags);
+
+/**
+ * Create a new compose table which overlays a memory buffer on a base
+ * table.
+ *
+ * This is just like xkb_compose_table_new_overlay_from_file(), but
+ * instead of a file, gets the Compose file as one string.
+ *
+ * @see xkb_compose_table_new_overlay_from_file()
+ * @memberof xkb_compose_table
+ * @since 1.3.0
+ */
+struct xkb_compose_table *
+xkb_compose_table_new_overlay_from_buffer(struct xkb_compose_table *base,
+                                          const char *buffer, size_t length,
+                                          enum xkb_compose_format format,
+                                          enum xkb_compose_compile_flags flags);
+
+/**
+ * Serialize a compose table to a file descriptor.
+ *
+ * The table is written in a binary format, starting at the current
+ * position of @p fd, which can then be loaded with
+ * xkb_compose_table_new_from_fd().  The format is only meant to be read
+ * by the same version of the library on the same machine.
+ *
+ * This is intended for sharing a table between processes: a process
+ * compiles the table once, writes it to a memfd(2) (or a file), and
+ * hands the file descriptor to other processes.  Every process which
+ * loads the table maps the same memory, instead of holding a private
+ * copy of it.
+ *
+ * @param table
+ *     The compose table to serialize.
+ * @param fd
+ *     A file descriptor open for writing.
+ *
+ * @returns 1 on success, or 0 on failure.
+ *
+ * @memberof xkb_compose_table
+ * @since 1.3.0
+ */
+int
+xkb_compose_table_serialize(struct xkb_compose_table *table, int fd);
+
+/**
+ * Create a new compose table from a serialized table.
+ *
+ * The file referred to by @p fd, from its start to its end, must contain
+ * a table written by xkb_compose_table_serialize().  It is mapped
+ * read-only and shared; the table contents are used directly from the
+ * mapping.  The file descriptor itself is not kept, and may be closed
+ * after the call.
+ *
+ * The contents are validated when loading the table, so they must not be
+ * modified afterwards, for as long as the table is used.  For a memfd(2),
+ * this can be guaranteed by sealing it with `F_SEAL_WRITE` and
+ * `F_SEAL_SHRINK` before passing it on.
+ *
+ * The locale of the table is the locale of the serialized table.
+ *
+ * @param context
+ *     The library context in which to create the compose table.
+ * @param fd
+ *     A file descriptor open for reading.
+ * @param flags
+ *     Optional flags for the compose table, or 0.
+ *
+ * @returns A compose table, or NULL if @p fd does not contain a valid
+ * serialized table.
+ *
+ * @memberof xkb_compose_table
+ * @since 1.3.0
+ */
+struct xkb_compose_table *
+xkb_compose_table_new_from_fd(struct xkb_context *context,
+                              int fd,
+                              enum xkb_compose_compile_flags flags);
+
 /**
  * Take a new reference on a compose table.
  *
@@ -299,6 +438,107 @@ xkb_compose_table_ref(struct xkb_compose_table *table);
 void
 xkb_compose_table_unref(struct xkb_compose_table *table);
 
+/**
+ * @struct xkb_compose_table_entry
+ * A Compose table entry: a sequence and its result.
+ *
+ * Entries are owned by the iterator which returned them, and are only
+ * valid until the next call to xkb_compose_table_iterator_next() or
+ * xkb_compose_table_iterator_free().
+ *
+ * @since 1.3.0
+ */
+struct xkb_compose_table_entry;
+
+/**
+ * Get the left-hand keysym sequence of a Compose table entry.
+ *
+ * @param[in] entry
+ *     The compose table entry.
+ * @param[out] sequence_length
+ *     Number of keysyms in the sequence.
+ *
+ * @returns The array of keysyms of the sequence.  It is owned by the
+ * entry.
+ *
+ * @memberof xkb_compose_table_entry
+ * @since 1.3.0
+ */
+const xkb_keysym_t *
+xkb_compose_table_entry_sequence(struct xkb_compose_table_entry *entry,
+                                 size_t *sequence_length);
+
+/**
+ * Get the right-hand result keysym of a Compose table entry.
+ *
+ * @returns The result keysym, or XKB_KEY_NoSymbol if the entry does not
+ * specify one.
+ *
+ * @memberof xkb_compose_table_entry
+ * @since 1.3.0
+ */
+xkb_keysym_t
+xkb_compose_table_entry_keysym(struct xkb_compose_table_entry *entry);
+
+/**
+ * Get the right-hand result string of a Compose table entry.
+ *
+ * @returns The result string, which is owned by the table, or the empty
+ * string if the entry does not specify one.
+ *
+ * @memberof xkb_compose_table_entry
+ * @since 1.3.0
+ */
+const char *
+xkb_compose_table_entry_utf8(struct xkb_compose_table_entry *entry);
+
+/**
+ * @struct xkb_compose_table_iterator
+ * Iterator over the entries of a compose table.
+ *
+ * @since 1.3.0
+ */
+struct xkb_compose_table_iterator;
+
+/**
+ * Create a new iterator over all the entries of a compose table.
+ *
+ * The entries are returned in lexicographic order of their sequences,
+ * compared as keysym values.  The table is walked directly; it is not
+ * compiled again.
+ *
+ * The iterator holds a reference on the table.
+ *
+ * @returns A new iterator, or NULL on failure.
+ *
+ * @memberof xkb_compose_table_iterator
+ * @since 1.3.0
+ */
+struct xkb_compose_table_iterator *
+xkb_compose_table_iterator_new(struct xkb_compose_table *table);
+
+/**
+ * Free a compose table iterator.
+ *
+ * @param iter The iterator.  If it is NULL, this function does nothing.
+ *
+ * @memberof xkb_compose_table_iterator
+ * @since 1.3.0
+ */
+void
+xkb_compose_table_iterator_free(struct xkb_compose_table_iterator *iter);
+
+/**
+ * Get the next entry of a compose table iterator.
+ *
+ * @returns The next entry, or NULL if there are no more entries.
+ *
+ * @memberof xkb_compose_table_iterator
+ * @since 1.3.0
+ */
+struct xkb_compose_table_entry *
+xkb_compose_table_iterator_next(struct xkb_compose_table_iterator *iter);
+
 /** Flags for compose state creation. */
 enum xkb_compose_state_flags {
     /** Do not apply any flags. */
@@ -491,6 +731,28 @@ xkb_compose_state_get_utf8(struct xkb_compose_state *state,
 xkb_keysym_t
 xkb_compose_state_get_one_sym(struct xkb_compose_state *state);
 
+/**
+ * Create a new iterator over the sequences which can complete the current
+ * sequence of a compose state.
+ *
+ * This is useful, for example, for showing the possible completions of
+ * a sequence in progress.  If the status is not XKB_COMPOSE_COMPOSING,
+ * the iterator returns no entries.
+ *
+ * The sequence of each entry holds only the keysyms which remain to be
+ * fed to complete it, not the keysyms fed so far.
+ *
+ * The iterator holds a reference on the compose table, but not on the
+ * state; later changes to the state do not affect it.
+ *
+ * @returns A new iterator, or NULL on failure.
+ *
+ * @memberof xkb_compose_state
+ * @since 1.3.0
+ */
+struct xkb_compose_table_iterator *
+xkb_compose_state_iterator_new(struct xkb_compose_state *state);
+
 /** @} */
 
 #ifdef __cplusplus
@@ -88,7 +88,9 @@ extern "C" {
  *    NewKeyboardNotify, MapNotify, StateNotify; using the
  *    xcb_xkb_select_events_aux() request.
  * 7. When NewKeyboardNotify or MapNotify are received, recreate the
- *    xkb_keymap and xkb_state as described above.
+ *    xkb_keymap and xkb_state as described above.  For MapNotify (and
+ *    NamesNotify, if selected), xkb_x11_keymap_new_from_notify() only
+ *    fetches the parts of the keymap which changed.
  * 8. When StateNotify is received, update the xkb_state accordingly
  *    using the xkb_state_update_mask() function.
  *
@@ -212,6 +214,128 @@ xkb_x11_keymap_new_from_device(struct xkb_context *context,
                                int32_t device_id,
                                enum xkb_keymap_compile_flags flags);
 
+/**
+ * @struct xkb_x11_keymap_request
+ * An in-flight request for the keymap of an X11 keyboard device.
+ *
+ * Unlike xkb_x11_keymap_new_from_device(), which waits for each reply
+ * from the X server in turn, a keymap request only sends the requests and
+ * is then completed step by step with xkb_x11_keymap_request_poll(), e.g.
+ * whenever the XCB connection becomes readable.  This lets the caller keep
+ * running its event loop while the keymap is being fetched.
+ *
+ * @since 1.3.0
+ */
+struct xkb_x11_keymap_request;
+
+/**
+ * The status of a keymap request.
+ *
+ * @since 1.3.0
+ */
+enum xkb_x11_keymap_request_status {
+    /** Some replies from the X server have not arrived yet. */
+    XKB_X11_KEYMAP_REQUEST_PENDING,
+    /** The keymap is complete and may be retrieved. */
+    XKB_X11_KEYMAP_REQUEST_DONE,
+    /** The keymap could not be fetched. */
+    XKB_X11_KEYMAP_REQUEST_FAILED
+};
+
+/**
+ * Send the requests needed to create a keymap from an X11 keyboard device.
+ *
+ * This function does not wait for any reply from the X server.  The
+ * requests are flushed to the connection.
+ *
+ * The parameters are the same as for xkb_x11_keymap_new_from_device().
+ *
+ * @returns A new keymap request, or NULL on failure.
+ *
+ * @since 1.3.0
+ */
+struct xkb_x11_keymap_request *
+xkb_x11_keymap_request_new(struct xkb_context *context,
+                           xcb_connection_t *connection,
+                           int32_t device_id,
+                           enum xkb_keymap_compile_flags flags);
+
+/**
+ * Handle the replies to a keymap request which have arrived so far.
+ *
+ * This function never blocks.  It reads what is available on the
+ * connection, handles the replies, and sends follow-up requests when
+ * needed.  Call it again, e.g. when the connection becomes readable, as
+ * long as it returns XKB_X11_KEYMAP_REQUEST_PENDING.
+ *
+ * Note that if the connection is also used with xcb_wait_for_event() or
+ * xcb_poll_for_event(), those may read the replies from the socket; this
+ * function should then be called after handling the events.
+ *
+ * @returns The status of the request.
+ *
+ * @since 1.3.0
+ */
+enum xkb_x11_keymap_request_status
+xkb_x11_keymap_request_poll(struct xkb_x11_keymap_request *request);
+
+/**
+ * Get the keymap of a completed keymap request.
+ *
+ * @returns A new reference to the keymap if the status of the request is
+ * XKB_X11_KEYMAP_REQUEST_DONE, or NULL otherwise.
+ *
+ * @since 1.3.0
+ */
+struct xkb_keymap *
+xkb_x11_keymap_request_get_keymap(struct xkb_x11_keymap_request *request);
+
+/**
+ * Free a keymap request.
+ *
+ * The request may be freed at any time; replies which have not arrived
+ * yet are discarded.
+ *
+ * @param request The request.  If it is NULL, this function does nothing.
+ *
+ * @since 1.3.0
+ */
+void
+xkb_x11_keymap_request_free(struct xkb_x11_keymap_request *request);
+
+/**
+ * Create an updated keymap from an XKB MapNotify or NamesNotify event.
+ *
+ * When only a part of the keymap of a device changes, e.g. the symbols of
+ * a few keys after running xmodmap, the X server sends a MapNotify or a
+ * NamesNotify event which describes what changed.  Instead of fetching
+ * the whole keymap again with xkb_x11_keymap_new_from_device(), this
+ * function only fetches the changed parts, and takes everything else from
+ * the old keymap.  Changes to the key types or to the range of keycodes
+ * still fetch the whole keymap.
+ *
+ * This function waits for the replies from the X server.
+ *
+ * @param keymap
+ *     The current keymap of the device, as created by
+ *     xkb_x11_keymap_new_from_device() or this function.  It is not
+ *     modified.
+ * @param connection
+ *     An XCB connection to the X server.
+ * @param event
+ *     An XKB event of type MapNotify or NamesNotify for the device.
+ *
+ * @returns A new keymap which includes the changes, or NULL on failure,
+ * in which case the whole keymap should be fetched again.
+ *
+ * @since 1.3.0
+ * @memberof xkb_keymap
+ */
+struct xkb_keymap *
+xkb_x11_keymap_new_from_notify(struct xkb_keymap *keymap,
+                               xcb_connection_t *connection,
+                               const xcb_generic_event_t *event);
+
 /**
  * Create a new keyboard state object from an X11 keyboard device.
  *
@@ -837,7 +837,19 @@ xkb_context_set_log_fn(struct xkb_context *context,
 /** Flags for keymap compilation. */
 enum xkb_keymap_compile_flags {
     /** Do not apply any flags. */
-    XKB_KEYMAP_COMPILE_NO_FLAGS = 0
+    XKB_KEYMAP_COMPILE_NO_FLAGS = 0,
+    /**
+     * Find and parse the files included by the keymap sections in worker
+     * threads, while the earlier sections are being compiled.
+     *
+     * The resulting keymap and the log messages are the same as without
+     * this flag, and the log function is still only called from the
+     * calling thread.  If the library was built without thread support,
+     * this flag has no effect.
+     *
+     * @since 1.3.0
+     */
+    XKB_KEYMAP_COMPILE_PARALLEL = (1 << 0)
 };
 
 /**
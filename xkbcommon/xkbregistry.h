@@ -27,6 +27,7 @@
 
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 /**
  * @file
@@ -127,6 +128,17 @@ struct rxkb_iso639_code;
  */
 struct rxkb_iso3166_code;
 
+/**
+ *
+ * @struct rxkb_search
+ *
+ * Opaque struct representing the ranked results of a full-text search
+ * through the layouts and options of a context. See rxkb_search_new().
+ *
+ * @since 1.3.0
+ */
+struct rxkb_search;
+
 /**
  * Describes the popularity of an item. Historically, some highly specialized or
  * experimental definitions are excluded from the default list and shipped in
@@ -163,6 +175,29 @@ enum rxkb_context_flags {
      * on the lookup behavior.
      */
     RXKB_CONTEXT_LOAD_EXOTIC_RULES = (1 << 1),
+    /**
+     * Use a cache of the parsed registry.
+     *
+     * rxkb_context_parse() then stores its result in a binary cache file
+     * in `$XDG_CACHE_HOME/xkbcommon` (or `$HOME/.cache/xkbcommon`).  A
+     * later parse of the same ruleset with the same include paths loads
+     * the cache instead of parsing the XML files, as long as none of
+     * those files has been modified, added or removed since.  A missing
+     * or stale cache is ignored, and the files are parsed as usual.
+     *
+     * @since 1.3.0
+     */
+    RXKB_CONTEXT_USE_CACHE = (1 << 2),
+    /**
+     * Validate the XML files against the DTD they reference.
+     *
+     * A file which is not valid is skipped as a whole.  Without this flag,
+     * the files only need to be well-formed, and unknown elements are
+     * skipped along with their content.
+     *
+     * @since 1.3.0
+     */
+    RXKB_CONTEXT_VALIDATE = (1 << 3),
 };
 
 /**
@@ -475,6 +510,25 @@ rxkb_layout_first(struct rxkb_context *ctx);
 struct rxkb_layout *
 rxkb_layout_next(struct rxkb_layout *l);
 
+/**
+ * Find the layout with the given name and variant in this context. Pass a
+ * NULL or empty variant to find the base layout.
+ *
+ * The lookup uses an index which is built on the first lookup; after that
+ * a lookup does not depend on the number of layouts.
+ *
+ * The refcount of the returned layout is not increased. Use rxkb_layout_ref()
+ * if you need to keep this struct outside the immediate scope.
+ *
+ * @return The layout or NULL if the context has no such layout or has not
+ * been parsed successfully.
+ *
+ * @since 1.3.0
+ */
+struct rxkb_layout *
+rxkb_layout_find(struct rxkb_context *ctx, const char *name,
+                 const char *variant);
+
 /**
  * Increase the refcount of the argument by one.
  *
@@ -630,6 +684,21 @@ rxkb_option_first(struct rxkb_option_group *group);
 struct rxkb_option *
 rxkb_option_next(struct rxkb_option *o);
 
+/**
+ * Find the option with the given name (e.g. "grp:alt_shift_toggle") in any
+ * option group of this context.
+ *
+ * The refcount of the returned option is not increased. Use rxkb_option_ref()
+ * if you need to keep this struct outside the immediate scope.
+ *
+ * @return The option or NULL if the context has no such option or has not
+ * been parsed successfully.
+ *
+ * @since 1.3.0
+ */
+struct rxkb_option *
+rxkb_option_find(struct rxkb_context *ctx, const char *name);
+
 /**
  * Increase the refcount of the argument by one.
  *
@@ -723,6 +792,37 @@ rxkb_layout_get_iso639_first(struct rxkb_layout *layout);
 struct rxkb_iso639_code *
 rxkb_iso639_code_next(struct rxkb_iso639_code *iso639);
 
+/**
+ * Return the first layout of this context with the given ISO 639 code (e.g.
+ * "eng"). Use this to start iterating over the layouts for a language,
+ * followed by calls to rxkb_layout_next_for_iso639(). The layouts are in
+ * the same order as for rxkb_layout_first() and rxkb_layout_next(). Codes
+ * are compared case-insensitively.
+ *
+ * The refcount of the returned layout is not increased. Use rxkb_layout_ref()
+ * if you need to keep this struct outside the immediate scope.
+ *
+ * @return The first layout with this code or NULL if there is none.
+ *
+ * @since 1.3.0
+ */
+struct rxkb_layout *
+rxkb_layout_first_for_iso639(struct rxkb_context *ctx, const char *code);
+
+/**
+ * Return the next layout with the given ISO 639 code after this layout.
+ * Returns NULL when no more layouts are available.
+ *
+ * The refcount of the returned layout is not increased. Use rxkb_layout_ref()
+ * if you need to keep this struct outside the immediate scope.
+ *
+ * @returns The next layout or NULL at the end of the list
+ *
+ * @since 1.3.0
+ */
+struct rxkb_layout *
+rxkb_layout_next_for_iso639(struct rxkb_layout *l, const char *code);
+
 /**
  * Increase the refcount of the argument by one.
  *
@@ -773,6 +873,141 @@ rxkb_layout_get_iso3166_first(struct rxkb_layout *layout);
 struct rxkb_iso3166_code *
 rxkb_iso3166_code_next(struct rxkb_iso3166_code *iso3166);
 
+/**
+ * Return the first layout of this context with the given ISO 3166 code (e.g.
+ * "US"). Use this to start iterating over the layouts for a country,
+ * followed by calls to rxkb_layout_next_for_iso3166(). The layouts are in
+ * the same order as for rxkb_layout_first() and rxkb_layout_next(). Codes
+ * are compared case-insensitively.
+ *
+ * The refcount of the returned layout is not increased. Use rxkb_layout_ref()
+ * if you need to keep this struct outside the immediate scope.
+ *
+ * @return The first layout with this code or NULL if there is none.
+ *
+ * @since 1.3.0
+ */
+struct rxkb_layout *
+rxkb_layout_first_for_iso3166(struct rxkb_context *ctx, const char *code);
+
+/**
+ * Return the next layout with the given ISO 3166 code after this layout.
+ * Returns NULL when no more layouts are available.
+ *
+ * The refcount of the returned layout is not increased. Use rxkb_layout_ref()
+ * if you need to keep this struct outside the immediate scope.
+ *
+ * @returns The next layout or NULL at the end of the list
+ *
+ * @since 1.3.0
+ */
+struct rxkb_layout *
+rxkb_layout_next_for_iso3166(struct rxkb_layout *l, const char *code);
+
+/**
+ * Flags for rxkb_search_new().
+ *
+ * @since 1.3.0
+ */
+enum rxkb_search_flags {
+    /** Do not apply any flags. */
+    RXKB_SEARCH_NO_FLAGS = 0,
+    /** Leave out the items with @ref RXKB_POPULARITY_EXOTIC. */
+    RXKB_SEARCH_SKIP_EXOTIC = (1 << 0),
+};
+
+/**
+ * Search the names, short descriptions and descriptions of the layouts
+ * and options of this context.
+ *
+ * The query is split into words, and each of them must be the start of a
+ * word of an item for the item to match, ignoring case. For example,
+ * "ger" and "germ swi" both match the layout "ch", "German (Switzerland)".
+ * This is meant for filtering a list as the user types.
+ *
+ * The matches are ranked: a match in the name counts more than one in the
+ * short description, which counts more than one in the description, and a
+ * whole word counts more than a prefix. Among equally good matches, the
+ * items with @ref RXKB_POPULARITY_STANDARD come first, then the items are
+ * in the order of rxkb_layout_first() and rxkb_option_first().
+ *
+ * The search uses an index which is built on the first search.
+ *
+ * The result holds a reference to the context.
+ *
+ * @param ctx A context which has been parsed successfully.
+ * @param query The words to search for.
+ * @param flags Optional flags for the search, or 0.
+ *
+ * @return The results, which may be empty, or NULL on error.
+ *
+ * @since 1.3.0
+ */
+struct rxkb_search *
+rxkb_search_new(struct rxkb_context *ctx, const char *query,
+                enum rxkb_search_flags flags);
+
+/**
+ * Increase the refcount of the argument by one.
+ *
+ * @returns The argument passed in to this function.
+ *
+ * @since 1.3.0
+ */
+struct rxkb_search *
+rxkb_search_ref(struct rxkb_search *search);
+
+/**
+ * Decrease the refcount of the argument by one. When the refcount hits zero,
+ * all memory associated with this struct is freed.
+ *
+ * @returns always NULL
+ *
+ * @since 1.3.0
+ */
+struct rxkb_search *
+rxkb_search_unref(struct rxkb_search *search);
+
+/**
+ * Return the number of layouts found by this search.
+ *
+ * @since 1.3.0
+ */
+size_t
+rxkb_search_get_num_layouts(struct rxkb_search *search);
+
+/**
+ * Return the layout at the given rank of this search, starting at 0 for
+ * the best match, or NULL if @p idx is out of range.
+ *
+ * The refcount of the returned layout is not increased. Use rxkb_layout_ref()
+ * if you need to keep this struct outside the immediate scope.
+ *
+ * @since 1.3.0
+ */
+struct rxkb_layout *
+rxkb_search_get_layout(struct rxkb_search *search, size_t idx);
+
+/**
+ * Return the number of options found by this search.
+ *
+ * @since 1.3.0
+ */
+size_t
+rxkb_search_get_num_options(struct rxkb_search *search);
+
+/**
+ * Return the option at the given rank of this search, starting at 0 for
+ * the best match, or NULL if @p idx is out of range.
+ *
+ * The refcount of the returned option is not increased. Use rxkb_option_ref()
+ * if you need to keep this struct outside the immediate scope.
+ *
+ * @since 1.3.0
+ */
+struct rxkb_option *
+rxkb_search_get_option(struct rxkb_search *search, size_t idx);
+
 /** @} */
 
 #ifdef __cplusplus